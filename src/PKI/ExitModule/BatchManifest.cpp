@@ -0,0 +1,282 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        BatchManifest.cpp
+
+    Abstract:
+
+        CBatchManifest class impl.
+
+--*/
+
+#include "pch.h"
+#include "CertIssuedEvent.h"
+#include "BatchManifest.h"
+
+LPCWSTR g_pwszManifestHeader = L"index\tserialnumber\tsubjectkeyidentifier\trawcertpath\r\n";
+constexpr const WCHAR g_wchByteOrderMark = 0xFEFF;
+constexpr const DWORD g_cbMaxResultFile = 1024 * 1024;
+
+namespace
+{
+    inline WCHAR* AppendText(
+        WCHAR* pwchCurrent,
+        LPCWSTR pwsz,
+        size_t cch)
+    {
+        CopyMemory(pwchCurrent, pwsz, cch * sizeof(WCHAR));
+        return pwchCurrent + cch;
+    }
+
+    inline LPCWSTR SkipQuotes(
+        LPCWSTR pwsz)
+    {
+        while (*pwsz == L'"' || *pwsz == L' ')
+        {
+            pwsz++;
+        }
+
+        return pwsz;
+    }
+}
+
+CBatchManifest::CBatchManifest()
+{
+}
+
+CBatchManifest::~CBatchManifest()
+{
+}
+
+HRESULT CBatchManifest::Format(
+    const CBuffer<CCertIssuedEvent*>& bufEvents,
+    const CBuffer<CHeapWString>& bufCertPaths)
+{
+    CStaticBuffer<WCHAR, 16> strIndex;
+    size_t cchHeader = wcslen(g_pwszManifestHeader);
+    size_t cchTotal = 1 + cchHeader;
+
+    if (bufEvents.GetLength() != bufCertPaths.GetLength())
+    {
+        return E_INVALIDARG;
+    }
+
+    for (size_t i = 0; i < bufEvents.GetLength(); i++)
+    {
+        const CCertIssuedEvent& objEvent = *bufEvents.Get()[i];
+        _ultow_s((ULONG)i, strIndex.Get(), strIndex.GetLength(), 10);
+        cchTotal +=
+            wcslen(strIndex.Get()) +
+            wcslen(objEvent.GetSerialNumber()) +
+            wcslen(objEvent.GetSubjectKeyIdentifier()) +
+            wcslen(bufCertPaths.Get()[i].Get()) +
+            5; // 3 tabs and CRLF
+    }
+
+    if (!m_bufData.Alloc(cchTotal * sizeof(WCHAR)))
+    {
+        ATLTRACE(L"Failed to alloc %d wchars for manifest.\n", cchTotal);
+        return E_OUTOFMEMORY;
+    }
+
+    WCHAR* pwchCurrent = reinterpret_cast<WCHAR*>(m_bufData.Get());
+    *pwchCurrent++ = g_wchByteOrderMark;
+    pwchCurrent = AppendText(pwchCurrent, g_pwszManifestHeader, cchHeader);
+
+    for (size_t i = 0; i < bufEvents.GetLength(); i++)
+    {
+        const CCertIssuedEvent& objEvent = *bufEvents.Get()[i];
+        LPCWSTR pwszCertPath = bufCertPaths.Get()[i].Get();
+        _ultow_s((ULONG)i, strIndex.Get(), strIndex.GetLength(), 10);
+
+        pwchCurrent = AppendText(pwchCurrent, strIndex.Get(), wcslen(strIndex.Get()));
+        *pwchCurrent++ = L'\t';
+        pwchCurrent = AppendText(pwchCurrent, objEvent.GetSerialNumber(), wcslen(objEvent.GetSerialNumber()));
+        *pwchCurrent++ = L'\t';
+        pwchCurrent = AppendText(pwchCurrent, objEvent.GetSubjectKeyIdentifier(), wcslen(objEvent.GetSubjectKeyIdentifier()));
+        *pwchCurrent++ = L'\t';
+        pwchCurrent = AppendText(pwchCurrent, pwszCertPath, wcslen(pwszCertPath));
+        *pwchCurrent++ = L'\r';
+        *pwchCurrent++ = L'\n';
+    }
+
+    return S_OK;
+}
+
+HRESULT CBatchManifest::ReadResults(
+    LPCWSTR pwszPath,
+    CBuffer<LONG>& bufStatus,
+    OUT size_t& cResults)
+{
+    CHeapWString strText;
+    cResults = 0;
+
+    HRESULT hr = ReadText(pwszPath, OUT strText);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    LPWSTR pwszLine = strText.Get();
+    while (pwszLine && *pwszLine)
+    {
+        LPWSTR pwszNext = wcschr(pwszLine, L'\n');
+        if (pwszNext)
+        {
+            *pwszNext++ = L'\0';
+        }
+
+        if (ParseResultLine(pwszLine, bufStatus))
+        {
+            cResults++;
+        }
+
+        pwszLine = pwszNext;
+    }
+
+    return S_OK;
+}
+
+HRESULT CBatchManifest::ReadText(
+    LPCWSTR pwszPath,
+    OUT CHeapWString& strText)
+{
+    HRESULT hr = S_OK;
+    CHeapBuffer<BYTE> bufFile;
+    LARGE_INTEGER liSize;
+    DWORD cbRead = 0;
+
+    HANDLE hFile = ::CreateFileW(
+        pwszPath,
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        nullptr, // lpSecurityAttributes
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL); // hTemplateFile
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        hr = HRESULT_FROM_WIN32(::GetLastError());
+        ATLTRACE(L"::CreateFileW(%s) failed, hr=%x\n", pwszPath, hr);
+        return hr;
+    }
+
+    do
+    {
+        if (!::GetFileSizeEx(hFile, &liSize))
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            break;
+        }
+
+        if (liSize.QuadPart > g_cbMaxResultFile)
+        {
+            ATLTRACE(L"Result file is too large, size=%I64d\n", liSize.QuadPart);
+            hr = HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+            break;
+        }
+
+        if (!bufFile.Alloc((size_t)liSize.QuadPart + 1))
+        {
+            hr = E_OUTOFMEMORY;
+            break;
+        }
+
+        if (!::ReadFile(
+            hFile,
+            bufFile.Get(),
+            (DWORD)liSize.QuadPart,
+            &cbRead,
+            nullptr)) // lpOverlapped
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"::ReadFile failed, hr=%x\n", hr);
+            break;
+        }
+    } while (false);
+
+    ::CloseHandle(hFile);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    const BYTE* pbText = bufFile.Get();
+    if (cbRead >= 2 && pbText[0] == 0xFF && pbText[1] == 0xFE)
+    {
+        size_t cch = (cbRead - 2) / sizeof(WCHAR);
+        if (!strText.Alloc(cch + 1))
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        CopyMemory(strText.Get(), pbText + 2, cch * sizeof(WCHAR));
+        strText.Get()[cch] = L'\0';
+        return S_OK;
+    }
+
+    if (cbRead >= 3 && pbText[0] == 0xEF && pbText[1] == 0xBB && pbText[2] == 0xBF)
+    {
+        pbText += 3;
+        cbRead -= 3;
+    }
+
+    int cch = 0;
+    if (cbRead > 0)
+    {
+        cch = ::MultiByteToWideChar(CP_UTF8, 0, (LPCSTR)pbText, (int)cbRead, nullptr, 0);
+        if (cch == 0)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"::MultiByteToWideChar failed, hr=%x\n", hr);
+            return hr;
+        }
+    }
+
+    if (!strText.Alloc((size_t)cch + 1))
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    if (cch > 0)
+    {
+        ::MultiByteToWideChar(CP_UTF8, 0, (LPCSTR)pbText, (int)cbRead, strText.Get(), cch);
+    }
+
+    strText.Get()[cch] = L'\0';
+    return S_OK;
+}
+
+bool CBatchManifest::ParseResultLine(
+    LPCWSTR pwszLine,
+    CBuffer<LONG>& bufStatus)
+{
+    LPWSTR pwszEnd = nullptr;
+    LPCWSTR pwsz = SkipQuotes(pwszLine);
+    if (!iswdigit(*pwsz))
+    {
+        return false;
+    }
+
+    ULONG nIndex = wcstoul(pwsz, &pwszEnd, 10);
+    pwsz = SkipQuotes(pwszEnd);
+    if (*pwsz != L'\t' && *pwsz != L',')
+    {
+        return false;
+    }
+
+    pwsz = SkipQuotes(pwsz + 1);
+
+    // Parse unsigned so 0x80070005 does not saturate. Negative values still wrap to the same LONG.
+    LONG lStatus = (LONG)wcstoul(pwsz, &pwszEnd, 0);
+    if (pwszEnd == pwsz || nIndex >= bufStatus.GetLength())
+    {
+        return false;
+    }
+
+    bufStatus.Get()[nIndex] = lStatus;
+    return true;
+}
@@ -0,0 +1,112 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        BatchManifest.h
+
+    Abstract:
+
+        CBatchManifest class declaration.
+
+--*/
+
+class CCertIssuedEvent;
+
+/*++
+
+    Abstract:
+
+        Manifest and result files exchanged with a batch event processor.
+
+    Remarks:
+
+        The manifest is UTF-16LE text with a BOM. The first line names the tab separated
+        columns. Each following line is one certificate:
+
+            index<TAB>serialnumber<TAB>subjectkeyidentifier<TAB>rawcertpath<CRLF>
+
+        The handler writes a result file with one line per certificate it processed:
+
+            index<TAB>status
+
+        The result file can be UTF-16LE with a BOM, UTF-8 or ASCII. Commas are accepted in
+        place of tabs and values can be quoted, so Export-Csv output works. Lines that do not
+        start with an index, like a header, are skipped. Status 0 is success. Hex status
+        codes need a 0x prefix.
+--*/
+class CBatchManifest
+{
+public:
+    CBatchManifest();
+    ~CBatchManifest();
+
+    /*++
+
+        Abstract:
+
+            Formats the manifest.
+
+        Parameters:
+
+            bufEvents - the events in the batch.
+            bufCertPaths - path to the raw cert file of each event, in the same order.
+
+        Returns:
+
+            S_OK - success.
+            other - error code.
+    --*/
+    HRESULT Format(
+        const CBuffer<CCertIssuedEvent*>& bufEvents,
+        const CBuffer<CHeapWString>& bufCertPaths);
+
+    /*++
+
+        Abstract:
+
+            Gets the bytes of the formatted manifest.
+
+    --*/
+    inline const CBuffer<BYTE>& GetData() const
+    {
+        return m_bufData;
+    }
+
+    /*++
+
+        Abstract:
+
+            Reads the result file written by the handler.
+
+        Parameters:
+
+            pwszPath - path to the result file.
+            bufStatus - status of each event, by index. Entries without a result line are not changed.
+            cResults - receives the number of result lines that were applied.
+
+        Returns:
+
+            S_OK - success.
+            other - error code.
+    --*/
+    static HRESULT ReadResults(
+        LPCWSTR pwszPath,
+        CBuffer<LONG>& bufStatus,
+        OUT size_t& cResults);
+
+private:
+    CHeapBuffer<BYTE> m_bufData;
+
+    static HRESULT ReadText(
+        LPCWSTR pwszPath,
+        OUT CHeapWString& strText);
+    static bool ParseResultLine(
+        LPCWSTR pwszLine,
+        CBuffer<LONG>& bufStatus);
+
+    CBatchManifest(const CBatchManifest&) = delete;
+    CBatchManifest& operator=(const CBatchManifest&) = delete;
+};
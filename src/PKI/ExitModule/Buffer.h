@@ -117,6 +117,19 @@ public:
         : CBuffer(nullptr, 0)
     {
     }
+
+    /*++
+
+        Abstract:
+
+            Points the buffer at another externally allocated buffer.
+
+    --*/
+    inline void Attach(T* p, size_t cLength)
+    {
+        m_p = p;
+        m_cLength = cLength;
+    }
 };
 
 /*++
@@ -194,6 +207,184 @@ public:
         m_cLength = cLength;
         return true;
     }
+
+    /*++
+
+        Abstract:
+
+            Reallocates the buffer with a larger number of elements, keeping the existing ones.
+
+        Parameters:
+
+            cLength - the number of elements in the new buffer. Not less than the current length.
+
+        Returns:
+
+            true - success.
+            false - the new buffer failed to get allocated. The existing buffer is unchanged.
+
+    --*/
+    bool Grow(size_t cLength)
+    {
+        T* pNew = new T[cLength];
+        if (!pNew)
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < m_cLength; i++)
+        {
+            pNew[i] = m_p[i];
+        }
+
+        Clear();
+        m_p = pNew;
+        m_cLength = cLength;
+        return true;
+    }
+};
+
+/*++
+
+    Abstract:
+
+        A byte buffer that owns a BSTR.
+
+    Remarks:
+
+        COM returns binary properties, like the raw certificate, as a BSTR. Taking the
+        BSTR from the VARIANT lets the bytes be used without copying them. Ownership moves
+        with MoveFrom(). The BSTR is freed with SysFreeString().
+--*/
+class CBstrBuffer : public CBuffer<BYTE>
+{
+public:
+    CBstrBuffer()
+        : CBuffer<BYTE>()
+    {
+    }
+
+    ~CBstrBuffer()
+    {
+        Clear();
+    }
+
+    /*++
+
+        Abstract:
+
+            Frees the BSTR.
+    --*/
+    void Clear()
+    {
+        if (m_p)
+        {
+            ::SysFreeString(reinterpret_cast<BSTR>(m_p));
+            m_p = nullptr;
+        }
+
+        m_cLength = 0;
+    }
+
+    /*++
+
+        Abstract:
+
+            Takes ownership of a BSTR. The length is its byte length.
+    --*/
+    void Attach(BSTR bstr)
+    {
+        Clear();
+        m_p = reinterpret_cast<BYTE*>(bstr);
+        m_cLength = bstr ? ::SysStringByteLen(bstr) : 0;
+    }
+
+    /*++
+
+        Abstract:
+
+            Releases ownership of the BSTR to the caller.
+    --*/
+    BSTR Detach()
+    {
+        BSTR bstr = reinterpret_cast<BSTR>(m_p);
+        m_p = nullptr;
+        m_cLength = 0;
+        return bstr;
+    }
+
+    /*++
+
+        Abstract:
+
+            Takes the BSTR out of a VARIANT, leaving it VT_EMPTY.
+
+        Parameters:
+
+            var - a VT_BSTR variant.
+
+        Returns:
+
+            S_OK - success.
+            HRESULT_FROM_WIN32(ERROR_INVALID_DATA) - var is not a VT_BSTR. Nothing changes.
+    --*/
+    HRESULT AttachVariant(VARIANT& var)
+    {
+        if (var.vt != VT_BSTR)
+        {
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+
+        Attach(var.bstrVal);
+        var.bstrVal = nullptr;
+        var.vt = VT_EMPTY;
+        return S_OK;
+    }
+
+    /*++
+
+        Abstract:
+
+            Takes ownership of the BSTR of another buffer, leaving it empty.
+    --*/
+    void MoveFrom(CBstrBuffer& bufOther)
+    {
+        if (&bufOther != this)
+        {
+            Attach(bufOther.Detach());
+        }
+    }
+
+    /*++
+
+        Abstract:
+
+            Copies bytes into a new BSTR.
+
+        Returns:
+
+            S_OK - success.
+            E_OUTOFMEMORY - out of memory. Nothing changes.
+            E_INVALIDARG - too large for a BSTR.
+    --*/
+    HRESULT CopyFrom(const CBuffer<BYTE>& bufSource)
+    {
+        if (bufSource.GetSize() > MAXUINT / 2)
+        {
+            return E_INVALIDARG;
+        }
+
+        BSTR bstr = ::SysAllocStringByteLen(
+            reinterpret_cast<LPCSTR>(bufSource.Get()),
+            (UINT)bufSource.GetSize());
+        if (!bstr)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        Attach(bstr);
+        return S_OK;
+    }
 };
 
 /*++
@@ -245,4 +436,72 @@ public:
 
         return S_OK;
     }
+
+    /*++
+
+        Abstract:
+
+            Copies the null terminated source string into the string.
+
+        Parameters:
+
+            pwsz - the source string to copy.
+
+        Returns:
+
+            S_OK - success.
+            E_OUTOFMEMORY - out of memory allocating the string.
+            other - internal error from ::StringCchCopy.
+    --*/
+    HRESULT CopyFrom(LPCWSTR pwsz)
+    {
+        if (pwsz)
+        {
+            size_t cch = wcslen(pwsz) + 1;
+            if (!Alloc(cch))
+            {
+                return E_OUTOFMEMORY;
+            }
+
+            return StringCchCopyW(m_p, cch, pwsz);
+        }
+        else
+        {
+            Clear();
+        }
+
+        return S_OK;
+    }
+
+    /*++
+
+        Abstract:
+
+            Copies a counted source string into the string and null terminates it.
+
+        Parameters:
+
+            pwch - the source characters. Does not need to be null terminated.
+            cch - the number of characters to copy.
+
+        Returns:
+
+            S_OK - success.
+            E_OUTOFMEMORY - out of memory allocating the string.
+    --*/
+    HRESULT CopyFrom(LPCWSTR pwch, size_t cch)
+    {
+        if (!Alloc(cch + 1))
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        if (cch > 0)
+        {
+            CopyMemory(m_p, pwch, cch * sizeof(WCHAR));
+        }
+
+        m_p[cch] = L'\0';
+        return S_OK;
+    }
 };
\ No newline at end of file
@@ -0,0 +1,917 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        CertFields.cpp
+
+    Abstract:
+
+        CCertFields class impl.
+
+--*/
+
+#include "pch.h"
+#include "CertFields.h"
+
+// Most RDNs an issuer or directory name can have.
+constexpr const size_t g_cMaxRdns = 32;
+
+// Content octets of the OIDs the parser looks for.
+const BYTE g_rgbOidSubjectAltName[] = { 0x55, 0x1D, 0x11 }; // 2.5.29.17
+const BYTE g_rgbOidEnhancedKeyUsage[] = { 0x55, 0x1D, 0x25 }; // 2.5.29.37
+const BYTE g_rgbOidTemplate[] = { 0x2B, 0x06, 0x01, 0x04, 0x01, 0x82, 0x37, 0x15, 0x07 }; // 1.3.6.1.4.1.311.21.7
+const BYTE g_rgbOidTemplateName[] = { 0x2B, 0x06, 0x01, 0x04, 0x01, 0x82, 0x37, 0x14, 0x02 }; // 1.3.6.1.4.1.311.20.2
+const BYTE g_rgbOidUpn[] = { 0x2B, 0x06, 0x01, 0x04, 0x01, 0x82, 0x37, 0x14, 0x02, 0x03 }; // 1.3.6.1.4.1.311.20.2.3
+const BYTE g_rgbOidCommonName[] = { 0x55, 0x04, 0x03 };
+const BYTE g_rgbOidSerialNumber[] = { 0x55, 0x04, 0x05 };
+const BYTE g_rgbOidCountry[] = { 0x55, 0x04, 0x06 };
+const BYTE g_rgbOidLocality[] = { 0x55, 0x04, 0x07 };
+const BYTE g_rgbOidState[] = { 0x55, 0x04, 0x08 };
+const BYTE g_rgbOidStreet[] = { 0x55, 0x04, 0x09 };
+const BYTE g_rgbOidOrganization[] = { 0x55, 0x04, 0x0A };
+const BYTE g_rgbOidOrganizationalUnit[] = { 0x55, 0x04, 0x0B };
+const BYTE g_rgbOidTitle[] = { 0x55, 0x04, 0x0C };
+const BYTE g_rgbOidEmail[] = { 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x09, 0x01 }; // 1.2.840.113549.1.9.1
+const BYTE g_rgbOidDomainComponent[] = { 0x09, 0x92, 0x26, 0x89, 0x93, 0xF2, 0x2C, 0x64, 0x01, 0x19 }; // 0.9.2342.19200300.100.1.25
+
+// Short names for name attributes, the same ones CertNameToStr uses.
+struct NameAttribute
+{
+    const BYTE* pbOid;
+    size_t cbOid;
+    LPCWSTR pwszName;
+};
+
+const NameAttribute g_rgNameAttributes[] =
+{
+    { g_rgbOidCommonName, sizeof(g_rgbOidCommonName), L"CN" },
+    { g_rgbOidSerialNumber, sizeof(g_rgbOidSerialNumber), L"SERIALNUMBER" },
+    { g_rgbOidCountry, sizeof(g_rgbOidCountry), L"C" },
+    { g_rgbOidLocality, sizeof(g_rgbOidLocality), L"L" },
+    { g_rgbOidState, sizeof(g_rgbOidState), L"S" },
+    { g_rgbOidStreet, sizeof(g_rgbOidStreet), L"STREET" },
+    { g_rgbOidOrganization, sizeof(g_rgbOidOrganization), L"O" },
+    { g_rgbOidOrganizationalUnit, sizeof(g_rgbOidOrganizationalUnit), L"OU" },
+    { g_rgbOidTitle, sizeof(g_rgbOidTitle), L"T" },
+    { g_rgbOidEmail, sizeof(g_rgbOidEmail), L"E" },
+    { g_rgbOidDomainComponent, sizeof(g_rgbOidDomainComponent), L"DC" },
+};
+
+static bool IsOid(
+    const DerElement& stElement,
+    const BYTE* pbOid,
+    size_t cbOid)
+{
+    return CDerReader::IsOid(stElement, CRefBuffer<const BYTE>(pbOid, cbOid));
+}
+
+/*++
+
+    Abstract:
+
+        Moves a buffer in use to a larger heap buffer, keeping its elements.
+
+    Parameters:
+
+        bufStatic - the initial buffer.
+        bufHeap - the heap buffer. Allocated the first time the static buffer is outgrown.
+        bufInUse - points at bufStatic or bufHeap. Points at bufHeap on success.
+        cNeeded - the number of elements needed.
+
+    Returns:
+
+        true - success.
+        false - out of memory. Nothing changes.
+--*/
+template<typename T, size_t N>
+static bool GrowBuffer(
+    CStaticBuffer<T, N>& bufStatic,
+    CHeapBuffer<T>& bufHeap,
+    CRefBuffer<T>& bufInUse,
+    size_t cNeeded)
+{
+    // Doubles, so a long list of SANs is copied a few times and not once per entry.
+    size_t cNew = max(bufInUse.GetLength() * 2, cNeeded);
+    if (bufInUse.Get() == bufStatic.Get())
+    {
+        if (!bufHeap.Alloc(cNew))
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < bufStatic.GetLength(); i++)
+        {
+            bufHeap.Get()[i] = bufStatic.Get()[i];
+        }
+    }
+    else if (!bufHeap.Grow(cNew))
+    {
+        return false;
+    }
+
+    bufInUse.Attach(bufHeap.Get(), bufHeap.GetLength());
+    return true;
+}
+
+CCertFields::CCertFields()
+{
+    Clear();
+}
+
+CCertFields::~CCertFields()
+{
+}
+
+HRESULT CCertFields::Parse(
+    const CBuffer<BYTE>& bufCert)
+{
+    HRESULT hr = S_OK;
+    DerElement stCertificate;
+    DerElement stTbsCertificate;
+    DerElement stIssuer;
+    DerElement stValidity;
+    DerElement stSubject;
+    DerElement stElement;
+    DerElement stSubjectAltName = {};
+    DerElement stEnhancedKeyUsage = {};
+    DerElement stTemplate = {};
+    DerElement stTemplateName = {};
+
+    Clear();
+
+    do
+    {
+        CDerReader objCertificate(bufCert);
+        if (!objCertificate.NextIf(DerTagSequence, OUT stCertificate))
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            ATLTRACE(L"Certificate is not a SEQUENCE.\n");
+            break;
+        }
+
+        CDerReader objCertificateFields(stCertificate);
+        if (!objCertificateFields.NextIf(DerTagSequence, OUT stTbsCertificate))
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            ATLTRACE(L"TBSCertificate is not a SEQUENCE.\n");
+            break;
+        }
+
+        // version [0] is optional. Then serialNumber, signature, issuer, validity, subject.
+        CDerReader objTbs(stTbsCertificate);
+        objTbs.NextIf(DerTagContextConstructed | 0, OUT stElement);
+        if (!objTbs.NextIf(DerTagInteger, OUT stElement) ||
+            !objTbs.NextIf(DerTagSequence, OUT stElement) ||
+            !objTbs.NextIf(DerTagSequence, OUT stIssuer) ||
+            !objTbs.NextIf(DerTagSequence, OUT stValidity) ||
+            !objTbs.NextIf(DerTagSequence, OUT stSubject))
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            ATLTRACE(L"TBSCertificate is malformed.\n");
+            break;
+        }
+
+        // The extensions are in [3], after subjectPublicKeyInfo and the optional unique IDs.
+        while (objTbs.Next(OUT stElement))
+        {
+            if (stElement.bTag != (DerTagContextConstructed | 3))
+            {
+                continue;
+            }
+
+            DerElement stExtensions;
+            CDerReader objExplicit(stElement);
+            if (!objExplicit.NextIf(DerTagSequence, OUT stExtensions))
+            {
+                break;
+            }
+
+            // Extension ::= SEQUENCE { extnID, critical BOOLEAN DEFAULT FALSE, extnValue OCTET STRING }
+            CDerReader objExtensions(stExtensions);
+            DerElement stExtension;
+            while (objExtensions.NextIf(DerTagSequence, OUT stExtension))
+            {
+                DerElement stOid;
+                DerElement stValue;
+                CDerReader objExtension(stExtension);
+                if (!objExtension.NextIf(DerTagOid, OUT stOid))
+                {
+                    continue;
+                }
+
+                objExtension.NextIf(DerTagBoolean, OUT stValue);
+                if (!objExtension.NextIf(DerTagOctetString, OUT stValue))
+                {
+                    continue;
+                }
+
+                if (IsOid(stOid, g_rgbOidSubjectAltName, sizeof(g_rgbOidSubjectAltName)))
+                {
+                    stSubjectAltName = stValue;
+                }
+                else if (IsOid(stOid, g_rgbOidEnhancedKeyUsage, sizeof(g_rgbOidEnhancedKeyUsage)))
+                {
+                    stEnhancedKeyUsage = stValue;
+                }
+                else if (IsOid(stOid, g_rgbOidTemplate, sizeof(g_rgbOidTemplate)))
+                {
+                    stTemplate = stValue;
+                }
+                else if (IsOid(stOid, g_rgbOidTemplateName, sizeof(g_rgbOidTemplateName)))
+                {
+                    stTemplateName = stValue;
+                }
+            }
+        }
+
+        BeginField();
+        AppendName(stIssuer);
+        EndField(CertFieldIssuer);
+
+        BeginField();
+        AppendName(stSubject);
+        EndField(CertFieldSubject);
+
+        // Validity ::= SEQUENCE { notBefore Time, notAfter Time }
+        CDerReader objValidity(stValidity);
+        if (objValidity.Next(OUT stElement))
+        {
+            BeginField();
+            AppendTime(stElement);
+            EndField(CertFieldNotBefore);
+        }
+
+        if (objValidity.Next(OUT stElement))
+        {
+            BeginField();
+            AppendTime(stElement);
+            EndField(CertFieldNotAfter);
+        }
+
+        if (stTemplate.pbContent)
+        {
+            BeginField();
+            AppendTemplate(stTemplate);
+            EndField(CertFieldTemplate);
+        }
+
+        if (!m_rgfFields[CertFieldTemplate] && stTemplateName.pbContent)
+        {
+            // The v1 extension is the template name as a BMPString.
+            CDerReader objTemplateName(stTemplateName);
+            if (objTemplateName.Next(OUT stElement))
+            {
+                BeginField();
+                AppendString(stElement);
+                EndField(CertFieldTemplate);
+            }
+        }
+
+        if (stEnhancedKeyUsage.pbContent)
+        {
+            BeginField();
+            AppendEnhancedKeyUsage(stEnhancedKeyUsage);
+            EndField(CertFieldEnhancedKeyUsage);
+        }
+
+        if (stSubjectAltName.pbContent)
+        {
+            BeginField();
+            AppendGeneralNames(stSubjectAltName);
+            EndField(CertFieldSubjectAltName);
+        }
+    } while (false);
+
+    if (FAILED(hr))
+    {
+        Clear();
+    }
+
+    return hr;
+}
+
+void CCertFields::Clear()
+{
+    // A heap buffer from an earlier Parse() is kept, since it is the larger one.
+    if (m_bufHeapText.Get())
+    {
+        m_bufText.Attach(m_bufHeapText.Get(), m_bufHeapText.GetLength());
+    }
+    else
+    {
+        m_bufText.Attach(m_bufStaticText.Get(), m_bufStaticText.GetLength());
+    }
+
+    if (m_bufHeapEntries.Get())
+    {
+        m_bufEntries.Attach(m_bufHeapEntries.Get(), m_bufHeapEntries.GetLength());
+    }
+    else
+    {
+        m_bufEntries.Attach(m_bufStaticEntries.Get(), m_bufStaticEntries.GetLength());
+    }
+
+    m_cchText = 0;
+    m_iFieldStart = 0;
+    m_fFieldFailed = false;
+    m_cEntries = 0;
+    m_iFieldFirstEntry = 0;
+    for (size_t i = 0; i < CertFieldCount; i++)
+    {
+        m_rgfFields[i] = false;
+        m_rgiFieldStart[i] = 0;
+        m_rgiFirstEntry[i] = 0;
+        m_rgcEntries[i] = 0;
+    }
+}
+
+void CCertFields::BeginField()
+{
+    m_iFieldStart = m_cchText;
+    m_iFieldFirstEntry = m_cEntries;
+    m_fFieldFailed = false;
+}
+
+void CCertFields::EndField(
+    CertField eField)
+{
+    AppendChar(L'\0');
+    if (m_fFieldFailed)
+    {
+        // Give the space back to the next field.
+        ATLTRACE(L"Cert field %d is malformed or out of memory.\n", eField);
+        m_cchText = m_iFieldStart;
+        m_cEntries = m_iFieldFirstEntry;
+        m_rgfFields[eField] = false;
+        return;
+    }
+
+    // An offset and not a pointer, since the text can still move to a larger buffer.
+    m_rgfFields[eField] = true;
+    m_rgiFieldStart[eField] = m_iFieldStart;
+    m_rgiFirstEntry[eField] = m_iFieldFirstEntry;
+    m_rgcEntries[eField] = m_cEntries - m_iFieldFirstEntry;
+}
+
+void CCertFields::FailField()
+{
+    m_fFieldFailed = true;
+}
+
+bool CCertFields::ReserveText(
+    size_t cch)
+{
+    if (m_fFieldFailed)
+    {
+        return false;
+    }
+
+    if (cch <= m_bufText.GetLength() - m_cchText)
+    {
+        return true;
+    }
+
+    if (!GrowBuffer(m_bufStaticText, m_bufHeapText, m_bufText, m_cchText + cch))
+    {
+        ATLTRACE(L"Failed to grow the cert field text to %Iu characters.\n", m_cchText + cch);
+        FailField();
+        return false;
+    }
+
+    return true;
+}
+
+void CCertFields::AddEntry(
+    size_t iStart)
+{
+    if (m_fFieldFailed)
+    {
+        return;
+    }
+
+    if (m_cEntries >= m_bufEntries.GetLength() &&
+        !GrowBuffer(m_bufStaticEntries, m_bufHeapEntries, m_bufEntries, m_cEntries + 1))
+    {
+        ATLTRACE(L"Failed to grow the cert field entries to %Iu.\n", m_cEntries + 1);
+        FailField();
+        return;
+    }
+
+    Entry& stEntry = m_bufEntries.Get()[m_cEntries++];
+    stEntry.iStart = iStart;
+    stEntry.cch = m_cchText - iStart;
+}
+
+void CCertFields::AppendChar(
+    WCHAR wch)
+{
+    if (!ReserveText(1))
+    {
+        return;
+    }
+
+    m_bufText.Get()[m_cchText++] = wch;
+}
+
+void CCertFields::AppendText(
+    LPCWSTR pwsz)
+{
+    for (LPCWSTR p = pwsz; *p; p++)
+    {
+        AppendChar(*p);
+    }
+}
+
+void CCertFields::AppendHex(
+    ULONGLONG ullValue)
+{
+    WCHAR rgwch[16];
+    size_t cch = 0;
+    do
+    {
+        rgwch[cch++] = L"0123456789abcdef"[ullValue & 0xF];
+        ullValue >>= 4;
+    } while (ullValue != 0);
+
+    while (cch > 0)
+    {
+        AppendChar(rgwch[--cch]);
+    }
+}
+
+void CCertFields::AppendDecimal(
+    ULONGLONG ullValue)
+{
+    WCHAR rgwch[20];
+    size_t cch = 0;
+    do
+    {
+        rgwch[cch++] = (WCHAR)(L'0' + (ullValue % 10));
+        ullValue /= 10;
+    } while (ullValue != 0);
+
+    while (cch > 0)
+    {
+        AppendChar(rgwch[--cch]);
+    }
+}
+
+void CCertFields::AppendString(
+    const DerElement& stValue)
+{
+    const BYTE* pb = stValue.pbContent;
+    size_t cb = stValue.cbContent;
+
+    switch (stValue.bTag)
+    {
+    case DerTagUtf8String:
+    {
+        if (cb == 0)
+        {
+            return;
+        }
+
+        if (cb > MAXINT)
+        {
+            FailField();
+            return;
+        }
+
+        // UTF-8 never takes more UTF-16 code units than bytes.
+        if (!ReserveText(cb))
+        {
+            return;
+        }
+
+        // Converts in place in the text buffer.
+        size_t cchRemaining = m_bufText.GetLength() - m_cchText;
+        int cch = ::MultiByteToWideChar(
+            CP_UTF8,
+            0, // dwFlags
+            reinterpret_cast<LPCSTR>(pb),
+            (int)cb,
+            m_bufText.Get() + m_cchText,
+            (int)min(cchRemaining, (size_t)MAXINT));
+        if (cch <= 0)
+        {
+            FailField();
+            return;
+        }
+
+        m_cchText += cch;
+        return;
+    }
+
+    case DerTagBmpString:
+        // UCS-2, big endian.
+        for (size_t i = 0; i + 1 < cb; i += 2)
+        {
+            AppendChar((WCHAR)((pb[i] << 8) | pb[i + 1]));
+        }
+
+        return;
+
+    case DerTagPrintableString:
+    case DerTagIA5String:
+    case DerTagT61String:
+    default:
+        // Single byte strings. T61 is treated as Latin-1, as CertSvc does.
+        for (size_t i = 0; i < cb; i++)
+        {
+            AppendChar((WCHAR)pb[i]);
+        }
+
+        return;
+    }
+}
+
+void CCertFields::AppendOid(
+    const DerElement& stOid)
+{
+    if (stOid.bTag != DerTagOid || stOid.cbContent == 0)
+    {
+        FailField();
+        return;
+    }
+
+    bool fFirst = true;
+    ULONGLONG ullArc = 0;
+    size_t cbArc = 0;
+    for (size_t i = 0; i < stOid.cbContent; i++)
+    {
+        BYTE b = stOid.pbContent[i];
+
+        // Base 128, high bit set on all but the last octet. 9 octets fill 63 bits.
+        if (++cbArc > 9)
+        {
+            FailField();
+            return;
+        }
+
+        ullArc = (ullArc << 7) | (b & 0x7F);
+        if (b & 0x80)
+        {
+            continue;
+        }
+
+        if (fFirst)
+        {
+            // The first arc is 0, 1 or 2 and shares an octet with the second.
+            ULONGLONG ullFirst = min(ullArc / 40, 2ULL);
+            AppendDecimal(ullFirst);
+            AppendChar(L'.');
+            AppendDecimal(ullArc - ullFirst * 40);
+            fFirst = false;
+        }
+        else
+        {
+            AppendChar(L'.');
+            AppendDecimal(ullArc);
+        }
+
+        ullArc = 0;
+        cbArc = 0;
+    }
+
+    if (cbArc != 0)
+    {
+        // Truncated arc.
+        FailField();
+    }
+}
+
+void CCertFields::AppendName(
+    const DerElement& stName)
+{
+    // Name ::= SEQUENCE OF RelativeDistinguishedName. Most specific is last in the encoding.
+    CStaticBuffer<DerElement, g_cMaxRdns> bufRdns;
+    size_t cRdns = 0;
+    CDerReader objName(stName);
+    DerElement stRdn;
+    while (objName.NextIf(DerTagSet, OUT stRdn))
+    {
+        if (cRdns == bufRdns.GetLength())
+        {
+            FailField();
+            return;
+        }
+
+        bufRdns.Get()[cRdns++] = stRdn;
+    }
+
+    if (!objName.IsEmpty())
+    {
+        FailField();
+        return;
+    }
+
+    for (size_t i = cRdns; i > 0; i--)
+    {
+        if (i != cRdns)
+        {
+            AppendText(L", ");
+        }
+
+        // RelativeDistinguishedName ::= SET OF AttributeTypeAndValue. Usually just one.
+        CDerReader objRdn(bufRdns.Get()[i - 1]);
+        DerElement stAttribute;
+        bool fFirstAttribute = true;
+        while (objRdn.NextIf(DerTagSequence, OUT stAttribute))
+        {
+            DerElement stType;
+            DerElement stValue;
+            CDerReader objAttribute(stAttribute);
+            if (!objAttribute.NextIf(DerTagOid, OUT stType) || !objAttribute.Next(OUT stValue))
+            {
+                FailField();
+                return;
+            }
+
+            if (!fFirstAttribute)
+            {
+                AppendChar(L'+');
+            }
+
+            LPCWSTR pwszType = nullptr;
+            for (const NameAttribute& stKnown : g_rgNameAttributes)
+            {
+                if (IsOid(stType, stKnown.pbOid, stKnown.cbOid))
+                {
+                    pwszType = stKnown.pwszName;
+                    break;
+                }
+            }
+
+            if (pwszType)
+            {
+                AppendText(pwszType);
+            }
+            else
+            {
+                AppendOid(stType);
+            }
+
+            AppendChar(L'=');
+            AppendString(stValue);
+            fFirstAttribute = false;
+        }
+    }
+}
+
+void CCertFields::AppendTime(
+    const DerElement& stTime)
+{
+    // UTCTime is YYMMDDHHMMSSZ and GeneralizedTime is YYYYMMDDHHMMSSZ. DER requires the Z and seconds.
+    size_t cchYear = 0;
+    if (stTime.bTag == DerTagUtcTime && stTime.cbContent == 13)
+    {
+        cchYear = 2;
+    }
+    else if (stTime.bTag == DerTagGeneralizedTime && stTime.cbContent == 15)
+    {
+        cchYear = 4;
+    }
+    else
+    {
+        FailField();
+        return;
+    }
+
+    const BYTE* pb = stTime.pbContent;
+    for (size_t i = 0; i < stTime.cbContent - 1; i++)
+    {
+        if (pb[i] < '0' || pb[i] > '9')
+        {
+            FailField();
+            return;
+        }
+    }
+
+    if (pb[stTime.cbContent - 1] != 'Z')
+    {
+        FailField();
+        return;
+    }
+
+    if (cchYear == 2)
+    {
+        // RFC 5280: YY >= 50 is 19YY, otherwise 20YY.
+        AppendText(pb[0] >= '5' ? L"19" : L"20");
+    }
+
+    for (size_t i = 0; i < cchYear; i++)
+    {
+        AppendChar((WCHAR)pb[i]);
+    }
+
+    // MM DD HH MM SS, with the ISO 8601 separators in front of each.
+    LPCWSTR pwszSeparators = L"--T::";
+    const BYTE* pbRest = pb + cchYear;
+    for (size_t i = 0; i < 5; i++)
+    {
+        AppendChar(pwszSeparators[i]);
+        AppendChar((WCHAR)pbRest[2 * i]);
+        AppendChar((WCHAR)pbRest[2 * i + 1]);
+    }
+
+    AppendChar(L'Z');
+}
+
+void CCertFields::AppendIPAddress(
+    const DerElement& stAddress)
+{
+    const BYTE* pb = stAddress.pbContent;
+    if (stAddress.cbContent == 4)
+    {
+        for (size_t i = 0; i < 4; i++)
+        {
+            if (i > 0)
+            {
+                AppendChar(L'.');
+            }
+
+            AppendDecimal(pb[i]);
+        }
+    }
+    else if (stAddress.cbContent == 16)
+    {
+        // Uncompressed, so the value does not depend on how zeros are grouped.
+        for (size_t i = 0; i < 16; i += 2)
+        {
+            if (i > 0)
+            {
+                AppendChar(L':');
+            }
+
+            AppendHex((pb[i] << 8) | pb[i + 1]);
+        }
+    }
+    else
+    {
+        FailField();
+    }
+}
+
+void CCertFields::AppendGeneralNames(
+    const DerElement& stNames)
+{
+    // The extension value is GeneralNames ::= SEQUENCE OF GeneralName.
+    DerElement stSequence;
+    CDerReader objValue(stNames);
+    if (!objValue.NextIf(DerTagSequence, OUT stSequence))
+    {
+        FailField();
+        return;
+    }
+
+    CDerReader objNames(stSequence);
+    DerElement stName;
+    bool fFirst = true;
+    while (objNames.Next(OUT stName))
+    {
+        size_t cchBefore = m_cchText;
+        if (!fFirst)
+        {
+            AppendChar(L',');
+        }
+
+        size_t iEntry = m_cchText;
+        switch (stName.bTag)
+        {
+        case DerTagContextConstructed | 0:
+        {
+            // otherName ::= SEQUENCE { type-id OID, value [0] EXPLICIT ANY }. Only the UPN is known.
+            DerElement stType;
+            DerElement stExplicit;
+            DerElement stValue;
+            CDerReader objOtherName(stName);
+            if (!objOtherName.NextIf(DerTagOid, OUT stType) ||
+                !IsOid(stType, g_rgbOidUpn, sizeof(g_rgbOidUpn)) ||
+                !objOtherName.NextIf(DerTagContextConstructed | 0, OUT stExplicit))
+            {
+                m_cchText = cchBefore;
+                continue;
+            }
+
+            CDerReader objExplicit(stExplicit);
+            if (!objExplicit.Next(OUT stValue))
+            {
+                m_cchText = cchBefore;
+                continue;
+            }
+
+            AppendText(L"upn:");
+            AppendString(stValue);
+            break;
+        }
+
+        case DerTagContextPrimitive | 1:
+            AppendText(L"email:");
+            AppendString(stName);
+            break;
+
+        case DerTagContextPrimitive | 2:
+            AppendText(L"dns:");
+            AppendString(stName);
+            break;
+
+        case DerTagContextConstructed | 4:
+        {
+            // directoryName is explicitly tagged because Name is a CHOICE.
+            DerElement stDirectoryName;
+            CDerReader objDirectoryName(stName);
+            if (!objDirectoryName.NextIf(DerTagSequence, OUT stDirectoryName))
+            {
+                m_cchText = cchBefore;
+                continue;
+            }
+
+            AppendText(L"dirname:");
+            AppendName(stDirectoryName);
+            break;
+        }
+
+        case DerTagContextPrimitive | 6:
+            AppendText(L"uri:");
+            AppendString(stName);
+            break;
+
+        case DerTagContextPrimitive | 7:
+            AppendText(L"ip:");
+            AppendIPAddress(stName);
+            break;
+
+        default:
+            // x400Address, ediPartyName and registeredID are left out.
+            m_cchText = cchBefore;
+            continue;
+        }
+
+        AddEntry(iEntry);
+        fFirst = false;
+    }
+
+    if (objNames.IsMalformed())
+    {
+        FailField();
+    }
+}
+
+void CCertFields::AppendEnhancedKeyUsage(
+    const DerElement& stUsages)
+{
+    // ExtKeyUsageSyntax ::= SEQUENCE OF KeyPurposeId
+    DerElement stSequence;
+    CDerReader objValue(stUsages);
+    if (!objValue.NextIf(DerTagSequence, OUT stSequence))
+    {
+        FailField();
+        return;
+    }
+
+    CDerReader objUsages(stSequence);
+    DerElement stOid;
+    bool fFirst = true;
+    while (objUsages.NextIf(DerTagOid, OUT stOid))
+    {
+        if (!fFirst)
+        {
+            AppendChar(L',');
+        }
+
+        size_t iEntry = m_cchText;
+        AppendOid(stOid);
+        AddEntry(iEntry);
+        fFirst = false;
+    }
+
+    if (!objUsages.IsEmpty())
+    {
+        FailField();
+    }
+}
+
+void CCertFields::AppendTemplate(
+    const DerElement& stTemplate)
+{
+    // CertificateTemplate ::= SEQUENCE { templateID OID, majorVersion INTEGER, minorVersion INTEGER OPTIONAL }
+    DerElement stSequence;
+    DerElement stOid;
+    CDerReader objValue(stTemplate);
+    if (!objValue.NextIf(DerTagSequence, OUT stSequence))
+    {
+        FailField();
+        return;
+    }
+
+    CDerReader objTemplate(stSequence);
+    if (!objTemplate.NextIf(DerTagOid, OUT stOid))
+    {
+        FailField();
+        return;
+    }
+
+    AppendOid(stOid);
+}
@@ -0,0 +1,224 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        CertFields.h
+
+    Abstract:
+
+        CCertFields class declaration.
+
+--*/
+
+#include "DerReader.h"
+
+/*++
+
+    Abstract:
+
+        Fields CCertFields extracts from a certificate.
+
+--*/
+enum CertField : DWORD
+{
+    // Issuer name, most specific RDN first, like CN=Issuing CA, DC=contoso, DC=com.
+    CertFieldIssuer = 0,
+
+    // Subject name, in the same format as the issuer. Empty for a cert with only SANs.
+    CertFieldSubject,
+
+    // Start of validity in UTC, like 2026-10-17T08:30:00Z.
+    CertFieldNotBefore,
+
+    // Expiration in UTC, like 2027-10-17T08:30:00Z.
+    CertFieldNotAfter,
+
+    // Template OID from the v2 template extension, or the name from the v1 extension.
+    CertFieldTemplate,
+
+    // Enhanced key usage OIDs separated by commas.
+    CertFieldEnhancedKeyUsage,
+
+    // Subject alternative names separated by commas, like dns:host.contoso.com,upn:user@contoso.com.
+    CertFieldSubjectAltName,
+
+    CertFieldCount,
+};
+
+/*++
+
+    Abstract:
+
+        Extracts fields for the handler straight from the DER bytes of a certificate.
+
+    Remarks:
+
+        Fetching these from ICertServerExit takes a property or extension call each, which
+        goes through CertSvc. The raw certificate is already in the event, so they are parsed
+        from it instead.
+
+        The field text starts in a fixed buffer inside the object, so it is meant to be a
+        local on the thread that formats the command line. Parse() allocates only when a
+        certificate's fields do not fit, like a cert with hundreds of SANs, and then moves
+        the text to a heap buffer that grows with it. A field that is not in the certificate
+        or is malformed is nullptr. A field is also nullptr if its buffer cannot be grown,
+        which is traced.
+
+        Values are not escaped. Strings in the certificate are converted from their ASN.1
+        string type to UTF-16.
+
+        The list fields, EKU and SAN, also record where each entry is, since a single entry
+        like a directory name can contain the separator.
+--*/
+class CCertFields
+{
+public:
+    // Room for the field text before it moves to the heap, including the null terminators.
+    static const size_t s_cchInitialText = 4096;
+
+    // Entries the list fields can have together before they move to the heap.
+    static const size_t s_cInitialEntries = 128;
+
+    CCertFields();
+    ~CCertFields();
+
+    /*++
+
+        Abstract:
+
+            Parses the fields from a certificate.
+
+        Parameters:
+
+            bufCert - the DER bytes of the certificate.
+
+        Returns:
+
+            S_OK - success. Some fields can still be nullptr.
+            HRESULT_FROM_WIN32(ERROR_INVALID_DATA) - not an X.509 certificate. All fields are nullptr.
+    --*/
+    HRESULT Parse(
+        const CBuffer<BYTE>& bufCert);
+
+    /*++
+
+        Abstract:
+
+            Gets a field, or nullptr if it was not found.
+
+        Remarks:
+
+            Valid while the object exists.
+    --*/
+    inline LPCWSTR Get(
+        CertField eField) const
+    {
+        return m_rgfFields[eField] ? m_bufText.Get() + m_rgiFieldStart[eField] : nullptr;
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets the number of entries in a list field.
+
+        Returns:
+
+            The number of entries. 0 for a field that is not a list or was not found.
+    --*/
+    inline size_t GetEntryCount(
+        CertField eField) const
+    {
+        return m_rgcEntries[eField];
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets one entry of a list field.
+
+        Parameters:
+
+            eField - the field.
+            iEntry - index of the entry. Less than GetEntryCount().
+            cch - receives the length of the entry.
+
+        Returns:
+
+            The start of the entry in the field text. Not null terminated.
+    --*/
+    inline LPCWSTR GetEntry(
+        CertField eField,
+        size_t iEntry,
+        OUT size_t& cch) const
+    {
+        const Entry& stEntry = m_bufEntries.Get()[m_rgiFirstEntry[eField] + iEntry];
+        cch = stEntry.cch;
+        return m_bufText.Get() + stEntry.iStart;
+    }
+
+private:
+    struct Entry
+    {
+        size_t iStart;
+        size_t cch;
+    };
+
+    // m_bufText and m_bufEntries point at the static buffers until the fields outgrow them.
+    CStaticBuffer<WCHAR, s_cchInitialText> m_bufStaticText;
+    CHeapBuffer<WCHAR> m_bufHeapText;
+    CRefBuffer<WCHAR> m_bufText;
+    size_t m_cchText;
+    size_t m_iFieldStart;
+    bool m_fFieldFailed;
+    bool m_rgfFields[CertFieldCount];
+    size_t m_rgiFieldStart[CertFieldCount];
+    CStaticBuffer<Entry, s_cInitialEntries> m_bufStaticEntries;
+    CHeapBuffer<Entry> m_bufHeapEntries;
+    CRefBuffer<Entry> m_bufEntries;
+    size_t m_cEntries;
+    size_t m_iFieldFirstEntry;
+    size_t m_rgiFirstEntry[CertFieldCount];
+    size_t m_rgcEntries[CertFieldCount];
+
+    void Clear();
+    void BeginField();
+    void EndField(
+        CertField eField);
+    void FailField();
+    bool ReserveText(
+        size_t cch);
+    void AddEntry(
+        size_t iStart);
+    void AppendChar(
+        WCHAR wch);
+    void AppendText(
+        LPCWSTR pwsz);
+    void AppendHex(
+        ULONGLONG ullValue);
+    void AppendDecimal(
+        ULONGLONG ullValue);
+    void AppendString(
+        const DerElement& stValue);
+    void AppendOid(
+        const DerElement& stOid);
+    void AppendName(
+        const DerElement& stName);
+    void AppendTime(
+        const DerElement& stTime);
+    void AppendIPAddress(
+        const DerElement& stAddress);
+    void AppendGeneralNames(
+        const DerElement& stNames);
+    void AppendEnhancedKeyUsage(
+        const DerElement& stUsages);
+    void AppendTemplate(
+        const DerElement& stTemplate);
+
+    CCertFields(const CCertFields&) = delete;
+    CCertFields& operator=(const CCertFields&) = delete;
+};
@@ -0,0 +1,171 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        CertIssuedEvent.cpp
+
+    Abstract:
+
+        CCertIssuedEvent class impl.
+
+--*/
+
+#include "pch.h"
+#include "CertServerExit.h"
+#include "CertIssuedEvent.h"
+
+// Indexes into g_rgProperties.
+constexpr const size_t g_iSubjectKeyIdentifier = 0;
+constexpr const size_t g_iSerialNumber = 1;
+constexpr const size_t g_iRawCertificate = 2;
+constexpr const size_t g_iRequesterName = 3;
+
+// The properties fetched for every issued cert.
+const CertPropertyDescriptor g_rgProperties[] =
+{
+    {
+        wszPROPCERTIFICATESUBJECTKEYIDENTIFIER,
+        CertServerPropType::PropTypeString,
+        CertServerPropSource::PropSourceCertificate,
+        false, // fOptional
+    },
+    {
+        wszPROPCERTIFICATESERIALNUMBER,
+        CertServerPropType::PropTypeString,
+        CertServerPropSource::PropSourceCertificate,
+        false, // fOptional
+    },
+    {
+        wszPROPRAWCERTIFICATE,
+        CertServerPropType::PropTypeBinary,
+        CertServerPropSource::PropSourceCertificate,
+        false, // fOptional
+    },
+    {
+        wszPROPREQUESTERNAME,
+        CertServerPropType::PropTypeString,
+        CertServerPropSource::PropSourceRequest,
+        true, // fOptional
+    },
+};
+
+CCertIssuedEvent::CCertIssuedEvent(
+    LONG lExitEvent,
+    LONG lContext)
+    : m_lExitEvent(lExitEvent),
+    m_lContext(lContext),
+    m_ullJournalPosition(0),
+    m_ullQueuedTime(0),
+    m_pwszSubjectKeyIdentifier(nullptr),
+    m_pwszSerialNumber(nullptr),
+    m_pwszRequesterName(nullptr)
+{
+}
+
+CCertIssuedEvent::~CCertIssuedEvent()
+{
+}
+
+HRESULT CCertIssuedEvent::InitPropertySet(
+    OUT CCertPropertySet& objProperties)
+{
+    return objProperties.Init(CRefBuffer<const CertPropertyDescriptor>(
+        g_rgProperties,
+        sizeof(g_rgProperties) / sizeof(g_rgProperties[0])));
+}
+
+HRESULT CCertIssuedEvent::Snapshot(
+    const CCertServerExit& objServer,
+    CCertPropertySet& objProperties)
+{
+    HRESULT hr = objProperties.Fetch(objServer, OUT m_objProperties);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"CCertPropertySet::Fetch failed, hr=%x\n", hr);
+        return hr;
+    }
+
+    BindProperties();
+
+    ATLTRACE(
+        L"Cert created. Subject Key Identifier=[%s], SerialNumber=[%s]\n",
+        m_pwszSubjectKeyIdentifier,
+        m_pwszSerialNumber);
+    ATLTRACE(L"Raw cert size in bytes=%x, arena size=%x\n", m_bufRawCert.GetSize(), m_objProperties.GetArenaSize());
+    return S_OK;
+}
+
+HRESULT CCertIssuedEvent::Restore(
+    LPCWSTR pwchSubjectKeyIdentifier,
+    size_t cchSubjectKeyIdentifier,
+    LPCWSTR pwchSerialNumber,
+    size_t cchSerialNumber,
+    const CBuffer<BYTE>& bufRawCert,
+    LPCWSTR pwchRequesterName,
+    size_t cchRequesterName)
+{
+    CertPropertyValue rgValues[] =
+    {
+        {
+            CertServerPropType::PropTypeString,
+            pwchSubjectKeyIdentifier,
+            cchSubjectKeyIdentifier * sizeof(WCHAR),
+            nullptr, // pbufOwner
+        },
+        {
+            CertServerPropType::PropTypeString,
+            pwchSerialNumber,
+            cchSerialNumber * sizeof(WCHAR),
+            nullptr, // pbufOwner
+        },
+        {
+            CertServerPropType::PropTypeBinary,
+            bufRawCert.Get(),
+            bufRawCert.GetSize(),
+            nullptr, // pbufOwner
+        },
+        {
+            CertServerPropType::PropTypeString,
+            // An empty requester name is written when it was not known.
+            (cchRequesterName > 0) ? pwchRequesterName : nullptr,
+            cchRequesterName * sizeof(WCHAR),
+            nullptr, // pbufOwner
+        },
+    };
+
+    HRESULT hr = m_objProperties.Pack(CRefBuffer<CertPropertyValue>(
+        rgValues,
+        sizeof(rgValues) / sizeof(rgValues[0])));
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"CCertPropertyRecord::Pack failed, hr=%x\n", hr);
+        return hr;
+    }
+
+    BindProperties();
+    return S_OK;
+}
+
+HRESULT CCertIssuedEvent::TakeRawCert(
+    OUT CBstrBuffer& bufResult)
+{
+    HRESULT hr = m_objProperties.TakeBinary(g_iRawCertificate, OUT bufResult);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"CCertPropertyRecord::TakeBinary failed, hr=%x\n", hr);
+        return hr;
+    }
+
+    m_objProperties.GetBinary(g_iRawCertificate, OUT m_bufRawCert);
+    return S_OK;
+}
+
+void CCertIssuedEvent::BindProperties()
+{
+    m_pwszSubjectKeyIdentifier = m_objProperties.GetString(g_iSubjectKeyIdentifier);
+    m_pwszSerialNumber = m_objProperties.GetString(g_iSerialNumber);
+    m_objProperties.GetBinary(g_iRawCertificate, OUT m_bufRawCert);
+    m_pwszRequesterName = m_objProperties.GetString(g_iRequesterName);
+}
@@ -0,0 +1,222 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        CertIssuedEvent.h
+
+    Abstract:
+
+        CCertIssuedEvent class declaration.
+
+--*/
+
+#include "CertPropertySet.h"
+
+class CCertServerExit;
+
+/*++
+
+    Abstract:
+
+        Snapshot of the properties of an issued certificate.
+
+    Remarks:
+
+        The ICertServerExit context is only valid for the duration of ICertExit::Notify().
+        This class copies everything the event processor needs so the event can be
+        delivered on another thread after Notify() returns.
+
+        The properties are kept in one immutable CCertPropertyRecord. The accessors point
+        into it, so they are valid for the lifetime of the event. The raw cert stays in the
+        BSTR ICertServerExit returned, and TakeRawCert() moves it to a handler that outlives
+        the delivery.
+--*/
+class CCertIssuedEvent
+{
+public:
+    CCertIssuedEvent(
+        LONG lExitEvent,
+        LONG lContext);
+    ~CCertIssuedEvent();
+
+    /*++
+
+        Abstract:
+
+            Initializes a property set with the properties this class snapshots.
+
+        Parameters:
+
+            objProperties - the property set to pass to Snapshot().
+
+        Returns:
+
+            S_OK - success.
+            other - error code.
+    --*/
+    static HRESULT InitPropertySet(
+        OUT CCertPropertySet& objProperties);
+
+    /*++
+
+        Abstract:
+
+            Copies the certificate properties from the server.
+
+        Parameters:
+
+            objServer - the server interface initialized with the Notify() context.
+            objProperties - the property set initialized by InitPropertySet().
+
+        Returns:
+
+            S_OK - success.
+            other - error code.
+    --*/
+    HRESULT Snapshot(
+        const CCertServerExit& objServer,
+        CCertPropertySet& objProperties);
+
+    /*++
+
+        Abstract:
+
+            Restores the certificate properties from a journal record.
+
+        Parameters:
+
+            pwchSubjectKeyIdentifier - subject key identifier characters, not null terminated.
+            cchSubjectKeyIdentifier - number of subject key identifier characters.
+            pwchSerialNumber - serial number characters, not null terminated.
+            cchSerialNumber - number of serial number characters.
+            bufRawCert - raw DER bytes of the cert.
+            pwchRequesterName - requester name characters, not null terminated.
+            cchRequesterName - number of requester name characters.
+
+        Returns:
+
+            S_OK - success.
+            E_OUTOFMEMORY - out of memory.
+    --*/
+    HRESULT Restore(
+        LPCWSTR pwchSubjectKeyIdentifier,
+        size_t cchSubjectKeyIdentifier,
+        LPCWSTR pwchSerialNumber,
+        size_t cchSerialNumber,
+        const CBuffer<BYTE>& bufRawCert,
+        LPCWSTR pwchRequesterName,
+        size_t cchRequesterName);
+
+    inline LONG GetExitEvent() const
+    {
+        return m_lExitEvent;
+    }
+
+    inline LONG GetContext() const
+    {
+        return m_lContext;
+    }
+
+    inline LPCWSTR GetSubjectKeyIdentifier() const
+    {
+        return m_pwszSubjectKeyIdentifier;
+    }
+
+    inline LPCWSTR GetSerialNumber() const
+    {
+        return m_pwszSerialNumber;
+    }
+
+    inline const CBuffer<BYTE>& GetRawCert() const
+    {
+        return m_bufRawCert;
+    }
+
+    /*++
+
+        Abstract:
+
+            Moves the raw cert out of the event.
+
+        Parameters:
+
+            bufResult - receives the raw DER bytes of the cert.
+
+        Returns:
+
+            S_OK - success.
+            other - error code.
+
+        Remarks:
+
+            A cert fetched from ICertServerExit is moved without a copy, and GetRawCert() is
+            empty afterwards. A cert restored from the journal is copied.
+    --*/
+    HRESULT TakeRawCert(
+        OUT CBstrBuffer& bufResult);
+
+    /*++
+
+        Abstract:
+
+            Gets the name of the account that submitted the request, or nullptr if it is not known.
+
+    --*/
+    inline LPCWSTR GetRequesterName() const
+    {
+        return m_pwszRequesterName;
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets where the event is in the journal. 0 if the event is not journaled.
+
+    --*/
+    inline ULONGLONG GetJournalPosition() const
+    {
+        return m_ullJournalPosition;
+    }
+
+    inline void SetJournalPosition(ULONGLONG ullPosition)
+    {
+        m_ullJournalPosition = ullPosition;
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets the QueryPerformanceCounter() value when the event was queued.
+
+    --*/
+    inline ULONGLONG GetQueuedTime() const
+    {
+        return m_ullQueuedTime;
+    }
+
+    inline void SetQueuedTime(ULONGLONG ullTime)
+    {
+        m_ullQueuedTime = ullTime;
+    }
+
+private:
+    LONG m_lExitEvent;
+    LONG m_lContext;
+    ULONGLONG m_ullJournalPosition;
+    ULONGLONG m_ullQueuedTime;
+    CCertPropertyRecord m_objProperties;
+    LPCWSTR m_pwszSubjectKeyIdentifier;
+    LPCWSTR m_pwszSerialNumber;
+    CRefBuffer<BYTE> m_bufRawCert;
+    LPCWSTR m_pwszRequesterName;
+
+    void BindProperties();
+
+    CCertIssuedEvent(const CCertIssuedEvent&) = delete;
+    CCertIssuedEvent& operator=(const CCertIssuedEvent&) = delete;
+};
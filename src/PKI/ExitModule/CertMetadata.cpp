@@ -0,0 +1,351 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        CertMetadata.cpp
+
+    Abstract:
+
+        CCertMetadata class impl.
+
+--*/
+
+#include "pch.h"
+#include <bcrypt.h>
+#include "CertFields.h"
+#include "CertMetadata.h"
+
+// Longest hash the thumbprints use. SHA-256.
+constexpr const size_t g_cbMaxHash = 32;
+
+namespace
+{
+    // Values that go in the document, so it can be measured and then written.
+    struct MetadataValues
+    {
+        LPCWSTR pwszSubjectKeyIdentifier;
+        LPCWSTR pwszSerialNumber;
+        LPCWSTR pwszThumbprintSha1;
+        LPCWSTR pwszThumbprintSha256;
+        const CCertFields* pFields;
+    };
+
+    // JSON member names of the single value fields, in document order.
+    const struct
+    {
+        LPCWSTR pwszName;
+        CertField eField;
+    } g_rgStringFields[] =
+    {
+        { L"subject", CertFieldSubject },
+        { L"issuer", CertFieldIssuer },
+        { L"notBefore", CertFieldNotBefore },
+        { L"notAfter", CertFieldNotAfter },
+        { L"template", CertFieldTemplate },
+    };
+
+    const struct
+    {
+        LPCWSTR pwszName;
+        CertField eField;
+    } g_rgListFields[] =
+    {
+        { L"subjectAltNames", CertFieldSubjectAltName },
+        { L"enhancedKeyUsages", CertFieldEnhancedKeyUsage },
+    };
+
+    /*++
+
+        Abstract:
+
+            Writes JSON text, or only counts it when there is no output buffer.
+
+    --*/
+    class CJsonWriter
+    {
+    public:
+        CJsonWriter(
+            LPWSTR pwchOut)
+            : m_pwchOut(pwchOut), m_cch(0), m_fFirstMember(true)
+        {
+        }
+
+        inline size_t GetLength() const
+        {
+            return m_cch;
+        }
+
+        void Put(
+            WCHAR wch)
+        {
+            if (m_pwchOut)
+            {
+                m_pwchOut[m_cch] = wch;
+            }
+
+            m_cch++;
+        }
+
+        void PutRaw(
+            LPCWSTR pwsz)
+        {
+            for (LPCWSTR p = pwsz; *p; p++)
+            {
+                Put(*p);
+            }
+        }
+
+        void PutString(
+            LPCWSTR pwch,
+            size_t cch)
+        {
+            Put(L'"');
+            for (size_t i = 0; i < cch; i++)
+            {
+                WCHAR wch = pwch[i];
+                if (wch == L'"' || wch == L'\\')
+                {
+                    Put(L'\\');
+                    Put(wch);
+                }
+                else if (wch < 0x20)
+                {
+                    // Control characters as \u00XX.
+                    PutRaw(L"\\u00");
+                    Put(L"0123456789abcdef"[wch >> 4]);
+                    Put(L"0123456789abcdef"[wch & 0xF]);
+                }
+                else
+                {
+                    Put(wch);
+                }
+            }
+
+            Put(L'"');
+        }
+
+        void PutStringOrNull(
+            LPCWSTR pwsz)
+        {
+            if (pwsz)
+            {
+                PutString(pwsz, wcslen(pwsz));
+            }
+            else
+            {
+                PutRaw(L"null");
+            }
+        }
+
+        void PutName(
+            LPCWSTR pwszName)
+        {
+            if (!m_fFirstMember)
+            {
+                Put(L',');
+            }
+
+            m_fFirstMember = false;
+            PutString(pwszName, wcslen(pwszName));
+            Put(L':');
+        }
+
+    private:
+        LPWSTR m_pwchOut;
+        size_t m_cch;
+        bool m_fFirstMember;
+    };
+
+    size_t Fill(
+        const MetadataValues& stValues,
+        LPWSTR pwchOut)
+    {
+        CJsonWriter objWriter(pwchOut);
+        const CCertFields& objFields = *stValues.pFields;
+
+        objWriter.Put(L'{');
+        objWriter.PutName(L"subjectKeyIdentifier");
+        objWriter.PutStringOrNull(stValues.pwszSubjectKeyIdentifier);
+        objWriter.PutName(L"serialNumber");
+        objWriter.PutStringOrNull(stValues.pwszSerialNumber);
+        objWriter.PutName(L"thumbprintSha1");
+        objWriter.PutStringOrNull(stValues.pwszThumbprintSha1);
+        objWriter.PutName(L"thumbprintSha256");
+        objWriter.PutStringOrNull(stValues.pwszThumbprintSha256);
+
+        for (const auto& stField : g_rgStringFields)
+        {
+            objWriter.PutName(stField.pwszName);
+            objWriter.PutStringOrNull(objFields.Get(stField.eField));
+        }
+
+        for (const auto& stField : g_rgListFields)
+        {
+            objWriter.PutName(stField.pwszName);
+            if (!objFields.Get(stField.eField))
+            {
+                objWriter.PutRaw(L"null");
+                continue;
+            }
+
+            objWriter.Put(L'[');
+            for (size_t i = 0; i < objFields.GetEntryCount(stField.eField); i++)
+            {
+                if (i > 0)
+                {
+                    objWriter.Put(L',');
+                }
+
+                size_t cchEntry = 0;
+                LPCWSTR pwchEntry = objFields.GetEntry(stField.eField, i, OUT cchEntry);
+                objWriter.PutString(pwchEntry, cchEntry);
+            }
+
+            objWriter.Put(L']');
+        }
+
+        objWriter.Put(L'}');
+        return objWriter.GetLength();
+    }
+}
+
+CCertMetadata::CCertMetadata()
+{
+}
+
+CCertMetadata::~CCertMetadata()
+{
+}
+
+HRESULT CCertMetadata::Format(
+    LPCWSTR pwszSubjectKeyIdentifier,
+    LPCWSTR pwszSerialNumber,
+    const CBuffer<BYTE>& bufRawCert,
+    const CCertFields& objFields)
+{
+    HRESULT hr = S_OK;
+    CStaticBuffer<WCHAR, s_cchMaxThumbprint> strSha1;
+    CStaticBuffer<WCHAR, s_cchMaxThumbprint> strSha256;
+    CHeapBuffer<WCHAR> bufText;
+
+    do
+    {
+        MetadataValues stValues;
+        stValues.pwszSubjectKeyIdentifier = pwszSubjectKeyIdentifier;
+        stValues.pwszSerialNumber = pwszSerialNumber;
+        stValues.pwszThumbprintSha1 = nullptr;
+        stValues.pwszThumbprintSha256 = nullptr;
+        stValues.pFields = &objFields;
+
+        // optional. ignore failure. The thumbprint is null.
+        hr = FormatThumbprint(BCRYPT_SHA1_ALGORITHM, bufRawCert, strSha1);
+        if (SUCCEEDED(hr))
+        {
+            stValues.pwszThumbprintSha1 = strSha1.Get();
+        }
+
+        hr = FormatThumbprint(BCRYPT_SHA256_ALGORITHM, bufRawCert, strSha256);
+        if (SUCCEEDED(hr))
+        {
+            stValues.pwszThumbprintSha256 = strSha256.Get();
+        }
+
+        // Measure, then write into a buffer of exactly that size.
+        size_t cch = Fill(stValues, nullptr);
+        if (cch > MAXINT || !bufText.Alloc(cch))
+        {
+            hr = E_OUTOFMEMORY;
+            ATLTRACE(L"Failed to alloc %d wchars for cert metadata.\n", cch);
+            break;
+        }
+
+        Fill(stValues, bufText.Get());
+
+        int cbData = ::WideCharToMultiByte(
+            CP_UTF8,
+            0, // dwFlags
+            bufText.Get(),
+            (int)cch,
+            nullptr, // lpMultiByteStr
+            0, // cbMultiByte
+            nullptr, // lpDefaultChar
+            nullptr); // lpUsedDefaultChar
+        if (cbData <= 0)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"::WideCharToMultiByte failed, hr=%x\n", hr);
+            break;
+        }
+
+        if (!m_bufData.Alloc(cbData))
+        {
+            hr = E_OUTOFMEMORY;
+            ATLTRACE(L"Failed to alloc %d bytes for cert metadata.\n", cbData);
+            break;
+        }
+
+        cbData = ::WideCharToMultiByte(
+            CP_UTF8,
+            0, // dwFlags
+            bufText.Get(),
+            (int)cch,
+            reinterpret_cast<LPSTR>(m_bufData.Get()),
+            cbData,
+            nullptr, // lpDefaultChar
+            nullptr); // lpUsedDefaultChar
+        if (cbData <= 0)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"::WideCharToMultiByte failed, hr=%x\n", hr);
+            break;
+        }
+
+        hr = S_OK;
+    } while (false);
+
+    return hr;
+}
+
+HRESULT CCertMetadata::FormatThumbprint(
+    LPCWSTR pwszAlgorithm,
+    const CBuffer<BYTE>& bufRawCert,
+    CBuffer<WCHAR>& strThumbprint)
+{
+    CStaticBuffer<BYTE, g_cbMaxHash> bufHash;
+    DWORD cbHash = (DWORD)bufHash.GetSize();
+
+    if (bufRawCert.GetSize() > MAXDWORD)
+    {
+        return E_INVALIDARG;
+    }
+
+    if (!::CryptHashCertificate2(
+        pwszAlgorithm,
+        0, // dwFlags
+        nullptr, // pvReserved
+        bufRawCert.Get(),
+        (DWORD)bufRawCert.GetSize(),
+        bufHash.Get(),
+        &cbHash))
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(::GetLastError());
+        ATLTRACE(L"::CryptHashCertificate2(%s) failed, hr=%x\n", pwszAlgorithm, hr);
+        return hr;
+    }
+
+    if (cbHash * 2 + 1 > strThumbprint.GetLength())
+    {
+        return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    }
+
+    for (DWORD i = 0; i < cbHash; i++)
+    {
+        strThumbprint.Get()[2 * i] = L"0123456789ABCDEF"[bufHash.Get()[i] >> 4];
+        strThumbprint.Get()[2 * i + 1] = L"0123456789ABCDEF"[bufHash.Get()[i] & 0xF];
+    }
+
+    strThumbprint.Get()[2 * cbHash] = L'\0';
+    return S_OK;
+}
@@ -0,0 +1,93 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        CertMetadata.h
+
+    Abstract:
+
+        CCertMetadata class declaration.
+
+--*/
+
+class CCertFields;
+
+/*++
+
+    Abstract:
+
+        JSON document with the fields of an issued cert, written next to the raw cert
+        so a handler does not have to load the cert to read them.
+
+    Remarks:
+
+        The document is UTF-8 without a BOM, on one line:
+
+            {"subjectKeyIdentifier":"...","serialNumber":"...",
+             "thumbprintSha1":"...","thumbprintSha256":"...",
+             "subject":"...","issuer":"...","notBefore":"...","notAfter":"...",
+             "template":"...","subjectAltNames":["..."],"enhancedKeyUsages":["..."]}
+
+        Thumbprints are upper case hex, like X509Certificate2.Thumbprint. The other
+        values are formatted as CCertFields formats them. A value that is not in the cert
+        or could not be parsed is null.
+--*/
+class CCertMetadata
+{
+public:
+    CCertMetadata();
+    ~CCertMetadata();
+
+    /*++
+
+        Abstract:
+
+            Formats the document.
+
+        Parameters:
+
+            pwszSubjectKeyIdentifier - the subject key identifier from CertSvc.
+            pwszSerialNumber - the serial number from CertSvc.
+            bufRawCert - DER bytes of the cert, for the thumbprints.
+            objFields - the fields parsed from bufRawCert.
+
+        Returns:
+
+            S_OK - success.
+            other - error code.
+    --*/
+    HRESULT Format(
+        LPCWSTR pwszSubjectKeyIdentifier,
+        LPCWSTR pwszSerialNumber,
+        const CBuffer<BYTE>& bufRawCert,
+        const CCertFields& objFields);
+
+    /*++
+
+        Abstract:
+
+            Gets the bytes of the formatted document.
+
+    --*/
+    inline const CBuffer<BYTE>& GetData() const
+    {
+        return m_bufData;
+    }
+
+private:
+    // Hex of a SHA-256 hash and a null terminator.
+    static const size_t s_cchMaxThumbprint = 65;
+
+    CHeapBuffer<BYTE> m_bufData;
+
+    static HRESULT FormatThumbprint(
+        LPCWSTR pwszAlgorithm,
+        const CBuffer<BYTE>& bufRawCert,
+        CBuffer<WCHAR>& strThumbprint);
+
+    CCertMetadata(const CCertMetadata&) = delete;
+    CCertMetadata& operator=(const CCertMetadata&) = delete;
+};
@@ -0,0 +1,475 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        CertPropertySet.cpp
+
+    Abstract:
+
+        CCertPropertySet and CCertPropertyRecord class impl.
+
+--*/
+
+#include "pch.h"
+#include "CertServerExit.h"
+#include "CertPropertySet.h"
+
+// Every value in the arena starts on this boundary so longs and dates can be read in place.
+constexpr const size_t g_cbArenaAlignment = sizeof(ULONGLONG);
+
+static size_t AlignArenaOffset(
+    size_t ib)
+{
+    return (ib + g_cbArenaAlignment - 1) & ~(g_cbArenaAlignment - 1);
+}
+
+CCertPropertyRecord::CCertPropertyRecord()
+    : m_cSlots(0)
+{
+    ZeroMemory(m_bufSlots.Get(), m_bufSlots.GetSize());
+}
+
+CCertPropertyRecord::~CCertPropertyRecord()
+{
+}
+
+HRESULT CCertPropertyRecord::Pack(
+    const CBuffer<CertPropertyValue>& bufValues)
+{
+    if (m_cSlots != 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_ALREADY_INITIALIZED);
+    }
+
+    if (bufValues.GetLength() > m_bufSlots.GetLength())
+    {
+        ATLTRACE(L"Too many properties, count=%d\n", bufValues.GetLength());
+        return E_INVALIDARG;
+    }
+
+    // First pass lays out the values so the arena is allocated once.
+    size_t cbArena = 0;
+    for (size_t i = 0; i < bufValues.GetLength(); i++)
+    {
+        const CertPropertyValue& stValue = bufValues.Get()[i];
+        Slot& stSlot = m_bufSlots.Get()[i];
+        stSlot.fPresent = (stValue.pv != nullptr || stValue.pbufOwner != nullptr);
+        stSlot.fOwned = (stValue.pbufOwner != nullptr);
+        if (!stSlot.fPresent)
+        {
+            continue;
+        }
+
+        if (stSlot.fOwned)
+        {
+            if (stValue.ePropType != CertServerPropType::PropTypeBinary)
+            {
+                ATLTRACE(L"Property %d is owned but not binary, type=%x\n", i, stValue.ePropType);
+                ZeroMemory(m_bufSlots.Get(), m_bufSlots.GetSize());
+                return E_INVALIDARG;
+            }
+
+            stSlot.cb = stValue.pbufOwner->GetSize();
+            continue;
+        }
+
+        size_t cbExpected = stValue.cb;
+        switch (stValue.ePropType)
+        {
+        case CertServerPropType::PropTypeLong:
+            cbExpected = sizeof(LONG);
+            break;
+
+        case CertServerPropType::PropTypeDate:
+            cbExpected = sizeof(DATE);
+            break;
+
+        case CertServerPropType::PropTypeString:
+            cbExpected = stValue.cb - (stValue.cb % sizeof(WCHAR));
+            break;
+        }
+
+        if (stValue.cb != cbExpected)
+        {
+            ATLTRACE(L"Property %d has the wrong size for type %x, cb=%d\n", i, stValue.ePropType, stValue.cb);
+            ZeroMemory(m_bufSlots.Get(), m_bufSlots.GetSize());
+            return E_INVALIDARG;
+        }
+
+        stSlot.ibOffset = AlignArenaOffset(cbArena);
+        stSlot.cb = stValue.cb;
+        cbArena = stSlot.ibOffset + stValue.cb;
+        if (stValue.ePropType == CertServerPropType::PropTypeString)
+        {
+            cbArena += sizeof(WCHAR);
+        }
+    }
+
+    if (cbArena > 0 && !m_bufArena.Alloc(cbArena))
+    {
+        ATLTRACE(L"Failed to alloc the property arena, cb=%d\n", cbArena);
+        ZeroMemory(m_bufSlots.Get(), m_bufSlots.GetSize());
+        return E_OUTOFMEMORY;
+    }
+
+    for (size_t i = 0; i < bufValues.GetLength(); i++)
+    {
+        const CertPropertyValue& stValue = bufValues.Get()[i];
+        const Slot& stSlot = m_bufSlots.Get()[i];
+        if (!stSlot.fPresent)
+        {
+            continue;
+        }
+
+        if (stSlot.fOwned)
+        {
+            m_bufOwned.Get()[i].MoveFrom(*stValue.pbufOwner);
+            continue;
+        }
+
+        BYTE* pbValue = m_bufArena.Get() + stSlot.ibOffset;
+        if (stSlot.cb > 0)
+        {
+            CopyMemory(pbValue, stValue.pv, stSlot.cb);
+        }
+
+        if (stValue.ePropType == CertServerPropType::PropTypeString)
+        {
+            reinterpret_cast<WCHAR*>(pbValue)[stSlot.cb / sizeof(WCHAR)] = L'\0';
+        }
+    }
+
+    m_cSlots = bufValues.GetLength();
+    return S_OK;
+}
+
+LPCWSTR CCertPropertyRecord::GetString(
+    size_t iProperty) const
+{
+    return reinterpret_cast<LPCWSTR>(GetValue(iProperty, 0));
+}
+
+void CCertPropertyRecord::GetBinary(
+    size_t iProperty,
+    OUT CRefBuffer<BYTE>& bufResult) const
+{
+    const BYTE* pbValue = GetValue(iProperty, 0);
+    if (!pbValue)
+    {
+        bufResult.Attach(nullptr, 0);
+        return;
+    }
+
+    // The record is immutable. CRefBuffer just has no const flavor.
+    bufResult.Attach(const_cast<BYTE*>(pbValue), m_bufSlots.Get()[iProperty].cb);
+}
+
+HRESULT CCertPropertyRecord::TakeBinary(
+    size_t iProperty,
+    OUT CBstrBuffer& bufResult)
+{
+    if (!IsPresent(iProperty))
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+    }
+
+    Slot& stSlot = m_bufSlots.Get()[iProperty];
+    if (stSlot.fOwned)
+    {
+        bufResult.MoveFrom(m_bufOwned.Get()[iProperty]);
+        stSlot.cb = 0;
+        return S_OK;
+    }
+
+    return bufResult.CopyFrom(CRefBuffer<BYTE>(m_bufArena.Get() + stSlot.ibOffset, stSlot.cb));
+}
+
+LONG CCertPropertyRecord::GetLong(
+    size_t iProperty) const
+{
+    const BYTE* pbValue = GetValue(iProperty, sizeof(LONG));
+    return pbValue ? *reinterpret_cast<const LONG*>(pbValue) : 0;
+}
+
+DATE CCertPropertyRecord::GetDate(
+    size_t iProperty) const
+{
+    const BYTE* pbValue = GetValue(iProperty, sizeof(DATE));
+    return pbValue ? *reinterpret_cast<const DATE*>(pbValue) : 0;
+}
+
+const BYTE* CCertPropertyRecord::GetValue(
+    size_t iProperty,
+    size_t cbExpected) const
+{
+    if (!IsPresent(iProperty))
+    {
+        return nullptr;
+    }
+
+    const Slot& stSlot = m_bufSlots.Get()[iProperty];
+    if (cbExpected != 0 && stSlot.cb != cbExpected)
+    {
+        ATLTRACE(L"Property %d is %d bytes, expected %d\n", iProperty, stSlot.cb, cbExpected);
+        return nullptr;
+    }
+
+    if (stSlot.fOwned)
+    {
+        // nullptr once the value was taken.
+        return m_bufOwned.Get()[iProperty].Get();
+    }
+
+    return m_bufArena.Get() + stSlot.ibOffset;
+}
+
+CCertPropertySet::CCertPropertySet()
+    : m_ullFrequency(1)
+{
+    LARGE_INTEGER liFrequency;
+    if (::QueryPerformanceFrequency(&liFrequency))
+    {
+        m_ullFrequency = (ULONGLONG)liFrequency.QuadPart;
+    }
+}
+
+CCertPropertySet::~CCertPropertySet()
+{
+}
+
+HRESULT CCertPropertySet::Init(
+    const CBuffer<const CertPropertyDescriptor>& bufDescriptors)
+{
+    HRESULT hr = S_OK;
+    size_t cProperties = bufDescriptors.GetLength();
+
+    do
+    {
+        if (cProperties == 0 || cProperties > CCertPropertyRecord::s_cMaxProperties)
+        {
+            hr = E_INVALIDARG;
+            ATLTRACE(L"Invalid property count=%d\n", cProperties);
+            break;
+        }
+
+        if (!m_bufNames.Alloc(cProperties) ||
+            !m_bufStats.Alloc(cProperties))
+        {
+            hr = E_OUTOFMEMORY;
+            ATLTRACE(L"Failed to alloc the property set.\n");
+            break;
+        }
+
+        ZeroMemory(m_bufStats.Get(), m_bufStats.GetSize());
+        for (size_t i = 0; i < cProperties; i++)
+        {
+            hr = m_bufNames.Get()[i].Append(bufDescriptors.Get()[i].pwszName);
+            if (FAILED(hr))
+            {
+                ATLTRACE(L"CComBSTR::Append failed, hr=%x\n", hr);
+                break;
+            }
+        }
+
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        m_bufDescriptors.Attach(bufDescriptors.Get(), cProperties);
+    } while (false);
+
+    if (FAILED(hr))
+    {
+        m_bufDescriptors.Attach(nullptr, 0);
+        m_bufNames.Clear();
+        m_bufStats.Clear();
+    }
+
+    return hr;
+}
+
+HRESULT CCertPropertySet::Fetch(
+    const CCertServerExit& objServer,
+    OUT CCertPropertyRecord& objRecord)
+{
+    HRESULT hr = S_OK;
+    size_t cProperties = GetCount();
+
+    // The variants own the values until they are copied into the record, except for
+    // binary values, whose BSTRs move into bufOwners and then into the record.
+    CStaticBuffer<ATL::CComVariant, CCertPropertyRecord::s_cMaxProperties> bufVariants;
+    CStaticBuffer<CBstrBuffer, CCertPropertyRecord::s_cMaxProperties> bufOwners;
+    CStaticBuffer<CertPropertyValue, CCertPropertyRecord::s_cMaxProperties> bufValues;
+
+    do
+    {
+        if (cProperties == 0)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INTERNAL_ERROR);
+            ATLTRACE(L"The property set is not initialized.\n");
+            break;
+        }
+
+        for (size_t i = 0; i < cProperties; i++)
+        {
+            const CertPropertyDescriptor& stDescriptor = GetDescriptor(i);
+            CertPropertyValue& stValue = bufValues.Get()[i];
+            stValue.ePropType = stDescriptor.ePropType;
+            stValue.pv = nullptr;
+            stValue.cb = 0;
+            stValue.pbufOwner = nullptr;
+
+            LARGE_INTEGER liStart;
+            LARGE_INTEGER liEnd;
+            ::QueryPerformanceCounter(&liStart);
+            hr = objServer.GetProperty(
+                stDescriptor.eSource,
+                m_bufNames.Get()[i],
+                stDescriptor.ePropType,
+                OUT bufVariants.Get()[i]);
+            if (SUCCEEDED(hr))
+            {
+                hr = ToValue(
+                    stDescriptor,
+                    bufVariants.Get()[i],
+                    bufOwners.Get()[i],
+                    OUT stValue);
+            }
+
+            ::QueryPerformanceCounter(&liEnd);
+            UpdateStats(i, liEnd.QuadPart - liStart.QuadPart, FAILED(hr));
+
+            if (FAILED(hr))
+            {
+                if (stDescriptor.fOptional)
+                {
+                    // optional. ignore failure.
+                    ATLTRACE(L"Optional property [%s] is missing, hr=%x\n", stDescriptor.pwszName, hr);
+                    stValue.pv = nullptr;
+                    stValue.pbufOwner = nullptr;
+                    hr = S_OK;
+                    continue;
+                }
+
+                ATLTRACE(L"Failed to fetch property [%s], hr=%x\n", stDescriptor.pwszName, hr);
+                break;
+            }
+        }
+
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        hr = objRecord.Pack(CRefBuffer<CertPropertyValue>(bufValues.Get(), cProperties));
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"CCertPropertyRecord::Pack failed, hr=%x\n", hr);
+            break;
+        }
+    } while (false);
+
+    return hr;
+}
+
+ULONGLONG CCertPropertySet::ToMicroseconds(
+    LONGLONG llTicks) const
+{
+    // Split so the multiply by 1000000 can't overflow for a long running total.
+    ULONGLONG ullTicks = (ULONGLONG)llTicks;
+    return (ullTicks / m_ullFrequency) * 1000000 + (ullTicks % m_ullFrequency) * 1000000 / m_ullFrequency;
+}
+
+void CCertPropertySet::UpdateStats(
+    size_t iProperty,
+    LONGLONG llTicks,
+    bool fFailed)
+{
+    CertPropertyStats& stStats = m_bufStats.Get()[iProperty];
+    ::InterlockedIncrement(&stStats.cFetches);
+    ::InterlockedExchangeAdd64(&stStats.llTicks, llTicks);
+    if (fFailed)
+    {
+        ::InterlockedIncrement(&stStats.cFailures);
+    }
+
+    LONGLONG llMaxTicks = stStats.llMaxTicks;
+    while (llTicks > llMaxTicks)
+    {
+        LONGLONG llPrevious = ::InterlockedCompareExchange64(&stStats.llMaxTicks, llTicks, llMaxTicks);
+        if (llPrevious == llMaxTicks)
+        {
+            break;
+        }
+
+        llMaxTicks = llPrevious;
+    }
+}
+
+HRESULT CCertPropertySet::ToValue(
+    const CertPropertyDescriptor& stDescriptor,
+    ATL::CComVariant& var,
+    CBstrBuffer& bufOwner,
+    OUT CertPropertyValue& stValue)
+{
+    VARTYPE vtExpected = VT_BSTR;
+    switch (stDescriptor.ePropType)
+    {
+    case CertServerPropType::PropTypeLong:
+        vtExpected = VT_I4;
+        break;
+
+    case CertServerPropType::PropTypeDate:
+        vtExpected = VT_DATE;
+        break;
+    }
+
+    if (var.vt != vtExpected)
+    {
+        ATLTRACE(L"Property [%s] expected vt=%d, actual=%d\n", stDescriptor.pwszName, vtExpected, var.vt);
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    switch (stDescriptor.ePropType)
+    {
+    case CertServerPropType::PropTypeLong:
+        stValue.pv = &var.lVal;
+        stValue.cb = sizeof(var.lVal);
+        break;
+
+    case CertServerPropType::PropTypeDate:
+        stValue.pv = &var.date;
+        stValue.cb = sizeof(var.date);
+        break;
+
+    case CertServerPropType::PropTypeBinary:
+        if (var.bstrVal)
+        {
+            // Keep the BSTR instead of copying a potentially large value.
+            bufOwner.AttachVariant(var);
+            stValue.pv = bufOwner.Get();
+            stValue.cb = bufOwner.GetSize();
+            stValue.pbufOwner = &bufOwner;
+            return S_OK;
+        }
+
+        break;
+
+    default:
+        stValue.pv = var.bstrVal;
+        stValue.cb = (size_t)::SysStringLen(var.bstrVal) * sizeof(WCHAR);
+        break;
+    }
+
+    // A null BSTR is an empty value, not a missing one.
+    if (!stValue.pv)
+    {
+        stValue.pv = L"";
+        stValue.cb = 0;
+    }
+
+    return S_OK;
+}
@@ -0,0 +1,353 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        CertPropertySet.h
+
+    Abstract:
+
+        CCertPropertySet and CCertPropertyRecord class declarations.
+
+--*/
+
+#include "CertServerPropType.h"
+
+class CCertServerExit;
+
+/*++
+
+    Abstract:
+
+        Describes one property to fetch for every event.
+
+--*/
+struct CertPropertyDescriptor
+{
+    // The property name, like wszPROPCERTIFICATESERIALNUMBER.
+    LPCWSTR pwszName;
+
+    // The property type.
+    CertServerPropType ePropType;
+
+    // Whether it is a request or a certificate property.
+    CertServerPropSource eSource;
+
+    // If true, a failure to fetch the property leaves it missing instead of failing the fetch.
+    bool fOptional;
+};
+
+/*++
+
+    Abstract:
+
+        A property value to copy into a record.
+
+    Remarks:
+
+        Strings are counted in bytes without a null terminator. Long and date values point
+        at a LONG and a DATE.
+
+        A binary value can instead be owned by a BSTR. The record then takes the BSTR
+        rather than copying the bytes.
+--*/
+struct CertPropertyValue
+{
+    // The property type.
+    CertServerPropType ePropType;
+
+    // The value, or nullptr if the property is missing.
+    const void* pv;
+
+    // Size of the value in bytes.
+    size_t cb;
+
+    // If not nullptr, the BSTR that holds a binary value. Pack() moves it into the record.
+    CBstrBuffer* pbufOwner;
+};
+
+/*++
+
+    Abstract:
+
+        Counters for fetching one property.
+
+    Remarks:
+
+        Updated with interlocked operations by every thread that fetches the property.
+        Times are QueryPerformanceCounter() ticks.
+--*/
+struct CertPropertyStats
+{
+    // Number of times the property was fetched.
+    volatile LONG cFetches;
+
+    // Number of fetches that failed.
+    volatile LONG cFailures;
+
+    // Total time spent fetching the property.
+    volatile LONGLONG llTicks;
+
+    // Longest single fetch.
+    volatile LONGLONG llMaxTicks;
+};
+
+/*++
+
+    Abstract:
+
+        Immutable copy of the properties of one event.
+
+    Remarks:
+
+        All values are copied into a single heap allocation, and only TakeBinary() changes
+        the record after Pack(), so it can be read on any thread after Notify() returns.
+        Strings are null terminated in the record.
+
+        Binary values that arrive in a BSTR, like the raw cert, stay in that BSTR instead of
+        being copied into the allocation. TakeBinary() moves such a value out of the record.
+--*/
+class CCertPropertyRecord
+{
+public:
+    // The most properties a record can hold.
+    static const size_t s_cMaxProperties = 16;
+
+    CCertPropertyRecord();
+    ~CCertPropertyRecord();
+
+    /*++
+
+        Abstract:
+
+            Copies the values into the record.
+
+        Parameters:
+
+            bufValues - the values, in descriptor order.
+
+        Returns:
+
+            S_OK - success.
+            E_OUTOFMEMORY - out of memory.
+            HRESULT_FROM_WIN32(ERROR_ALREADY_INITIALIZED) - the record was already packed.
+            E_INVALIDARG - too many values, or a value has the wrong size for its type.
+    --*/
+    HRESULT Pack(
+        const CBuffer<CertPropertyValue>& bufValues);
+
+    inline size_t GetCount() const
+    {
+        return m_cSlots;
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets the size of the single allocation that holds the values.
+
+    --*/
+    inline size_t GetArenaSize() const
+    {
+        return m_bufArena.GetSize();
+    }
+
+    inline bool IsPresent(
+        size_t iProperty) const
+    {
+        return iProperty < m_cSlots && m_bufSlots.Get()[iProperty].fPresent;
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets a string property, or nullptr if it is missing.
+
+    --*/
+    LPCWSTR GetString(
+        size_t iProperty) const;
+
+    /*++
+
+        Abstract:
+
+            Points bufResult at a binary property. It is empty if the property is missing.
+
+        Remarks:
+
+            bufResult is only valid while the record exists.
+    --*/
+    void GetBinary(
+        size_t iProperty,
+        OUT CRefBuffer<BYTE>& bufResult) const;
+
+    /*++
+
+        Abstract:
+
+            Gets a long property, or 0 if it is missing.
+
+    --*/
+    LONG GetLong(
+        size_t iProperty) const;
+
+    /*++
+
+        Abstract:
+
+            Gets a date property, or 0 if it is missing.
+
+    --*/
+    DATE GetDate(
+        size_t iProperty) const;
+
+    /*++
+
+        Abstract:
+
+            Moves a binary property into a caller owned BSTR.
+
+        Parameters:
+
+            iProperty - the property.
+            bufResult - receives the value.
+
+        Returns:
+
+            S_OK - success.
+            HRESULT_FROM_WIN32(ERROR_NOT_FOUND) - the property is missing.
+            E_OUTOFMEMORY - out of memory.
+
+        Remarks:
+
+            If the record owns a BSTR for the property, it is moved and GetBinary() is empty
+            afterwards. Otherwise the value is copied and the record does not change.
+    --*/
+    HRESULT TakeBinary(
+        size_t iProperty,
+        OUT CBstrBuffer& bufResult);
+
+private:
+    struct Slot
+    {
+        size_t ibOffset;
+        size_t cb;
+        bool fPresent;
+        bool fOwned;
+    };
+
+    CHeapBuffer<BYTE> m_bufArena;
+    CStaticBuffer<Slot, s_cMaxProperties> m_bufSlots;
+    CStaticBuffer<CBstrBuffer, s_cMaxProperties> m_bufOwned;
+    size_t m_cSlots;
+
+    const BYTE* GetValue(
+        size_t iProperty,
+        size_t cbExpected) const;
+
+    CCertPropertyRecord(const CCertPropertyRecord&) = delete;
+    CCertPropertyRecord& operator=(const CCertPropertyRecord&) = delete;
+};
+
+/*++
+
+    Abstract:
+
+        Fetches a fixed set of properties from ICertServerExit in one pass.
+
+    Remarks:
+
+        The property names are allocated once by Init() instead of for every event. Fetch()
+        gets every property, then copies all of them into the record with one allocation.
+
+        Fetch() can be called on several threads at once. Each property keeps latency and
+        failure counters.
+--*/
+class CCertPropertySet
+{
+public:
+    CCertPropertySet();
+    ~CCertPropertySet();
+
+    /*++
+
+        Abstract:
+
+            Allocates the property names and resets the counters.
+
+        Parameters:
+
+            bufDescriptors - the properties to fetch. Must stay valid while the set is used.
+
+        Returns:
+
+            S_OK - success.
+            E_OUTOFMEMORY - out of memory.
+            E_INVALIDARG - there are more than CCertPropertyRecord::s_cMaxProperties.
+    --*/
+    HRESULT Init(
+        const CBuffer<const CertPropertyDescriptor>& bufDescriptors);
+
+    /*++
+
+        Abstract:
+
+            Fetches every property into a record.
+
+        Parameters:
+
+            objServer - the server interface initialized with the Notify() context.
+            objRecord - receives the values, in descriptor order.
+
+        Returns:
+
+            S_OK - success.
+            other - error code from a property that is not optional.
+    --*/
+    HRESULT Fetch(
+        const CCertServerExit& objServer,
+        OUT CCertPropertyRecord& objRecord);
+
+    inline size_t GetCount() const
+    {
+        return m_bufDescriptors.GetLength();
+    }
+
+    inline const CertPropertyDescriptor& GetDescriptor(
+        size_t iProperty) const
+    {
+        return m_bufDescriptors.Get()[iProperty];
+    }
+
+    inline const CertPropertyStats& GetStats(
+        size_t iProperty) const
+    {
+        return m_bufStats.Get()[iProperty];
+    }
+
+    ULONGLONG ToMicroseconds(
+        LONGLONG llTicks) const;
+
+private:
+    CRefBuffer<const CertPropertyDescriptor> m_bufDescriptors;
+    CHeapBuffer<ATL::CComBSTR> m_bufNames;
+    CHeapBuffer<CertPropertyStats> m_bufStats;
+    ULONGLONG m_ullFrequency;
+
+    void UpdateStats(
+        size_t iProperty,
+        LONGLONG llTicks,
+        bool fFailed);
+    static HRESULT ToValue(
+        const CertPropertyDescriptor& stDescriptor,
+        ATL::CComVariant& var,
+        CBstrBuffer& bufOwner,
+        OUT CertPropertyValue& stValue);
+
+    CCertPropertySet(const CCertPropertySet&) = delete;
+    CCertPropertySet& operator=(const CCertPropertySet&) = delete;
+};
@@ -20,6 +20,7 @@
 --*/
 
 #include "pch.h"
+#include "StageTimer.h"
 #include "CertServerExit.h"
 
 CCertServerExit::CCertServerExit()
@@ -71,54 +72,92 @@ HRESULT CCertServerExit::Init(
     return hr;
 }
 
-HRESULT CCertServerExit::GetRequestProperty(
-    LPCWSTR pwszName,
-    CertServerPropType ePropType,
-    OUT ATL::CComVariant& varResult) const
+HRESULT CCertServerExit::Attach(
+    ICertServerExit* pInner,
+    LONG lContext)
 {
     HRESULT hr = S_OK;
-    ATL::CComBSTR bstrName;
 
     do
     {
-        if (!m_ptrInner)
-        {
-            hr = HRESULT_FROM_WIN32(ERROR_INTERNAL_ERROR);
-            ATLTRACE(L"m_ptrInner is null.\n");
-            break;
-        }
+        Clear();
 
-        hr = bstrName.Append(pwszName);
-        if (FAILED(hr))
+        if (!pInner)
         {
-            ATLTRACE(L"bstrName.Append failed, hr=%x\n", hr);
+            hr = E_POINTER;
             break;
         }
 
-        varResult.Clear();
-        hr = m_ptrInner->GetRequestProperty(bstrName, ePropType, &varResult);
-        if (FAILED(hr))
+        m_ptrInner = pInner;
+        if (lContext != 0)
         {
-            ATLTRACE(
-                L"ICertServerExit::GetRequestProperty(%s, %x) failed, hr=%x\n",
-                pwszName,
-                ePropType,
-                hr);
-            break;
+            hr = m_ptrInner->SetContext(lContext);
+            if (FAILED(hr))
+            {
+                ATLTRACE(L"ICertServerExit::SetContext(%x) failed, hr=%x\n", lContext, hr);
+                break;
+            }
         }
 
+        m_lContext = lContext;
     } while (false);
 
+    if (FAILED(hr))
+    {
+        Clear();
+    }
+
     return hr;
 }
 
+HRESULT CCertServerExit::GetRequestProperty(
+    LPCWSTR pwszName,
+    CertServerPropType ePropType,
+    OUT ATL::CComVariant& varResult) const
+{
+    ATL::CComBSTR bstrName;
+    HRESULT hr = bstrName.Append(pwszName);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"bstrName.Append failed, hr=%x\n", hr);
+        return hr;
+    }
+
+    return GetProperty(
+        CertServerPropSource::PropSourceRequest,
+        bstrName,
+        ePropType,
+        OUT varResult);
+}
+
 HRESULT CCertServerExit::GetCertificateProperty(
     LPCWSTR pwszName,
     CertServerPropType ePropType,
     OUT ATL::CComVariant& varResult) const
 {
-    HRESULT hr = S_OK;
     ATL::CComBSTR bstrName;
+    HRESULT hr = bstrName.Append(pwszName);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"bstrName.Append failed, hr=%x\n", hr);
+        return hr;
+    }
+
+    return GetProperty(
+        CertServerPropSource::PropSourceCertificate,
+        bstrName,
+        ePropType,
+        OUT varResult);
+}
+
+HRESULT CCertServerExit::GetProperty(
+    CertServerPropSource eSource,
+    const BSTR bstrName,
+    CertServerPropType ePropType,
+    OUT ATL::CComVariant& varResult) const
+{
+    PMI_STAGE_TIMER(PerfStagePropertyRead);
+    HRESULT hr = S_OK;
 
     do
     {
@@ -129,25 +168,33 @@ HRESULT CCertServerExit::GetCertificateProperty(
             break;
         }
 
-        hr = bstrName.Append(pwszName);
-        if (FAILED(hr))
+        varResult.Clear();
+        if (eSource == CertServerPropSource::PropSourceRequest)
         {
-            ATLTRACE(L"bstrName.Append failed, hr=%x\n", hr);
-            break;
+            hr = m_ptrInner->GetRequestProperty(bstrName, ePropType, &varResult);
+            if (FAILED(hr))
+            {
+                ATLTRACE(
+                    L"ICertServerExit::GetRequestProperty(%s, %x) failed, hr=%x\n",
+                    bstrName,
+                    ePropType,
+                    hr);
+                break;
+            }
         }
-
-        varResult.Clear();
-        hr = m_ptrInner->GetCertificateProperty(bstrName, ePropType, &varResult);
-        if (FAILED(hr))
+        else
         {
-            ATLTRACE(
-                L"ICertServerExit::GetCertificateProperty(%s, %x) failed, hr=%x\n",
-                pwszName,
-                ePropType,
-                hr);
-            break;
+            hr = m_ptrInner->GetCertificateProperty(bstrName, ePropType, &varResult);
+            if (FAILED(hr))
+            {
+                ATLTRACE(
+                    L"ICertServerExit::GetCertificateProperty(%s, %x) failed, hr=%x\n",
+                    bstrName,
+                    ePropType,
+                    hr);
+                break;
+            }
         }
-
     } while (false);
 
     return hr;
@@ -162,7 +209,7 @@ HRESULT CCertServerExit::GetModuleRegistryLocation(
 }
 
 HRESULT CCertServerExit::GetRawCertificateProperty(
-    OUT CHeapBuffer<BYTE>& bufResult) const
+    OUT CBstrBuffer& bufResult) const
 {
     HRESULT hr = S_OK;
     ATL::CComVariant var;
@@ -179,23 +226,12 @@ HRESULT CCertServerExit::GetRawCertificateProperty(
             break;
         }
 
-        if (var.vt != VT_BSTR)
+        hr = bufResult.AttachVariant(var);
+        if (FAILED(hr))
         {
             ATLTRACE(L"Expected VT_BSTR, actual=%d\n", var.vt);
-            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
-            break;
-        }
-
-        size_t cb = ::SysStringByteLen(var.bstrVal);
-
-        if (!bufResult.Alloc(cb))
-        {
-            hr = E_OUTOFMEMORY;
-            ATLTRACE(L"Failed to alloc heap for raw cert.\n");
             break;
         }
-
-        CopyMemory(bufResult.Get(), var.bstrVal, cb);
     } while (false);
 
     return hr;
@@ -225,6 +261,23 @@ HRESULT CCertServerExit::GetCertificateStringProperty(
     return hr;
 }
 
+HRESULT CCertServerExit::GetRequestStringProperty(
+    LPCWSTR pwszName,
+    OUT CHeapWString& strResult) const
+{
+    ATL::CComVariant var;
+    HRESULT hr = GetRequestProperty(
+        pwszName,
+        CertServerPropType::PropTypeString,
+        OUT var);
+    if (SUCCEEDED(hr))
+    {
+        hr = CopyString(var, strResult);
+    }
+
+    return hr;
+}
+
 HRESULT CCertServerExit::GetCertificateLongProperty(
     LPCWSTR pwszName,
     OUT LONG& lResult) const
@@ -60,6 +60,29 @@ public:
     HRESULT Init(
         LONG lContext = 0L);
 
+    /*++
+
+        Abstract:
+
+            Initializes the server interface from an existing instance.
+
+        Parameters:
+
+            pInner - the instance to use. Another reference is taken.
+            lContext - the context passed to ICertExit::Notify() or 0.
+
+        Returns:
+
+            S_OK for success or an error code.
+
+        Remarks:
+
+            Used by CCertServerExitCache to reuse an instance for several events.
+    --*/
+    HRESULT Attach(
+        ICertServerExit* pInner,
+        LONG lContext);
+
     /*++
     
         Abstract:
@@ -136,6 +159,33 @@ public:
         CertServerPropType ePropType,
         OUT ATL::CComVariant& varResult) const;
 
+    /*++
+
+        Abstract:
+
+            Gets a property of the request or the certificate by a preallocated name.
+
+        Parameters:
+
+            eSource - whether to get a request or a certificate property.
+            bstrName - the property name.
+            ePropType - the property type.
+            varResult - receives the value of the property.
+
+        Returns:
+
+            S_OK for success. An error code on failure.
+
+        Remarks:
+
+            Lets callers that fetch the same properties for every event allocate the names once.
+    --*/
+    HRESULT GetProperty(
+        CertServerPropSource eSource,
+        const BSTR bstrName,
+        CertServerPropType ePropType,
+        OUT ATL::CComVariant& varResult) const;
+
     /*++
     
         Abstract:
@@ -185,14 +235,18 @@ public:
 
         Parameters:
 
-            bufResult - On success, receives the raw bytes of the request.
+            bufResult - On success, owns the BSTR with the raw bytes of the cert.
 
         Returns:
 
             S_OK - success.
             Other - error code.
+
+        Remarks:
+
+            The BSTR is taken from the VARIANT, so the cert is not copied.
     --*/
-    HRESULT GetRawCertificateProperty(OUT CHeapBuffer<BYTE>& bufResult) const;
+    HRESULT GetRawCertificateProperty(OUT CBstrBuffer& bufResult) const;
 
     /*++
 
@@ -240,6 +294,29 @@ public:
             strResult);
     }
 
+    /*++
+
+        Abstract:
+
+            Gets the requester name property of the request.
+
+        Parameters:
+
+            strResult - On success, receives the domain\user name of the requester.
+
+        Returns:
+
+            S_OK - success.
+            Other - error code.
+    --*/
+    HRESULT GetRequestRequesterNameProperty(
+        OUT CHeapWString& strResult) const
+    {
+        return GetRequestStringProperty(
+            wszPROPREQUESTERNAME,
+            strResult);
+    }
+
 private:
     ATL::CComPtr<ICertServerExit> m_ptrInner;
     LONG m_lContext;
@@ -252,6 +329,10 @@ private:
         LPCWSTR pwszName,
         OUT CHeapWString& strResult) const;
 
+    HRESULT GetRequestStringProperty(
+        LPCWSTR pwszName,
+        OUT CHeapWString& strResult) const;
+
     HRESULT GetCertificateLongProperty(
         LPCWSTR pwszName,
         OUT LONG& lResult) const;
@@ -0,0 +1,231 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        CertServerExitCache.cpp
+
+    Abstract:
+
+        CCertServerExitCache class impl.
+
+--*/
+
+#include "pch.h"
+#include "CertServerExit.h"
+#include "CertServerExitCache.h"
+
+CCertServerExitCache::CCertServerExitCache()
+    : m_dwFlsIndex(FLS_OUT_OF_INDEXES),
+    m_pEntries(nullptr),
+    m_ullFrequency(1),
+    m_cActivations(0),
+    m_cReuses(0),
+    m_llActivationTicks(0)
+{
+    ::InitializeSRWLock(&m_lock);
+
+    LARGE_INTEGER liFrequency;
+    if (::QueryPerformanceFrequency(&liFrequency))
+    {
+        m_ullFrequency = (ULONGLONG)liFrequency.QuadPart;
+    }
+
+    m_dwFlsIndex = ::FlsAlloc(FlsCallback);
+    if (m_dwFlsIndex == FLS_OUT_OF_INDEXES)
+    {
+        ATLTRACE(L"FlsAlloc failed, hr=%x. Instances are not cached.\n", HRESULT_FROM_WIN32(::GetLastError()));
+    }
+}
+
+CCertServerExitCache::~CCertServerExitCache()
+{
+    Clear();
+
+    if (m_dwFlsIndex != FLS_OUT_OF_INDEXES)
+    {
+        // Calls FlsCallback for the entry of every thread that is still running.
+        ::FlsFree(m_dwFlsIndex);
+        m_dwFlsIndex = FLS_OUT_OF_INDEXES;
+    }
+}
+
+HRESULT CCertServerExitCache::Init(
+    LONG lContext,
+    OUT CCertServerExit& objServer)
+{
+    HRESULT hr = S_OK;
+    Entry* pEntry = nullptr;
+    ATL::CComPtr<ICertServerExit> ptrServer;
+
+    if (m_dwFlsIndex != FLS_OUT_OF_INDEXES)
+    {
+        pEntry = static_cast<Entry*>(::FlsGetValue(m_dwFlsIndex));
+    }
+
+    if (pEntry)
+    {
+        // Clear() can release the instance from another thread.
+        ::AcquireSRWLockShared(&m_lock);
+        ptrServer = pEntry->pServer;
+        ::ReleaseSRWLockShared(&m_lock);
+    }
+
+    if (ptrServer)
+    {
+        ::InterlockedIncrement(&m_cReuses);
+        hr = objServer.Attach(ptrServer, lContext);
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"CCertServerExit::Attach failed on a cached instance, hr=%x\n", hr);
+            Evict(*pEntry);
+        }
+
+        return hr;
+    }
+
+    hr = Create(OUT ptrServer);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    if (m_dwFlsIndex == FLS_OUT_OF_INDEXES)
+    {
+        return objServer.Attach(ptrServer, lContext);
+    }
+
+    if (!pEntry)
+    {
+        pEntry = new Entry();
+        if (pEntry)
+        {
+            pEntry->pThis = this;
+            pEntry->pServer = nullptr;
+            pEntry->pPrev = nullptr;
+
+            ::AcquireSRWLockExclusive(&m_lock);
+            pEntry->pNext = m_pEntries;
+            if (m_pEntries)
+            {
+                m_pEntries->pPrev = pEntry;
+            }
+
+            m_pEntries = pEntry;
+            ::ReleaseSRWLockExclusive(&m_lock);
+
+            if (!::FlsSetValue(m_dwFlsIndex, pEntry))
+            {
+                ATLTRACE(L"FlsSetValue failed, hr=%x\n", HRESULT_FROM_WIN32(::GetLastError()));
+                Remove(pEntry);
+                pEntry = nullptr;
+            }
+        }
+    }
+
+    if (pEntry)
+    {
+        ::AcquireSRWLockExclusive(&m_lock);
+        pEntry->pServer = ptrServer;
+        pEntry->pServer->AddRef();
+        ::ReleaseSRWLockExclusive(&m_lock);
+    }
+
+    return objServer.Attach(ptrServer, lContext);
+}
+
+void CCertServerExitCache::Clear()
+{
+    // The entries stay in the threads' slots and are freed when the threads exit.
+    ::AcquireSRWLockExclusive(&m_lock);
+    for (Entry* pEntry = m_pEntries; pEntry; pEntry = pEntry->pNext)
+    {
+        if (pEntry->pServer)
+        {
+            pEntry->pServer->Release();
+            pEntry->pServer = nullptr;
+        }
+    }
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+}
+
+ULONGLONG CCertServerExitCache::GetActivationUSecs() const
+{
+    // Split so the multiply by 1000000 can't overflow.
+    ULONGLONG ullTicks = (ULONGLONG)m_llActivationTicks;
+    return (ullTicks / m_ullFrequency) * 1000000 + (ullTicks % m_ullFrequency) * 1000000 / m_ullFrequency;
+}
+
+HRESULT CCertServerExitCache::Create(
+    OUT ATL::CComPtr<ICertServerExit>& ptrServer)
+{
+    LARGE_INTEGER liStart;
+    LARGE_INTEGER liEnd;
+
+    ::QueryPerformanceCounter(&liStart);
+    HRESULT hr = ptrServer.CoCreateInstance(
+        CLSID_CCertServerExit,
+        nullptr, // pUnkOuter
+        CLSCTX_INPROC_SERVER);
+    ::QueryPerformanceCounter(&liEnd);
+
+    ::InterlockedIncrement(&m_cActivations);
+    ::InterlockedExchangeAdd64(&m_llActivationTicks, liEnd.QuadPart - liStart.QuadPart);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"CCI for CLSID_CCertServerExit failed, hr=%x\n", hr);
+    }
+
+    return hr;
+}
+
+void CCertServerExitCache::Evict(
+    Entry& stEntry)
+{
+    // The entry stays, so the next event on the thread creates a new instance.
+    ::AcquireSRWLockExclusive(&m_lock);
+    if (stEntry.pServer)
+    {
+        stEntry.pServer->Release();
+        stEntry.pServer = nullptr;
+    }
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+}
+
+void CCertServerExitCache::Remove(
+    Entry* pEntry)
+{
+    ::AcquireSRWLockExclusive(&m_lock);
+    if (pEntry->pPrev)
+    {
+        pEntry->pPrev->pNext = pEntry->pNext;
+    }
+    else
+    {
+        m_pEntries = pEntry->pNext;
+    }
+
+    if (pEntry->pNext)
+    {
+        pEntry->pNext->pPrev = pEntry->pPrev;
+    }
+
+    if (pEntry->pServer)
+    {
+        pEntry->pServer->Release();
+    }
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+    delete pEntry;
+}
+
+VOID WINAPI CCertServerExitCache::FlsCallback(
+    PVOID pvData)
+{
+    // Runs on a thread that is exiting, or in FlsFree() for every thread.
+    Entry* pEntry = static_cast<Entry*>(pvData);
+    pEntry->pThis->Remove(pEntry);
+}
@@ -0,0 +1,147 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        CertServerExitCache.h
+
+    Abstract:
+
+        CCertServerExitCache class declaration.
+
+--*/
+
+class CCertServerExit;
+
+/*++
+
+    Abstract:
+
+        Keeps one ICertServerExit instance for each CertSvc thread that calls the exit module.
+
+    Remarks:
+
+        CertSvc calls ICertExit::Notify() on a small set of threads. Instead of creating
+        CLSID_CCertServerExit for every event, the first event on a thread creates it and
+        later events on the same thread only call SetContext().
+
+        An instance is only used on the thread that created it. It is kept in a fiber local
+        storage slot, and the slot's callback releases it when the thread exits, so a thread
+        ID that Windows hands to a new thread never finds the old thread's instance, and
+        the instances of exited threads don't pile up. If no slot can be allocated, every
+        event creates an instance, as before.
+
+        The COM activation is counted and timed, so the time saved by reusing instances
+        can be estimated. Loading the module in a process that registers a fake class
+        object for CLSID_CCertServerExit, like TestConsoleApp.exe loadtest, exercises the
+        cache without CertSvc.
+--*/
+class CCertServerExitCache
+{
+public:
+    CCertServerExitCache();
+    ~CCertServerExitCache();
+
+    /*++
+
+        Abstract:
+
+            Initializes objServer with this thread's instance, creating it if needed.
+
+        Parameters:
+
+            lContext - the context passed to ICertExit::Notify() or 0.
+            objServer - receives the instance.
+
+        Returns:
+
+            S_OK - success.
+            other - error code.
+
+        Remarks:
+
+            If SetContext() fails on a cached instance, it is dropped so the next event on
+            the thread creates a new one.
+    --*/
+    HRESULT Init(
+        LONG lContext,
+        OUT CCertServerExit& objServer);
+
+    /*++
+
+        Abstract:
+
+            Releases the cached instances.
+
+        Remarks:
+
+            Call when CertSvc shuts the module down. The counters are kept. A thread that
+            calls Init() again afterwards creates a new instance.
+    --*/
+    void Clear();
+
+    /*++
+
+        Abstract:
+
+            Gets the number of instances created with CoCreateInstance.
+
+    --*/
+    inline LONG GetActivations() const
+    {
+        return m_cActivations;
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets the number of events that reused a cached instance.
+
+    --*/
+    inline LONG GetReuses() const
+    {
+        return m_cReuses;
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets the total time spent in CoCreateInstance, in microseconds.
+
+    --*/
+    ULONGLONG GetActivationUSecs() const;
+
+private:
+    // One per thread that called Init(), in the thread's slot and in the list.
+    struct Entry
+    {
+        CCertServerExitCache* pThis;
+        ICertServerExit* pServer;
+        Entry* pPrev;
+        Entry* pNext;
+    };
+
+    SRWLOCK m_lock;
+    DWORD m_dwFlsIndex;
+    Entry* m_pEntries;
+    ULONGLONG m_ullFrequency;
+    volatile LONG m_cActivations;
+    volatile LONG m_cReuses;
+    volatile LONGLONG m_llActivationTicks;
+
+    HRESULT Create(
+        OUT ATL::CComPtr<ICertServerExit>& ptrServer);
+    void Evict(
+        Entry& stEntry);
+    void Remove(
+        Entry* pEntry);
+    static VOID WINAPI FlsCallback(
+        PVOID pvData);
+
+    CCertServerExitCache(const CCertServerExitCache&) = delete;
+    CCertServerExitCache& operator=(const CCertServerExitCache&) = delete;
+};
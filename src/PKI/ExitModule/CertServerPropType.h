@@ -9,7 +9,7 @@
 
     Abstract:
 
-        CertServerPropType enum
+        CertServerPropType and CertServerPropSource enums
 
     Authors:
 
@@ -40,4 +40,20 @@ typedef enum _CertServerPropType : DWORD
 
     // string.
     PropTypeString = PROPTYPE_STRING,
-} CertServerPropType;
\ No newline at end of file
+} CertServerPropType;
+
+/*++
+
+    Abstract:
+
+        Selects which ICertServerExit method fetches a property.
+
+--*/
+typedef enum _CertServerPropSource : DWORD
+{
+    // ICertServerExit::GetRequestProperty.
+    PropSourceRequest = 0,
+
+    // ICertServerExit::GetCertificateProperty.
+    PropSourceCertificate = 1,
+} CertServerPropSource;
\ No newline at end of file
@@ -0,0 +1,433 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        CommandLineTemplate.cpp
+
+    Abstract:
+
+        CCommandLineTemplate class impl.
+
+--*/
+
+#include "pch.h"
+#include "CommandLineTemplate.h"
+
+// CreateProcessW limit, including the null terminator.
+constexpr const size_t g_cchMaxCommandLine = 32767;
+
+namespace
+{
+    struct PlaceholderName
+    {
+        LPCWSTR pwsz;
+        size_t cch;
+        bool fEscapeForPS;
+    };
+
+    // In CommandLinePlaceholder order. {serial} is hex and has never been quoted for PowerShell.
+    const PlaceholderName g_rgPlaceholderNames[PlaceholderCount] =
+    {
+        { L"{ski}", 5, true },
+        { L"{serial}", 8, false },
+        { L"{rawcertpath}", 13, true },
+        { L"{requester}", 11, true },
+        { L"{metadatapath}", 14, true },
+        { L"{issuer}", 8, true },
+        { L"{notafter}", 10, true },
+        { L"{template}", 10, true },
+        { L"{eku}", 5, true },
+        { L"{san}", 5, true },
+        { L"{manifest}", 10, true },
+        { L"{resultpath}", 12, true },
+    };
+
+    bool FindPlaceholder(
+        LPCWSTR pwsz,
+        OUT DWORD& dwPlaceholder)
+    {
+        for (DWORD i = 0; i < PlaceholderCount; i++)
+        {
+            if (wcsncmp(pwsz, g_rgPlaceholderNames[i].pwsz, g_rgPlaceholderNames[i].cch) == 0)
+            {
+                dwPlaceholder = i;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    inline bool NeedsQuotes(
+        WCHAR wch)
+    {
+        return wch == L' ' || wch == L'\t' || wch == L'\n' || wch == L'\v' || wch == L'"';
+    }
+
+    /*++
+
+        Abstract:
+
+            Calls fn for each character of an argument before Windows quoting.
+
+    --*/
+    template<typename TPart, typename TFunc>
+    void ForEachArgumentChar(
+        const TPart* pParts,
+        size_t cParts,
+        const CommandLineValues& stValues,
+        TFunc&& fn)
+    {
+        for (const TPart* pPart = pParts; pPart != pParts + cParts; pPart++)
+        {
+            if (pPart->dwPlaceholder == 0)
+            {
+                // Literal text.
+                for (size_t i = 0; i < pPart->cch; i++)
+                {
+                    fn(pPart->pwch[i]);
+                }
+
+                continue;
+            }
+
+            LPCWSTR pwszValue = stValues.rgpwsz[pPart->dwPlaceholder - 1];
+            if (pPart->fEscapeForPS)
+            {
+                fn(L'\'');
+            }
+
+            for (LPCWSTR p = pwszValue; p && *p; p++)
+            {
+                if (pPart->fEscapeForPS && *p == L'\'')
+                {
+                    fn(L'\'');
+                }
+
+                fn(*p);
+            }
+
+            if (pPart->fEscapeForPS)
+            {
+                fn(L'\'');
+            }
+        }
+    }
+}
+
+CCommandLineTemplate::CCommandLineTemplate()
+    : m_cchText(0), m_cParts(0), m_dwPlaceholders(0)
+{
+}
+
+CCommandLineTemplate::~CCommandLineTemplate()
+{
+}
+
+HRESULT CCommandLineTemplate::Compile(
+    LPCWSTR pwszExePath,
+    const CBuffer<LPCWSTR>& bufBaseArgs,
+    const CBuffer<LPCWSTR>& bufOperationArgs,
+    bool fEscapeForPS)
+{
+    m_cchText = 0;
+    m_cParts = 0;
+    m_dwPlaceholders = 0;
+
+    if (!pwszExePath || wcschr(pwszExePath, L'"'))
+    {
+        ATLTRACE(L"Exe path cannot be quoted.\n");
+        return E_INVALIDARG;
+    }
+
+    // Worst case sizes. A quoted argument is at most twice as long plus the quotes,
+    // and an argument with placeholders also keeps its raw text.
+    size_t cchExePath = wcslen(pwszExePath);
+    size_t cchText = cchExePath + 2;
+    size_t cParts = 1;
+    const CBuffer<LPCWSTR>* rgpbufArgs[] = { &bufBaseArgs, &bufOperationArgs };
+    for (const CBuffer<LPCWSTR>* pbufArgs : rgpbufArgs)
+    {
+        for (size_t i = 0; i < pbufArgs->GetLength(); i++)
+        {
+            LPCWSTR pwszArg = pbufArgs->Get()[i];
+            size_t cBraces = 0;
+            size_t cch = 0;
+            for (; pwszArg[cch]; cch++)
+            {
+                cBraces += (pwszArg[cch] == L'{') ? 1 : 0;
+            }
+
+            cchText += 3 * cch + 3;
+            cParts += 2 * cBraces + 3;
+        }
+    }
+
+    if (!m_bufText.Alloc(cchText) || !m_bufParts.Alloc(cParts))
+    {
+        ATLTRACE(L"Failed to alloc command line template.\n");
+        return E_OUTOFMEMORY;
+    }
+
+    // CreateProcessW does not unescape the exe path. It only strips the quotes.
+    bool fQuoteExePath = (cchExePath == 0);
+    for (size_t i = 0; i < cchExePath; i++)
+    {
+        fQuoteExePath |= NeedsQuotes(pwszExePath[i]);
+    }
+
+    if (fQuoteExePath)
+    {
+        AppendRendered(L"\"", 1);
+    }
+
+    AppendRendered(pwszExePath, cchExePath);
+
+    if (fQuoteExePath)
+    {
+        AppendRendered(L"\"", 1);
+    }
+
+    for (const CBuffer<LPCWSTR>* pbufArgs : rgpbufArgs)
+    {
+        for (size_t i = 0; i < pbufArgs->GetLength(); i++)
+        {
+            AppendRendered(L" ", 1);
+            CompileArgument(pbufArgs->Get()[i], fEscapeForPS);
+        }
+    }
+
+    return S_OK;
+}
+
+HRESULT CCommandLineTemplate::Format(
+    const CommandLineValues& stValues,
+    OUT CHeapBuffer<WCHAR>& bufResult) const
+{
+    if (!IsCompiled())
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+    }
+
+    // Measure, then write into a buffer of exactly that size.
+    size_t cch = Fill(stValues, nullptr);
+    if (cch + 1 > g_cchMaxCommandLine)
+    {
+        ATLTRACE(L"Command line of %d chars is too long.\n", cch);
+        return HRESULT_FROM_WIN32(ERROR_FILENAME_EXCED_RANGE);
+    }
+
+    if (!bufResult.Alloc(cch + 1))
+    {
+        ATLTRACE(L"Failed to alloc buffer for command line.\n");
+        return E_OUTOFMEMORY;
+    }
+
+    Fill(stValues, bufResult.Get());
+    bufResult.Get()[cch] = L'\0';
+    return S_OK;
+}
+
+void CCommandLineTemplate::AppendRendered(
+    LPCWSTR pwch,
+    size_t cch)
+{
+    LPWSTR pwchText = m_bufText.Get() + m_cchText;
+    MoveMemory(pwchText, pwch, cch * sizeof(WCHAR));
+    m_cchText += cch;
+
+    // Extend the last part if this text follows it.
+    Part* pLast = m_cParts > 0 ? &m_bufParts.Get()[m_cParts - 1] : nullptr;
+    if (pLast && pLast->eKind == PartRendered && pLast->pwch + pLast->cch == pwchText)
+    {
+        pLast->cch += cch;
+        return;
+    }
+
+    Part& stPart = m_bufParts.Get()[m_cParts++];
+    stPart.eKind = PartRendered;
+    stPart.dwPlaceholder = 0;
+    stPart.fEscapeForPS = false;
+    stPart.pwch = pwchText;
+    stPart.cch = cch;
+}
+
+void CCommandLineTemplate::AppendLiteral(
+    LPCWSTR pwch,
+    size_t cch)
+{
+    if (cch == 0)
+    {
+        return;
+    }
+
+    Part& stPart = m_bufParts.Get()[m_cParts++];
+    stPart.eKind = PartLiteral;
+    stPart.dwPlaceholder = 0;
+    stPart.fEscapeForPS = false;
+    stPart.pwch = m_bufText.Get() + m_cchText;
+    stPart.cch = cch;
+
+    CopyMemory(m_bufText.Get() + m_cchText, pwch, cch * sizeof(WCHAR));
+    m_cchText += cch;
+}
+
+void CCommandLineTemplate::CompileArgument(
+    LPCWSTR pwszArg,
+    bool fEscapeForPS)
+{
+    size_t iArgument = m_cParts++;
+    Part& stArgument = m_bufParts.Get()[iArgument];
+    stArgument.eKind = PartArgument;
+    stArgument.dwPlaceholder = 0;
+    stArgument.fEscapeForPS = false;
+    stArgument.pwch = nullptr;
+
+    LPCWSTR pwszLiteral = pwszArg;
+    LPCWSTR p = pwszArg;
+    while (*p)
+    {
+        DWORD dwPlaceholder = 0;
+        if (*p != L'{' || !FindPlaceholder(p, OUT dwPlaceholder))
+        {
+            p++;
+            continue;
+        }
+
+        // Keep the raw text. It is quoted along with the value.
+        AppendLiteral(pwszLiteral, p - pwszLiteral);
+
+        // Stored one based so a literal part is the one with dwPlaceholder 0.
+        Part& stPlaceholder = m_bufParts.Get()[m_cParts++];
+        stPlaceholder.eKind = PartPlaceholder;
+        stPlaceholder.dwPlaceholder = dwPlaceholder + 1;
+        stPlaceholder.fEscapeForPS = fEscapeForPS && g_rgPlaceholderNames[dwPlaceholder].fEscapeForPS;
+        stPlaceholder.pwch = nullptr;
+        stPlaceholder.cch = 0;
+        m_dwPlaceholders |= (1UL << dwPlaceholder);
+
+        p += g_rgPlaceholderNames[dwPlaceholder].cch;
+        pwszLiteral = p;
+    }
+
+    if (m_cParts == iArgument + 1)
+    {
+        // No placeholders. Quote it now.
+        Part stLiteral;
+        stLiteral.eKind = PartLiteral;
+        stLiteral.dwPlaceholder = 0;
+        stLiteral.fEscapeForPS = false;
+        stLiteral.pwch = pwszArg;
+        stLiteral.cch = p - pwszArg;
+
+        m_cParts = iArgument;
+        LPWSTR pwchRendered = m_bufText.Get() + m_cchText;
+        size_t cchRendered = WriteArgument(&stLiteral, 1, CommandLineValues(), pwchRendered);
+
+        // The text is already in place. AppendRendered() moves it onto itself.
+        AppendRendered(pwchRendered, cchRendered);
+        return;
+    }
+
+    AppendLiteral(pwszLiteral, p - pwszLiteral);
+    m_bufParts.Get()[iArgument].cch = m_cParts - iArgument - 1;
+}
+
+size_t CCommandLineTemplate::Fill(
+    const CommandLineValues& stValues,
+    LPWSTR pwchOut) const
+{
+    size_t cch = 0;
+
+    for (size_t i = 0; i < m_cParts; i++)
+    {
+        const Part& stPart = m_bufParts.Get()[i];
+        if (stPart.eKind == PartRendered)
+        {
+            if (pwchOut)
+            {
+                CopyMemory(pwchOut + cch, stPart.pwch, stPart.cch * sizeof(WCHAR));
+            }
+
+            cch += stPart.cch;
+        }
+        else if (stPart.eKind == PartArgument)
+        {
+            cch += WriteArgument(
+                &stPart + 1,
+                stPart.cch,
+                stValues,
+                pwchOut ? pwchOut + cch : nullptr);
+            i += stPart.cch;
+        }
+    }
+
+    return cch;
+}
+
+size_t CCommandLineTemplate::WriteArgument(
+    const Part* pParts,
+    size_t cParts,
+    const CommandLineValues& stValues,
+    LPWSTR pwchOut)
+{
+    bool fEmpty = true;
+    bool fQuote = false;
+    ForEachArgumentChar(pParts, cParts, stValues, [&](WCHAR wch)
+    {
+        fEmpty = false;
+        fQuote |= NeedsQuotes(wch);
+    });
+
+    fQuote |= fEmpty;
+
+    size_t cch = 0;
+    size_t cBackslashes = 0;
+    auto Put = [&](WCHAR wch)
+    {
+        if (pwchOut)
+        {
+            pwchOut[cch] = wch;
+        }
+
+        cch++;
+    };
+
+    if (!fQuote)
+    {
+        // Backslashes are only special in front of a quote, and there are none.
+        ForEachArgumentChar(pParts, cParts, stValues, Put);
+        return cch;
+    }
+
+    Put(L'"');
+    ForEachArgumentChar(pParts, cParts, stValues, [&](WCHAR wch)
+    {
+        if (wch == L'\\')
+        {
+            cBackslashes++;
+            return;
+        }
+
+        // Backslashes in front of a quote are doubled, and the quote gets one more.
+        size_t cOut = (wch == L'"') ? 2 * cBackslashes + 1 : cBackslashes;
+        for (size_t i = 0; i < cOut; i++)
+        {
+            Put(L'\\');
+        }
+
+        cBackslashes = 0;
+        Put(wch);
+    });
+
+    // The closing quote follows the last backslashes, so they are doubled too.
+    for (size_t i = 0; i < 2 * cBackslashes; i++)
+    {
+        Put(L'\\');
+    }
+
+    Put(L'"');
+    return cch;
+}
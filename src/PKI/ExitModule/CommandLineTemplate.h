@@ -0,0 +1,233 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        CommandLineTemplate.h
+
+    Abstract:
+
+        CCommandLineTemplate class declaration.
+
+--*/
+
+/*++
+
+    Abstract:
+
+        Values that can be substituted into a command line template.
+
+    Remarks:
+
+        The name in braces is what appears in an argument, for example -path {rawcertpath}.
+--*/
+enum CommandLinePlaceholder : DWORD
+{
+    // {ski} - subject key identifier of the cert.
+    PlaceholderSubjectKeyIdentifier = 0,
+
+    // {serial} - serial number of the cert.
+    PlaceholderSerialNumber,
+
+    // {rawcertpath} - path to the file with the DER bytes of the cert.
+    PlaceholderRawCertPath,
+
+    // {requester} - name of the account that submitted the request.
+    PlaceholderRequester,
+
+    // {metadatapath} - path to the JSON metadata of the cert. See CertMetadata.h.
+    PlaceholderMetadataPath,
+
+    // {issuer} - issuer name of the cert, parsed from the raw cert.
+    PlaceholderIssuer,
+
+    // {notafter} - expiration of the cert in UTC, parsed from the raw cert.
+    PlaceholderNotAfter,
+
+    // {template} - certificate template OID or name, parsed from the raw cert.
+    PlaceholderTemplate,
+
+    // {eku} - enhanced key usage OIDs, parsed from the raw cert.
+    PlaceholderEnhancedKeyUsage,
+
+    // {san} - subject alternative names, parsed from the raw cert.
+    PlaceholderSubjectAltName,
+
+    // {manifest} - path to the batch manifest.
+    PlaceholderManifestPath,
+
+    // {resultpath} - path the batch handler writes results to.
+    PlaceholderResultPath,
+
+    PlaceholderCount,
+};
+
+/*++
+
+    Abstract:
+
+        Per event values for CCommandLineTemplate::Format().
+
+    Remarks:
+
+        A nullptr value is substituted as an empty string.
+--*/
+struct CommandLineValues
+{
+    CommandLineValues()
+        : rgpwsz()
+    {
+    }
+
+    LPCWSTR rgpwsz[PlaceholderCount];
+};
+
+/*++
+
+    Abstract:
+
+        A handler command line that is parsed and quoted once and filled in for each event.
+
+    Remarks:
+
+        Arguments without placeholders are quoted when the template is compiled. Arguments
+        with placeholders are quoted when they are filled in, since the values can have spaces
+        or quotes. Quoting follows the rules CommandLineToArgvW and the C runtime use, so each
+        argument reaches the handler unchanged.
+
+        With EscapeForPS, every placeholder value except {serial} is also wrapped in single
+        quotes for PowerShell, with embedded single quotes doubled.
+
+        Unknown names in braces are left as is, so script blocks in the Arguments still work.
+
+        Immutable after Compile(), so it can be shared by threads.
+--*/
+class CCommandLineTemplate
+{
+public:
+    CCommandLineTemplate();
+    ~CCommandLineTemplate();
+
+    /*++
+
+        Abstract:
+
+            Compiles the template.
+
+        Parameters:
+
+            pwszExePath - path to the handler. Must not contain quotes.
+            bufBaseArgs - arguments from the config. Can contain placeholders.
+            bufOperationArgs - arguments for the operation. Can contain placeholders.
+            fEscapeForPS - true to quote placeholder values for PowerShell.
+
+        Returns:
+
+            S_OK - success.
+            E_INVALIDARG - the exe path has a quote in it.
+            E_OUTOFMEMORY - out of memory.
+    --*/
+    HRESULT Compile(
+        LPCWSTR pwszExePath,
+        const CBuffer<LPCWSTR>& bufBaseArgs,
+        const CBuffer<LPCWSTR>& bufOperationArgs,
+        bool fEscapeForPS);
+
+    inline bool IsCompiled() const
+    {
+        return m_cParts > 0;
+    }
+
+    /*++
+
+        Abstract:
+
+            Checks whether any argument uses a placeholder.
+
+        Remarks:
+
+            Lets callers skip computing values that are not used.
+    --*/
+    inline bool UsesPlaceholder(
+        CommandLinePlaceholder ePlaceholder) const
+    {
+        return (m_dwPlaceholders & (1UL << ePlaceholder)) != 0;
+    }
+
+    /*++
+
+        Abstract:
+
+            Fills in the template.
+
+        Parameters:
+
+            stValues - the placeholder values.
+            bufResult - on success, receives the null terminated command line, sized to fit.
+
+        Returns:
+
+            S_OK - success.
+            HRESULT_FROM_WIN32(ERROR_FILENAME_EXCED_RANGE) - the command line is too long for CreateProcessW.
+            other - error code.
+    --*/
+    HRESULT Format(
+        const CommandLineValues& stValues,
+        OUT CHeapBuffer<WCHAR>& bufResult) const;
+
+private:
+    enum PartKind : DWORD
+    {
+        // Text to copy as is.
+        PartRendered,
+
+        // Start of an argument with placeholders. cch is the number of parts that follow for it.
+        PartArgument,
+
+        // Argument text before quoting.
+        PartLiteral,
+
+        // A placeholder value. dwPlaceholder is the CommandLinePlaceholder plus one.
+        PartPlaceholder,
+    };
+
+    struct Part
+    {
+        PartKind eKind;
+        DWORD dwPlaceholder;
+        bool fEscapeForPS;
+        LPCWSTR pwch;
+        size_t cch;
+    };
+
+    CHeapBuffer<WCHAR> m_bufText;
+    size_t m_cchText;
+    CHeapBuffer<Part> m_bufParts;
+    size_t m_cParts;
+
+    // Bit n is set if placeholder n is used.
+    DWORD m_dwPlaceholders;
+
+    void AppendRendered(
+        LPCWSTR pwch,
+        size_t cch);
+    void AppendLiteral(
+        LPCWSTR pwch,
+        size_t cch);
+    void CompileArgument(
+        LPCWSTR pwszArg,
+        bool fEscapeForPS);
+    size_t Fill(
+        const CommandLineValues& stValues,
+        LPWSTR pwchOut) const;
+    static size_t WriteArgument(
+        const Part* pParts,
+        size_t cParts,
+        const CommandLineValues& stValues,
+        LPWSTR pwchOut);
+
+    CCommandLineTemplate(const CCommandLineTemplate&) = delete;
+    CCommandLineTemplate& operator=(const CCommandLineTemplate&) = delete;
+};
@@ -0,0 +1,373 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        ConfigSource.cpp
+
+    Abstract:
+
+        CConfigSource derived class impls.
+
+--*/
+
+#include "pch.h"
+#include "ConfigSource.h"
+
+LPCWSTR g_pwszConfigFileSection = L"PMIExitModule";
+constexpr const DWORD g_cchInitialFileValue = 256;
+constexpr const DWORD g_cchMaxFileValue = 32768;
+constexpr const DWORD g_cMaxFileListItems = 256;
+
+CRegistryConfigSource::CRegistryConfigSource(
+    HKEY hRoot,
+    LPCWSTR pwszSubkey)
+    : m_hRoot(hRoot), m_pwszSubkey(pwszSubkey), m_hEvent(NULL)
+{
+}
+
+CRegistryConfigSource::~CRegistryConfigSource()
+{
+    Close();
+}
+
+HRESULT CRegistryConfigSource::Open()
+{
+    Close();
+
+    LSTATUS lr = m_key.Open(
+        m_hRoot,
+        m_pwszSubkey,
+        KEY_ENUMERATE_SUB_KEYS | KEY_EXECUTE | KEY_QUERY_VALUE | KEY_NOTIFY);
+    if (lr != ERROR_SUCCESS)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(lr);
+        ATLTRACE(L"Failed to open reg key %s, hr=%x\n", m_pwszSubkey, hr);
+        return hr;
+    }
+
+    return S_OK;
+}
+
+void CRegistryConfigSource::Close()
+{
+    // Closing the key ends any pending change notification.
+    m_key.Close();
+
+    if (m_hEvent)
+    {
+        ::CloseHandle(m_hEvent);
+        m_hEvent = NULL;
+    }
+}
+
+HRESULT CRegistryConfigSource::QueryString(
+    LPCWSTR pwszName,
+    OUT CHeapWString& strValue)
+{
+    ULONG cch = 0;
+    LSTATUS lr = m_key.QueryStringValue(pwszName, nullptr, &cch);
+    if (lr != ERROR_SUCCESS)
+    {
+        return HRESULT_FROM_WIN32(lr);
+    }
+
+    // Room for a null terminator the value might not have.
+    if (!strValue.Alloc((size_t)cch + 1))
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    cch = (ULONG)strValue.GetLength();
+    lr = m_key.QueryStringValue(pwszName, strValue.Get(), &cch);
+    if (lr != ERROR_SUCCESS)
+    {
+        strValue.Clear();
+        return HRESULT_FROM_WIN32(lr);
+    }
+
+    return S_OK;
+}
+
+HRESULT CRegistryConfigSource::QueryDWORD(
+    LPCWSTR pwszName,
+    OUT DWORD& dwValue)
+{
+    return HRESULT_FROM_WIN32(m_key.QueryDWORDValue(pwszName, OUT dwValue));
+}
+
+HRESULT CRegistryConfigSource::QueryMultiString(
+    LPCWSTR pwszName,
+    OUT CHeapBuffer<WCHAR>& bufValue)
+{
+    ULONG cch = 0;
+    LSTATUS lr = m_key.QueryMultiStringValue(pwszName, nullptr, &cch);
+    if (lr != ERROR_SUCCESS)
+    {
+        return HRESULT_FROM_WIN32(lr);
+    }
+
+    // Room for the two null terminators the value might not have.
+    if (!bufValue.Alloc((size_t)cch + 2))
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    ZeroMemory(bufValue.Get(), bufValue.GetSize());
+    cch = (ULONG)bufValue.GetLength();
+    lr = m_key.QueryMultiStringValue(pwszName, bufValue.Get(), &cch);
+    if (lr != ERROR_SUCCESS)
+    {
+        bufValue.Clear();
+        return HRESULT_FROM_WIN32(lr);
+    }
+
+    return S_OK;
+}
+
+HRESULT CRegistryConfigSource::ArmChangeNotification(
+    OUT HANDLE& hChange)
+{
+    hChange = NULL;
+
+    if (!m_key.m_hKey)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+    }
+
+    if (!m_hEvent)
+    {
+        m_hEvent = ::CreateEventW(
+            nullptr, // lpEventAttributes
+            FALSE, // bManualReset
+            FALSE, // bInitialState
+            nullptr); // lpName
+        if (!m_hEvent)
+        {
+            return HRESULT_FROM_WIN32(::GetLastError());
+        }
+    }
+
+    // The registration ends if the calling thread exits, so the watcher thread calls this.
+    LSTATUS lr = m_key.NotifyChangeKeyValue(
+        FALSE, // bWatchSubtree
+        REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET,
+        m_hEvent,
+        TRUE); // bAsync
+    if (lr != ERROR_SUCCESS)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(lr);
+        ATLTRACE(L"RegNotifyChangeKeyValue failed, hr=%x\n", hr);
+        return hr;
+    }
+
+    hChange = m_hEvent;
+    return S_OK;
+}
+
+CFileConfigSource::CFileConfigSource(
+    LPCWSTR pwszPath)
+    : m_hChange(INVALID_HANDLE_VALUE)
+{
+    // A failed copy leaves the path empty and Open() fails.
+    m_strPath.CopyFrom(pwszPath);
+}
+
+CFileConfigSource::~CFileConfigSource()
+{
+    Close();
+}
+
+HRESULT CFileConfigSource::Open()
+{
+    Close();
+
+    if (!m_strPath.Get())
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    if (::GetFileAttributesW(m_strPath.Get()) == INVALID_FILE_ATTRIBUTES)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(::GetLastError());
+        ATLTRACE(L"Config file [%s] not found, hr=%x\n", m_strPath.Get(), hr);
+        return hr;
+    }
+
+    HRESULT hr = m_strDirectory.CopyFrom(m_strPath.Get());
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    LPWSTR pwszSlash = wcsrchr(m_strDirectory.Get(), L'\\');
+    if (pwszSlash)
+    {
+        *pwszSlash = L'\0';
+    }
+    else
+    {
+        hr = m_strDirectory.CopyFrom(L".");
+    }
+
+    return hr;
+}
+
+void CFileConfigSource::Close()
+{
+    if (m_hChange != INVALID_HANDLE_VALUE)
+    {
+        ::FindCloseChangeNotification(m_hChange);
+        m_hChange = INVALID_HANDLE_VALUE;
+    }
+}
+
+HRESULT CFileConfigSource::QueryString(
+    LPCWSTR pwszName,
+    OUT CHeapWString& strValue)
+{
+    for (DWORD cch = g_cchInitialFileValue; cch <= g_cchMaxFileValue; cch *= 2)
+    {
+        if (!strValue.Alloc(cch))
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        DWORD cchCopied = ::GetPrivateProfileStringW(
+            g_pwszConfigFileSection,
+            pwszName,
+            L"", // lpDefault
+            strValue.Get(),
+            cch,
+            m_strPath.Get());
+        if (cchCopied == 0)
+        {
+            strValue.Clear();
+            return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+        }
+
+        if (cchCopied < cch - 1)
+        {
+            return S_OK;
+        }
+    }
+
+    strValue.Clear();
+    return HRESULT_FROM_WIN32(ERROR_MORE_DATA);
+}
+
+HRESULT CFileConfigSource::QueryDWORD(
+    LPCWSTR pwszName,
+    OUT DWORD& dwValue)
+{
+    CHeapWString strValue;
+    HRESULT hr = QueryString(pwszName, OUT strValue);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    LPWSTR pwszEnd = nullptr;
+    DWORD dwResult = wcstoul(strValue.Get(), &pwszEnd, 0);
+    if (pwszEnd == strValue.Get())
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    dwValue = dwResult;
+    return S_OK;
+}
+
+HRESULT CFileConfigSource::QueryMultiString(
+    LPCWSTR pwszName,
+    OUT CHeapBuffer<WCHAR>& bufValue)
+{
+    HRESULT hr = S_OK;
+    CStaticBuffer<WCHAR, 128> strItemName;
+    CHeapBuffer<CHeapWString> bufItems;
+    size_t cItems = 0;
+    size_t cchTotal = 1;
+
+    if (!bufItems.Alloc(g_cMaxFileListItems))
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    for (; cItems < g_cMaxFileListItems; cItems++)
+    {
+        hr = ::StringCchPrintfW(strItemName.Get(), strItemName.GetLength(), L"%s%u", pwszName, (DWORD)cItems + 1);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        hr = QueryString(strItemName.Get(), OUT bufItems.Get()[cItems]);
+        if (hr == HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND))
+        {
+            break;
+        }
+        else if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        cchTotal += wcslen(bufItems.Get()[cItems].Get()) + 1;
+    }
+
+    if (cItems == 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+    }
+
+    if (!bufValue.Alloc(cchTotal))
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    LPWSTR pwszCurrent = bufValue.Get();
+    for (size_t i = 0; i < cItems; i++)
+    {
+        size_t cch = wcslen(bufItems.Get()[i].Get()) + 1;
+        CopyMemory(pwszCurrent, bufItems.Get()[i].Get(), cch * sizeof(WCHAR));
+        pwszCurrent += cch;
+    }
+
+    *pwszCurrent = L'\0';
+    return S_OK;
+}
+
+HRESULT CFileConfigSource::ArmChangeNotification(
+    OUT HANDLE& hChange)
+{
+    hChange = NULL;
+
+    if (!m_strDirectory.Get())
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+    }
+
+    if (m_hChange == INVALID_HANDLE_VALUE)
+    {
+        m_hChange = ::FindFirstChangeNotificationW(
+            m_strDirectory.Get(),
+            FALSE, // bWatchSubtree
+            FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+        if (m_hChange == INVALID_HANDLE_VALUE)
+        {
+            HRESULT hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"FindFirstChangeNotificationW(%s) failed, hr=%x\n", m_strDirectory.Get(), hr);
+            return hr;
+        }
+    }
+    else if (!::FindNextChangeNotification(m_hChange))
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(::GetLastError());
+        ATLTRACE(L"FindNextChangeNotification failed, hr=%x\n", hr);
+        Close();
+        return hr;
+    }
+
+    hChange = m_hChange;
+    return S_OK;
+}
@@ -0,0 +1,218 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        ConfigSource.h
+
+    Abstract:
+
+        CConfigSource and derived class declarations.
+
+--*/
+
+/*++
+
+    Abstract:
+
+        Source of named config values that can signal when they change.
+
+    Remarks:
+
+        Query methods return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND) for values that are not set.
+        All methods are called from one thread at a time.
+--*/
+class CConfigSource
+{
+public:
+    virtual ~CConfigSource() = default;
+
+    /*++
+
+        Abstract:
+
+            Opens the source.
+
+        Returns:
+
+            S_OK - success.
+            other - error code. The source can be opened again later.
+    --*/
+    virtual HRESULT Open() = 0;
+
+    /*++
+
+        Abstract:
+
+            Closes the source and stops watching for changes.
+
+    --*/
+    virtual void Close() = 0;
+
+    /*++
+
+        Abstract:
+
+            Reads a string value.
+
+        Parameters:
+
+            pwszName - the value name.
+            strValue - on success, receives the null terminated value.
+
+        Returns:
+
+            S_OK - success.
+            other - error code.
+    --*/
+    virtual HRESULT QueryString(
+        LPCWSTR pwszName,
+        OUT CHeapWString& strValue) = 0;
+
+    /*++
+
+        Abstract:
+
+            Reads a DWORD value.
+
+        Parameters:
+
+            pwszName - the value name.
+            dwValue - on success, receives the value.
+
+        Returns:
+
+            S_OK - success.
+            other - error code.
+    --*/
+    virtual HRESULT QueryDWORD(
+        LPCWSTR pwszName,
+        OUT DWORD& dwValue) = 0;
+
+    /*++
+
+        Abstract:
+
+            Reads a list of strings.
+
+        Parameters:
+
+            pwszName - the value name.
+            bufValue - on success, receives null terminated strings followed by an empty string.
+
+        Returns:
+
+            S_OK - success.
+            other - error code.
+    --*/
+    virtual HRESULT QueryMultiString(
+        LPCWSTR pwszName,
+        OUT CHeapBuffer<WCHAR>& bufValue) = 0;
+
+    /*++
+
+        Abstract:
+
+            Asks to be signaled the next time the config changes.
+
+        Parameters:
+
+            hChange - on success, receives a handle that gets signaled on the next change.
+                      The source owns the handle.
+
+        Returns:
+
+            S_OK - success.
+            other - error code. The caller should poll instead.
+
+        Remarks:
+
+            Call again after each signal to watch for the next change.
+    --*/
+    virtual HRESULT ArmChangeNotification(
+        OUT HANDLE& hChange) = 0;
+
+protected:
+    CConfigSource() = default;
+
+private:
+    CConfigSource(const CConfigSource&) = delete;
+    CConfigSource& operator=(const CConfigSource&) = delete;
+};
+
+/*++
+
+    Abstract:
+
+        Config values in a registry key.
+
+--*/
+class CRegistryConfigSource : public CConfigSource
+{
+public:
+    CRegistryConfigSource(
+        HKEY hRoot,
+        LPCWSTR pwszSubkey);
+    virtual ~CRegistryConfigSource();
+
+    virtual HRESULT Open();
+    virtual void Close();
+    virtual HRESULT QueryString(
+        LPCWSTR pwszName,
+        OUT CHeapWString& strValue);
+    virtual HRESULT QueryDWORD(
+        LPCWSTR pwszName,
+        OUT DWORD& dwValue);
+    virtual HRESULT QueryMultiString(
+        LPCWSTR pwszName,
+        OUT CHeapBuffer<WCHAR>& bufValue);
+    virtual HRESULT ArmChangeNotification(
+        OUT HANDLE& hChange);
+
+private:
+    HKEY m_hRoot;
+    LPCWSTR m_pwszSubkey;
+    ATL::CRegKey m_key;
+    HANDLE m_hEvent;
+};
+
+/*++
+
+    Abstract:
+
+        Config values in an INI file.
+
+    Remarks:
+
+        Values are in the [PMIExitModule] section. A list is written as Name1, Name2 and so on
+        up to the first missing number. DWORD values can be decimal or hex with a 0x prefix.
+        Use this to test config reload without changing HKLM.
+--*/
+class CFileConfigSource : public CConfigSource
+{
+public:
+    CFileConfigSource(
+        LPCWSTR pwszPath);
+    virtual ~CFileConfigSource();
+
+    virtual HRESULT Open();
+    virtual void Close();
+    virtual HRESULT QueryString(
+        LPCWSTR pwszName,
+        OUT CHeapWString& strValue);
+    virtual HRESULT QueryDWORD(
+        LPCWSTR pwszName,
+        OUT DWORD& dwValue);
+    virtual HRESULT QueryMultiString(
+        LPCWSTR pwszName,
+        OUT CHeapBuffer<WCHAR>& bufValue);
+    virtual HRESULT ArmChangeNotification(
+        OUT HANDLE& hChange);
+
+private:
+    CHeapWString m_strPath;
+    CHeapWString m_strDirectory;
+    HANDLE m_hChange;
+};
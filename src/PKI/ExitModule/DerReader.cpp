@@ -0,0 +1,130 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        DerReader.cpp
+
+    Abstract:
+
+        CDerReader class impl.
+
+--*/
+
+#include "pch.h"
+#include "DerReader.h"
+
+// Tag number 31 means the tag continues in more octets.
+constexpr const BYTE g_bDerTagNumberMask = 0x1F;
+
+// Long form lengths longer than this do not fit any certificate.
+constexpr const size_t g_cbMaxLengthOctets = 4;
+
+CDerReader::CDerReader(
+    const CBuffer<BYTE>& bufDer)
+    : m_pbCurrent(bufDer.Get()),
+    m_cbRemaining(bufDer.GetSize()),
+    m_fMalformed(false)
+{
+}
+
+CDerReader::CDerReader(
+    const DerElement& stElement)
+    : m_pbCurrent(stElement.pbContent),
+    m_cbRemaining(stElement.cbContent),
+    m_fMalformed(false)
+{
+}
+
+CDerReader::~CDerReader()
+{
+}
+
+bool CDerReader::Next(
+    OUT DerElement& stElement)
+{
+    size_t cbElement = 0;
+    if (!Peek(OUT stElement, OUT cbElement))
+    {
+        return false;
+    }
+
+    m_pbCurrent += cbElement;
+    m_cbRemaining -= cbElement;
+    return true;
+}
+
+bool CDerReader::NextIf(
+    BYTE bTag,
+    OUT DerElement& stElement)
+{
+    size_t cbElement = 0;
+    if (!Peek(OUT stElement, OUT cbElement) || stElement.bTag != bTag)
+    {
+        return false;
+    }
+
+    m_pbCurrent += cbElement;
+    m_cbRemaining -= cbElement;
+    return true;
+}
+
+bool CDerReader::IsOid(
+    const DerElement& stElement,
+    const CBuffer<const BYTE>& bufOid)
+{
+    return stElement.bTag == DerTagOid &&
+        stElement.cbContent == bufOid.GetSize() &&
+        memcmp(stElement.pbContent, bufOid.Get(), bufOid.GetSize()) == 0;
+}
+
+bool CDerReader::Peek(
+    OUT DerElement& stElement,
+    OUT size_t& cbElement)
+{
+    if (m_fMalformed || m_cbRemaining == 0)
+    {
+        return false;
+    }
+
+    // Tag and at least one length octet.
+    if (m_cbRemaining < 2 || (m_pbCurrent[0] & g_bDerTagNumberMask) == g_bDerTagNumberMask)
+    {
+        m_fMalformed = true;
+        return false;
+    }
+
+    size_t cbHeader = 2;
+    size_t cbContent = m_pbCurrent[1];
+    if (cbContent & 0x80)
+    {
+        // Long form. The low bits are the number of length octets. 0 is indefinite.
+        size_t cbLength = cbContent & 0x7F;
+        if (cbLength == 0 || cbLength > g_cbMaxLengthOctets || m_cbRemaining < cbHeader + cbLength)
+        {
+            m_fMalformed = true;
+            return false;
+        }
+
+        cbContent = 0;
+        for (size_t i = 0; i < cbLength; i++)
+        {
+            cbContent = (cbContent << 8) | m_pbCurrent[cbHeader + i];
+        }
+
+        cbHeader += cbLength;
+    }
+
+    if (cbContent > m_cbRemaining - cbHeader)
+    {
+        m_fMalformed = true;
+        return false;
+    }
+
+    stElement.bTag = m_pbCurrent[0];
+    stElement.pbContent = m_pbCurrent + cbHeader;
+    stElement.cbContent = cbContent;
+    cbElement = cbHeader + cbContent;
+    return true;
+}
@@ -0,0 +1,172 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        DerReader.h
+
+    Abstract:
+
+        CDerReader class declaration.
+
+--*/
+
+/*++
+
+    Abstract:
+
+        Identifier octets of the DER elements used by X.509.
+
+--*/
+enum DerTag : BYTE
+{
+    DerTagBoolean = 0x01,
+    DerTagInteger = 0x02,
+    DerTagOctetString = 0x04,
+    DerTagOid = 0x06,
+    DerTagUtf8String = 0x0C,
+    DerTagPrintableString = 0x13,
+    DerTagT61String = 0x14,
+    DerTagIA5String = 0x16,
+    DerTagUtcTime = 0x17,
+    DerTagGeneralizedTime = 0x18,
+    DerTagBmpString = 0x1E,
+    DerTagSequence = 0x30,
+    DerTagSet = 0x31,
+
+    // Context specific tags add the tag number to these.
+    DerTagContextPrimitive = 0x80,
+    DerTagContextConstructed = 0xA0,
+};
+
+/*++
+
+    Abstract:
+
+        One DER element. The content points into the buffer being read.
+
+--*/
+struct DerElement
+{
+    // The identifier octet. Only single octet tags are supported.
+    BYTE bTag;
+
+    // The content octets.
+    const BYTE* pbContent;
+
+    // Number of content octets.
+    size_t cbContent;
+};
+
+/*++
+
+    Abstract:
+
+        Walks the elements of a DER encoded buffer without allocating.
+
+    Remarks:
+
+        The reader moves forward through the elements at one level. To read the elements
+        inside a constructed element, like a SEQUENCE, create another reader over it.
+
+        Indefinite lengths and multi octet tags are not DER for anything in a certificate,
+        so they are treated as malformed. Once malformed, Next() keeps failing.
+--*/
+class CDerReader
+{
+public:
+    /*++
+
+        Abstract:
+
+            Reads the elements of a buffer.
+
+    --*/
+    CDerReader(
+        const CBuffer<BYTE>& bufDer);
+
+    /*++
+
+        Abstract:
+
+            Reads the elements inside a constructed element.
+
+    --*/
+    CDerReader(
+        const DerElement& stElement);
+
+    ~CDerReader();
+
+    /*++
+
+        Abstract:
+
+            Reads the next element.
+
+        Parameters:
+
+            stElement - receives the element.
+
+        Returns:
+
+            true - success.
+            false - no more elements, or the encoding is malformed.
+    --*/
+    bool Next(
+        OUT DerElement& stElement);
+
+    /*++
+
+        Abstract:
+
+            Reads the next element if it has a tag.
+
+        Parameters:
+
+            bTag - the expected tag.
+            stElement - receives the element.
+
+        Returns:
+
+            true - the next element has the tag and was read.
+            false - otherwise. The reader does not move unless the encoding is malformed.
+    --*/
+    bool NextIf(
+        BYTE bTag,
+        OUT DerElement& stElement);
+
+    inline bool IsEmpty() const
+    {
+        return m_cbRemaining == 0;
+    }
+
+    inline bool IsMalformed() const
+    {
+        return m_fMalformed;
+    }
+
+    /*++
+
+        Abstract:
+
+            Checks whether an OID element has the given content octets.
+
+    --*/
+    static bool IsOid(
+        const DerElement& stElement,
+        const CBuffer<const BYTE>& bufOid);
+
+private:
+    const BYTE* m_pbCurrent;
+    size_t m_cbRemaining;
+    bool m_fMalformed;
+
+    bool Peek(
+        OUT DerElement& stElement,
+        OUT size_t& cbElement);
+
+    CDerReader(const CDerReader&) = delete;
+    CDerReader& operator=(const CDerReader&) = delete;
+};
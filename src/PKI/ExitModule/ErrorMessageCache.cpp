@@ -0,0 +1,141 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        ErrorMessageCache.cpp
+
+    Abstract:
+
+        CErrorMessageCache class impl.
+
+--*/
+
+#include "pch.h"
+#include "ErrorMessageCache.h"
+
+constexpr const size_t g_cchMessage = 4096;
+
+CErrorMessageCache::CErrorMessageCache()
+    : m_cEntries(0),
+    m_cHits(0),
+    m_cMisses(0)
+{
+    ::InitializeSRWLock(&m_lock);
+}
+
+CErrorMessageCache::~CErrorMessageCache()
+{
+}
+
+HRESULT CErrorMessageCache::Format(
+    HRESULT hrError,
+    LANGID langId,
+    CHeapBuffer<WCHAR>& bufMessage,
+    OUT LPCWSTR& rpwszMessage)
+{
+    HRESULT hr = S_OK;
+    rpwszMessage = nullptr;
+
+    ::AcquireSRWLockShared(&m_lock);
+    const Entry* pEntry = Find(hrError, langId);
+    if (pEntry)
+    {
+        // Entries do not change once they are added.
+        rpwszMessage = pEntry->strMessage.Get();
+        hr = pEntry->hrFormat;
+    }
+
+    ::ReleaseSRWLockShared(&m_lock);
+    if (pEntry)
+    {
+        ::InterlockedIncrement(&m_cHits);
+        return hr;
+    }
+
+    ::InterlockedIncrement(&m_cMisses);
+    if (!bufMessage.Alloc(g_cchMessage))
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    DWORD cch = ::FormatMessageW(
+        FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+        NULL, // lpSource
+        hrError,
+        langId,
+        bufMessage.Get(),
+        (DWORD)bufMessage.GetLength(),
+        nullptr);
+    if (cch == 0)
+    {
+        hr = HRESULT_FROM_WIN32(::GetLastError());
+        ATLTRACE(L"FormatMessage failed for error=%x, hr=%x\n", hrError, hr);
+        bufMessage.Clear();
+
+        // Anything else, like low memory, can succeed next time.
+        if (hr != HRESULT_FROM_WIN32(ERROR_MR_MID_NOT_FOUND))
+        {
+            return hr;
+        }
+    }
+
+    ::AcquireSRWLockExclusive(&m_lock);
+    do
+    {
+        // Another thread may have added it while this one was formatting.
+        pEntry = Find(hrError, langId);
+        if (pEntry)
+        {
+            break;
+        }
+
+        if ((size_t)m_cEntries >= s_cMaxEntries)
+        {
+            break;
+        }
+
+        Entry& stEntry = m_bufEntries.Get()[m_cEntries];
+        if (FAILED(stEntry.strMessage.CopyFrom(bufMessage.Get())))
+        {
+            // Not cached. The caller still has the text in bufMessage.
+            break;
+        }
+
+        stEntry.hrError = hrError;
+        stEntry.langId = langId;
+        stEntry.hrFormat = hr;
+        m_cEntries++;
+        pEntry = &stEntry;
+    } while (false);
+
+    if (pEntry)
+    {
+        rpwszMessage = pEntry->strMessage.Get();
+        hr = pEntry->hrFormat;
+    }
+    else
+    {
+        rpwszMessage = bufMessage.Get();
+    }
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+    return hr;
+}
+
+const CErrorMessageCache::Entry* CErrorMessageCache::Find(
+    HRESULT hrError,
+    LANGID langId) const
+{
+    for (LONG i = 0; i < m_cEntries; i++)
+    {
+        const Entry& stEntry = m_bufEntries.Get()[i];
+        if (stEntry.hrError == hrError && stEntry.langId == langId)
+        {
+            return &stEntry;
+        }
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,112 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        ErrorMessageCache.h
+
+    Abstract:
+
+        CErrorMessageCache class declaration.
+
+--*/
+
+#include "Buffer.h"
+
+/*++
+
+    Abstract:
+
+        Keeps the system message text of the errors that were reported.
+
+    Remarks:
+
+        Only a few distinct HRESULTs are ever reported, so the first report of each one
+        calls FormatMessageW and the rest share the text. A hit takes a shared lock and
+        does not allocate.
+
+        Entries are never removed, so the text stays valid while the cache exists. Once
+        s_cMaxEntries are cached, other errors are formatted into the caller's buffer for
+        each report, as before. An error with no message text is cached as a failure.
+--*/
+class CErrorMessageCache
+{
+public:
+    // Distinct HRESULT and language pairs kept.
+    static const size_t s_cMaxEntries = 64;
+
+    CErrorMessageCache();
+    ~CErrorMessageCache();
+
+    /*++
+
+        Abstract:
+
+            Gets the message text for an error.
+
+        Parameters:
+
+            hrError - the error.
+            langId - the language of the text.
+            bufMessage - formatted into when the error cannot be cached.
+            rpwszMessage - receives the text, or nullptr on failure. Valid while the cache
+                and bufMessage exist.
+
+        Returns:
+
+            S_OK - success.
+            other - FormatMessageW failed. Errors with no message text fail the same way
+                every time.
+    --*/
+    HRESULT Format(
+        HRESULT hrError,
+        LANGID langId,
+        CHeapBuffer<WCHAR>& bufMessage,
+        OUT LPCWSTR& rpwszMessage);
+
+    inline LONG GetHits() const
+    {
+        return m_cHits;
+    }
+
+    inline LONG GetMisses() const
+    {
+        return m_cMisses;
+    }
+
+    inline LONG GetCount() const
+    {
+        return m_cEntries;
+    }
+
+private:
+    struct Entry
+    {
+        HRESULT hrError;
+        LANGID langId;
+        HRESULT hrFormat;
+        CHeapWString strMessage;
+    };
+
+    SRWLOCK m_lock;
+    CStaticBuffer<Entry, s_cMaxEntries> m_bufEntries;
+    volatile LONG m_cEntries;
+    volatile LONG m_cHits;
+    volatile LONG m_cMisses;
+
+    /*++
+
+        Abstract:
+
+            Finds the entry for an error. Call with the lock held.
+
+    --*/
+    const Entry* Find(
+        HRESULT hrError,
+        LANGID langId) const;
+
+    CErrorMessageCache(const CErrorMessageCache&) = delete;
+    CErrorMessageCache& operator=(const CErrorMessageCache&) = delete;
+};
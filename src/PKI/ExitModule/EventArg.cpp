@@ -21,10 +21,28 @@
 
 #include "pch.h"
 #include "EventArg.h"
+#include "ErrorMessageCache.h"
 
 const LPCWSTR CNumericEventArg<DWORD>::s_pwszFormatString = L"%u";
 const LPCWSTR CNumericEventArg<HRESULT>::s_pwszFormatString = L"%x";
-constexpr const size_t g_cchMessage = 4096;
+
+// Shared by every module instance in the process.
+CErrorMessageCache g_objErrorMessageCache;
+
+// "00" to "99", so FormatDecimal writes two digits per divide.
+constexpr const WCHAR g_rgwchDigitPairs[] =
+    L"00010203040506070809"
+    L"10111213141516171819"
+    L"20212223242526272829"
+    L"30313233343536373839"
+    L"40414243444546474849"
+    L"50515253545556575859"
+    L"60616263646566676869"
+    L"70717273747576777879"
+    L"80818283848586878889"
+    L"90919293949596979899";
+
+constexpr const WCHAR g_rgwchHexDigits[] = L"0123456789abcdef";
 
 HRESULT CStringEventArg::Format(OUT LPCWSTR& rpwszResult)
 {
@@ -34,27 +52,71 @@ HRESULT CStringEventArg::Format(OUT LPCWSTR& rpwszResult)
 
 HRESULT CErrorMessageEventArg::Format(OUT LPCWSTR& rpwszResult)
 {
-    if (!m_bufMessage.Alloc(g_cchMessage))
+    return g_objErrorMessageCache.Format(m_hr, m_langId, m_bufMessage, OUT rpwszResult);
+}
+
+const CErrorMessageCache& CErrorMessageEventArg::GetCache()
+{
+    return g_objErrorMessageCache;
+}
+
+size_t CEventArgFormatterBase::FormatDecimal(
+    DWORD dwValue,
+    LPWSTR pwchOut)
+{
+    // Filled from the end, since the number of digits is not known up front.
+    WCHAR rgwchDigits[10];
+    size_t iDigit = sizeof(rgwchDigits) / sizeof(rgwchDigits[0]);
+    while (dwValue >= 100)
+    {
+        DWORD iPair = (dwValue % 100) * 2;
+        dwValue /= 100;
+        rgwchDigits[--iDigit] = g_rgwchDigitPairs[iPair + 1];
+        rgwchDigits[--iDigit] = g_rgwchDigitPairs[iPair];
+    }
+
+    if (dwValue >= 10)
+    {
+        DWORD iPair = dwValue * 2;
+        rgwchDigits[--iDigit] = g_rgwchDigitPairs[iPair + 1];
+        rgwchDigits[--iDigit] = g_rgwchDigitPairs[iPair];
+    }
+    else
+    {
+        rgwchDigits[--iDigit] = (WCHAR)(L'0' + dwValue);
+    }
+
+    size_t cch = sizeof(rgwchDigits) / sizeof(rgwchDigits[0]) - iDigit;
+    memcpy(pwchOut, rgwchDigits + iDigit, cch * sizeof(WCHAR));
+    pwchOut[cch] = L'\0';
+    return cch;
+}
+
+size_t CEventArgFormatterBase::FormatHex(
+    DWORD dwValue,
+    LPWSTR pwchOut)
+{
+    // Skip the leading zero nibbles, but keep the last one for 0.
+    int iShift = 28;
+    while (iShift > 0 && (dwValue >> iShift) == 0)
     {
-        return E_OUTOFMEMORY;
+        iShift -= 4;
     }
 
-    HRESULT hr = S_OK;
-    DWORD cch = ::FormatMessageW(
-        FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-        NULL, // lpSource
-        m_hr,
-        LANG_SYSTEM_DEFAULT,
-        m_bufMessage.Get(),
-        (DWORD)m_bufMessage.GetLength(),
-        nullptr);
-    if (cch == 0)
+    size_t cch = 0;
+    for (; iShift >= 0; iShift -= 4)
     {
-        hr = HRESULT_FROM_WIN32(::GetLastError());
-        ATLTRACE(L"FormatMessage failed for error=%x, hr=%x\n", m_hr, hr);
-        m_bufMessage.Clear();
+        pwchOut[cch++] = g_rgwchHexDigits[(dwValue >> iShift) & 0xF];
     }
 
-    rpwszResult = m_bufMessage.Get();
-    return hr;
-}
\ No newline at end of file
+    pwchOut[cch] = L'\0';
+    return cch;
+}
+
+HRESULT CEventArgFormatterBase::FormatErrorMessage(
+    const ErrorMessageText& stError,
+    CHeapBuffer<WCHAR>& bufMessage,
+    OUT LPCWSTR& rpwszResult)
+{
+    return g_objErrorMessageCache.Format(stError.hr, stError.langId, bufMessage, OUT rpwszResult);
+}
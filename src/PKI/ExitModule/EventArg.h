@@ -20,6 +20,8 @@
 
 --*/
 
+class CErrorMessageCache;
+
 /*++
 
     Abstract:
@@ -107,17 +109,256 @@ private:
     CStaticBuffer<WCHAR, 32> m_bufResult;
 };
 
+/*++
+
+    Abstract:
+
+        The system message text for an HRESULT.
+
+    Remarks:
+
+        The text comes from a CErrorMessageCache shared by the process, so an error that
+        was reported before does not call FormatMessageW or allocate again.
+--*/
 class CErrorMessageEventArg : public CEventArg
 {
 public:
-    CErrorMessageEventArg(HRESULT hr)
-        : CEventArg(), m_hr(hr)
+    CErrorMessageEventArg(HRESULT hr, LANGID langId = LANG_SYSTEM_DEFAULT)
+        : CEventArg(), m_hr(hr), m_langId(langId)
     {
     }
 
     virtual HRESULT Format(OUT LPCWSTR& rpwszResult);
 
+    /*++
+
+        Abstract:
+
+            Gets the cache of formatted messages, for its stats.
+
+    --*/
+    static const CErrorMessageCache& GetCache();
+
 private:
     HRESULT m_hr;
+    LANGID m_langId;
+
+    // Only used for an error the cache cannot hold.
     CHeapBuffer<WCHAR> m_bufMessage;
-};
\ No newline at end of file
+};
+
+/*++
+
+    Abstract:
+
+        Marks an HRESULT whose system message text is the event argument.
+
+--*/
+struct ErrorMessageText
+{
+    explicit ErrorMessageText(HRESULT hrIn, LANGID langIdIn = LANG_SYSTEM_DEFAULT)
+        : hr(hrIn), langId(langIdIn)
+    {
+    }
+
+    HRESULT hr;
+    LANGID langId;
+};
+
+/*++
+
+    Abstract:
+
+        The parts of CEventArgFormatter that do not depend on the number of arguments.
+
+--*/
+class CEventArgFormatterBase
+{
+public:
+    // Longest formatted number with its null. 4294967295 is 10 digits.
+    static const size_t s_cchMaxNumber = 12;
+
+    /*++
+
+        Abstract:
+
+            Writes a value in decimal, like %u, and a null.
+
+        Returns:
+
+            The number of digits.
+
+        Remarks:
+
+            Writes two digits per divide from a table, like std::to_chars.
+    --*/
+    static size_t FormatDecimal(
+        DWORD dwValue,
+        LPWSTR pwchOut);
+
+    /*++
+
+        Abstract:
+
+            Writes a value in lower case hex without leading zeros, like %x, and a null.
+
+        Returns:
+
+            The number of digits.
+
+    --*/
+    static size_t FormatHex(
+        DWORD dwValue,
+        LPWSTR pwchOut);
+
+    /*++
+
+        Abstract:
+
+            Gets the message text for an error from the process wide cache.
+
+        Parameters:
+
+            stError - the error and language.
+            bufMessage - only used if the cache cannot hold the error.
+            rpwszResult - receives the text.
+
+        Returns:
+
+            S_OK - success.
+            other - FormatMessageW failed.
+    --*/
+    static HRESULT FormatErrorMessage(
+        const ErrorMessageText& stError,
+        CHeapBuffer<WCHAR>& bufMessage,
+        OUT LPCWSTR& rpwszResult);
+
+protected:
+    CEventArgFormatterBase() = default;
+    ~CEventArgFormatterBase() = default;
+
+private:
+    CEventArgFormatterBase(const CEventArgFormatterBase&) = delete;
+    CEventArgFormatterBase& operator=(const CEventArgFormatterBase&) = delete;
+};
+
+/*++
+
+    Abstract:
+
+        Formats N event arguments into strings that live on the stack.
+
+    Remarks:
+
+        Replaces building a CEventArg for each argument. The argument types are known at
+        compile time, so there are no virtual calls and no array of strings on the heap.
+        Each argument is formatted by the Put() overload for its type, the same way the
+        matching CEventArg did:
+
+            DWORD - decimal, like CNumericEventArg<DWORD>.
+            LONG, HRESULT - hex, like CNumericEventArg<HRESULT>.
+            LPCWSTR - used as is, like CStringEventArg. Must outlive the formatter.
+            ErrorMessageText - the message text, like CErrorMessageEventArg.
+
+        Nothing is allocated unless an error message does not fit in the cache.
+--*/
+template<size_t N>
+class CEventArgFormatter : public CEventArgFormatterBase
+{
+public:
+    CEventArgFormatter()
+        : m_rgpwszStrings(), m_bufStrings(m_rgpwszStrings, N)
+    {
+    }
+
+    /*++
+
+        Abstract:
+
+            Formats the arguments in order.
+
+        Returns:
+
+            S_OK - success.
+            other - an argument failed to format.
+    --*/
+    template<typename... TArgs>
+    HRESULT Format(
+        const TArgs&... args)
+    {
+        static_assert(sizeof...(TArgs) == N, "Pass one argument for each string.");
+        return FormatFrom(0, args...);
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets the formatted strings. Valid while the formatter exists.
+
+    --*/
+    inline const CBuffer<LPCWSTR>& GetStrings() const
+    {
+        return m_bufStrings;
+    }
+
+private:
+    LPCWSTR m_rgpwszStrings[N];
+    CRefBuffer<LPCWSTR> m_bufStrings;
+    WCHAR m_rgwchNumbers[N][s_cchMaxNumber];
+    CHeapBuffer<WCHAR> m_rgbufMessages[N];
+
+    inline HRESULT FormatFrom(
+        size_t /* iArg */)
+    {
+        return S_OK;
+    }
+
+    template<typename TFirst, typename... TRest>
+    HRESULT FormatFrom(
+        size_t iArg,
+        const TFirst& first,
+        const TRest&... rest)
+    {
+        HRESULT hr = Put(iArg, first);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        return FormatFrom(iArg + 1, rest...);
+    }
+
+    inline HRESULT Put(
+        size_t iArg,
+        DWORD dwValue)
+    {
+        FormatDecimal(dwValue, m_rgwchNumbers[iArg]);
+        m_rgpwszStrings[iArg] = m_rgwchNumbers[iArg];
+        return S_OK;
+    }
+
+    inline HRESULT Put(
+        size_t iArg,
+        LONG lValue)
+    {
+        FormatHex((DWORD)lValue, m_rgwchNumbers[iArg]);
+        m_rgpwszStrings[iArg] = m_rgwchNumbers[iArg];
+        return S_OK;
+    }
+
+    inline HRESULT Put(
+        size_t iArg,
+        LPCWSTR pwszValue)
+    {
+        m_rgpwszStrings[iArg] = pwszValue;
+        return S_OK;
+    }
+
+    inline HRESULT Put(
+        size_t iArg,
+        const ErrorMessageText& stError)
+    {
+        return FormatErrorMessage(stError, m_rgbufMessages[iArg], OUT m_rgpwszStrings[iArg]);
+    }
+};
@@ -0,0 +1,284 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventCoalescer.cpp
+
+    Abstract:
+
+        CEventCoalescer class impl.
+
+--*/
+
+#include "pch.h"
+#include "EventCoalescer.h"
+
+// Longest time between flush passes. Shorter windows are flushed at their own length.
+constexpr const DWORD g_dwMaxCoalesceFlushIntervalMSecs = 1000;
+
+CEventCoalescer::CEventCoalescer()
+    : m_dwWindowMSecs(0),
+    m_pfnCoalesced(nullptr),
+    m_pvContext(nullptr),
+    m_fRunning(false),
+    m_hStopEvent(NULL),
+    m_hFlushThread(NULL),
+    m_cSuppressed(0)
+{
+    ::InitializeSRWLock(&m_lock);
+    for (size_t i = 0; i < m_bufEntries.GetLength(); i++)
+    {
+        m_bufEntries.Get()[i].fInUse = false;
+    }
+}
+
+CEventCoalescer::~CEventCoalescer()
+{
+    Stop();
+}
+
+HRESULT CEventCoalescer::Start(
+    DWORD dwWindowMSecs,
+    PFN_EVENTS_COALESCED pfnCoalesced,
+    PVOID pvContext)
+{
+    HRESULT hr = S_OK;
+    if (dwWindowMSecs == 0 || !pfnCoalesced)
+    {
+        return E_INVALIDARG;
+    }
+
+    do
+    {
+        m_dwWindowMSecs = dwWindowMSecs;
+        m_pfnCoalesced = pfnCoalesced;
+        m_pvContext = pvContext;
+
+        m_hStopEvent = ::CreateEventW(
+            nullptr, // lpEventAttributes
+            TRUE, // bManualReset
+            FALSE, // bInitialState
+            nullptr); // lpName
+        if (!m_hStopEvent)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateEventW failed, hr=%x\n", hr);
+            break;
+        }
+
+        // Set before the thread starts, so a report that races the start is counted.
+        m_fRunning = true;
+
+        m_hFlushThread = ::CreateThread(
+            nullptr, // lpThreadAttributes
+            0, // dwStackSize
+            FlushThreadProc,
+            this, // lpParameter
+            0, // dwCreationFlags
+            nullptr); // lpThreadId
+        if (!m_hFlushThread)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateThread failed, hr=%x\n", hr);
+            break;
+        }
+    } while (false);
+
+    if (FAILED(hr))
+    {
+        Stop();
+    }
+
+    return hr;
+}
+
+void CEventCoalescer::Stop()
+{
+    // Reports that see this are written, so the last flush has every repeat.
+    ::AcquireSRWLockExclusive(&m_lock);
+    m_fRunning = false;
+    ::ReleaseSRWLockExclusive(&m_lock);
+
+    if (m_hFlushThread)
+    {
+        ::SetEvent(m_hStopEvent);
+
+        // The thread flushes every open window before it exits.
+        ::WaitForSingleObject(m_hFlushThread, INFINITE);
+        ::CloseHandle(m_hFlushThread);
+        m_hFlushThread = NULL;
+    }
+    else
+    {
+        Flush(::GetTickCount64(), true); // fAll
+    }
+
+    if (m_hStopEvent)
+    {
+        ::CloseHandle(m_hStopEvent);
+        m_hStopEvent = NULL;
+    }
+}
+
+bool CEventCoalescer::ShouldReport(
+    DWORD dwEventID,
+    DWORD dwCode,
+    LPCWSTR pwszSerialNumber)
+{
+    if (!m_fRunning)
+    {
+        return true;
+    }
+
+    ULONGLONG ullNow = ::GetTickCount64();
+    CoalescedEvent stExpired;
+    bool fExpired = false;
+    bool fReport = true;
+
+    ::AcquireSRWLockExclusive(&m_lock);
+    do
+    {
+        if (!m_fRunning)
+        {
+            break;
+        }
+
+        Entry* pEntry = nullptr;
+        Entry* pFree = nullptr;
+        for (size_t i = 0; i < m_bufEntries.GetLength(); i++)
+        {
+            Entry& stEntry = m_bufEntries.Get()[i];
+            if (!stEntry.fInUse)
+            {
+                if (!pFree)
+                {
+                    pFree = &stEntry;
+                }
+            }
+            else if (stEntry.stEvent.dwEventID == dwEventID && stEntry.stEvent.dwCode == dwCode)
+            {
+                pEntry = &stEntry;
+                break;
+            }
+        }
+
+        if (pEntry && ullNow - pEntry->ullWindowStart >= m_dwWindowMSecs)
+        {
+            // The flush thread has not closed it yet. This report starts the next window.
+            fExpired = CloseEntry(*pEntry, OUT stExpired);
+            pFree = pEntry;
+            pEntry = nullptr;
+        }
+
+        if (!pEntry)
+        {
+            if (pFree)
+            {
+                pFree->fInUse = true;
+                pFree->ullWindowStart = ullNow;
+                pFree->ullLastRepeat = ullNow;
+                pFree->stEvent.dwEventID = dwEventID;
+                pFree->stEvent.dwCode = dwCode;
+                pFree->stEvent.cRepeats = 0;
+                pFree->stEvent.dwSeconds = 0;
+                pFree->stEvent.wszFirstSerialNumber[0] = L'\0';
+                pFree->stEvent.wszLastSerialNumber[0] = L'\0';
+            }
+
+            break;
+        }
+
+        // A repeat. Serial numbers that do not fit are truncated.
+        CoalescedEvent& stEvent = pEntry->stEvent;
+        LPCWSTR pwszSerial = pwszSerialNumber ? pwszSerialNumber : L"";
+        if (stEvent.cRepeats == 0)
+        {
+            ::StringCchCopyW(stEvent.wszFirstSerialNumber, CoalescedEvent::s_cchMaxSerialNumber, pwszSerial);
+        }
+
+        ::StringCchCopyW(stEvent.wszLastSerialNumber, CoalescedEvent::s_cchMaxSerialNumber, pwszSerial);
+        stEvent.cRepeats++;
+        pEntry->ullLastRepeat = ullNow;
+        fReport = false;
+    } while (false);
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+
+    if (fExpired)
+    {
+        m_pfnCoalesced(stExpired, m_pvContext);
+    }
+
+    if (!fReport)
+    {
+        ::InterlockedIncrement(&m_cSuppressed);
+    }
+
+    return fReport;
+}
+
+void CEventCoalescer::Flush(
+    ULONGLONG ullNow,
+    bool fAll)
+{
+    CStaticBuffer<CoalescedEvent, s_cMaxKeys> bufEvents;
+    size_t cEvents = 0;
+
+    ::AcquireSRWLockExclusive(&m_lock);
+    for (size_t i = 0; i < m_bufEntries.GetLength(); i++)
+    {
+        Entry& stEntry = m_bufEntries.Get()[i];
+        if (!stEntry.fInUse || (!fAll && ullNow - stEntry.ullWindowStart < m_dwWindowMSecs))
+        {
+            continue;
+        }
+
+        if (CloseEntry(stEntry, OUT bufEvents.Get()[cEvents]))
+        {
+            cEvents++;
+        }
+    }
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+
+    for (size_t i = 0; i < cEvents; i++)
+    {
+        m_pfnCoalesced(bufEvents.Get()[i], m_pvContext);
+    }
+}
+
+bool CEventCoalescer::CloseEntry(
+    Entry& stEntry,
+    OUT CoalescedEvent& stEvent)
+{
+    stEntry.fInUse = false;
+    if (stEntry.stEvent.cRepeats == 0)
+    {
+        return false;
+    }
+
+    ULONGLONG ullMSecs = stEntry.ullLastRepeat - stEntry.ullWindowStart;
+    stEvent = stEntry.stEvent;
+    stEvent.dwSeconds = (DWORD)((ullMSecs + 999) / 1000);
+    return true;
+}
+
+DWORD WINAPI CEventCoalescer::FlushThreadProc(
+    LPVOID pvParam)
+{
+    static_cast<CEventCoalescer*>(pvParam)->RunFlush();
+    return 0;
+}
+
+void CEventCoalescer::RunFlush()
+{
+    DWORD dwIntervalMSecs = min(m_dwWindowMSecs, g_dwMaxCoalesceFlushIntervalMSecs);
+    while (::WaitForSingleObject(m_hStopEvent, dwIntervalMSecs) == WAIT_TIMEOUT)
+    {
+        Flush(::GetTickCount64(), false); // fAll
+    }
+
+    Flush(::GetTickCount64(), true); // fAll
+}
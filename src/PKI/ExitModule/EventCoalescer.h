@@ -0,0 +1,202 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventCoalescer.h
+
+    Abstract:
+
+        CEventCoalescer class declaration.
+
+--*/
+
+#include "Buffer.h"
+
+/*++
+
+    Abstract:
+
+        Summary of the reports of one event that were not written.
+
+--*/
+struct CoalescedEvent
+{
+    // Longest serial number kept. Longer ones are truncated.
+    static const size_t s_cchMaxSerialNumber = 64;
+
+    DWORD dwEventID;
+    DWORD dwCode;
+
+    // Reports after the one that was written.
+    DWORD cRepeats;
+
+    // Seconds from the written report to the last repeat, rounded up.
+    DWORD dwSeconds;
+    WCHAR wszFirstSerialNumber[s_cchMaxSerialNumber];
+    WCHAR wszLastSerialNumber[s_cchMaxSerialNumber];
+};
+
+/*++
+
+    Abstract:
+
+        Collapses repeated reports of the same event into one summary per window.
+
+    Remarks:
+
+        Reports are keyed by event ID and code, the exit code or HRESULT. The first report
+        of a key is written. Reports of the same key in the next window are counted, along
+        with the first and last serial number, and not written. When the window ends, the
+        flush thread passes the summary to a callback, and the next report of the key is
+        written again. So a handler that fails every certificate costs two events per
+        window instead of two per certificate.
+
+        The table has s_cMaxKeys entries. A report that finds no free entry is written.
+--*/
+class CEventCoalescer
+{
+public:
+    // Distinct event ID and code pairs tracked at once.
+    static const size_t s_cMaxKeys = 32;
+
+    /*++
+
+        Abstract:
+
+            Called on the flush thread, or the thread calling Stop(), for each window that
+            had repeats.
+
+        Parameters:
+
+            stEvent - the summary.
+            pvContext - the context passed to Start().
+
+    --*/
+    typedef void (*PFN_EVENTS_COALESCED)(
+        const CoalescedEvent& stEvent,
+        PVOID pvContext);
+
+    CEventCoalescer();
+    ~CEventCoalescer();
+
+    /*++
+
+        Abstract:
+
+            Starts the flush thread.
+
+        Parameters:
+
+            dwWindowMSecs - how long repeats of a written report are counted. Not 0.
+            pfnCoalesced - called with each summary.
+            pvContext - passed to pfnCoalesced.
+
+        Returns:
+
+            S_OK - success.
+            other - error code. ShouldReport() returns true for every report.
+    --*/
+    HRESULT Start(
+        DWORD dwWindowMSecs,
+        PFN_EVENTS_COALESCED pfnCoalesced,
+        PVOID pvContext);
+
+    /*++
+
+        Abstract:
+
+            Stops the flush thread and passes the summaries of open windows to the callback.
+
+        Remarks:
+
+            Later reports are all written. Safe to call more than once.
+    --*/
+    void Stop();
+
+    /*++
+
+        Abstract:
+
+            Counts a report and decides whether it is written.
+
+        Parameters:
+
+            dwEventID - the event ID.
+            dwCode - the exit code or HRESULT the event reports.
+            pwszSerialNumber - serial number of the certificate, or nullptr.
+
+        Returns:
+
+            true - write the event.
+            false - the event is counted in a summary. Do not write it.
+    --*/
+    bool ShouldReport(
+        DWORD dwEventID,
+        DWORD dwCode,
+        LPCWSTR pwszSerialNumber);
+
+    inline LONG GetSuppressed() const
+    {
+        return m_cSuppressed;
+    }
+
+private:
+    struct Entry
+    {
+        bool fInUse;
+        ULONGLONG ullWindowStart;
+        ULONGLONG ullLastRepeat;
+        CoalescedEvent stEvent;
+    };
+
+    SRWLOCK m_lock;
+    CStaticBuffer<Entry, s_cMaxKeys> m_bufEntries;
+    DWORD m_dwWindowMSecs;
+    PFN_EVENTS_COALESCED m_pfnCoalesced;
+    PVOID m_pvContext;
+    volatile bool m_fRunning;
+    HANDLE m_hStopEvent;
+    HANDLE m_hFlushThread;
+    volatile LONG m_cSuppressed;
+
+    /*++
+
+        Abstract:
+
+            Closes the windows that ended before ullNow, or all of them, and passes their
+            summaries to the callback.
+
+        Remarks:
+
+            The callback is called outside the lock, so it can report events.
+    --*/
+    void Flush(
+        ULONGLONG ullNow,
+        bool fAll);
+
+    /*++
+
+        Abstract:
+
+            Copies the summary of an entry and frees it.
+
+        Returns:
+
+            true - the entry had repeats. stEvent has the summary.
+            false - nothing to report.
+    --*/
+    static bool CloseEntry(
+        Entry& stEntry,
+        OUT CoalescedEvent& stEvent);
+
+    static DWORD WINAPI FlushThreadProc(
+        LPVOID pvParam);
+
+    void RunFlush();
+
+    CEventCoalescer(const CEventCoalescer&) = delete;
+    CEventCoalescer& operator=(const CEventCoalescer&) = delete;
+};
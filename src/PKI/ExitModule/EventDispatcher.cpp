@@ -0,0 +1,410 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventDispatcher.cpp
+
+    Abstract:
+
+        CEventDispatcher class impl.
+
+--*/
+
+#include "pch.h"
+#include "PMIExitModuleEventSource.h"
+#include "EventProcessor.h"
+#include "EventProcessorConfigCache.h"
+#include "CertIssuedEvent.h"
+#include "EventJournal.h"
+#include "EventDispatcher.h"
+
+// Each handler can take up to HandlerTimeoutMSecs, 10s by default, and a full batch 50s more.
+// A worker still running after this is traced, and Stop() keeps waiting for it.
+constexpr const DWORD g_dwWorkerStopTimeoutMSecs = 120000;
+
+CEventDispatcher::CEventDispatcher(
+    const CPMIExitModuleEventSource& objEventSource,
+    CEventProcessorConfigCache& objConfigCache,
+    CEventJournal& objJournal)
+    : m_objEventSource(objEventSource),
+    m_objConfigCache(objConfigCache),
+    m_objJournal(objJournal),
+    m_objPersistentHandler(objEventSource),
+    m_objHandlerPool(objEventSource, objConfigCache),
+    m_cThreads(0),
+    m_hConcurrency(NULL),
+    m_ullFrequency(1),
+    m_cInlineDeliveries(0),
+    m_cWorkersStarted(0)
+{
+    LARGE_INTEGER liFrequency;
+    if (::QueryPerformanceFrequency(&liFrequency))
+    {
+        m_ullFrequency = (ULONGLONG)liFrequency.QuadPart;
+    }
+}
+
+CEventDispatcher::~CEventDispatcher()
+{
+    Stop();
+
+    if (m_hConcurrency)
+    {
+        ::CloseHandle(m_hConcurrency);
+    }
+}
+
+HRESULT CEventDispatcher::Start(
+    size_t cWorkers,
+    size_t cCapacity)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        if (m_bufThreads.GetLength() > 0)
+        {
+            ATLTRACE(L"The dispatcher has been previously started.\n");
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+            break;
+        }
+
+        if (cWorkers == 0 || cWorkers > MAXIMUM_WAIT_OBJECTS)
+        {
+            hr = E_INVALIDARG;
+            break;
+        }
+
+        hr = m_objQueue.Init(cCapacity);
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"CEventQueue::Init failed, hr=%x\n", hr);
+            break;
+        }
+
+        if (!m_bufThreads.Alloc(cWorkers) || !m_bufStats.Alloc(cWorkers))
+        {
+            ATLTRACE(L"Failed to alloc worker thread handles.\n");
+            hr = E_OUTOFMEMORY;
+            break;
+        }
+
+        ZeroMemory(m_bufStats.Get(), m_bufStats.GetSize());
+
+        // Inline deliveries wait for a free slot, so no more than cWorkers handlers run at once.
+        m_hConcurrency = ::CreateSemaphoreW(
+            nullptr, // lpSemaphoreAttributes
+            (LONG)cWorkers, // lInitialCount
+            (LONG)cWorkers, // lMaximumCount
+            nullptr); // lpName
+        if (!m_hConcurrency)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateSemaphoreW failed, hr=%x\n", hr);
+            break;
+        }
+
+        HRESULT hrReaper = m_objReaper.Start(cWorkers);
+        if (FAILED(hrReaper))
+        {
+            // Workers wait for their handlers instead.
+            ATLTRACE(L"CProcessReaper::Start failed, hr=%x\n", hrReaper);
+        }
+
+        HRESULT hrPool = m_objHandlerPool.Start();
+        if (FAILED(hrPool))
+        {
+            // Handlers are started for each event instead.
+            ATLTRACE(L"CHandlerPool::Start failed, hr=%x\n", hrPool);
+        }
+
+        for (; m_cThreads < cWorkers; m_cThreads++)
+        {
+            HANDLE hThread = ::CreateThread(
+                nullptr, // lpThreadAttributes
+                0, // dwStackSize
+                WorkerThreadProc,
+                this, // lpParameter
+                0, // dwCreationFlags
+                nullptr); // lpThreadId
+            if (!hThread)
+            {
+                hr = HRESULT_FROM_WIN32(::GetLastError());
+                ATLTRACE(L"CreateThread failed, hr=%x\n", hr);
+                break;
+            }
+
+            m_bufThreads.Get()[m_cThreads] = hThread;
+        }
+    } while (false);
+
+    if (FAILED(hr))
+    {
+        Stop();
+    }
+
+    return hr;
+}
+
+void CEventDispatcher::Stop()
+{
+    m_objQueue.Close();
+
+    for (size_t i = 0; i < m_cThreads; i++)
+    {
+        HANDLE hThread = m_bufThreads.Get()[i];
+        DWORD dwRes = ::WaitForSingleObject(hThread, g_dwWorkerStopTimeoutMSecs);
+        if (dwRes == WAIT_TIMEOUT)
+        {
+            // The worker uses the journal, the reaper and the handlers, which are torn down
+            // next and freed with the exit module. The handler timeouts bound this wait.
+            ATLTRACE(L"Worker thread %d did not stop in %dms. Waiting for it.\n", i, g_dwWorkerStopTimeoutMSecs);
+            dwRes = ::WaitForSingleObject(hThread, INFINITE);
+        }
+
+        if (dwRes != WAIT_OBJECT_0)
+        {
+            ATLTRACE(L"Failed to wait for worker thread %d, dwRes=%d\n", i, dwRes);
+        }
+
+        ::CloseHandle(hThread);
+    }
+
+    ReportWorkerStats();
+    m_cThreads = 0;
+
+    // No more events can arrive from the workers. Handlers they started are reaped or killed.
+    m_objReaper.Stop();
+    m_objPersistentHandler.Stop();
+    m_objHandlerPool.Stop();
+
+    ATLTRACE(
+        L"Dispatcher stopped. High water mark=%d, inline deliveries=%d\n",
+        m_objQueue.GetHighWaterMark(),
+        m_cInlineDeliveries);
+}
+
+HRESULT CEventDispatcher::Post(
+    CCertIssuedEvent* pEvent)
+{
+    if (m_objJournal.IsOpen())
+    {
+        HRESULT hrJournal = m_objJournal.Append(*pEvent);
+        if (FAILED(hrJournal))
+        {
+            // Still deliver it. It just will not survive a restart.
+            ATLTRACE(L"CEventJournal::Append failed, hr=%x\n", hrJournal);
+        }
+    }
+
+    pEvent->SetQueuedTime(GetTime());
+    if (m_cThreads > 0 && m_objQueue.TryEnqueue(pEvent))
+    {
+        return S_OK;
+    }
+
+    // The queue is full or the workers are not running.
+    ::InterlockedIncrement(&m_cInlineDeliveries);
+    ATLTRACE(L"Delivering event inline, queue depth=%d\n", m_objQueue.GetDepth());
+    HRESULT hr = Deliver(CRefBuffer<CCertIssuedEvent*>(&pEvent, 1));
+    m_objJournal.Checkpoint(*pEvent);
+    delete pEvent;
+    return hr;
+}
+
+HRESULT CEventDispatcher::Deliver(
+    const CBuffer<CCertIssuedEvent*>& bufEvents)
+{
+    CEventProcessorConfigRef objConfigRef(m_objConfigCache);
+    CEventProcessor objEventProcessor(
+        objConfigRef.Get(),
+        m_objEventSource,
+        &m_objPersistentHandler,
+        &m_objHandlerPool,
+        &m_objReaper,
+        &m_objJournal);
+
+    HRESULT hr = objConfigRef.Get().GetLoadResult();
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"The event processor config is not loaded, hr=%x\n", hr);
+        return hr;
+    }
+
+    if (m_hConcurrency)
+    {
+        ::WaitForSingleObject(m_hConcurrency, INFINITE);
+    }
+
+    hr = objEventProcessor.NotifyCertIssued(bufEvents);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"CEventProcessor::NotifyCertIssued failed, hr=%x\n", hr);
+    }
+
+    if (m_hConcurrency)
+    {
+        ::ReleaseSemaphore(m_hConcurrency, 1, nullptr);
+    }
+
+    return hr;
+}
+
+DWORD WINAPI CEventDispatcher::WorkerThreadProc(
+    LPVOID pvParam)
+{
+    CEventDispatcher* pThis = static_cast<CEventDispatcher*>(pvParam);
+    LONG iWorker = ::InterlockedIncrement(&pThis->m_cWorkersStarted) - 1;
+    pThis->RunWorker(pThis->m_bufStats.Get()[iWorker]);
+    return 0;
+}
+
+void CEventDispatcher::RunWorker(
+    DispatcherWorkerStats& stStats)
+{
+    CHeapBuffer<CCertIssuedEvent*> bufBatch;
+    ULONGLONG ullIdleStart = GetTime();
+
+    for (CCertIssuedEvent* pEvent = m_objQueue.Dequeue();
+        pEvent;
+        pEvent = m_objQueue.Dequeue())
+    {
+        ULONGLONG ullBusyStart = GetTime();
+        stStats.ullIdleUSecs += ToMicroseconds(ullBusyStart - ullIdleStart);
+
+        // Config changes take effect for the next batch. This one keeps its snapshot.
+        CEventProcessorConfigRef objConfigRef(m_objConfigCache);
+        const CEventProcessorConfig& objConfig = objConfigRef.Get();
+        CEventProcessor objEventProcessor(
+            objConfig,
+            m_objEventSource,
+            &m_objPersistentHandler,
+            &m_objHandlerPool,
+            &m_objReaper,
+            &m_objJournal);
+        CCertIssuedEvent** ppEvents = &pEvent;
+        size_t cEvents = 1;
+
+        HRESULT hr = objConfig.GetLoadResult();
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"The event processor config is not loaded, hr=%x\n", hr);
+        }
+        else
+        {
+            size_t cMaxEvents = objConfig.GetBatchMaxEvents();
+            if (objConfig.GetHandlerMode() == HandlerModeBatch &&
+                (bufBatch.GetLength() >= cMaxEvents || bufBatch.Alloc(cMaxEvents)))
+            {
+                bufBatch.Get()[0] = pEvent;
+                cEvents = GatherBatch(bufBatch, cMaxEvents, objConfig.GetBatchWindowMSecs());
+                ppEvents = bufBatch.Get();
+            }
+
+            // Only inline deliveries ever wait here. Each worker has its own slot.
+            ::WaitForSingleObject(m_hConcurrency, INFINITE);
+            hr = objEventProcessor.NotifyCertIssued(CRefBuffer<CCertIssuedEvent*>(ppEvents, cEvents));
+            ::ReleaseSemaphore(m_hConcurrency, 1, nullptr);
+            if (FAILED(hr))
+            {
+                ATLTRACE(L"CEventProcessor::NotifyCertIssued failed, hr=%x\n", hr);
+            }
+        }
+
+        for (size_t i = 0; i < cEvents; i++)
+        {
+            stStats.ullQueueWaitUSecs += ToMicroseconds(ullBusyStart - ppEvents[i]->GetQueuedTime());
+
+            if (FAILED(hr))
+            {
+                // Same reporting Notify() does for inline failures.
+                m_objEventSource.ReportNotifyFailedInternalError(
+                    ppEvents[i]->GetExitEvent(),
+                    ppEvents[i]->GetContext(),
+                    hr);
+            }
+
+            // A handler the reaper tracks cleared the position. It is checkpointed when reaped.
+            m_objJournal.Checkpoint(*ppEvents[i]);
+            delete ppEvents[i];
+        }
+
+        ::InterlockedExchangeAdd(&stStats.cEvents, (LONG)cEvents);
+        ullIdleStart = GetTime();
+        stStats.ullBusyUSecs += ToMicroseconds(ullIdleStart - ullBusyStart);
+    }
+
+    stStats.ullIdleUSecs += ToMicroseconds(GetTime() - ullIdleStart);
+}
+
+void CEventDispatcher::ReportWorkerStats() const
+{
+    for (size_t i = 0; i < m_cThreads; i++)
+    {
+        const DispatcherWorkerStats& stStats = m_bufStats.Get()[i];
+        ULONGLONG ullTotalUSecs = stStats.ullBusyUSecs + stStats.ullIdleUSecs;
+        DWORD dwUtilization = ullTotalUSecs ? (DWORD)((stStats.ullBusyUSecs * 100) / ullTotalUSecs) : 0;
+        DWORD dwAverageWaitMSecs = stStats.cEvents ? (DWORD)(stStats.ullQueueWaitUSecs / stStats.cEvents / 1000) : 0;
+        DWORD dwAverageRunMSecs = stStats.cEvents ? (DWORD)(stStats.ullBusyUSecs / stStats.cEvents / 1000) : 0;
+
+        ATLTRACE(
+            L"Worker %d: events=%d, busy=%I64uus, idle=%I64uus, queue wait=%I64uus\n",
+            i,
+            stStats.cEvents,
+            stStats.ullBusyUSecs,
+            stStats.ullIdleUSecs,
+            stStats.ullQueueWaitUSecs);
+        m_objEventSource.ReportWorkerStats(
+            (DWORD)i,
+            (DWORD)stStats.cEvents,
+            dwUtilization,
+            dwAverageWaitMSecs,
+            dwAverageRunMSecs);
+    }
+}
+
+ULONGLONG CEventDispatcher::GetTime() const
+{
+    LARGE_INTEGER liNow;
+    ::QueryPerformanceCounter(&liNow);
+    return (ULONGLONG)liNow.QuadPart;
+}
+
+ULONGLONG CEventDispatcher::ToMicroseconds(
+    ULONGLONG ullTicks) const
+{
+    // Split so ullTicks * 1000000 cannot overflow over a long idle period.
+    return (ullTicks / m_ullFrequency) * 1000000 + (ullTicks % m_ullFrequency) * 1000000 / m_ullFrequency;
+}
+
+size_t CEventDispatcher::GatherBatch(
+    CBuffer<CCertIssuedEvent*>& bufBatch,
+    size_t cMaxEvents,
+    DWORD dwWindowMSecs)
+{
+    size_t cEvents = 1;
+    ULONGLONG ullDeadline = ::GetTickCount64() + dwWindowMSecs;
+
+    while (cEvents < cMaxEvents)
+    {
+        ULONGLONG ullNow = ::GetTickCount64();
+        if (ullNow >= ullDeadline)
+        {
+            break;
+        }
+
+        // Returns right away once the queue is closed, so shutdown does not wait out the window.
+        CCertIssuedEvent* pEvent = m_objQueue.Dequeue((DWORD)(ullDeadline - ullNow));
+        if (!pEvent)
+        {
+            break;
+        }
+
+        bufBatch.Get()[cEvents++] = pEvent;
+    }
+
+    ATLTRACE(L"Gathered a batch of %d events.\n", cEvents);
+    return cEvents;
+}
@@ -0,0 +1,225 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventDispatcher.h
+
+    Abstract:
+
+        CEventDispatcher class declaration.
+
+--*/
+
+#include "EventQueue.h"
+#include "HandlerPool.h"
+#include "PersistentHandler.h"
+#include "ProcessReaper.h"
+
+class CCertIssuedEvent;
+class CEventJournal;
+class CEventProcessorConfigCache;
+class CPMIExitModuleEventSource;
+
+/*++
+
+    Abstract:
+
+        Statistics for one dispatcher worker thread.
+
+    Remarks:
+
+        Only the worker updates its own statistics. Times are in microseconds.
+--*/
+struct DispatcherWorkerStats
+{
+    // Number of events the worker delivered.
+    volatile LONG cEvents;
+
+    // Time spent gathering and delivering events.
+    ULONGLONG ullBusyUSecs;
+
+    // Time spent waiting for the queue.
+    ULONGLONG ullIdleUSecs;
+
+    // Total time the delivered events waited in the queue.
+    ULONGLONG ullQueueWaitUSecs;
+};
+
+/*++
+
+    Abstract:
+
+        Delivers events to the event processor on background worker threads.
+
+    Remarks:
+
+        ICertExit::Notify() posts a snapshot of the event and returns without waiting
+        for the event processor. If the queue is full or the workers are not running,
+        the event is delivered inline on the calling thread so no events are dropped.
+        This applies back pressure to CertSvc instead of losing notifications.
+
+        In batch mode, a worker holds the first event for up to the batch window while it
+        gathers more events, then runs the handler once for all of them.
+
+        Each delivery uses the config snapshot that is current when it starts.
+
+        If the journal is open, each event is appended to it before it is queued and
+        checkpointed after the event processor is done with it.
+
+        Each worker delivers one event or batch at a time. Inline deliveries count against
+        the same limit. A process-per-event handler is handed to the reaper once it has
+        its cert, so the worker can start the next one. The reaper has as many slots as
+        there are workers, so no more than that many handlers run at once either way.
+--*/
+class CEventDispatcher
+{
+public:
+    CEventDispatcher(
+        const CPMIExitModuleEventSource& objEventSource,
+        CEventProcessorConfigCache& objConfigCache,
+        CEventJournal& objJournal);
+    ~CEventDispatcher();
+
+    /*++
+
+        Abstract:
+
+            Starts the worker threads.
+
+        Parameters:
+
+            cWorkers - the number of worker threads, which is also the number of handlers that can run at once.
+            cCapacity - the maximum number of events waiting for a worker.
+
+        Returns:
+
+            S_OK - success.
+            other - error code. No workers are running.
+    --*/
+    HRESULT Start(
+        size_t cWorkers,
+        size_t cCapacity);
+
+    /*++
+
+        Abstract:
+
+            Stops accepting events, waits for queued events to be delivered and stops the workers.
+
+        Remarks:
+
+            Safe to call more than once. Do not call under the loader lock.
+
+            Waits for every worker to exit, however long its handler takes, because the
+            workers use the journal and handlers that are freed after this returns.
+    --*/
+    void Stop();
+
+    /*++
+
+        Abstract:
+
+            Posts an event for delivery.
+
+        Parameters:
+
+            pEvent - the event. Ownership always transfers to the dispatcher.
+
+        Returns:
+
+            S_OK - the event was queued or delivered inline.
+            other - inline delivery failed.
+    --*/
+    HRESULT Post(
+        CCertIssuedEvent* pEvent);
+
+    /*++
+
+        Abstract:
+
+            Delivers events to the event processor on the calling thread.
+
+        Parameters:
+
+            bufEvents - the events to deliver. The caller keeps ownership.
+
+        Returns:
+
+            S_OK - success.
+            other - error code.
+    --*/
+    HRESULT Deliver(
+        const CBuffer<CCertIssuedEvent*>& bufEvents);
+
+    inline LONG GetQueueDepth() const
+    {
+        return m_objQueue.GetDepth();
+    }
+
+    inline LONG GetQueueHighWaterMark() const
+    {
+        return m_objQueue.GetHighWaterMark();
+    }
+
+    inline LONG GetInlineDeliveryCount() const
+    {
+        return m_cInlineDeliveries;
+    }
+
+    inline size_t GetWorkerCount() const
+    {
+        return m_cThreads;
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets the statistics of a worker.
+
+        Parameters:
+
+            iWorker - index of the worker, less than GetWorkerCount().
+
+    --*/
+    inline const DispatcherWorkerStats& GetWorkerStats(
+        size_t iWorker) const
+    {
+        return m_bufStats.Get()[iWorker];
+    }
+
+private:
+    const CPMIExitModuleEventSource& m_objEventSource;
+    CEventProcessorConfigCache& m_objConfigCache;
+    CEventJournal& m_objJournal;
+    CEventQueue m_objQueue;
+    CPersistentHandler m_objPersistentHandler;
+    CHandlerPool m_objHandlerPool;
+    CProcessReaper m_objReaper;
+    CHeapBuffer<HANDLE> m_bufThreads;
+    CHeapBuffer<DispatcherWorkerStats> m_bufStats;
+    size_t m_cThreads;
+    HANDLE m_hConcurrency;
+    ULONGLONG m_ullFrequency;
+    volatile LONG m_cInlineDeliveries;
+    volatile LONG m_cWorkersStarted;
+
+    static DWORD WINAPI WorkerThreadProc(
+        LPVOID pvParam);
+    void RunWorker(
+        DispatcherWorkerStats& stStats);
+    void ReportWorkerStats() const;
+    ULONGLONG GetTime() const;
+    ULONGLONG ToMicroseconds(
+        ULONGLONG ullTicks) const;
+    size_t GatherBatch(
+        CBuffer<CCertIssuedEvent*>& bufBatch,
+        size_t cMaxEvents,
+        DWORD dwWindowMSecs);
+
+    CEventDispatcher(const CEventDispatcher&) = delete;
+    CEventDispatcher& operator=(const CEventDispatcher&) = delete;
+};
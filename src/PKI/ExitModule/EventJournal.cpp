@@ -0,0 +1,1108 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventJournal.cpp
+
+    Abstract:
+
+        CEventJournal class impl.
+
+--*/
+
+#include "pch.h"
+#include <sddl.h>
+#include "CertIssuedEvent.h"
+#include "PMIExitModuleEventSource.h"
+#include "EventDispatcher.h"
+#include "EventJournal.h"
+
+LPCWSTR g_pwszJournalFilePrefix = L"PMIJournal.";
+LPCWSTR g_pwszJournalFileSearch = L"PMIJournal.*.dat";
+LPCWSTR g_pwszJournalQuarantinePrefix = L"PMIJournal.Quarantine.";
+
+// Only SYSTEM and Administrators can touch the journal. Replayed events end up on the handler's command line.
+LPCWSTR g_pwszJournalDirectorySDDL = L"D:P(A;OICI;FA;;;SY)(A;OICI;FA;;;BA)";
+
+constexpr const size_t g_cbJournalSegment = 4 * 1024 * 1024;
+constexpr const size_t g_cMaxJournalSegments = 16;
+constexpr const size_t g_cbJournalSegmentHeader = 64;
+constexpr const size_t g_cbJournalRecordAlignment = 8;
+constexpr const DWORD g_dwJournalFlushIntervalMSecs = 100;
+constexpr const DWORD g_dwJournalSegmentMagic = 0x534A4D50; // 'PMJS'
+constexpr const DWORD g_dwJournalRecordMagic = 0x524A4D50; // 'PMJR'
+constexpr const WORD g_wJournalVersion = 1;
+
+namespace
+{
+    /*++
+
+        Abstract:
+
+            Fixed header at the start of every segment file.
+
+    --*/
+    struct JournalSegmentHeader
+    {
+        DWORD dwMagic;
+        WORD wVersion;
+        WORD wReserved;
+        DWORD dwNumber;
+        DWORD cbSegment;
+    };
+
+    enum JournalRecordState : LONG
+    {
+        JOURNAL_RECORD_PENDING = 0,
+        JOURNAL_RECORD_DELIVERED = 1,
+        JOURNAL_RECORD_QUARANTINED = 2,
+    };
+
+    /*++
+
+        Abstract:
+
+            Header in front of every record.
+
+        Remarks:
+
+            dwMagic is written last, so a record torn by a crash fails the magic or CRC check.
+            The CRC covers cbPayload, ullSequence and the payload. lState is updated in place
+            by Checkpoint() and is not covered.
+    --*/
+    struct JournalRecordHeader
+    {
+        DWORD dwMagic;
+        DWORD dwCrc;
+        DWORD cbPayload;
+        volatile LONG lState;
+        ULONGLONG ullSequence;
+    };
+
+    /*++
+
+        Abstract:
+
+            Fixed part of an event record payload.
+
+    --*/
+    struct JournalEventPayload
+    {
+        LONG lExitEvent;
+        LONG lContext;
+        DWORD cchSubjectKeyIdentifier;
+        DWORD cchSerialNumber;
+        DWORD cbRawCert;
+    };
+
+    struct CCrc32Table
+    {
+        DWORD rgdw[256];
+
+        constexpr CCrc32Table()
+            : rgdw()
+        {
+            for (DWORD i = 0; i < 256; i++)
+            {
+                DWORD dw = i;
+                for (int j = 0; j < 8; j++)
+                {
+                    dw = (dw & 1) ? (0xEDB88320 ^ (dw >> 1)) : (dw >> 1);
+                }
+
+                rgdw[i] = dw;
+            }
+        }
+    };
+
+    constexpr const CCrc32Table g_crcTable;
+
+    inline DWORD UpdateCrc(
+        DWORD dwCrc,
+        const void* pv,
+        size_t cb)
+    {
+        const BYTE* pb = static_cast<const BYTE*>(pv);
+        dwCrc = ~dwCrc;
+        for (size_t i = 0; i < cb; i++)
+        {
+            dwCrc = g_crcTable.rgdw[(dwCrc ^ pb[i]) & 0xFF] ^ (dwCrc >> 8);
+        }
+
+        return ~dwCrc;
+    }
+
+    inline DWORD ComputeRecordCrc(
+        const JournalRecordHeader& stHeader)
+    {
+        DWORD dwCrc = UpdateCrc(0, &stHeader.cbPayload, sizeof(stHeader.cbPayload));
+        dwCrc = UpdateCrc(dwCrc, &stHeader.ullSequence, sizeof(stHeader.ullSequence));
+        return UpdateCrc(dwCrc, &stHeader + 1, stHeader.cbPayload);
+    }
+
+    inline size_t AlignRecord(
+        size_t cb)
+    {
+        return (cb + g_cbJournalRecordAlignment - 1) & ~(g_cbJournalRecordAlignment - 1);
+    }
+
+    inline ULONGLONG MakePosition(
+        DWORD dwNumber,
+        size_t cbOffset)
+    {
+        return ((ULONGLONG)dwNumber << 32) | (DWORD)cbOffset;
+    }
+
+    inline size_t GetStringLength(
+        LPCWSTR pwsz)
+    {
+        return pwsz ? wcslen(pwsz) : 0;
+    }
+
+    inline BYTE* AppendBytes(
+        BYTE* pbCurrent,
+        const void* pv,
+        size_t cb)
+    {
+        if (cb > 0)
+        {
+            CopyMemory(pbCurrent, pv, cb);
+        }
+
+        return pbCurrent + cb;
+    }
+
+    HRESULT CreateDirectoryTree(
+        LPCWSTR pwszPath)
+    {
+        HRESULT hr = S_OK;
+        CHeapWString strPath;
+        PSECURITY_DESCRIPTOR pSD = nullptr;
+        SECURITY_ATTRIBUTES stAttributes;
+        ZeroMemory(&stAttributes, sizeof(stAttributes));
+        stAttributes.nLength = sizeof(stAttributes);
+
+        do
+        {
+            hr = strPath.CopyFrom(pwszPath);
+            if (FAILED(hr))
+            {
+                break;
+            }
+
+            if (!::ConvertStringSecurityDescriptorToSecurityDescriptorW(
+                g_pwszJournalDirectorySDDL,
+                SDDL_REVISION_1,
+                &pSD,
+                nullptr)) // SecurityDescriptorSize
+            {
+                hr = HRESULT_FROM_WIN32(::GetLastError());
+                ATLTRACE(L"ConvertStringSecurityDescriptorToSecurityDescriptorW failed, hr=%x\n", hr);
+                break;
+            }
+
+            stAttributes.lpSecurityDescriptor = pSD;
+
+            // Parents that already exist, like the drive, fail with access denied or already exists.
+            // Only the result for the full path matters.
+            for (LPWSTR pwsz = strPath.Get(); *pwsz; pwsz++)
+            {
+                if (*pwsz == L'\\' && pwsz != strPath.Get())
+                {
+                    *pwsz = L'\0';
+                    ::CreateDirectoryW(strPath.Get(), &stAttributes);
+                    *pwsz = L'\\';
+                }
+            }
+
+            if (!::CreateDirectoryW(strPath.Get(), &stAttributes))
+            {
+                DWORD dwError = ::GetLastError();
+                if (dwError != ERROR_ALREADY_EXISTS)
+                {
+                    hr = HRESULT_FROM_WIN32(dwError);
+                    ATLTRACE(L"CreateDirectoryW(%s) failed, hr=%x\n", strPath.Get(), hr);
+                    break;
+                }
+            }
+        } while (false);
+
+        if (pSD)
+        {
+            ::LocalFree(pSD);
+        }
+
+        return hr;
+    }
+
+    /*++
+
+        Abstract:
+
+            Copies a record that cannot be replayed to its own file in the journal directory.
+
+        Remarks:
+
+            The file does not match g_pwszJournalFileSearch, so it is never recovered. It
+            inherits the directory's DACL.
+    --*/
+    HRESULT QuarantineRecord(
+        LPCWSTR pwszDirectory,
+        const JournalRecordHeader& stHeader,
+        OUT CHeapWString& strPath)
+    {
+        size_t cchPath = wcslen(pwszDirectory) + wcslen(g_pwszJournalQuarantinePrefix) + 32;
+        if (!strPath.Alloc(cchPath))
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        HRESULT hr = ::StringCchPrintfW(
+            strPath.Get(),
+            cchPath,
+            L"%s\\%s%I64u.bad",
+            pwszDirectory,
+            g_pwszJournalQuarantinePrefix,
+            stHeader.ullSequence);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        HANDLE hFile = ::CreateFileW(
+            strPath.Get(),
+            GENERIC_WRITE,
+            0, // dwShareMode
+            nullptr, // lpSecurityAttributes
+            CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL,
+            NULL); // hTemplateFile
+        if (hFile == INVALID_HANDLE_VALUE)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateFileW(%s) failed, hr=%x\n", strPath.Get(), hr);
+            return hr;
+        }
+
+        DWORD cbWritten = 0;
+        if (!::WriteFile(hFile, &stHeader, (DWORD)(sizeof(stHeader) + stHeader.cbPayload), &cbWritten, nullptr))
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"WriteFile(%s) failed, hr=%x\n", strPath.Get(), hr);
+        }
+
+        ::CloseHandle(hFile);
+        return hr;
+    }
+
+    HRESULT ReadEventRecord(
+        const JournalRecordHeader& stHeader,
+        OUT CCertIssuedEvent*& pEvent)
+    {
+        pEvent = nullptr;
+
+        JournalEventPayload stPayload;
+        if (stHeader.cbPayload < sizeof(stPayload))
+        {
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+
+        const BYTE* pbPayload = reinterpret_cast<const BYTE*>(&stHeader + 1);
+        CopyMemory(&stPayload, pbPayload, sizeof(stPayload));
+
+        ULONGLONG cbExpected =
+            sizeof(stPayload) +
+            ((ULONGLONG)stPayload.cchSubjectKeyIdentifier + stPayload.cchSerialNumber) * sizeof(WCHAR) +
+            stPayload.cbRawCert;
+        // Records written before the requester name was journaled end at the raw cert.
+        ULONGLONG cbRequesterName = stHeader.cbPayload - cbExpected;
+        if (cbExpected > stHeader.cbPayload || (cbRequesterName % sizeof(WCHAR)) != 0)
+        {
+            ATLTRACE(L"Journal record size mismatch. Expected=%I64u, actual=%u\n", cbExpected, stHeader.cbPayload);
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+
+        LPCWSTR pwchSubjectKeyIdentifier = reinterpret_cast<LPCWSTR>(pbPayload + sizeof(stPayload));
+        LPCWSTR pwchSerialNumber = pwchSubjectKeyIdentifier + stPayload.cchSubjectKeyIdentifier;
+        const BYTE* pbRawCert = reinterpret_cast<const BYTE*>(pwchSerialNumber + stPayload.cchSerialNumber);
+        LPCWSTR pwchRequesterName = reinterpret_cast<LPCWSTR>(pbRawCert + stPayload.cbRawCert);
+
+        CCertIssuedEvent* pNew = new CCertIssuedEvent(stPayload.lExitEvent, stPayload.lContext);
+        if (!pNew)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        HRESULT hr = pNew->Restore(
+            pwchSubjectKeyIdentifier,
+            stPayload.cchSubjectKeyIdentifier,
+            pwchSerialNumber,
+            stPayload.cchSerialNumber,
+            CRefBuffer<BYTE>(const_cast<BYTE*>(pbRawCert), stPayload.cbRawCert),
+            pwchRequesterName,
+            (size_t)(cbRequesterName / sizeof(WCHAR)));
+        if (FAILED(hr))
+        {
+            delete pNew;
+            return hr;
+        }
+
+        pEvent = pNew;
+        return S_OK;
+    }
+}
+
+CEventJournal::CEventJournal()
+    : m_pCurrent(nullptr),
+    m_dwNextNumber(1),
+    m_ullNextSequence(1),
+    m_hStopEvent(NULL),
+    m_hFlushThread(NULL),
+    m_cAppends(0),
+    m_cFlushes(0)
+{
+    ::InitializeSRWLock(&m_lock);
+}
+
+CEventJournal::~CEventJournal()
+{
+    Close();
+}
+
+HRESULT CEventJournal::Open(
+    LPCWSTR pwszDirectory)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        if (IsOpen())
+        {
+            ATLTRACE(L"The journal has been previously opened.\n");
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+            break;
+        }
+
+        DWORD cch = ::ExpandEnvironmentStringsW(pwszDirectory, nullptr, 0);
+        if (cch == 0)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"ExpandEnvironmentStringsW(%s) failed, hr=%x\n", pwszDirectory, hr);
+            break;
+        }
+
+        if (!m_strDirectory.Alloc(cch))
+        {
+            hr = E_OUTOFMEMORY;
+            break;
+        }
+
+        if (::ExpandEnvironmentStringsW(pwszDirectory, m_strDirectory.Get(), cch) == 0)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"ExpandEnvironmentStringsW(%s) failed, hr=%x\n", pwszDirectory, hr);
+            break;
+        }
+
+        hr = CreateDirectoryTree(m_strDirectory.Get());
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        if (!m_bufSegments.Alloc(g_cMaxJournalSegments))
+        {
+            hr = E_OUTOFMEMORY;
+            break;
+        }
+
+        // The slots are not initialized by Alloc, so they are cleared rather than unmapped.
+        for (size_t i = 0; i < m_bufSegments.GetLength(); i++)
+        {
+            Segment& objSegment = m_bufSegments.Get()[i];
+            ZeroMemory(&objSegment, sizeof(objSegment));
+            objSegment.hFile = INVALID_HANDLE_VALUE;
+        }
+
+        hr = Recover();
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"CEventJournal::Recover failed, hr=%x\n", hr);
+            break;
+        }
+
+        m_hStopEvent = ::CreateEventW(
+            nullptr, // lpEventAttributes
+            TRUE, // bManualReset
+            FALSE, // bInitialState
+            nullptr); // lpName
+        if (!m_hStopEvent)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateEventW failed, hr=%x\n", hr);
+            break;
+        }
+
+        m_hFlushThread = ::CreateThread(
+            nullptr, // lpThreadAttributes
+            0, // dwStackSize
+            FlushThreadProc,
+            this, // lpParameter
+            0, // dwCreationFlags
+            nullptr); // lpThreadId
+        if (!m_hFlushThread)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateThread failed, hr=%x\n", hr);
+            break;
+        }
+
+        ATLTRACE(L"Journal opened in [%s]\n", m_strDirectory.Get());
+    } while (false);
+
+    if (FAILED(hr))
+    {
+        Close();
+    }
+
+    return hr;
+}
+
+size_t CEventJournal::Replay(
+    CEventDispatcher& objDispatcher,
+    const CPMIExitModuleEventSource& objEventSource)
+{
+    CStaticBuffer<DWORD, g_cMaxJournalSegments> bufNumbers;
+    size_t cNumbers = 0;
+    size_t cReplayed = 0;
+
+    // Everything open now was recovered. Segments that replaying creates are not walked.
+    ::AcquireSRWLockExclusive(&m_lock);
+    for (size_t i = 0; i < m_bufSegments.GetLength(); i++)
+    {
+        Segment& objSegment = m_bufSegments.Get()[i];
+        if (objSegment.dwNumber != 0 && objSegment.cPending > 0)
+        {
+            objSegment.fReplaying = true;
+            bufNumbers.Get()[cNumbers++] = objSegment.dwNumber;
+        }
+    }
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+
+    for (size_t i = 0; i < cNumbers; i++)
+    {
+        ::AcquireSRWLockExclusive(&m_lock);
+        Segment* pSegment = FindSegment(bufNumbers.Get()[i]);
+        ::ReleaseSRWLockExclusive(&m_lock);
+        if (!pSegment)
+        {
+            continue;
+        }
+
+        // fReplaying keeps the flush thread from unmapping the segment.
+        for (size_t cbOffset = g_cbJournalSegmentHeader; cbOffset < pSegment->cbWritten;)
+        {
+            JournalRecordHeader& stHeader = *reinterpret_cast<JournalRecordHeader*>(pSegment->pbView + cbOffset);
+            cbOffset += AlignRecord(sizeof(stHeader) + stHeader.cbPayload);
+            if (stHeader.lState != JOURNAL_RECORD_PENDING)
+            {
+                continue;
+            }
+
+            CCertIssuedEvent* pEvent = nullptr;
+            HRESULT hr = ReadEventRecord(stHeader, OUT pEvent);
+            if (FAILED(hr))
+            {
+                // Left pending, it would keep its segment forever and the journal would fill up.
+                ATLTRACE(L"Failed to read journal record %I64u, hr=%x\n", stHeader.ullSequence, hr);
+                CHeapWString strQuarantinePath;
+                HRESULT hrQuarantine = QuarantineRecord(m_strDirectory.Get(), stHeader, OUT strQuarantinePath);
+                if (FAILED(hrQuarantine))
+                {
+                    ATLTRACE(L"Failed to quarantine journal record %I64u, hr=%x\n", stHeader.ullSequence, hrQuarantine);
+                }
+
+                objEventSource.ReportJournalRecordQuarantined(
+                    hr,
+                    SUCCEEDED(hrQuarantine) ? strQuarantinePath.Get() : L"");
+
+                ::AcquireSRWLockExclusive(&m_lock);
+                stHeader.lState = JOURNAL_RECORD_QUARANTINED;
+                pSegment->cPending--;
+                ::ReleaseSRWLockExclusive(&m_lock);
+                continue;
+            }
+
+            ATLTRACE(L"Replaying journal record %I64u, SerialNumber=[%s]\n", stHeader.ullSequence, pEvent->GetSerialNumber());
+
+            // The dispatcher journals the event again before this record is marked delivered.
+            objDispatcher.Post(pEvent);
+            cReplayed++;
+
+            ::AcquireSRWLockExclusive(&m_lock);
+            stHeader.lState = JOURNAL_RECORD_DELIVERED;
+            pSegment->cPending--;
+            ::ReleaseSRWLockExclusive(&m_lock);
+        }
+
+        ::AcquireSRWLockExclusive(&m_lock);
+        pSegment->fReplaying = false;
+        ::ReleaseSRWLockExclusive(&m_lock);
+    }
+
+    ATLTRACE(L"Replayed %d journaled events.\n", cReplayed);
+    return cReplayed;
+}
+
+void CEventJournal::Close()
+{
+    if (m_hFlushThread)
+    {
+        ::SetEvent(m_hStopEvent);
+
+        // The thread flushes once more before it exits.
+        ::WaitForSingleObject(m_hFlushThread, INFINITE);
+        ::CloseHandle(m_hFlushThread);
+        m_hFlushThread = NULL;
+    }
+
+    if (m_hStopEvent)
+    {
+        ::CloseHandle(m_hStopEvent);
+        m_hStopEvent = NULL;
+    }
+
+    for (size_t i = 0; i < m_bufSegments.GetLength(); i++)
+    {
+        Segment& objSegment = m_bufSegments.Get()[i];
+        if (objSegment.dwNumber != 0)
+        {
+            UnmapSegment(objSegment, objSegment.cPending == 0); // fDelete
+        }
+    }
+
+    m_bufSegments.Clear();
+    m_pCurrent = nullptr;
+
+    ATLTRACE(L"Journal closed. Appends=%d, flushes=%d\n", m_cAppends, m_cFlushes);
+}
+
+HRESULT CEventJournal::Append(
+    CCertIssuedEvent& objEvent)
+{
+    HRESULT hr = S_OK;
+
+    if (!IsOpen())
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+    }
+
+    const CBuffer<BYTE>& bufRawCert = objEvent.GetRawCert();
+    JournalEventPayload stPayload;
+    stPayload.lExitEvent = objEvent.GetExitEvent();
+    stPayload.lContext = objEvent.GetContext();
+    stPayload.cchSubjectKeyIdentifier = (DWORD)GetStringLength(objEvent.GetSubjectKeyIdentifier());
+    stPayload.cchSerialNumber = (DWORD)GetStringLength(objEvent.GetSerialNumber());
+    stPayload.cbRawCert = (DWORD)bufRawCert.GetSize();
+    size_t cchRequesterName = GetStringLength(objEvent.GetRequesterName());
+
+    size_t cbPayload =
+        sizeof(stPayload) +
+        ((size_t)stPayload.cchSubjectKeyIdentifier + stPayload.cchSerialNumber) * sizeof(WCHAR) +
+        stPayload.cbRawCert +
+        cchRequesterName * sizeof(WCHAR);
+    size_t cbRecord = AlignRecord(sizeof(JournalRecordHeader) + cbPayload);
+    if (cbRecord > g_cbJournalSegment - g_cbJournalSegmentHeader)
+    {
+        ATLTRACE(L"Event of %d bytes does not fit in a journal segment.\n", cbRecord);
+        return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+    }
+
+    ::AcquireSRWLockExclusive(&m_lock);
+
+    do
+    {
+        if (!m_pCurrent || m_pCurrent->cbWritten + cbRecord > g_cbJournalSegment)
+        {
+            hr = StartSegment();
+            if (FAILED(hr))
+            {
+                ATLTRACE(L"CEventJournal::StartSegment failed, hr=%x\n", hr);
+                break;
+            }
+        }
+
+        size_t cbOffset = m_pCurrent->cbWritten;
+        JournalRecordHeader* pHeader = reinterpret_cast<JournalRecordHeader*>(m_pCurrent->pbView + cbOffset);
+
+        BYTE* pbCurrent = reinterpret_cast<BYTE*>(pHeader + 1);
+        pbCurrent = AppendBytes(pbCurrent, &stPayload, sizeof(stPayload));
+        pbCurrent = AppendBytes(
+            pbCurrent,
+            objEvent.GetSubjectKeyIdentifier(),
+            stPayload.cchSubjectKeyIdentifier * sizeof(WCHAR));
+        pbCurrent = AppendBytes(
+            pbCurrent,
+            objEvent.GetSerialNumber(),
+            stPayload.cchSerialNumber * sizeof(WCHAR));
+        pbCurrent = AppendBytes(pbCurrent, bufRawCert.Get(), stPayload.cbRawCert);
+        AppendBytes(
+            pbCurrent,
+            objEvent.GetRequesterName(),
+            cchRequesterName * sizeof(WCHAR));
+
+        pHeader->cbPayload = (DWORD)cbPayload;
+        pHeader->lState = JOURNAL_RECORD_PENDING;
+        pHeader->ullSequence = m_ullNextSequence++;
+        pHeader->dwCrc = ComputeRecordCrc(*pHeader);
+        pHeader->dwMagic = g_dwJournalRecordMagic;
+
+        m_pCurrent->cbWritten += cbRecord;
+        m_pCurrent->cPending++;
+        objEvent.SetJournalPosition(MakePosition(m_pCurrent->dwNumber, cbOffset));
+    } while (false);
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+
+    if (SUCCEEDED(hr))
+    {
+        ::InterlockedIncrement(&m_cAppends);
+    }
+
+    return hr;
+}
+
+void CEventJournal::Checkpoint(
+    const CCertIssuedEvent& objEvent)
+{
+    Checkpoint(objEvent.GetJournalPosition());
+}
+
+void CEventJournal::Checkpoint(
+    ULONGLONG ullPosition)
+{
+    if (ullPosition == 0)
+    {
+        return;
+    }
+
+    DWORD dwNumber = (DWORD)(ullPosition >> 32);
+    size_t cbOffset = (DWORD)ullPosition;
+
+    ::AcquireSRWLockExclusive(&m_lock);
+    Segment* pSegment = FindSegment(dwNumber);
+    if (pSegment)
+    {
+        JournalRecordHeader* pHeader = reinterpret_cast<JournalRecordHeader*>(pSegment->pbView + cbOffset);
+        pHeader->lState = JOURNAL_RECORD_DELIVERED;
+        pSegment->cPending--;
+    }
+    else
+    {
+        ATLTRACE(L"Journal segment %d is not open.\n", dwNumber);
+    }
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+}
+
+HRESULT CEventJournal::FormatSegmentPath(
+    DWORD dwNumber,
+    OUT CHeapWString& strPath) const
+{
+    size_t cch = wcslen(m_strDirectory.Get()) + wcslen(g_pwszJournalFilePrefix) + 16;
+    if (!strPath.Alloc(cch))
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    return ::StringCchPrintfW(
+        strPath.Get(),
+        strPath.GetLength(),
+        L"%s\\%s%08u.dat",
+        m_strDirectory.Get(),
+        g_pwszJournalFilePrefix,
+        dwNumber);
+}
+
+HRESULT CEventJournal::MapSegment(
+    DWORD dwNumber,
+    bool fCreate,
+    OUT Segment& objSegment) const
+{
+    HRESULT hr = S_OK;
+    CHeapWString strPath;
+
+    do
+    {
+        hr = FormatSegmentPath(dwNumber, OUT strPath);
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        objSegment.hFile = ::CreateFileW(
+            strPath.Get(),
+            GENERIC_READ | GENERIC_WRITE,
+            0, // dwShareMode
+            nullptr, // lpSecurityAttributes
+            fCreate ? CREATE_ALWAYS : OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL,
+            NULL); // hTemplateFile
+        if (objSegment.hFile == INVALID_HANDLE_VALUE)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateFileW(%s) failed, hr=%x\n", strPath.Get(), hr);
+            break;
+        }
+
+        if (!fCreate)
+        {
+            LARGE_INTEGER liSize;
+            if (!::GetFileSizeEx(objSegment.hFile, &liSize) || (ULONGLONG)liSize.QuadPart != g_cbJournalSegment)
+            {
+                hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+                ATLTRACE(L"Journal segment [%s] has the wrong size.\n", strPath.Get());
+                break;
+            }
+        }
+
+        // Mapping a new file extends it to the full segment size filled with zeros.
+        objSegment.hMapping = ::CreateFileMappingW(
+            objSegment.hFile,
+            nullptr, // lpFileMappingAttributes
+            PAGE_READWRITE,
+            0, // dwMaximumSizeHigh
+            (DWORD)g_cbJournalSegment,
+            nullptr); // lpName
+        if (!objSegment.hMapping)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateFileMappingW(%s) failed, hr=%x\n", strPath.Get(), hr);
+            break;
+        }
+
+        objSegment.pbView = static_cast<BYTE*>(::MapViewOfFile(
+            objSegment.hMapping,
+            FILE_MAP_READ | FILE_MAP_WRITE,
+            0, // dwFileOffsetHigh
+            0, // dwFileOffsetLow
+            g_cbJournalSegment));
+        if (!objSegment.pbView)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"MapViewOfFile(%s) failed, hr=%x\n", strPath.Get(), hr);
+            break;
+        }
+
+        objSegment.dwNumber = dwNumber;
+    } while (false);
+
+    if (FAILED(hr))
+    {
+        UnmapSegment(objSegment, false); // fDelete
+        if (fCreate && strPath.Get())
+        {
+            ::DeleteFileW(strPath.Get());
+        }
+    }
+
+    return hr;
+}
+
+void CEventJournal::UnmapSegment(
+    Segment& objSegment,
+    bool fDelete) const
+{
+    if (objSegment.pbView)
+    {
+        ::UnmapViewOfFile(objSegment.pbView);
+    }
+
+    if (objSegment.hMapping)
+    {
+        ::CloseHandle(objSegment.hMapping);
+    }
+
+    if (objSegment.hFile && objSegment.hFile != INVALID_HANDLE_VALUE)
+    {
+        ::CloseHandle(objSegment.hFile);
+    }
+
+    if (fDelete && objSegment.dwNumber != 0)
+    {
+        CHeapWString strPath;
+        if (SUCCEEDED(FormatSegmentPath(objSegment.dwNumber, OUT strPath)) &&
+            !::DeleteFileW(strPath.Get()))
+        {
+            ATLTRACE(
+                L"Failed to delete journal segment [%s], hr=%x\n",
+                strPath.Get(),
+                HRESULT_FROM_WIN32(::GetLastError()));
+        }
+    }
+
+    ZeroMemory(&objSegment, sizeof(objSegment));
+    objSegment.hFile = INVALID_HANDLE_VALUE;
+}
+
+HRESULT CEventJournal::Recover()
+{
+    HRESULT hr = S_OK;
+    CHeapWString strSearch;
+    WIN32_FIND_DATAW stFindData;
+    size_t cchDirectory = wcslen(m_strDirectory.Get());
+
+    if (!strSearch.Alloc(cchDirectory + wcslen(g_pwszJournalFileSearch) + 2))
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    hr = ::StringCchPrintfW(
+        strSearch.Get(),
+        strSearch.GetLength(),
+        L"%s\\%s",
+        m_strDirectory.Get(),
+        g_pwszJournalFileSearch);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    HANDLE hFind = ::FindFirstFileW(strSearch.Get(), &stFindData);
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        DWORD dwError = ::GetLastError();
+        return (dwError == ERROR_FILE_NOT_FOUND) ? S_OK : HRESULT_FROM_WIN32(dwError);
+    }
+
+    do
+    {
+        DWORD dwNumber = wcstoul(stFindData.cFileName + wcslen(g_pwszJournalFilePrefix), nullptr, 10);
+        if (dwNumber == 0)
+        {
+            continue;
+        }
+
+        if (dwNumber >= m_dwNextNumber)
+        {
+            m_dwNextNumber = dwNumber + 1;
+        }
+
+        Segment* pSegment = FindFreeSlot();
+        if (!pSegment)
+        {
+            // The rest is picked up after the recovered segments are delivered and deleted.
+            ATLTRACE(L"Too many journal segments. Skipping [%s]\n", stFindData.cFileName);
+            continue;
+        }
+
+        HRESULT hrMap = MapSegment(dwNumber, false, OUT *pSegment);
+        if (FAILED(hrMap))
+        {
+            ATLTRACE(L"Failed to map journal segment [%s], hr=%x\n", stFindData.cFileName, hrMap);
+            continue;
+        }
+
+        RecoverSegment(*pSegment);
+    } while (::FindNextFileW(hFind, &stFindData));
+
+    ::FindClose(hFind);
+    return S_OK;
+}
+
+void CEventJournal::RecoverSegment(
+    Segment& objSegment)
+{
+    const JournalSegmentHeader* pSegmentHeader = reinterpret_cast<const JournalSegmentHeader*>(objSegment.pbView);
+    if (pSegmentHeader->dwMagic != g_dwJournalSegmentMagic ||
+        pSegmentHeader->wVersion != g_wJournalVersion ||
+        pSegmentHeader->dwNumber != objSegment.dwNumber ||
+        pSegmentHeader->cbSegment != g_cbJournalSegment)
+    {
+        // Keep the file for investigation, but do not replay from it.
+        ATLTRACE(L"Journal segment %d has an invalid header.\n", objSegment.dwNumber);
+        UnmapSegment(objSegment, false); // fDelete
+        return;
+    }
+
+    size_t cbOffset = g_cbJournalSegmentHeader;
+    while (cbOffset + sizeof(JournalRecordHeader) <= g_cbJournalSegment)
+    {
+        const JournalRecordHeader* pHeader = reinterpret_cast<const JournalRecordHeader*>(objSegment.pbView + cbOffset);
+        if (pHeader->dwMagic != g_dwJournalRecordMagic)
+        {
+            break;
+        }
+
+        if (pHeader->cbPayload > g_cbJournalSegment - cbOffset - sizeof(JournalRecordHeader) ||
+            ComputeRecordCrc(*pHeader) != pHeader->dwCrc)
+        {
+            // Torn write. Nothing after it was appended.
+            ATLTRACE(L"Journal segment %d has a torn record at offset %d.\n", objSegment.dwNumber, cbOffset);
+            break;
+        }
+
+        if (pHeader->lState == JOURNAL_RECORD_PENDING)
+        {
+            objSegment.cPending++;
+        }
+
+        if (pHeader->ullSequence >= m_ullNextSequence)
+        {
+            m_ullNextSequence = pHeader->ullSequence + 1;
+        }
+
+        cbOffset += AlignRecord(sizeof(JournalRecordHeader) + pHeader->cbPayload);
+    }
+
+    objSegment.cbWritten = cbOffset;
+    objSegment.cbFlushed = cbOffset;
+    objSegment.fSealed = true;
+
+    ATLTRACE(L"Recovered journal segment %d with %d pending events.\n", objSegment.dwNumber, objSegment.cPending);
+}
+
+CEventJournal::Segment* CEventJournal::FindFreeSlot()
+{
+    return FindSegment(0);
+}
+
+CEventJournal::Segment* CEventJournal::FindSegment(
+    DWORD dwNumber)
+{
+    for (size_t i = 0; i < m_bufSegments.GetLength(); i++)
+    {
+        if (m_bufSegments.Get()[i].dwNumber == dwNumber)
+        {
+            return &m_bufSegments.Get()[i];
+        }
+    }
+
+    return nullptr;
+}
+
+HRESULT CEventJournal::StartSegment()
+{
+    if (m_pCurrent)
+    {
+        m_pCurrent->fSealed = true;
+        m_pCurrent = nullptr;
+    }
+
+    Segment* pSegment = FindFreeSlot();
+    if (!pSegment)
+    {
+        ATLTRACE(L"Every journal segment holds undelivered events.\n");
+        return HRESULT_FROM_WIN32(ERROR_DISK_FULL);
+    }
+
+    HRESULT hr = MapSegment(m_dwNextNumber, true, OUT *pSegment);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    m_dwNextNumber++;
+
+    JournalSegmentHeader* pHeader = reinterpret_cast<JournalSegmentHeader*>(pSegment->pbView);
+    pHeader->wVersion = g_wJournalVersion;
+    pHeader->dwNumber = pSegment->dwNumber;
+    pHeader->cbSegment = (DWORD)g_cbJournalSegment;
+    pHeader->dwMagic = g_dwJournalSegmentMagic;
+
+    pSegment->cbWritten = g_cbJournalSegmentHeader;
+    m_pCurrent = pSegment;
+    return S_OK;
+}
+
+DWORD WINAPI CEventJournal::FlushThreadProc(
+    LPVOID pvParam)
+{
+    static_cast<CEventJournal*>(pvParam)->RunFlush();
+    return 0;
+}
+
+void CEventJournal::RunFlush()
+{
+    while (::WaitForSingleObject(m_hStopEvent, g_dwJournalFlushIntervalMSecs) == WAIT_TIMEOUT)
+    {
+        FlushSegments();
+    }
+
+    FlushSegments();
+}
+
+void CEventJournal::FlushSegments()
+{
+    struct FlushItem
+    {
+        Segment* pSegment;
+        size_t cbFrom;
+        size_t cbTo;
+    };
+
+    CStaticBuffer<FlushItem, g_cMaxJournalSegments> bufItems;
+    size_t cItems = 0;
+
+    // Only this thread unmaps segments while the journal is open, so the views stay valid
+    // while they are flushed outside the lock.
+    ::AcquireSRWLockExclusive(&m_lock);
+    for (size_t i = 0; i < m_bufSegments.GetLength(); i++)
+    {
+        Segment& objSegment = m_bufSegments.Get()[i];
+        if (objSegment.dwNumber == 0)
+        {
+            continue;
+        }
+
+        if (objSegment.fSealed && objSegment.cPending == 0 && !objSegment.fReplaying)
+        {
+            ATLTRACE(L"Deleting delivered journal segment %d\n", objSegment.dwNumber);
+            UnmapSegment(objSegment, true); // fDelete
+            continue;
+        }
+
+        if (objSegment.cbWritten > objSegment.cbFlushed)
+        {
+            FlushItem& stItem = bufItems.Get()[cItems++];
+            stItem.pSegment = &objSegment;
+            stItem.cbFrom = objSegment.cbFlushed;
+            stItem.cbTo = objSegment.cbWritten;
+        }
+    }
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+
+    if (cItems == 0)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < cItems; i++)
+    {
+        FlushItem& stItem = bufItems.Get()[i];
+        if (!::FlushViewOfFile(stItem.pSegment->pbView + stItem.cbFrom, stItem.cbTo - stItem.cbFrom) ||
+            !::FlushFileBuffers(stItem.pSegment->hFile))
+        {
+            // Retried on the next pass.
+            ATLTRACE(L"Failed to flush journal segment %d, hr=%x\n", stItem.pSegment->dwNumber, HRESULT_FROM_WIN32(::GetLastError()));
+            stItem.cbTo = stItem.cbFrom;
+        }
+    }
+
+    ::AcquireSRWLockExclusive(&m_lock);
+    for (size_t i = 0; i < cItems; i++)
+    {
+        FlushItem& stItem = bufItems.Get()[i];
+        if (stItem.cbTo > stItem.pSegment->cbFlushed)
+        {
+            stItem.pSegment->cbFlushed = stItem.cbTo;
+        }
+    }
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+    ::InterlockedIncrement(&m_cFlushes);
+}
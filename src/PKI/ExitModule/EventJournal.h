@@ -0,0 +1,233 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventJournal.h
+
+    Abstract:
+
+        CEventJournal class declaration.
+
+--*/
+
+class CCertIssuedEvent;
+class CEventDispatcher;
+class CPMIExitModuleEventSource;
+
+/*++
+
+    Abstract:
+
+        Write-ahead journal of events that have not been delivered to the event processor yet.
+
+    Remarks:
+
+        The journal is a set of fixed size segment files that are memory mapped. Each event
+        is appended as a checksummed record before it is queued. When a worker is done with
+        the event, the state word in its record is set to delivered. A segment file is deleted
+        once it is full and every record in it has been delivered.
+
+        Records are in the file system cache as soon as Append() returns, so they survive a
+        CertSvc crash or restart. A background thread flushes new records to disk every
+        g_dwJournalFlushIntervalMSecs, so one flush covers every event appended in that window.
+        A power loss can lose the records appended since the last flush.
+
+        Delivery is at least once. An event that was being delivered when CertSvc stopped is
+        delivered again after the restart.
+
+        Segment layout:
+            JournalSegmentHeader at offset 0.
+            JournalRecordHeader + payload, 8 byte aligned, starting at g_cbJournalSegmentHeader.
+            Zeros after the last record.
+
+        Event record payload:
+            LONG lExitEvent, LONG lContext, DWORD cchSubjectKeyIdentifier, DWORD cchSerialNumber,
+            DWORD cbRawCert, then the subject key identifier and serial number WCHARs without
+            null terminators, then the raw cert bytes, then the requester name WCHARs without a
+            null terminator. The requester name runs to the end of the payload and is empty in
+            records from older versions.
+--*/
+class CEventJournal
+{
+public:
+    CEventJournal();
+    ~CEventJournal();
+
+    /*++
+
+        Abstract:
+
+            Opens the journal and recovers segments left by a previous run.
+
+        Parameters:
+
+            pwszDirectory - directory for the segment files. It is created if it does not exist.
+
+        Returns:
+
+            S_OK - success.
+            other - error code. The journal is not open.
+
+        Remarks:
+
+            Call Replay() after the dispatcher is started to deliver recovered events.
+    --*/
+    HRESULT Open(
+        LPCWSTR pwszDirectory);
+
+    /*++
+
+        Abstract:
+
+            Posts the undelivered events recovered by Open() to the dispatcher.
+
+        Parameters:
+
+            objDispatcher - the dispatcher. It appends each event to the journal again.
+            objEventSource - reports records that cannot be read.
+
+        Returns:
+
+            The number of events that were replayed.
+
+        Remarks:
+
+            A record that cannot be read is copied to a PMIJournal.Quarantine.<sequence>.bad
+            file, reported, and marked so it is not tried again. Otherwise it would keep its
+            segment, and the journal would stop accepting events once every segment was kept.
+    --*/
+    size_t Replay(
+        CEventDispatcher& objDispatcher,
+        const CPMIExitModuleEventSource& objEventSource);
+
+    /*++
+
+        Abstract:
+
+            Flushes the journal and closes it.
+
+        Remarks:
+
+            Call after the dispatcher is stopped. Undelivered records stay on disk for the next Open().
+    --*/
+    void Close();
+
+    inline bool IsOpen() const
+    {
+        return m_hFlushThread != NULL;
+    }
+
+    /*++
+
+        Abstract:
+
+            Appends an event to the journal.
+
+        Parameters:
+
+            objEvent - the event. On success, its journal position is set.
+
+        Returns:
+
+            S_OK - success.
+            other - error code. The event is not journaled but can still be delivered.
+    --*/
+    HRESULT Append(
+        CCertIssuedEvent& objEvent);
+
+    /*++
+
+        Abstract:
+
+            Records that an event has been delivered.
+
+        Parameters:
+
+            objEvent - the event. Events without a journal position are ignored.
+    --*/
+    void Checkpoint(
+        const CCertIssuedEvent& objEvent);
+
+    /*++
+
+        Abstract:
+
+            Records that an event has been delivered, after the event itself is gone.
+
+        Parameters:
+
+            ullPosition - the event's journal position. 0 is ignored.
+    --*/
+    void Checkpoint(
+        ULONGLONG ullPosition);
+
+    inline LONG GetAppendCount() const
+    {
+        return m_cAppends;
+    }
+
+    inline LONG GetFlushCount() const
+    {
+        return m_cFlushes;
+    }
+
+private:
+    /*++
+
+        Abstract:
+
+            A mapped segment file.
+
+    --*/
+    struct Segment
+    {
+        DWORD dwNumber;
+        HANDLE hFile;
+        HANDLE hMapping;
+        BYTE* pbView;
+        size_t cbWritten;
+        size_t cbFlushed;
+        LONG cPending;
+        bool fSealed;
+        bool fReplaying;
+    };
+
+    SRWLOCK m_lock;
+    CHeapWString m_strDirectory;
+    CHeapBuffer<Segment> m_bufSegments;
+    Segment* m_pCurrent;
+    DWORD m_dwNextNumber;
+    ULONGLONG m_ullNextSequence;
+    HANDLE m_hStopEvent;
+    HANDLE m_hFlushThread;
+    volatile LONG m_cAppends;
+    volatile LONG m_cFlushes;
+
+    HRESULT FormatSegmentPath(
+        DWORD dwNumber,
+        OUT CHeapWString& strPath) const;
+    HRESULT MapSegment(
+        DWORD dwNumber,
+        bool fCreate,
+        OUT Segment& objSegment) const;
+    void UnmapSegment(
+        Segment& objSegment,
+        bool fDelete) const;
+    HRESULT Recover();
+    void RecoverSegment(
+        Segment& objSegment);
+    Segment* FindFreeSlot();
+    Segment* FindSegment(
+        DWORD dwNumber);
+    HRESULT StartSegment();
+    static DWORD WINAPI FlushThreadProc(
+        LPVOID pvParam);
+    void RunFlush();
+    void FlushSegments();
+
+    CEventJournal(const CEventJournal&) = delete;
+    CEventJournal& operator=(const CEventJournal&) = delete;
+};
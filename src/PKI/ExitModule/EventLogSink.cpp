@@ -0,0 +1,394 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventLogSink.cpp
+
+    Abstract:
+
+        EventLogRecord and event log sink class impl.
+
+--*/
+
+#include "pch.h"
+#include "EventLogSink.h"
+
+// The string pointers follow the record, so it has to end on a pointer boundary.
+static_assert(sizeof(EventLogRecord) % sizeof(LPCWSTR) == 0, "EventLogRecord size must be pointer aligned.");
+
+// Longest line prefix. Time, type, category and event ID.
+constexpr const size_t g_cchMaxLinePrefix = 64;
+
+namespace
+{
+    /*++
+
+        Abstract:
+
+            Writes a line of text, or only counts it when there is no output buffer.
+
+    --*/
+    class CLineWriter
+    {
+    public:
+        CLineWriter(
+            LPWSTR pwchOut)
+            : m_pwchOut(pwchOut), m_cch(0)
+        {
+        }
+
+        inline size_t GetLength() const
+        {
+            return m_cch;
+        }
+
+        void Put(
+            WCHAR wch)
+        {
+            if (m_pwchOut)
+            {
+                m_pwchOut[m_cch] = wch;
+            }
+
+            m_cch++;
+        }
+
+        void PutRaw(
+            LPCWSTR pwsz)
+        {
+            for (LPCWSTR p = pwsz; *p; p++)
+            {
+                Put(*p);
+            }
+        }
+
+        void PutField(
+            LPCWSTR pwsz)
+        {
+            // Keep one record per line and one string per field.
+            for (LPCWSTR p = pwsz; *p; p++)
+            {
+                Put((*p == L'\t' || *p == L'\r' || *p == L'\n') ? L' ' : *p);
+            }
+        }
+
+    private:
+        LPWSTR m_pwchOut;
+        size_t m_cch;
+    };
+}
+
+EventLogRecord* EventLogRecord::Create(
+    WORD wType,
+    WORD wCategory,
+    DWORD dwEventID,
+    const CBuffer<LPCWSTR>& bufStrings,
+    const CBuffer<BYTE>& bufData,
+    const PSID pUserSid)
+{
+    if (bufStrings.GetLength() > MAXWORD || bufData.GetSize() > MAXDWORD)
+    {
+        return nullptr;
+    }
+
+    DWORD cbSid = pUserSid ? ::GetLengthSid(pUserSid) : 0;
+    size_t cchText = 0;
+    for (size_t i = 0; i < bufStrings.GetLength(); i++)
+    {
+        LPCWSTR pwsz = bufStrings.Get()[i];
+        cchText += (pwsz ? wcslen(pwsz) : 0) + 1;
+    }
+
+    // Record, string pointers, SID, strings, data. Each part keeps the alignment the next needs.
+    size_t cbRecord =
+        sizeof(EventLogRecord) +
+        bufStrings.GetLength() * sizeof(LPCWSTR) +
+        cbSid +
+        cchText * sizeof(WCHAR) +
+        bufData.GetSize();
+    BYTE* pbRecord = new BYTE[cbRecord];
+    if (!pbRecord)
+    {
+        return nullptr;
+    }
+
+    EventLogRecord* pRecord = reinterpret_cast<EventLogRecord*>(pbRecord);
+    BYTE* pbNext = pbRecord + sizeof(EventLogRecord);
+
+    pRecord->wType = wType;
+    pRecord->wCategory = wCategory;
+    pRecord->dwEventID = dwEventID;
+    pRecord->cStrings = (WORD)bufStrings.GetLength();
+    pRecord->cbData = (DWORD)bufData.GetSize();
+    ::GetSystemTimeAsFileTime(&pRecord->ftReported);
+
+    pRecord->rgpwszStrings = reinterpret_cast<LPCWSTR*>(pbNext);
+    pbNext += bufStrings.GetLength() * sizeof(LPCWSTR);
+
+    pRecord->pUserSid = nullptr;
+    if (pUserSid)
+    {
+        pRecord->pUserSid = reinterpret_cast<PSID>(pbNext);
+        ::CopySid(cbSid, pRecord->pUserSid, pUserSid);
+        pbNext += cbSid;
+    }
+
+    LPWSTR pwchText = reinterpret_cast<LPWSTR>(pbNext);
+    for (size_t i = 0; i < bufStrings.GetLength(); i++)
+    {
+        LPCWSTR pwsz = bufStrings.Get()[i];
+        size_t cch = pwsz ? wcslen(pwsz) : 0;
+        if (cch > 0)
+        {
+            memcpy(pwchText, pwsz, cch * sizeof(WCHAR));
+        }
+
+        pwchText[cch] = L'\0';
+        pRecord->rgpwszStrings[i] = pwchText;
+        pwchText += cch + 1;
+    }
+
+    pbNext = reinterpret_cast<BYTE*>(pwchText);
+    pRecord->pbData = nullptr;
+    if (bufData.GetSize() > 0)
+    {
+        memcpy(pbNext, bufData.Get(), bufData.GetSize());
+        pRecord->pbData = pbNext;
+    }
+
+    return pRecord;
+}
+
+void EventLogRecord::Free(
+    const EventLogRecord* pRecord)
+{
+    delete[] reinterpret_cast<const BYTE*>(pRecord);
+}
+
+CReportEventSink::CReportEventSink()
+    : m_hEventLog(NULL)
+{
+}
+
+CReportEventSink::~CReportEventSink()
+{
+    if (m_hEventLog)
+    {
+        ::DeregisterEventSource(m_hEventLog);
+        m_hEventLog = NULL;
+    }
+}
+
+HRESULT CReportEventSink::Open(
+    LPCWSTR pwszProviderName)
+{
+    HRESULT hr = S_OK;
+    m_hEventLog = ::RegisterEventSourceW(
+        NULL, // lpUNCServerName
+        pwszProviderName); // lpSourceName
+    if (!m_hEventLog)
+    {
+        hr = HRESULT_FROM_WIN32(::GetLastError());
+        ATLTRACE(L"RegisterEventSourceW(%s) failed, hr=%x\n", pwszProviderName, hr);
+    }
+
+    return hr;
+}
+
+HRESULT CReportEventSink::Write(
+    const CBuffer<const EventLogRecord*>& bufRecords)
+{
+    HRESULT hrFirst = S_OK;
+    if (!m_hEventLog)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+    }
+
+    // The event log has no batch API. The batch still saves a thread switch per event.
+    for (size_t i = 0; i < bufRecords.GetLength(); i++)
+    {
+        const EventLogRecord& stRecord = *bufRecords.Get()[i];
+        if (!::ReportEventW(
+            m_hEventLog,
+            stRecord.wType,
+            stRecord.wCategory,
+            stRecord.dwEventID,
+            stRecord.pUserSid,
+            stRecord.cStrings,
+            stRecord.cbData,
+            stRecord.rgpwszStrings,
+            const_cast<LPBYTE>(stRecord.pbData)))
+        {
+            HRESULT hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"ReportEventW failed, hr=%x\n", hr);
+            if (SUCCEEDED(hrFirst))
+            {
+                hrFirst = hr;
+            }
+        }
+    }
+
+    return hrFirst;
+}
+
+CFileEventLogSink::CFileEventLogSink()
+    : m_hFile(INVALID_HANDLE_VALUE)
+{
+    ::InitializeSRWLock(&m_lock);
+}
+
+CFileEventLogSink::~CFileEventLogSink()
+{
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        ::CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+}
+
+HRESULT CFileEventLogSink::Open(
+    LPCWSTR pwszPath)
+{
+    HRESULT hr = S_OK;
+    m_hFile = ::CreateFileW(
+        pwszPath,
+        FILE_APPEND_DATA,
+        FILE_SHARE_READ,
+        nullptr, // lpSecurityAttributes
+        OPEN_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL); // hTemplateFile
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        hr = HRESULT_FROM_WIN32(::GetLastError());
+        ATLTRACE(L"::CreateFileW(%s) failed, hr=%x\n", pwszPath, hr);
+    }
+
+    return hr;
+}
+
+HRESULT CFileEventLogSink::Write(
+    const CBuffer<const EventLogRecord*>& bufRecords)
+{
+    HRESULT hr = S_OK;
+    CHeapBuffer<WCHAR> bufText;
+    CHeapBuffer<BYTE> bufUtf8;
+
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+    }
+
+    do
+    {
+        // Measure, then write into a buffer of exactly that size.
+        size_t cch = FormatLines(bufRecords, nullptr);
+        if (cch == 0)
+        {
+            break;
+        }
+
+        if (cch > MAXINT || !bufText.Alloc(cch))
+        {
+            hr = E_OUTOFMEMORY;
+            ATLTRACE(L"Failed to alloc %d wchars for event log lines.\n", cch);
+            break;
+        }
+
+        FormatLines(bufRecords, bufText.Get());
+
+        int cbUtf8 = ::WideCharToMultiByte(
+            CP_UTF8,
+            0, // dwFlags
+            bufText.Get(),
+            (int)cch,
+            nullptr, // lpMultiByteStr
+            0, // cbMultiByte
+            nullptr, // lpDefaultChar
+            nullptr); // lpUsedDefaultChar
+        if (cbUtf8 <= 0 || !bufUtf8.Alloc(cbUtf8))
+        {
+            hr = E_OUTOFMEMORY;
+            ATLTRACE(L"Failed to alloc %d bytes for event log lines.\n", cbUtf8);
+            break;
+        }
+
+        cbUtf8 = ::WideCharToMultiByte(
+            CP_UTF8,
+            0, // dwFlags
+            bufText.Get(),
+            (int)cch,
+            reinterpret_cast<LPSTR>(bufUtf8.Get()),
+            cbUtf8,
+            nullptr, // lpDefaultChar
+            nullptr); // lpUsedDefaultChar
+        if (cbUtf8 <= 0)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"::WideCharToMultiByte failed, hr=%x\n", hr);
+            break;
+        }
+
+        // Synchronous writes from other threads must not interleave with a batch.
+        DWORD cbWritten = 0;
+        ::AcquireSRWLockExclusive(&m_lock);
+        BOOL fWritten = ::WriteFile(
+            m_hFile,
+            bufUtf8.Get(),
+            (DWORD)cbUtf8,
+            &cbWritten,
+            nullptr); // lpOverlapped
+        ::ReleaseSRWLockExclusive(&m_lock);
+        if (!fWritten)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"::WriteFile failed, hr=%x\n", hr);
+            break;
+        }
+    } while (false);
+
+    return hr;
+}
+
+size_t CFileEventLogSink::FormatLines(
+    const CBuffer<const EventLogRecord*>& bufRecords,
+    LPWSTR pwchOut)
+{
+    CLineWriter objWriter(pwchOut);
+    for (size_t i = 0; i < bufRecords.GetLength(); i++)
+    {
+        const EventLogRecord& stRecord = *bufRecords.Get()[i];
+        SYSTEMTIME stTime = {};
+        ::FileTimeToSystemTime(&stRecord.ftReported, &stTime);
+
+        WCHAR wszPrefix[g_cchMaxLinePrefix];
+        ::StringCchPrintfW(
+            wszPrefix,
+            g_cchMaxLinePrefix,
+            L"%04u-%02u-%02uT%02u:%02u:%02u.%03uZ\t%u\t%u\t0x%08x",
+            stTime.wYear,
+            stTime.wMonth,
+            stTime.wDay,
+            stTime.wHour,
+            stTime.wMinute,
+            stTime.wSecond,
+            stTime.wMilliseconds,
+            stRecord.wType,
+            stRecord.wCategory,
+            stRecord.dwEventID);
+        objWriter.PutRaw(wszPrefix);
+
+        for (WORD j = 0; j < stRecord.cStrings; j++)
+        {
+            objWriter.Put(L'\t');
+            objWriter.PutField(stRecord.rgpwszStrings[j]);
+        }
+
+        objWriter.Put(L'\r');
+        objWriter.Put(L'\n');
+    }
+
+    return objWriter.GetLength();
+}
@@ -0,0 +1,202 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventLogSink.h
+
+    Abstract:
+
+        EventLogRecord struct and event log sink class declarations.
+
+--*/
+
+/*++
+
+    Abstract:
+
+        One event to write, with the parameters of ReportEventW.
+
+    Remarks:
+
+        Records queued by CEventLogWriter are allocated by Create() as one block that also
+        holds the strings, the SID and the data. A record for a synchronous write can point
+        at the caller's memory instead.
+--*/
+struct EventLogRecord
+{
+    WORD wType;
+    WORD wCategory;
+    DWORD dwEventID;
+    PSID pUserSid;
+    WORD cStrings;
+    DWORD cbData;
+    LPCWSTR* rgpwszStrings;
+    const BYTE* pbData;
+
+    // When the event was reported. The event log stamps the time it is written instead.
+    FILETIME ftReported;
+
+    /*++
+
+        Abstract:
+
+            Allocates a record with a copy of the event.
+
+        Parameters:
+
+            wType - event type.
+            wCategory - event category.
+            dwEventID - event ID.
+            bufStrings - list of strings to include in the event.
+            bufData - custom event data.
+            pUserSid - user SID, or nullptr.
+
+        Returns:
+
+            The record, or nullptr if it could not be allocated. Free it with Free().
+    --*/
+    static EventLogRecord* Create(
+        WORD wType,
+        WORD wCategory,
+        DWORD dwEventID,
+        const CBuffer<LPCWSTR>& bufStrings,
+        const CBuffer<BYTE>& bufData,
+        const PSID pUserSid);
+
+    static void Free(
+        const EventLogRecord* pRecord);
+};
+
+/*++
+
+    Abstract:
+
+        Where event log records are written.
+
+    Remarks:
+
+        CEventLogWriter calls Write() from its thread only. Synchronous writes can come
+        from any thread, so implementations must be thread-safe.
+--*/
+class CEventLogSink
+{
+public:
+    virtual ~CEventLogSink() = default;
+
+    /*++
+
+        Abstract:
+
+            Writes a batch of records in order.
+
+        Parameters:
+
+            bufRecords - the records.
+
+        Returns:
+
+            S_OK - success.
+            other - the first error. The remaining records are still written.
+    --*/
+    virtual HRESULT Write(
+        const CBuffer<const EventLogRecord*>& bufRecords) = 0;
+
+protected:
+    CEventLogSink() = default;
+
+private:
+    CEventLogSink(const CEventLogSink&) = delete;
+    CEventLogSink& operator=(const CEventLogSink&) = delete;
+};
+
+/*++
+
+    Abstract:
+
+        Writes records to the Windows event log with ReportEventW.
+
+--*/
+class CReportEventSink : public CEventLogSink
+{
+public:
+    CReportEventSink();
+    virtual ~CReportEventSink();
+
+    /*++
+
+        Abstract:
+
+            Registers the event source.
+
+        Parameters:
+
+            pwszProviderName - the event source name.
+
+        Returns:
+
+            S_OK - success.
+            other - error.
+    --*/
+    HRESULT Open(
+        LPCWSTR pwszProviderName);
+
+    virtual HRESULT Write(
+        const CBuffer<const EventLogRecord*>& bufRecords);
+
+private:
+    HANDLE m_hEventLog;
+};
+
+/*++
+
+    Abstract:
+
+        Appends records to a UTF-8 text file, one line per record.
+
+    Remarks:
+
+        Used to measure the exit module without the event log, or on a machine where
+        the message DLL is not registered. Each line is tab separated:
+
+            <reported time, UTC ISO 8601>\t<type>\t<category>\t<event ID>\t<string 1>\t...
+
+        Each batch is written with one WriteFile call.
+--*/
+class CFileEventLogSink : public CEventLogSink
+{
+public:
+    CFileEventLogSink();
+    virtual ~CFileEventLogSink();
+
+    /*++
+
+        Abstract:
+
+            Opens the file for append. It is created if it does not exist.
+
+        Parameters:
+
+            pwszPath - the file path.
+
+        Returns:
+
+            S_OK - success.
+            other - error.
+    --*/
+    HRESULT Open(
+        LPCWSTR pwszPath);
+
+    virtual HRESULT Write(
+        const CBuffer<const EventLogRecord*>& bufRecords);
+
+private:
+    HANDLE m_hFile;
+    SRWLOCK m_lock;
+
+    static size_t FormatLines(
+        const CBuffer<const EventLogRecord*>& bufRecords,
+        LPWSTR pwchOut);
+};
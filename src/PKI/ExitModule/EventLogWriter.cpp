@@ -0,0 +1,304 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventLogWriter.cpp
+
+    Abstract:
+
+        CEventLogWriter class impl.
+
+--*/
+
+#include "pch.h"
+#include "EventLogWriter.h"
+
+CEventLogWriter::CEventLogWriter()
+    : m_pSink(nullptr),
+    m_llMask(0),
+    m_llTail(0),
+    m_llHead(0),
+    m_lIdle(0),
+    m_fStopping(false),
+    m_hWakeEvent(NULL),
+    m_hThread(NULL),
+    m_cWritten(0),
+    m_cBatches(0),
+    m_cDropped(0)
+{
+}
+
+CEventLogWriter::~CEventLogWriter()
+{
+    Stop();
+
+    // Only records that were claimed but not published while Stop() ran can be left.
+    for (size_t i = 0; i < m_bufSlots.GetLength(); i++)
+    {
+        EventLogRecord::Free(m_bufSlots.Get()[i].pRecord);
+    }
+}
+
+HRESULT CEventLogWriter::Start(
+    CEventLogSink* pSink,
+    size_t cCapacity)
+{
+    HRESULT hr = S_OK;
+
+    // With one slot, a free sequence for the next lap would read as published.
+    size_t cSlots = 2;
+
+    if (!pSink)
+    {
+        return E_POINTER;
+    }
+
+    while (cSlots < cCapacity)
+    {
+        cSlots <<= 1;
+    }
+
+    do
+    {
+        if (!m_bufSlots.Alloc(cSlots))
+        {
+            hr = E_OUTOFMEMORY;
+            ATLTRACE(L"Failed to alloc %d event log slots.\n", cSlots);
+            break;
+        }
+
+        // Slot i is free for position i on the first lap.
+        for (size_t i = 0; i < cSlots; i++)
+        {
+            m_bufSlots.Get()[i].llSequence = (LONGLONG)i;
+            m_bufSlots.Get()[i].pRecord = nullptr;
+        }
+
+        m_pSink = pSink;
+        m_llMask = (LONGLONG)cSlots - 1;
+        m_llTail = 0;
+        m_llHead = 0;
+        m_lIdle = 0;
+        m_fStopping = false;
+
+        m_hWakeEvent = ::CreateEventW(
+            nullptr, // lpEventAttributes
+            FALSE, // bManualReset
+            FALSE, // bInitialState
+            nullptr); // lpName
+        if (!m_hWakeEvent)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateEventW failed, hr=%x\n", hr);
+            break;
+        }
+
+        m_hThread = ::CreateThread(
+            nullptr, // lpThreadAttributes
+            0, // dwStackSize
+            WriterThreadProc,
+            this, // lpParameter
+            0, // dwCreationFlags
+            nullptr); // lpThreadId
+        if (!m_hThread)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateThread failed, hr=%x\n", hr);
+            break;
+        }
+    } while (false);
+
+    if (FAILED(hr))
+    {
+        Stop();
+    }
+
+    return hr;
+}
+
+void CEventLogWriter::Stop()
+{
+    if (m_hThread)
+    {
+        m_fStopping = true;
+        ::SetEvent(m_hWakeEvent);
+
+        // The thread drains the ring before it exits.
+        ::WaitForSingleObject(m_hThread, INFINITE);
+        ::CloseHandle(m_hThread);
+        m_hThread = NULL;
+
+        // Records published after the thread last looked.
+        Drain();
+    }
+
+    if (m_hWakeEvent)
+    {
+        ::CloseHandle(m_hWakeEvent);
+        m_hWakeEvent = NULL;
+    }
+}
+
+HRESULT CEventLogWriter::Post(
+    WORD wType,
+    WORD wCategory,
+    DWORD dwEventID,
+    const CBuffer<LPCWSTR>& bufStrings,
+    const CBuffer<BYTE>& bufData,
+    const PSID pUserSid)
+{
+    if (!IsRunning())
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+    }
+
+    // Copy before claiming a slot, so the slot is held for as short a time as possible.
+    EventLogRecord* pRecord = EventLogRecord::Create(
+        wType,
+        wCategory,
+        dwEventID,
+        bufStrings,
+        bufData,
+        pUserSid);
+    if (!pRecord)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    Slot* pSlot = nullptr;
+    LONGLONG llPosition = m_llTail;
+    for (;;)
+    {
+        pSlot = &m_bufSlots.Get()[llPosition & m_llMask];
+        LONGLONG llDiff = pSlot->llSequence - llPosition;
+        if (llDiff == 0)
+        {
+            LONGLONG llSeen = ::InterlockedCompareExchange64(&m_llTail, llPosition + 1, llPosition);
+            if (llSeen == llPosition)
+            {
+                break;
+            }
+
+            llPosition = llSeen;
+        }
+        else if (llDiff < 0)
+        {
+            // The writer has not given the slot back from the last lap. The ring is full.
+            ::InterlockedIncrement(&m_cDropped);
+            EventLogRecord::Free(pRecord);
+            return HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW);
+        }
+        else
+        {
+            // Another producer claimed it first.
+            llPosition = m_llTail;
+        }
+    }
+
+    pSlot->pRecord = pRecord;
+    ::InterlockedExchange64(&pSlot->llSequence, llPosition + 1);
+
+    // Only the producer that sees the writer idle pays for the wake up.
+    if (m_lIdle && ::InterlockedExchange(&m_lIdle, 0))
+    {
+        ::SetEvent(m_hWakeEvent);
+    }
+
+    return S_OK;
+}
+
+size_t CEventLogWriter::TakeBatch(
+    const EventLogRecord** rgpRecords)
+{
+    size_t cRecords = 0;
+    while (cRecords < s_cMaxBatch)
+    {
+        Slot& stSlot = m_bufSlots.Get()[m_llHead & m_llMask];
+        if (stSlot.llSequence != m_llHead + 1)
+        {
+            // Empty, or claimed and not published yet. Either way the head has to wait.
+            break;
+        }
+
+        rgpRecords[cRecords++] = stSlot.pRecord;
+        stSlot.pRecord = nullptr;
+
+        // Free for the position one lap ahead.
+        ::InterlockedExchange64(&stSlot.llSequence, m_llHead + m_llMask + 1);
+        m_llHead++;
+    }
+
+    return cRecords;
+}
+
+bool CEventLogWriter::HasPublished() const
+{
+    if (m_bufSlots.GetLength() == 0)
+    {
+        return false;
+    }
+
+    const Slot& stSlot = m_bufSlots.Get()[m_llHead & m_llMask];
+    return stSlot.llSequence == m_llHead + 1;
+}
+
+void CEventLogWriter::Drain()
+{
+    const EventLogRecord* rgpRecords[s_cMaxBatch];
+    for (;;)
+    {
+        size_t cRecords = TakeBatch(rgpRecords);
+        if (cRecords == 0)
+        {
+            break;
+        }
+
+        CRefBuffer<const EventLogRecord*> bufBatch(rgpRecords, cRecords);
+        HRESULT hr = m_pSink->Write(bufBatch);
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"Failed to write %d event log records, hr=%x\n", cRecords, hr);
+        }
+
+        for (size_t i = 0; i < cRecords; i++)
+        {
+            EventLogRecord::Free(rgpRecords[i]);
+        }
+
+        ::InterlockedExchangeAdd(&m_cWritten, (LONG)cRecords);
+        ::InterlockedIncrement(&m_cBatches);
+    }
+}
+
+DWORD WINAPI CEventLogWriter::WriterThreadProc(
+    LPVOID pvParam)
+{
+    static_cast<CEventLogWriter*>(pvParam)->RunWriter();
+    return 0;
+}
+
+void CEventLogWriter::RunWriter()
+{
+    for (;;)
+    {
+        Drain();
+        if (m_fStopping)
+        {
+            break;
+        }
+
+        ::InterlockedExchange(&m_lIdle, 1);
+
+        // A record published before the flag was set did not signal. Look once more.
+        if (HasPublished() || m_fStopping)
+        {
+            ::InterlockedExchange(&m_lIdle, 0);
+            continue;
+        }
+
+        ::WaitForSingleObject(m_hWakeEvent, INFINITE);
+        ::InterlockedExchange(&m_lIdle, 0);
+    }
+}
@@ -0,0 +1,206 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventLogWriter.h
+
+    Abstract:
+
+        CEventLogWriter class declaration.
+
+--*/
+
+#include "EventLogSink.h"
+
+/*++
+
+    Abstract:
+
+        Writes event log records to a sink on a background thread.
+
+    Remarks:
+
+        Post() copies the event into a record and puts it in a bounded ring without taking
+        a lock, so a CertSvc thread does not wait on ReportEventW. Any number of threads can
+        post. The writer thread is the only consumer.
+
+        Each slot has a sequence number. A producer claims the slot at the tail with a
+        compare-exchange and publishes it by setting the sequence to the next position. The
+        writer takes published slots from the head in order and gives them back by setting
+        the sequence one lap ahead.
+
+        The writer sleeps on an event when the ring is empty. Producers only signal it when
+        it is sleeping, so a burst of events costs one wake up. Each wake up writes up to
+        s_cMaxBatch records per call to the sink.
+
+        When the ring is full the event is dropped and counted. Waiting would put the
+        event log back on the CertSvc thread.
+--*/
+class CEventLogWriter
+{
+public:
+    // Most records given to the sink in one call.
+    static const size_t s_cMaxBatch = 64;
+
+    CEventLogWriter();
+    ~CEventLogWriter();
+
+    /*++
+
+        Abstract:
+
+            Allocates the ring and starts the writer thread.
+
+        Parameters:
+
+            pSink - where records are written. It must outlive the writer.
+            cCapacity - slots in the ring. Rounded up to a power of 2, at least 2.
+
+        Returns:
+
+            S_OK - success.
+            other - error code. The writer is not started.
+    --*/
+    HRESULT Start(
+        CEventLogSink* pSink,
+        size_t cCapacity);
+
+    /*++
+
+        Abstract:
+
+            Writes everything that was posted and stops the writer thread.
+
+        Remarks:
+
+            Call after the threads that post are stopped. A record posted while Stop() runs
+            is written by Stop() on the calling thread.
+    --*/
+    void Stop();
+
+    inline bool IsRunning() const
+    {
+        return m_hThread != NULL && !m_fStopping;
+    }
+
+    /*++
+
+        Abstract:
+
+            Copies an event into the ring.
+
+        Parameters:
+
+            wType - event type.
+            wCategory - event category.
+            dwEventID - event ID.
+            bufStrings - list of strings to include in the event.
+            bufData - custom event data.
+            pUserSid - user SID, or nullptr.
+
+        Returns:
+
+            S_OK - the event is queued.
+            HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION) - the writer is not running.
+            E_OUTOFMEMORY - the record could not be allocated.
+            HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW) - the ring is full. The event is dropped.
+    --*/
+    HRESULT Post(
+        WORD wType,
+        WORD wCategory,
+        DWORD dwEventID,
+        const CBuffer<LPCWSTR>& bufStrings,
+        const CBuffer<BYTE>& bufData,
+        const PSID pUserSid);
+
+    inline LONG GetWritten() const
+    {
+        return m_cWritten;
+    }
+
+    inline LONG GetBatches() const
+    {
+        return m_cBatches;
+    }
+
+    inline LONG GetDropped() const
+    {
+        return m_cDropped;
+    }
+
+private:
+    struct Slot
+    {
+        volatile LONGLONG llSequence;
+        EventLogRecord* pRecord;
+    };
+
+    CEventLogSink* m_pSink;
+    CHeapBuffer<Slot> m_bufSlots;
+    LONGLONG m_llMask;
+
+    // Next position to claim. Shared by the producers.
+    volatile LONGLONG m_llTail;
+
+    // Next position to take. Only the consumer touches it.
+    LONGLONG m_llHead;
+
+    // 1 while the writer thread is waiting, or about to wait, for m_hWakeEvent.
+    volatile LONG m_lIdle;
+    volatile bool m_fStopping;
+    HANDLE m_hWakeEvent;
+    HANDLE m_hThread;
+
+    volatile LONG m_cWritten;
+    volatile LONG m_cBatches;
+    volatile LONG m_cDropped;
+
+    /*++
+
+        Abstract:
+
+            Takes up to s_cMaxBatch published records from the head.
+
+        Returns:
+
+            The number of records put in rgpRecords.
+
+        Remarks:
+
+            Only called by the consumer. That is the writer thread, or Stop() after it exits.
+    --*/
+    size_t TakeBatch(
+        const EventLogRecord** rgpRecords);
+
+    /*++
+
+        Abstract:
+
+            Gets whether the record at the head is published.
+
+    --*/
+    bool HasPublished() const;
+
+    /*++
+
+        Abstract:
+
+            Writes published records until the ring is empty.
+
+        Remarks:
+
+            Only called by the consumer. That is the writer thread, or Stop() after it exits.
+    --*/
+    void Drain();
+
+    static DWORD WINAPI WriterThreadProc(
+        LPVOID pvParam);
+
+    void RunWriter();
+
+    CEventLogWriter(const CEventLogWriter&) = delete;
+    CEventLogWriter& operator=(const CEventLogWriter&) = delete;
+};
@@ -24,22 +24,68 @@
 #include "EventProcessor.h"
 #include "TempFile.h"
 #include "Process.h"
+#include "Pipe.h"
+#include "PersistentHandler.h"
+#include "HandlerPool.h"
+#include "ProcessReaper.h"
+#include "EventJournal.h"
+#include "CertIssuedEvent.h"
+#include "CertFields.h"
+#include "CertMetadata.h"
+#include "BatchManifest.h"
+#include "PerfCounters.h"
 
 LPCWSTR g_pwszTempFileNamePrefix = L"PMI";
-constexpr const DWORD g_dwProcessTimeoutMSecs = 10000;
 
-CEventProcessor::CEventProcessor(const CPMIExitModuleEventSource& objEventSource)
-    : m_objEventSource(objEventSource)
+// Extra time a batch handler gets for each certificate in the batch.
+constexpr const DWORD g_dwBatchItemTimeoutMSecs = 100;
+
+// A process-per-event handler and the files it uses. Freed once the handler is reaped.
+struct CEventProcessor::PendingProcess
 {
-}
+    PendingProcess(
+        const CPMIExitModuleEventSource& objEventSourceIn,
+        DWORD dwTimeoutMSecsIn)
+        : objEventSource(objEventSourceIn),
+        dwTimeoutMSecs(dwTimeoutMSecsIn),
+        pJournal(nullptr),
+        ullJournalPosition(0)
+    {
+    }
 
-CEventProcessor::~CEventProcessor()
+    const CPMIExitModuleEventSource& objEventSource;
+    DWORD dwTimeoutMSecs;
+
+    // Checkpointed once the handler is reaped, so a crash before then replays the event.
+    CEventJournal* pJournal;
+    ULONGLONG ullJournalPosition;
+    CHeapWString strSerialNumber;
+    CProcess objProcess;
+    CHeapWString strTempFile;
+    CTempFile objTempFile;
+    CHeapWString strMetadataFile;
+    CTempFile objMetadataFile;
+    CBstrBuffer bufStdInput;
+};
+
+CEventProcessor::CEventProcessor(
+    const CEventProcessorConfig& objConfig,
+    const CPMIExitModuleEventSource& objEventSource,
+    CPersistentHandler* pPersistentHandler,
+    CHandlerPool* pHandlerPool,
+    CProcessReaper* pReaper,
+    CEventJournal* pJournal)
+    : m_objConfig(objConfig),
+    m_objEventSource(objEventSource),
+    m_pPersistentHandler(pPersistentHandler),
+    m_pHandlerPool(pHandlerPool),
+    m_pReaper(pReaper),
+    m_pJournal(pJournal)
 {
 }
 
-HRESULT CEventProcessor::Init()
+CEventProcessor::~CEventProcessor()
 {
-    return m_objConfig.Init();
 }
 
 HRESULT CEventProcessor::GetTempFilePath(
@@ -77,16 +123,11 @@ HRESULT CEventProcessor::GetTempFilePath(
     return hr;
 }
 
-HRESULT CEventProcessor::NotifyCertIssued(
-    LPCWSTR pwszSubjectKeyIdentifier,
-    LPCWSTR pwszSerialNumber,
-    const CBuffer<BYTE>& bufRawCert) const
+HRESULT CEventProcessor::WriteTempFile(
+    const CBuffer<BYTE>& bufRawCert,
+    OUT CHeapWString& strTempFile,
+    CTempFile& objTempFile)
 {
-    CHeapWString strTempFile;
-    CTempFile objTempFile;
-    CHeapWString strEscSubjectKeyIdentifier;
-    CHeapWString strEscTempFile;
-
     HRESULT hr = GetTempFilePath(strTempFile);
     if (FAILED(hr))
     {
@@ -106,7 +147,11 @@ HRESULT CEventProcessor::NotifyCertIssued(
     while (cbTotal < bufRawCert.GetLength())
     {
         size_t cbWritten = 0;
-        hr = objTempFile.Write(bufRawCert, 0, bufRawCert.GetLength(), OUT cbWritten);
+        hr = objTempFile.Write(
+            bufRawCert,
+            cbTotal,
+            bufRawCert.GetLength() - cbTotal,
+            OUT cbWritten);
         if (FAILED(hr))
         {
             ATLTRACE(L"Failed to write to temp file, hr=%x\n", hr);
@@ -117,97 +162,607 @@ HRESULT CEventProcessor::NotifyCertIssued(
     }
 
     objTempFile.Close();
+    return hr;
+}
+
+HRESULT CEventProcessor::WriteMetadataFile(
+    LPCWSTR pwszSubjectKeyIdentifier,
+    LPCWSTR pwszSerialNumber,
+    const CBuffer<BYTE>& bufRawCert,
+    const CCertFields& objFields,
+    OUT CHeapWString& strMetadataFile,
+    CTempFile& objMetadataFile)
+{
+    CCertMetadata objMetadata;
+    HRESULT hr = objMetadata.Format(
+        pwszSubjectKeyIdentifier,
+        pwszSerialNumber,
+        bufRawCert,
+        objFields);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"CCertMetadata::Format failed, hr=%x\n", hr);
+        return hr;
+    }
+
+    return WriteTempFile(objMetadata.GetData(), OUT strMetadataFile, objMetadataFile);
+}
 
-    LPCWSTR pwszEscSubjectKeyIdentifier = pwszSubjectKeyIdentifier;
-    LPCWSTR pwszEscTempFile = strTempFile.Get();
-    if (m_objConfig.GetEscapeForPS())
+HRESULT CEventProcessor::NotifyCertIssued(
+    CCertIssuedEvent& objEvent) const
+{
+    LPCWSTR pwszSubjectKeyIdentifier = objEvent.GetSubjectKeyIdentifier();
+    LPCWSTR pwszSerialNumber = objEvent.GetSerialNumber();
+    const CBuffer<BYTE>& bufRawCert = objEvent.GetRawCert();
+
+    if (m_pPersistentHandler && m_objConfig.GetHandlerMode() == HandlerModePersistent)
     {
-        hr = EscapeArgumentForPS(pwszSubjectKeyIdentifier, strEscSubjectKeyIdentifier);
+        return NotifyCertIssuedPersistent(
+            pwszSubjectKeyIdentifier,
+            pwszSerialNumber,
+            bufRawCert);
+    }
+
+    HRESULT hr = S_OK;
+    if (m_pHandlerPool &&
+        m_objConfig.GetHandlerMode() == HandlerModeProcessPerEvent &&
+        m_objConfig.GetWarmHandlers() > 0)
+    {
+        hr = NotifyCertIssuedWarm(
+            pwszSubjectKeyIdentifier,
+            pwszSerialNumber,
+            bufRawCert);
+        if (hr != HRESULT_FROM_WIN32(ERROR_NOT_FOUND))
+        {
+            return hr;
+        }
+
+        // No warm handler was ready. Start one for this event.
+        hr = S_OK;
+    }
+
+    // Owns everything the handler needs until it exits, which can be after this returns.
+    PendingProcess* pPending = new PendingProcess(m_objEventSource, m_objConfig.GetHandlerTimeoutMSecs());
+    if (!pPending)
+    {
+        ATLTRACE(L"Failed to alloc pending process.\n");
+        return E_OUTOFMEMORY;
+    }
+
+    // Reported when the handler fails, which can be after the event is released.
+    hr = pPending->strSerialNumber.CopyFrom(pwszSerialNumber);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"Failed to copy the serial number, hr=%x\n", hr);
+        delete pPending;
+        return hr;
+    }
+
+    // Parsed before the handler takes the cert. Only the placeholders the template uses are worth it.
+    const CCommandLineTemplate& objTemplate = m_objConfig.GetCertIssuedTemplate();
+    bool fMetadata = objTemplate.UsesPlaceholder(PlaceholderMetadataPath);
+    CCertFields objFields;
+    if (fMetadata ||
+        objTemplate.UsesPlaceholder(PlaceholderIssuer) ||
+        objTemplate.UsesPlaceholder(PlaceholderNotAfter) ||
+        objTemplate.UsesPlaceholder(PlaceholderTemplate) ||
+        objTemplate.UsesPlaceholder(PlaceholderEnhancedKeyUsage) ||
+        objTemplate.UsesPlaceholder(PlaceholderSubjectAltName))
+    {
+        // optional. ignore failure. The fields are left empty.
+        hr = objFields.Parse(bufRawCert);
         if (FAILED(hr))
         {
-            ATLTRACE(L"Failed to escape subject key identifier, hr=%x\n", hr);
+            ATLTRACE(L"CCertFields::Parse failed, hr=%x\n", hr);
+            hr = S_OK;
+        }
+    }
+
+    if (fMetadata)
+    {
+        hr = WriteMetadataFile(
+            pwszSubjectKeyIdentifier,
+            pwszSerialNumber,
+            bufRawCert,
+            objFields,
+            OUT pPending->strMetadataFile,
+            pPending->objMetadataFile);
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"WriteMetadataFile failed, hr=%x\n", hr);
+            delete pPending;
             return hr;
         }
+    }
 
-        pwszEscSubjectKeyIdentifier = strEscSubjectKeyIdentifier.Get();
+    const CBuffer<BYTE>* pbufStdInput = nullptr;
+    if (m_objConfig.GetCertDelivery() == CertDeliveryStdIn)
+    {
+        // The temp file is only written if the handler fails. The event is done with the
+        // cert after this, so the handler takes it instead of a copy.
+        hr = objEvent.TakeRawCert(OUT pPending->bufStdInput);
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"CCertIssuedEvent::TakeRawCert failed, hr=%x\n", hr);
+            delete pPending;
+            return hr;
+        }
 
-        hr = EscapeArgumentForPS(strTempFile.Get(), strEscTempFile);
+        pbufStdInput = &pPending->bufStdInput;
+    }
+    else
+    {
+        hr = WriteTempFile(bufRawCert, OUT pPending->strTempFile, pPending->objTempFile);
         if (FAILED(hr))
         {
-            ATLTRACE(L"Failed to escape temp file path, hr=%x\n", hr);
+            ATLTRACE(L"WriteTempFile failed, hr=%x\n", hr);
+            delete pPending;
             return hr;
         }
+    }
 
-        pwszEscTempFile = strEscTempFile.Get();
+    CommandLineValues stValues;
+    stValues.rgpwsz[PlaceholderSubjectKeyIdentifier] = pwszSubjectKeyIdentifier;
+    stValues.rgpwsz[PlaceholderSerialNumber] = pwszSerialNumber;
+    stValues.rgpwsz[PlaceholderRawCertPath] = pPending->strTempFile.Get();
+    stValues.rgpwsz[PlaceholderRequester] = objEvent.GetRequesterName();
+    stValues.rgpwsz[PlaceholderMetadataPath] = pPending->strMetadataFile.Get();
+    stValues.rgpwsz[PlaceholderIssuer] = objFields.Get(CertFieldIssuer);
+    stValues.rgpwsz[PlaceholderNotAfter] = objFields.Get(CertFieldNotAfter);
+    stValues.rgpwsz[PlaceholderTemplate] = objFields.Get(CertFieldTemplate);
+    stValues.rgpwsz[PlaceholderEnhancedKeyUsage] = objFields.Get(CertFieldEnhancedKeyUsage);
+    stValues.rgpwsz[PlaceholderSubjectAltName] = objFields.Get(CertFieldSubjectAltName);
+
+    // Waits here if HandlerConcurrency handlers are already running.
+    bool fSlot = m_pReaper && m_pReaper->AcquireSlot();
+
+    DWORD dwWaitMSecs = 0;
+    hr = StartProcess(
+        objTemplate,
+        stValues,
+        pbufStdInput,
+        pPending->objProcess,
+        pPending->dwTimeoutMSecs,
+        OUT dwWaitMSecs);
+    if (SUCCEEDED(hr) && fSlot)
+    {
+        // Set before Track(), since the handler can be reaped before it returns.
+        pPending->pJournal = m_pJournal;
+        pPending->ullJournalPosition = objEvent.GetJournalPosition();
+
+        hr = m_pReaper->Track(
+            pPending->objProcess,
+            dwWaitMSecs,
+            OnProcessReaped,
+            pPending);
+        if (SUCCEEDED(hr))
+        {
+            // The reaper reports the result, checkpoints the event, frees pPending and
+            // releases the slot.
+            objEvent.SetJournalPosition(0);
+            return hr;
+        }
+
+        ATLTRACE(L"CProcessReaper::Track failed, hr=%x. Waiting on this thread.\n", hr);
+        hr = S_OK;
     }
 
-    LPCWSTR rgpwszArgs[] =
+    if (SUCCEEDED(hr))
     {
-        L"certissued",
-        L"-subjectkeyidentifier",
-        pwszEscSubjectKeyIdentifier,
-        L"-serialnumber",
-        pwszSerialNumber,
-        L"-rawcertpath",
-        pwszEscTempFile,
-    };
+        hr = WaitProcess(pPending->objProcess, dwWaitMSecs);
+    }
 
-    constexpr size_t cArgs = sizeof(rgpwszArgs) / sizeof(rgpwszArgs[0]);
-    const CBuffer<LPCWSTR>& bufBaseArgs = m_objConfig.GetArguments();
-    CHeapBuffer<LPCWSTR> bufArgs;
-    if (!bufArgs.Alloc(cArgs + bufBaseArgs.GetLength()))
+    hr = CompleteProcess(*pPending, hr);
+
+    if (fSlot)
     {
-        hr = E_OUTOFMEMORY;
-        ATLTRACE(L"Failed to alloc buffer for args.\n");
-        return hr;
+        m_pReaper->ReleaseSlot();
     }
 
-    CopyMemory(bufArgs.Get(), bufBaseArgs.Get(), bufBaseArgs.GetSize());
-    CopyMemory(bufArgs.Get() + bufBaseArgs.GetLength(), rgpwszArgs, cArgs * sizeof(LPCWSTR));
+    delete pPending;
+    return hr;
+}
+
+void CEventProcessor::OnProcessReaped(
+    HRESULT hrExit,
+    PVOID pvContext)
+{
+    PendingProcess* pPending = static_cast<PendingProcess*>(pvContext);
+    CompleteProcess(*pPending, hrExit);
+    if (pPending->pJournal)
+    {
+        pPending->pJournal->Checkpoint(pPending->ullJournalPosition);
+    }
 
+    delete pPending;
+}
+
+HRESULT CEventProcessor::CompleteProcess(
+    PendingProcess& stPending,
+    HRESULT hrWait)
+{
+    const CBuffer<BYTE>* pbufStdInput = stPending.bufStdInput.Get() ? &stPending.bufStdInput : nullptr;
     DWORD dwExitCode = 0;
-    hr = RunProcess(bufArgs, strTempFile.Get(), OUT dwExitCode);
+
+    HRESULT hr = ReportProcessExit(
+        stPending.objEventSource,
+        stPending.objProcess,
+        hrWait,
+        stPending.dwTimeoutMSecs,
+        stPending.strSerialNumber.Get(),
+        pbufStdInput,
+        stPending.strTempFile,
+        stPending.objTempFile,
+        OUT dwExitCode);
     if (FAILED(hr) || dwExitCode != 0)
     {
         if (FAILED(hr))
         {
-            ATLTRACE(L"RunProcess failed, hr=%x\n");
+            ATLTRACE(L"The handler did not finish, hr=%x\n", hr);
+        }
+
+        if (SUCCEEDED(SpillStdInput(pbufStdInput, stPending.strTempFile, stPending.objTempFile)))
+        {
+            ATLTRACE(
+                L"Preserving temp file [%s] for debugging.\n",
+                stPending.strTempFile.Get());
+            stPending.objTempFile.Preserve();
+        }
+
+        if (stPending.strMetadataFile.Get())
+        {
+            ATLTRACE(
+                L"Preserving metadata file [%s] for debugging.\n",
+                stPending.strMetadataFile.Get());
+            stPending.objMetadataFile.Preserve();
+        }
+    }
+
+    return hr;
+}
+
+HRESULT CEventProcessor::SpillStdInput(
+    const CBuffer<BYTE>* pbufStdInput,
+    CHeapWString& strTempFile,
+    CTempFile& objTempFile)
+{
+    if (!pbufStdInput || strTempFile.Get())
+    {
+        return S_OK;
+    }
+
+    HRESULT hr = WriteTempFile(*pbufStdInput, OUT strTempFile, objTempFile);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"WriteTempFile failed, hr=%x\n", hr);
+        strTempFile.Clear();
+    }
+
+    return hr;
+}
+
+HRESULT CEventProcessor::NotifyCertIssued(
+    const CBuffer<CCertIssuedEvent*>& bufEvents) const
+{
+    HRESULT hr = S_OK;
+
+    if (m_objConfig.GetHandlerMode() == HandlerModeBatch)
+    {
+        return NotifyCertIssuedBatch(bufEvents);
+    }
+
+    for (size_t i = 0; i < bufEvents.GetLength(); i++)
+    {
+        HRESULT hrEvent = NotifyCertIssued(*bufEvents.Get()[i]);
+        if (FAILED(hrEvent) && SUCCEEDED(hr))
+        {
+            hr = hrEvent;
+        }
+    }
+
+    return hr;
+}
+
+HRESULT CEventProcessor::NotifyCertIssuedBatch(
+    const CBuffer<CCertIssuedEvent*>& bufEvents) const
+{
+    HRESULT hr = S_OK;
+    size_t cEvents = bufEvents.GetLength();
+    CHeapBuffer<CHeapWString> bufCertPaths;
+    CHeapBuffer<CTempFile> bufCertFiles;
+    CHeapBuffer<LONG> bufStatus;
+    CBatchManifest objManifest;
+    CHeapWString strManifest;
+    CTempFile objManifestFile;
+    CHeapWString strResults;
+    CTempFile objResultsFile;
+
+    if (!bufCertPaths.Alloc(cEvents) ||
+        !bufCertFiles.Alloc(cEvents) ||
+        !bufStatus.Alloc(cEvents))
+    {
+        ATLTRACE(L"Failed to alloc batch of %d events.\n", cEvents);
+        return E_OUTOFMEMORY;
+    }
+
+    for (size_t i = 0; i < cEvents; i++)
+    {
+        hr = WriteTempFile(
+            bufEvents.Get()[i]->GetRawCert(),
+            OUT bufCertPaths.Get()[i],
+            bufCertFiles.Get()[i]);
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"WriteTempFile failed, hr=%x\n", hr);
+            return hr;
+        }
+    }
+
+    hr = objManifest.Format(bufEvents, bufCertPaths);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"CBatchManifest::Format failed, hr=%x\n", hr);
+        return hr;
+    }
+
+    hr = WriteTempFile(objManifest.GetData(), OUT strManifest, objManifestFile);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"Failed to write manifest, hr=%x\n", hr);
+        return hr;
+    }
+
+    // The handler writes the results. Only create the empty file here so it gets cleaned up.
+    hr = WriteTempFile(CRefBuffer<BYTE>(), OUT strResults, objResultsFile);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"Failed to create result file, hr=%x\n", hr);
+        return hr;
+    }
+
+    CommandLineValues stValues;
+    stValues.rgpwsz[PlaceholderManifestPath] = strManifest.Get();
+    stValues.rgpwsz[PlaceholderResultPath] = strResults.Get();
+
+    DWORD dwProcessID = 0;
+    DWORD dwExitCode = 0;
+    hr = RunProcess(
+        m_objConfig.GetBatchTemplate(),
+        stValues,
+        strManifest,
+        objManifestFile,
+        m_objConfig.GetHandlerTimeoutMSecs() + (DWORD)cEvents * g_dwBatchItemTimeoutMSecs,
+        OUT dwProcessID,
+        OUT dwExitCode);
+
+    // Items without a result line get the exit code, or the error if the process did not finish.
+    LONG lDefaultStatus = FAILED(hr) ? hr : (LONG)dwExitCode;
+    for (size_t i = 0; i < cEvents; i++)
+    {
+        bufStatus.Get()[i] = lDefaultStatus;
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        size_t cResults = 0;
+        HRESULT hrRead = CBatchManifest::ReadResults(strResults.Get(), bufStatus, OUT cResults);
+        if (FAILED(hrRead))
+        {
+            ATLTRACE(L"CBatchManifest::ReadResults failed, hr=%x\n", hrRead);
+        }
+
+        ATLTRACE(L"Read %d results for a batch of %d events.\n", cResults, cEvents);
+    }
+
+    bool fAnyFailed = false;
+    for (size_t i = 0; i < cEvents; i++)
+    {
+        const CCertIssuedEvent& objEvent = *bufEvents.Get()[i];
+        LONG lStatus = bufStatus.Get()[i];
+        if (lStatus == 0)
+        {
+            m_objEventSource.ReportHandlerEventSucceeded(
+                dwProcessID,
+                objEvent.GetSerialNumber());
+        }
+        else
+        {
+            fAnyFailed = true;
+            bufCertFiles.Get()[i].Preserve();
+            m_objEventSource.ReportHandlerEventFailed(
+                dwProcessID,
+                objEvent.GetSerialNumber(),
+                lStatus,
+                bufCertPaths.Get()[i].Get());
         }
+    }
+
+    if (fAnyFailed)
+    {
+        ATLTRACE(L"Preserving manifest [%s] for debugging.\n", strManifest.Get());
+        objManifestFile.Preserve();
+        objResultsFile.Preserve();
+    }
 
+    return hr;
+}
+
+HRESULT CEventProcessor::NotifyCertIssuedPersistent(
+    LPCWSTR pwszSubjectKeyIdentifier,
+    LPCWSTR pwszSerialNumber,
+    const CBuffer<BYTE>& bufRawCert) const
+{
+    LONG lStatus = 0;
+    DWORD dwProcessID = 0;
+
+    HRESULT hr = m_pPersistentHandler->NotifyCertIssued(
+        m_objConfig,
+        pwszSubjectKeyIdentifier,
+        pwszSerialNumber,
+        bufRawCert,
+        OUT lStatus,
+        OUT dwProcessID);
+    if (SUCCEEDED(hr) && lStatus == 0)
+    {
+        return hr;
+    }
+
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"CPersistentHandler::NotifyCertIssued failed, hr=%x\n", hr);
+    }
+
+    ReportFrameHandlerFailed(hr, lStatus, dwProcessID, pwszSerialNumber, bufRawCert);
+    return hr;
+}
+
+HRESULT CEventProcessor::NotifyCertIssuedWarm(
+    LPCWSTR pwszSubjectKeyIdentifier,
+    LPCWSTR pwszSerialNumber,
+    const CBuffer<BYTE>& bufRawCert) const
+{
+    LONG lStatus = 0;
+    DWORD dwProcessID = 0;
+
+    HRESULT hr = m_pHandlerPool->NotifyCertIssued(
+        m_objConfig,
+        pwszSubjectKeyIdentifier,
+        pwszSerialNumber,
+        bufRawCert,
+        m_objConfig.GetHandlerTimeoutMSecs(),
+        OUT lStatus,
+        OUT dwProcessID);
+    if (hr == HRESULT_FROM_WIN32(ERROR_NOT_FOUND))
+    {
+        return hr;
+    }
+
+    if (SUCCEEDED(hr) && lStatus == 0)
+    {
+        m_objEventSource.ReportHandlerEventSucceeded(dwProcessID, pwszSerialNumber);
+        return hr;
+    }
+
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"CHandlerPool::NotifyCertIssued failed, hr=%x\n", hr);
+    }
+
+    ReportFrameHandlerFailed(hr, lStatus, dwProcessID, pwszSerialNumber, bufRawCert);
+    return hr;
+}
+
+void CEventProcessor::ReportFrameHandlerFailed(
+    HRESULT hr,
+    LONG lStatus,
+    DWORD dwProcessID,
+    LPCWSTR pwszSerialNumber,
+    const CBuffer<BYTE>& bufRawCert) const
+{
+    // The cert only went over the pipe. Write it out so the failure can be investigated.
+    CHeapWString strTempFile;
+    CTempFile objTempFile;
+    HRESULT hrWrite = WriteTempFile(bufRawCert, OUT strTempFile, objTempFile);
+    if (SUCCEEDED(hrWrite))
+    {
         ATLTRACE(
             L"Preserving temp file [%s] for debugging.\n",
             strTempFile.Get());
         objTempFile.Preserve();
     }
 
-    return hr;
+    m_objEventSource.ReportHandlerEventFailed(
+        dwProcessID,
+        pwszSerialNumber,
+        FAILED(hr) ? hr : lStatus,
+        SUCCEEDED(hrWrite) ? strTempFile.Get() : L"");
 }
 
 HRESULT CEventProcessor::RunProcess(
-    const CBuffer<LPCWSTR>& bufArgs,
-    LPCWSTR pwszTempFile,
+    const CCommandLineTemplate& objTemplate,
+    const CommandLineValues& stValues,
+    CHeapWString& strTempFile,
+    CTempFile& objTempFile,
+    DWORD dwTimeoutMSecs,
+    OUT DWORD& dwProcessID,
     OUT DWORD& dwExitCode) const
 {
-    HRESULT hr = S_OK;
     CProcess objProc;
+    DWORD dwWaitMSecs = 0;
+    dwProcessID = 0;
+    dwExitCode = 0;
+
+    HRESULT hr = StartProcess(
+        objTemplate,
+        stValues,
+        nullptr, // pbufStdInput
+        objProc,
+        dwTimeoutMSecs,
+        OUT dwWaitMSecs);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    dwProcessID = objProc.GetProcessID();
+    hr = WaitProcess(objProc, dwWaitMSecs);
+    return ReportProcessExit(
+        m_objEventSource,
+        objProc,
+        hr,
+        dwTimeoutMSecs,
+        stValues.rgpwsz[PlaceholderSerialNumber],
+        nullptr, // pbufStdInput
+        strTempFile,
+        objTempFile,
+        OUT dwExitCode);
+}
 
-    if (!m_objConfig.GetExePath())
+HRESULT CEventProcessor::StartProcess(
+    const CCommandLineTemplate& objTemplate,
+    const CommandLineValues& stValues,
+    const CBuffer<BYTE>* pbufStdInput,
+    CProcess& objProc,
+    DWORD dwTimeoutMSecs,
+    OUT DWORD& dwWaitMSecs) const
+{
+    HRESULT hr = S_OK;
+    CPipe objStdInput;
+    HANDLE hStdInput = INVALID_HANDLE_VALUE;
+    dwWaitMSecs = dwTimeoutMSecs;
+
+    if (!m_objConfig.GetExePath() || !objTemplate.IsCompiled())
     {
         ATLTRACE(L"No Process registered.\n");
         return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
     }
 
+    if (pbufStdInput)
+    {
+        hr = objStdInput.Create(true); // fOutbound
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"Failed to create stdin pipe, hr=%x\n", hr);
+            return hr;
+        }
+
+        hStdInput = objStdInput.GetClientHandle();
+    }
+
     hr = objProc.Create(
         m_objConfig.GetExePath(),
-        bufArgs,
-        NORMAL_PRIORITY_CLASS | CREATE_NEW_CONSOLE | CREATE_NEW_PROCESS_GROUP);
+        objTemplate,
+        stValues,
+        NORMAL_PRIORITY_CLASS | CREATE_NEW_CONSOLE | CREATE_NEW_PROCESS_GROUP,
+        hStdInput);
     if (FAILED(hr))
     {
         ATLTRACE(L"CProcess::Create failed, hr=%x\n", hr);
         m_objEventSource.ReportProcessStartFailed(
             m_objConfig.GetExePath(),
             objProc.GetCommandLine(),
-            hr);
+            hr,
+            stValues.rgpwsz[PlaceholderSerialNumber]);
         return hr;
     }
 
@@ -215,25 +770,98 @@ HRESULT CEventProcessor::RunProcess(
         m_objConfig.GetExePath(),
         objProc.GetCommandLine(),
         objProc.GetProcessID(),
-        objProc.GetThreadID());
+        objProc.GetThreadID(),
+        stValues.rgpwsz[PlaceholderSerialNumber]);
 
-    hr = objProc.Wait(g_dwProcessTimeoutMSecs);
-    if (FAILED(hr))
+    if (pbufStdInput)
+    {
+        ULONGLONG ullStart = ::GetTickCount64();
+
+        // The child has its own copy. Closing ours lets a write fail fast if it exits without reading.
+        objStdInput.CloseClient();
+        HRESULT hrWrite = objStdInput.Write(
+            pbufStdInput->Get(),
+            pbufStdInput->GetSize(),
+            dwTimeoutMSecs);
+        if (FAILED(hrWrite))
+        {
+            // The exit code decides the result. A handler does not have to read stdin.
+            ATLTRACE(L"Failed to write the raw cert to stdin, hr=%x\n", hrWrite);
+        }
+
+        // Closing the pipe gives the handler end of file after the last byte.
+        objStdInput.Close();
+
+        ULONGLONG ullElapsed = ::GetTickCount64() - ullStart;
+        dwWaitMSecs = (ullElapsed < dwTimeoutMSecs) ? dwTimeoutMSecs - (DWORD)ullElapsed : 0;
+    }
+
+    return hr;
+}
+
+HRESULT CEventProcessor::WaitProcess(
+    CProcess& objProc,
+    DWORD dwWaitMSecs)
+{
+    HRESULT hr = objProc.Wait(dwWaitMSecs);
+    if (hr == HRESULT_FROM_WIN32(ERROR_TIMEOUT))
+    {
+        // Same as the reaper. Ends the processes the handler started too.
+        HRESULT hrKill = objProc.Terminate(ERROR_TIMEOUT);
+        if (FAILED(hrKill))
+        {
+            ATLTRACE(L"CProcess::Terminate failed, hr=%x\n", hrKill);
+        }
+
+        // Termination is asynchronous. The temp files are cleaned up next, so wait until it is gone.
+        HRESULT hrExit = objProc.Wait(INFINITE);
+        if (FAILED(hrExit))
+        {
+            ATLTRACE(L"CProcess::Wait failed after terminating, hr=%x\n", hrExit);
+        }
+    }
+
+    return hr;
+}
+
+HRESULT CEventProcessor::ReportProcessExit(
+    const CPMIExitModuleEventSource& objEventSource,
+    CProcess& objProc,
+    HRESULT hrWait,
+    DWORD dwTimeoutMSecs,
+    LPCWSTR pwszSerialNumber,
+    const CBuffer<BYTE>* pbufStdInput,
+    CHeapWString& strTempFile,
+    CTempFile& objTempFile,
+    OUT DWORD& dwExitCode)
+{
+    dwExitCode = 0;
+
+    if (objProc.GetStartTicks() != 0 && (SUCCEEDED(hrWait) || hrWait == HRESULT_FROM_WIN32(ERROR_TIMEOUT)))
     {
-        ATLTRACE(L"CProcess::Wait failed, hr=%x\n", hr);
-        if (hr == HRESULT_FROM_WIN32(ERROR_TIMEOUT))
+        ULONGLONG ullMSecs = ::GetTickCount64() - objProc.GetStartTicks();
+        CPerfCounters::Get().RecordHandlerLatency((DWORD)min(ullMSecs, (ULONGLONG)MAXDWORD));
+    }
+
+    if (FAILED(hrWait))
+    {
+        ATLTRACE(L"The process did not exit, hr=%x\n", hrWait);
+        if (hrWait == HRESULT_FROM_WIN32(ERROR_TIMEOUT))
         {
-            m_objEventSource.ReportProcessTimedOut(
-                g_dwProcessTimeoutMSecs / 1000,
+            CPerfCounters::Get().Add(PerfCounterHandlerTimeouts);
+            SpillStdInput(pbufStdInput, strTempFile, objTempFile);
+            objEventSource.ReportProcessTimedOut(
+                dwTimeoutMSecs / 1000,
                 objProc.GetProcessID(),
                 objProc.GetThreadID(),
-                pwszTempFile);
+                strTempFile.Get() ? strTempFile.Get() : L"",
+                pwszSerialNumber);
         }
 
-        return hr;
+        return hrWait;
     }
 
-    hr = objProc.GetExitCode(OUT dwExitCode);
+    HRESULT hr = objProc.GetExitCode(OUT dwExitCode);
     if (FAILED(hr))
     {
         ATLTRACE(L"CProcess::GetExitCode failed, hr=%x\n", hr);
@@ -247,15 +875,18 @@ HRESULT CEventProcessor::RunProcess(
         dwExitCode);
     if (dwExitCode != 0)
     {
-        m_objEventSource.ReportProcessFailed(
+        CPerfCounters::Get().Add(PerfCounterHandlerFailures);
+        SpillStdInput(pbufStdInput, strTempFile, objTempFile);
+        objEventSource.ReportProcessFailed(
             objProc.GetProcessID(),
             objProc.GetThreadID(),
             dwExitCode,
-            pwszTempFile);
+            strTempFile.Get() ? strTempFile.Get() : L"",
+            pwszSerialNumber);
     }
     else
     {
-        m_objEventSource.ReportProcessSucceeded(
+        objEventSource.ReportProcessSucceeded(
             objProc.GetProcessID(),
             objProc.GetThreadID(),
             dwExitCode);
@@ -263,57 +894,3 @@ HRESULT CEventProcessor::RunProcess(
 
     return hr;
 }
-
-HRESULT CEventProcessor::EscapeArgumentForPS(
-    LPCWSTR pwsz,
-    OUT CHeapWString& strResult)
-{
-    HRESULT hr = S_OK;
-
-    size_t cch = wcslen(pwsz) + 3;
-
-    if (!strResult.Alloc(cch))
-    {
-        return E_OUTOFMEMORY;
-    }
-
-    LPWSTR pwszResult = strResult.Get();
-
-    hr = ::StringCchCopyExW(
-        pwszResult,
-        cch,
-        L"'",
-        &pwszResult,
-        &cch,
-        STRSAFE_IGNORE_NULLS);
-    if (FAILED(hr))
-    {
-        return hr;
-    }
-
-    hr = ::StringCchCopyExW(
-        pwszResult,
-        cch,
-        pwsz,
-        &pwszResult,
-        &cch,
-        STRSAFE_IGNORE_NULLS);
-    if (FAILED(hr))
-    {
-        return hr;
-    }
-
-    hr = ::StringCchCopyExW(
-        pwszResult,
-        cch,
-        L"'",
-        &pwszResult,
-        &cch,
-        STRSAFE_IGNORE_NULLS);
-    if (FAILED(hr))
-    {
-        return hr;
-    }
-
-    return hr;
-}
@@ -22,39 +22,154 @@
 
 #include "EventProcessorConfig.h"
 
+class CCertFields;
+class CCertIssuedEvent;
+class CEventJournal;
+class CHandlerPool;
+class CPersistentHandler;
+class CProcess;
+class CProcessReaper;
+class CTempFile;
+
 /*++
 
     Abstract:
 
         Processes structured events from the exit module by calling an external process.
 
+    Remarks:
+
+        objConfig must outlive the event processor.
+
+        With a reaper, a process-per-event handler is reaped on the reaper's thread, so
+        NotifyCertIssued() returns once the handler has started and has its cert. The
+        result is reported to the event log when the handler exits or is terminated.
+        The event is checkpointed in the journal then too, and its journal position is
+        cleared so the caller does not checkpoint it early.
+
+        When the handler reads the cert from stdin, the raw cert BSTR is moved from the
+        event to the pending handler, so the cert is not copied on its way from COM to
+        the handler.
 --*/
 class CEventProcessor
 {
 public:
-    CEventProcessor(const CPMIExitModuleEventSource& objEventSource);
+    CEventProcessor(
+        const CEventProcessorConfig& objConfig,
+        const CPMIExitModuleEventSource& objEventSource,
+        CPersistentHandler* pPersistentHandler = nullptr,
+        CHandlerPool* pHandlerPool = nullptr,
+        CProcessReaper* pReaper = nullptr,
+        CEventJournal* pJournal = nullptr);
     ~CEventProcessor();
 
-    HRESULT Init();
+    /*++
+
+        Abstract:
+
+            Processes one or more issued certificates.
+
+        Parameters:
 
+            bufEvents - the events. The raw cert may be moved out of an event.
+
+        Returns:
+
+            S_OK - success. Per certificate failures from the handler are reported to the event log.
+            other - error code.
+
+        Remarks:
+
+            In batch mode, the handler is run once for all the events. Otherwise each event is
+            processed in turn and the first failure is returned.
+    --*/
     HRESULT NotifyCertIssued(
-        LPCWSTR pwszSubjectKeyIdentifier,
-        LPCWSTR pwszSerialNumber,
-        const CBuffer<BYTE>& bufRawCert) const;
+        const CBuffer<CCertIssuedEvent*>& bufEvents) const;
+
+    inline const CEventProcessorConfig& GetConfig() const
+    {
+        return m_objConfig;
+    }
 
 private:
-    CEventProcessorConfig m_objConfig;
+    const CEventProcessorConfig& m_objConfig;
     const CPMIExitModuleEventSource& m_objEventSource;
+    CPersistentHandler* m_pPersistentHandler;
+    CHandlerPool* m_pHandlerPool;
+    CProcessReaper* m_pReaper;
+    CEventJournal* m_pJournal;
+
+    struct PendingProcess;
 
     static HRESULT GetTempFilePath(
         OUT CHeapWString& strPath);
-    static HRESULT EscapeArgumentForPS(
-        LPCWSTR pwsz,
-        OUT CHeapWString& strResult);
+    static HRESULT WriteTempFile(
+        const CBuffer<BYTE>& bufRawCert,
+        OUT CHeapWString& strTempFile,
+        CTempFile& objTempFile);
+    static HRESULT WriteMetadataFile(
+        LPCWSTR pwszSubjectKeyIdentifier,
+        LPCWSTR pwszSerialNumber,
+        const CBuffer<BYTE>& bufRawCert,
+        const CCertFields& objFields,
+        OUT CHeapWString& strMetadataFile,
+        CTempFile& objMetadataFile);
+    static HRESULT SpillStdInput(
+        const CBuffer<BYTE>* pbufStdInput,
+        CHeapWString& strTempFile,
+        CTempFile& objTempFile);
     HRESULT RunProcess(
-        const CBuffer<LPCWSTR>& bufArgs,
-        LPCWSTR pwszTempFile,
+        const CCommandLineTemplate& objTemplate,
+        const CommandLineValues& stValues,
+        CHeapWString& strTempFile,
+        CTempFile& objTempFile,
+        DWORD dwTimeoutMSecs,
+        OUT DWORD& dwProcessID,
         OUT DWORD& dwExitCode) const;
+    HRESULT StartProcess(
+        const CCommandLineTemplate& objTemplate,
+        const CommandLineValues& stValues,
+        const CBuffer<BYTE>* pbufStdInput,
+        CProcess& objProc,
+        DWORD dwTimeoutMSecs,
+        OUT DWORD& dwWaitMSecs) const;
+    static HRESULT WaitProcess(
+        CProcess& objProc,
+        DWORD dwWaitMSecs);
+    static HRESULT ReportProcessExit(
+        const CPMIExitModuleEventSource& objEventSource,
+        CProcess& objProc,
+        HRESULT hrWait,
+        DWORD dwTimeoutMSecs,
+        LPCWSTR pwszSerialNumber,
+        const CBuffer<BYTE>* pbufStdInput,
+        CHeapWString& strTempFile,
+        CTempFile& objTempFile,
+        OUT DWORD& dwExitCode);
+    static HRESULT CompleteProcess(
+        PendingProcess& stPending,
+        HRESULT hrWait);
+    static void OnProcessReaped(
+        HRESULT hrExit,
+        PVOID pvContext);
+    HRESULT NotifyCertIssued(
+        CCertIssuedEvent& objEvent) const;
+    HRESULT NotifyCertIssuedBatch(
+        const CBuffer<CCertIssuedEvent*>& bufEvents) const;
+    HRESULT NotifyCertIssuedPersistent(
+        LPCWSTR pwszSubjectKeyIdentifier,
+        LPCWSTR pwszSerialNumber,
+        const CBuffer<BYTE>& bufRawCert) const;
+    HRESULT NotifyCertIssuedWarm(
+        LPCWSTR pwszSubjectKeyIdentifier,
+        LPCWSTR pwszSerialNumber,
+        const CBuffer<BYTE>& bufRawCert) const;
+    void ReportFrameHandlerFailed(
+        HRESULT hr,
+        LONG lStatus,
+        DWORD dwProcessID,
+        LPCWSTR pwszSerialNumber,
+        const CBuffer<BYTE>& bufRawCert) const;
 
     CEventProcessor(const CEventProcessor&) = delete;
     CEventProcessor& operator=(const CEventProcessor&) = delete;
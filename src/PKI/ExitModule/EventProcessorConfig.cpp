@@ -19,17 +19,115 @@
 
 --*/
 #include "pch.h"
+#include "ConfigSource.h"
 #include "EventProcessorConfig.h"
+#include "HandlerProtocol.h"
 
-LPCWSTR g_pwszRegSubkey = L"Software\\Microsoft\\PMI\\PMIExitModule";
 LPCWSTR g_pwszExePathValueName = L"ExePath";
 LPCWSTR g_pwszArgumentsValueName = L"Arguments";
 LPCWSTR g_pwszEscapeForPSValueName = L"EscapeForPS";
+LPCWSTR g_pwszHandlerModeValueName = L"HandlerMode";
+LPCWSTR g_pwszCertDeliveryValueName = L"CertDelivery";
+LPCWSTR g_pwszCertMetadataValueName = L"CertMetadata";
+LPCWSTR g_pwszWarmHandlersValueName = L"WarmHandlers";
+LPCWSTR g_pwszBatchMaxEventsValueName = L"BatchMaxEvents";
+LPCWSTR g_pwszBatchWindowMSecsValueName = L"BatchWindowMSecs";
+LPCWSTR g_pwszJournalPathValueName = L"JournalPath";
+LPCWSTR g_pwszTracePathValueName = L"TracePath";
+LPCWSTR g_pwszHandlerConcurrencyValueName = L"HandlerConcurrency";
+LPCWSTR g_pwszHandlerTimeoutMSecsValueName = L"HandlerTimeoutMSecs";
+LPCWSTR g_pwszEventCoalesceWindowSecsValueName = L"EventCoalesceWindowSecs";
 
-constexpr const size_t g_cbRegValueBuffer = 1024;
+constexpr const size_t g_cDefaultBatchMaxEvents = 100;
+constexpr const size_t g_cMaxBatchMaxEvents = 500;
+constexpr const DWORD g_dwDefaultBatchWindowMSecs = 1000;
+constexpr const DWORD g_dwMaxBatchWindowMSecs = 60000;
+constexpr const size_t g_cDefaultHandlerConcurrency = 1;
+constexpr const size_t g_cMaxHandlerConcurrency = 32;
+constexpr const size_t g_cMaxWarmHandlers = 16;
+constexpr const DWORD g_dwDefaultHandlerTimeoutMSecs = 10000;
+constexpr const DWORD g_dwMinHandlerTimeoutMSecs = 1000;
+constexpr const DWORD g_dwMaxHandlerTimeoutMSecs = 600000;
+constexpr const DWORD g_dwDefaultEventCoalesceWindowSecs = 60;
+constexpr const DWORD g_dwMaxEventCoalesceWindowSecs = 3600;
+
+LPCWSTR g_rgpwszCertIssuedArgs[] =
+{
+    L"certissued",
+    L"-subjectkeyidentifier",
+    L"{ski}",
+    L"-serialnumber",
+    L"{serial}",
+    L"-rawcertpath",
+    L"{rawcertpath}",
+};
+
+LPCWSTR g_rgpwszCertIssuedStdInArgs[] =
+{
+    L"certissued",
+    L"-subjectkeyidentifier",
+    L"{ski}",
+    L"-serialnumber",
+    L"{serial}",
+    L"-rawcertstdin",
+};
+
+LPCWSTR g_rgpwszCertIssuedMetadataArgs[] =
+{
+    L"certissued",
+    L"-subjectkeyidentifier",
+    L"{ski}",
+    L"-serialnumber",
+    L"{serial}",
+    L"-rawcertpath",
+    L"{rawcertpath}",
+    L"-metadatapath",
+    L"{metadatapath}",
+};
+
+LPCWSTR g_rgpwszCertIssuedStdInMetadataArgs[] =
+{
+    L"certissued",
+    L"-subjectkeyidentifier",
+    L"{ski}",
+    L"-serialnumber",
+    L"{serial}",
+    L"-rawcertstdin",
+    L"-metadatapath",
+    L"{metadatapath}",
+};
+
+LPCWSTR g_rgpwszBatchArgs[] =
+{
+    L"certissuedbatch",
+    L"-manifest",
+    L"{manifest}",
+    L"-resultpath",
+    L"{resultpath}",
+};
+
+LPCWSTR g_rgpwszEventStreamArgs[] =
+{
+    WSZ_HANDLER_OPERATION_EVENTSTREAM,
+};
+
+LPCWSTR g_rgpwszStandbyArgs[] =
+{
+    WSZ_HANDLER_OPERATION_STANDBY,
+};
 
 CEventProcessorConfig::CEventProcessorConfig()
-    : m_fEscapeForPS(false)
+    : m_hrLoad(E_PENDING),
+    m_fEscapeForPS(false),
+    m_eHandlerMode(HandlerModeProcessPerEvent),
+    m_eCertDelivery(CertDeliveryTempFile),
+    m_fCertMetadata(false),
+    m_cWarmHandlers(0),
+    m_cBatchMaxEvents(g_cDefaultBatchMaxEvents),
+    m_dwBatchWindowMSecs(g_dwDefaultBatchWindowMSecs),
+    m_cHandlerConcurrency(g_cDefaultHandlerConcurrency),
+    m_dwHandlerTimeoutMSecs(g_dwDefaultHandlerTimeoutMSecs),
+    m_dwEventCoalesceWindowSecs(g_dwDefaultEventCoalesceWindowSecs)
 {
 }
 
@@ -37,95 +135,265 @@ CEventProcessorConfig::~CEventProcessorConfig()
 {
 }
 
-HRESULT CEventProcessorConfig::Init()
+HRESULT CEventProcessorConfig::Load(
+    CConfigSource& objSource)
 {
     HRESULT hr = S_OK;
-    LSTATUS lr = ERROR_SUCCESS;
-    ATL::CRegKey keyModule;
-    DWORD dwType = 0;
-    DWORD cbBuf = 0;
+    HRESULT hrOptional = S_OK;
 
     do
     {
-        lr = keyModule.Open(
-            HKEY_LOCAL_MACHINE,
-            g_pwszRegSubkey,
-            KEY_ENUMERATE_SUB_KEYS | KEY_EXECUTE | KEY_QUERY_VALUE);
-        if (lr != ERROR_SUCCESS)
-        {
-            hr = HRESULT_FROM_WIN32(lr);
-            ATLTRACE(L"Failed to open reg key HKLM\\%s, hr=%x\n", g_pwszRegSubkey, hr);
+        hr = objSource.QueryString(
+            g_pwszExePathValueName,
+            OUT m_strExePath);
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"Failed to query config value %s, hr=%x\n", g_pwszExePathValueName, hr);
             break;
         }
 
-        if (!m_strExePath.Alloc(g_cbRegValueBuffer))
+        DWORD dwEscapeForPS = 0;
+        hrOptional = objSource.QueryDWORD(
+            g_pwszEscapeForPSValueName,
+            OUT dwEscapeForPS);
+        if (FAILED(hrOptional))
         {
-            ATLTRACE(L"Failed to alloc wchars for exe path.\n");
-            hr = E_OUTOFMEMORY;
-            break;
+            // optional. ignore failure.
+            ATLTRACE(
+                L"Failed to query optional config value %s, hr=%x\n",
+                g_pwszEscapeForPSValueName,
+                hrOptional);
+        }
+        else
+        {
+            m_fEscapeForPS = (dwEscapeForPS != 0);
         }
 
-        cbBuf = (DWORD)m_strExePath.GetSize();
-        lr = keyModule.QueryValue(
-            g_pwszExePathValueName,
-            &dwType,
-            (BYTE*)m_strExePath.Get(),
-            &cbBuf);
-        if (lr != ERROR_SUCCESS)
+        DWORD dwHandlerMode = 0;
+        hrOptional = objSource.QueryDWORD(
+            g_pwszHandlerModeValueName,
+            OUT dwHandlerMode);
+        if (FAILED(hrOptional))
         {
-            hr = HRESULT_FROM_WIN32(lr);
-            ATLTRACE(L"Failed to query reg value %s, hr=%x\n", g_pwszExePathValueName, hr);
-            break;
+            // optional. ignore failure.
+            ATLTRACE(
+                L"Failed to query optional config value %s, hr=%x\n",
+                g_pwszHandlerModeValueName,
+                hrOptional);
+        }
+        else if (dwHandlerMode > HandlerModeBatch)
+        {
+            ATLTRACE(L"Ignoring unknown handler mode %d\n", dwHandlerMode);
+        }
+        else
+        {
+            m_eHandlerMode = (HandlerMode)dwHandlerMode;
         }
 
-        if (dwType != REG_SZ && dwType != REG_EXPAND_SZ)
+        DWORD dwCertDelivery = 0;
+        hrOptional = objSource.QueryDWORD(
+            g_pwszCertDeliveryValueName,
+            OUT dwCertDelivery);
+        if (FAILED(hrOptional))
         {
-            ATLTRACE(L"Expected REG_SZ, actual %d\n", dwType);
-            hr = E_UNEXPECTED;
-            break;
+            // optional. ignore failure.
+            ATLTRACE(
+                L"Failed to query optional config value %s, hr=%x\n",
+                g_pwszCertDeliveryValueName,
+                hrOptional);
+        }
+        else if (dwCertDelivery > CertDeliveryStdIn)
+        {
+            ATLTRACE(L"Ignoring unknown cert delivery %d\n", dwCertDelivery);
+        }
+        else
+        {
+            m_eCertDelivery = (CertDelivery)dwCertDelivery;
         }
 
-        DWORD dwEscapeForPS = 0;
-        lr = keyModule.QueryDWORDValue(
-            g_pwszEscapeForPSValueName,
-            OUT dwEscapeForPS);
-        if (lr != ERROR_SUCCESS)
+        DWORD dwCertMetadata = 0;
+        hrOptional = objSource.QueryDWORD(
+            g_pwszCertMetadataValueName,
+            OUT dwCertMetadata);
+        if (FAILED(hrOptional))
         {
             // optional. ignore failure.
             ATLTRACE(
-                L"Failed to query optional reg value %s, hr=%x\n",
-                g_pwszEscapeForPSValueName,
-                HRESULT_FROM_WIN32(lr));
+                L"Failed to query optional config value %s, hr=%x\n",
+                g_pwszCertMetadataValueName,
+                hrOptional);
         }
         else
         {
-            m_fEscapeForPS = (dwEscapeForPS != 0);
+            m_fCertMetadata = (dwCertMetadata != 0);
         }
 
-        if (!m_bufArgData.Alloc(g_cbRegValueBuffer))
+        DWORD dwBatchMaxEvents = 0;
+        hrOptional = objSource.QueryDWORD(
+            g_pwszBatchMaxEventsValueName,
+            OUT dwBatchMaxEvents);
+        if (FAILED(hrOptional))
         {
-            ATLTRACE(L"Failed to alloc wchars for args.\n");
-            hr = E_OUTOFMEMORY;
-            break;
+            // optional. ignore failure.
+            ATLTRACE(
+                L"Failed to query optional config value %s, hr=%x\n",
+                g_pwszBatchMaxEventsValueName,
+                hrOptional);
+        }
+        else if (dwBatchMaxEvents == 0 || dwBatchMaxEvents > g_cMaxBatchMaxEvents)
+        {
+            ATLTRACE(L"Ignoring out of range batch max events %d\n", dwBatchMaxEvents);
+        }
+        else
+        {
+            m_cBatchMaxEvents = dwBatchMaxEvents;
+        }
+
+        DWORD dwBatchWindowMSecs = 0;
+        hrOptional = objSource.QueryDWORD(
+            g_pwszBatchWindowMSecsValueName,
+            OUT dwBatchWindowMSecs);
+        if (FAILED(hrOptional))
+        {
+            // optional. ignore failure.
+            ATLTRACE(
+                L"Failed to query optional config value %s, hr=%x\n",
+                g_pwszBatchWindowMSecsValueName,
+                hrOptional);
+        }
+        else if (dwBatchWindowMSecs > g_dwMaxBatchWindowMSecs)
+        {
+            ATLTRACE(L"Ignoring out of range batch window %d\n", dwBatchWindowMSecs);
+        }
+        else
+        {
+            m_dwBatchWindowMSecs = dwBatchWindowMSecs;
+        }
+
+        DWORD dwHandlerConcurrency = 0;
+        hrOptional = objSource.QueryDWORD(
+            g_pwszHandlerConcurrencyValueName,
+            OUT dwHandlerConcurrency);
+        if (FAILED(hrOptional))
+        {
+            // optional. ignore failure.
+            ATLTRACE(
+                L"Failed to query optional config value %s, hr=%x\n",
+                g_pwszHandlerConcurrencyValueName,
+                hrOptional);
+        }
+        else if (dwHandlerConcurrency == 0 || dwHandlerConcurrency > g_cMaxHandlerConcurrency)
+        {
+            ATLTRACE(L"Ignoring out of range handler concurrency %d\n", dwHandlerConcurrency);
+        }
+        else
+        {
+            m_cHandlerConcurrency = dwHandlerConcurrency;
+        }
+
+        DWORD dwWarmHandlers = 0;
+        hrOptional = objSource.QueryDWORD(
+            g_pwszWarmHandlersValueName,
+            OUT dwWarmHandlers);
+        if (FAILED(hrOptional))
+        {
+            // optional. ignore failure.
+            ATLTRACE(
+                L"Failed to query optional config value %s, hr=%x\n",
+                g_pwszWarmHandlersValueName,
+                hrOptional);
+        }
+        else if (dwWarmHandlers > g_cMaxWarmHandlers)
+        {
+            ATLTRACE(L"Ignoring out of range warm handlers %d\n", dwWarmHandlers);
+        }
+        else
+        {
+            m_cWarmHandlers = dwWarmHandlers;
         }
 
-        ULONG cch = (ULONG)m_bufArgData.GetLength();
-        lr = keyModule.QueryMultiStringValue(
+        DWORD dwHandlerTimeoutMSecs = 0;
+        hrOptional = objSource.QueryDWORD(
+            g_pwszHandlerTimeoutMSecsValueName,
+            OUT dwHandlerTimeoutMSecs);
+        if (FAILED(hrOptional))
+        {
+            // optional. ignore failure.
+            ATLTRACE(
+                L"Failed to query optional config value %s, hr=%x\n",
+                g_pwszHandlerTimeoutMSecsValueName,
+                hrOptional);
+        }
+        else if (dwHandlerTimeoutMSecs < g_dwMinHandlerTimeoutMSecs ||
+            dwHandlerTimeoutMSecs > g_dwMaxHandlerTimeoutMSecs)
+        {
+            ATLTRACE(L"Ignoring out of range handler timeout %d\n", dwHandlerTimeoutMSecs);
+        }
+        else
+        {
+            m_dwHandlerTimeoutMSecs = dwHandlerTimeoutMSecs;
+        }
+
+        DWORD dwEventCoalesceWindowSecs = 0;
+        hrOptional = objSource.QueryDWORD(
+            g_pwszEventCoalesceWindowSecsValueName,
+            OUT dwEventCoalesceWindowSecs);
+        if (FAILED(hrOptional))
+        {
+            // optional. ignore failure.
+            ATLTRACE(
+                L"Failed to query optional config value %s, hr=%x\n",
+                g_pwszEventCoalesceWindowSecsValueName,
+                hrOptional);
+        }
+        else if (dwEventCoalesceWindowSecs > g_dwMaxEventCoalesceWindowSecs)
+        {
+            ATLTRACE(L"Ignoring out of range event coalesce window %d\n", dwEventCoalesceWindowSecs);
+        }
+        else
+        {
+            m_dwEventCoalesceWindowSecs = dwEventCoalesceWindowSecs;
+        }
+
+        hrOptional = objSource.QueryString(
+            g_pwszJournalPathValueName,
+            OUT m_strJournalPath);
+        if (FAILED(hrOptional))
+        {
+            // optional. ignore failure.
+            ATLTRACE(
+                L"Failed to query optional config value %s, hr=%x\n",
+                g_pwszJournalPathValueName,
+                hrOptional);
+        }
+
+        hrOptional = objSource.QueryString(
+            g_pwszTracePathValueName,
+            OUT m_strTracePath);
+        if (FAILED(hrOptional))
+        {
+            // optional. ignore failure.
+            ATLTRACE(
+                L"Failed to query optional config value %s, hr=%x\n",
+                g_pwszTracePathValueName,
+                hrOptional);
+        }
+
+        hrOptional = objSource.QueryMultiString(
             g_pwszArgumentsValueName,
-            m_bufArgData.Get(),
-            &cch);
-        if (lr != ERROR_SUCCESS)
+            OUT m_bufArgData);
+        if (FAILED(hrOptional))
         {
             // optional. ignore failure.
             ATLTRACE(
-                L"Failed to query optional reg value %s, hr=%x\n",
+                L"Failed to query optional config value %s, hr=%x\n",
                 g_pwszArgumentsValueName,
-                HRESULT_FROM_WIN32(lr));
+                hrOptional);
         }
         else
         {
             size_t cArgs = 0;
-            size_t cchMax = cch;
+            size_t cchMax = m_bufArgData.GetLength();
             LPCWSTR pwsz = m_bufArgData.Get();
             while (pwsz && *pwsz)
             {
@@ -148,8 +416,8 @@ HRESULT CEventProcessorConfig::Init()
             }
 
             pwsz = m_bufArgData.Get();
-            cchMax = cch;
-            for (UINT nIndex = 0; pwsz && *pwsz; nIndex++)
+            cchMax = m_bufArgData.GetLength();
+            for (UINT nIndex = 0; pwsz && *pwsz && nIndex < cArgs; nIndex++)
             {
                 size_t cchArg = 0;
                 hr = ::StringCchLengthW(pwsz, cchMax, &cchArg);
@@ -160,12 +428,77 @@ HRESULT CEventProcessorConfig::Init()
 
                 m_bufArguments.Get()[nIndex] = pwsz;
 
-                cchMax -= (ULONG)cchArg + 1;
+                cchMax -= cchArg + 1;
                 pwsz += cchArg + 1;
             }
         }
-        
+
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        hr = CompileTemplates();
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"CEventProcessorConfig::CompileTemplates failed, hr=%x\n", hr);
+            break;
+        }
     } while (false);
 
+    m_hrLoad = hr;
     return hr;
 }
+
+HRESULT CEventProcessorConfig::CompileTemplates()
+{
+    CRefBuffer<LPCWSTR> bufCertIssuedArgs;
+    if (m_eCertDelivery == CertDeliveryStdIn)
+    {
+        bufCertIssuedArgs.Attach(
+            m_fCertMetadata ? g_rgpwszCertIssuedStdInMetadataArgs : g_rgpwszCertIssuedStdInArgs,
+            m_fCertMetadata ? ARRAYSIZE(g_rgpwszCertIssuedStdInMetadataArgs) : ARRAYSIZE(g_rgpwszCertIssuedStdInArgs));
+    }
+    else
+    {
+        bufCertIssuedArgs.Attach(
+            m_fCertMetadata ? g_rgpwszCertIssuedMetadataArgs : g_rgpwszCertIssuedArgs,
+            m_fCertMetadata ? ARRAYSIZE(g_rgpwszCertIssuedMetadataArgs) : ARRAYSIZE(g_rgpwszCertIssuedArgs));
+    }
+
+    HRESULT hr = m_objCertIssuedTemplate.Compile(
+        m_strExePath.Get(),
+        m_bufArguments,
+        bufCertIssuedArgs,
+        m_fEscapeForPS);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    hr = m_objBatchTemplate.Compile(
+        m_strExePath.Get(),
+        m_bufArguments,
+        CRefBuffer<LPCWSTR>(g_rgpwszBatchArgs, ARRAYSIZE(g_rgpwszBatchArgs)),
+        m_fEscapeForPS);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    hr = m_objEventStreamTemplate.Compile(
+        m_strExePath.Get(),
+        m_bufArguments,
+        CRefBuffer<LPCWSTR>(g_rgpwszEventStreamArgs, ARRAYSIZE(g_rgpwszEventStreamArgs)),
+        m_fEscapeForPS);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    return m_objStandbyTemplate.Compile(
+        m_strExePath.Get(),
+        m_bufArguments,
+        CRefBuffer<LPCWSTR>(g_rgpwszStandbyArgs, ARRAYSIZE(g_rgpwszStandbyArgs)),
+        m_fEscapeForPS);
+}
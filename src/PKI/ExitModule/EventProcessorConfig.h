@@ -20,11 +20,54 @@
 
 --*/
 
+#include "CommandLineTemplate.h"
+
+class CConfigSource;
+
+/*++
+
+    Abstract:
+
+        How the event processor runs the registered handler.
+--*/
+enum HandlerMode : DWORD
+{
+    // Start a new process for each event. Event data is passed on the command line.
+    HandlerModeProcessPerEvent = 0,
+
+    // Keep one process running and stream events to its stdin. See HandlerProtocol.h.
+    HandlerModePersistent = 1,
+
+    // Start one process for a batch of events. Event data is passed in a manifest file.
+    HandlerModeBatch = 2,
+};
+
 /*++
 
     Abstract:
 
-        Registry Configuration used by the event processor.
+        How the raw cert reaches a handler started for each event.
+--*/
+enum CertDelivery : DWORD
+{
+    // Write the DER bytes to a temp file and pass -rawcertpath.
+    CertDeliveryTempFile = 0,
+
+    // Write the DER bytes to the handler's stdin and pass -rawcertstdin. A temp file is only
+    // written when the handler fails, so the cert can be investigated.
+    CertDeliveryStdIn = 1,
+};
+
+/*++
+
+    Abstract:
+
+        Configuration used by the event processor.
+
+    Remarks:
+
+        Loaded once per config change by CEventProcessorConfigCache and not modified after that,
+        so any number of threads can read it without locking.
 --*/
 class CEventProcessorConfig
 {
@@ -36,14 +79,37 @@ public:
     
         Abstract:
 
-            Loads config values from the registry.
+            Loads config values.
+
+        Parameters:
+
+            objSource - the opened config source.
 
         Returns:
 
             S_OK - success.
-            other - error.
+            other - error. Values that were not read keep their defaults.
     --*/
-    HRESULT Init();
+    HRESULT Load(
+        CConfigSource& objSource);
+
+    /*++
+
+        Abstract:
+
+            Gets the result of Load(), or the error that kept it from being called.
+
+    --*/
+    inline HRESULT GetLoadResult() const
+    {
+        return m_hrLoad;
+    }
+
+    inline void SetLoadResult(
+        HRESULT hr)
+    {
+        m_hrLoad = hr;
+    }
 
     inline LPCWSTR GetExePath() const
     {
@@ -60,11 +126,185 @@ public:
         return m_fEscapeForPS;
     }
 
+    /*++
+
+        Abstract:
+
+            Gets the command line for the certissued operation.
+
+        Remarks:
+
+            Compiled by Load() from the exe path, the Arguments and the operation arguments.
+            The operation arguments depend on GetCertDelivery() and GetCertMetadata().
+    --*/
+    inline const CCommandLineTemplate& GetCertIssuedTemplate() const
+    {
+        return m_objCertIssuedTemplate;
+    }
+
+    inline const CCommandLineTemplate& GetBatchTemplate() const
+    {
+        return m_objBatchTemplate;
+    }
+
+    inline const CCommandLineTemplate& GetEventStreamTemplate() const
+    {
+        return m_objEventStreamTemplate;
+    }
+
+    inline const CCommandLineTemplate& GetStandbyTemplate() const
+    {
+        return m_objStandbyTemplate;
+    }
+
+    inline HandlerMode GetHandlerMode() const
+    {
+        return m_eHandlerMode;
+    }
+
+    inline CertDelivery GetCertDelivery() const
+    {
+        return m_eCertDelivery;
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets whether the certissued command line passes -metadatapath.
+
+        Remarks:
+
+            The metadata file is written for any handler command line that uses {metadatapath},
+            so Arguments can also name it without this set.
+    --*/
+    inline bool GetCertMetadata() const
+    {
+        return m_fCertMetadata;
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets the number of handler processes to keep started ahead of events, or 0 for none.
+
+        Remarks:
+
+            Only used when the handler mode is HandlerModeProcessPerEvent.
+    --*/
+    inline size_t GetWarmHandlers() const
+    {
+        return m_cWarmHandlers;
+    }
+
+    inline size_t GetBatchMaxEvents() const
+    {
+        return m_cBatchMaxEvents;
+    }
+
+    inline DWORD GetBatchWindowMSecs() const
+    {
+        return m_dwBatchWindowMSecs;
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets the number of handlers that can run at the same time.
+
+        Remarks:
+
+            Read when the exit module is initialized. Changing it needs a CertSvc restart.
+            Other values take effect for the next event after they change.
+    --*/
+    inline size_t GetHandlerConcurrency() const
+    {
+        return m_cHandlerConcurrency;
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets the time a handler has to process an event before it is terminated.
+
+        Remarks:
+
+            Also the time to wait for an ack from a persistent or warm handler. A batch
+            handler gets extra time for each event in the batch.
+    --*/
+    inline DWORD GetHandlerTimeoutMSecs() const
+    {
+        return m_dwHandlerTimeoutMSecs;
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets the time repeated failure events are coalesced for, or 0 to report each one.
+
+        Remarks:
+
+            Read when the exit module is initialized. Changing it needs a CertSvc restart.
+    --*/
+    inline DWORD GetEventCoalesceWindowSecs() const
+    {
+        return m_dwEventCoalesceWindowSecs;
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets the directory for the event journal, or nullptr to use the default.
+
+    --*/
+    inline LPCWSTR GetJournalPath() const
+    {
+        return m_strJournalPath.Get();
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets the directory to capture event traces to, or nullptr to not capture them.
+
+        Remarks:
+
+            Read when the exit module is initialized. Changing it needs a CertSvc restart.
+    --*/
+    inline LPCWSTR GetTracePath() const
+    {
+        return m_strTracePath.Get();
+    }
+
 private:
+    HRESULT m_hrLoad;
     CHeapWString m_strExePath;
     CHeapBuffer<WCHAR> m_bufArgData;
     CHeapBuffer<LPCWSTR> m_bufArguments;
     bool m_fEscapeForPS;
+    HandlerMode m_eHandlerMode;
+    CertDelivery m_eCertDelivery;
+    bool m_fCertMetadata;
+    size_t m_cWarmHandlers;
+    size_t m_cBatchMaxEvents;
+    DWORD m_dwBatchWindowMSecs;
+    size_t m_cHandlerConcurrency;
+    DWORD m_dwHandlerTimeoutMSecs;
+    DWORD m_dwEventCoalesceWindowSecs;
+    CHeapWString m_strJournalPath;
+    CHeapWString m_strTracePath;
+    CCommandLineTemplate m_objCertIssuedTemplate;
+    CCommandLineTemplate m_objBatchTemplate;
+    CCommandLineTemplate m_objEventStreamTemplate;
+    CCommandLineTemplate m_objStandbyTemplate;
+
+    HRESULT CompileTemplates();
 
     CEventProcessorConfig(const CEventProcessorConfig&) = delete;
     CEventProcessorConfig& operator=(const CEventProcessorConfig&) = delete;
@@ -0,0 +1,349 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventProcessorConfigCache.cpp
+
+    Abstract:
+
+        CEventProcessorConfigCache class impl.
+
+--*/
+
+#include "pch.h"
+#include "ConfigSource.h"
+#include "EventProcessorConfigCache.h"
+
+LPCWSTR g_pwszRegSubkey = L"Software\\Microsoft\\PMI\\PMIExitModule";
+#ifdef PMI_TEST_HOOKS
+LPCWSTR g_pwszConfigFileVariable = L"PMIEXITMODULE_CONFIG_FILE";
+#endif
+
+// How often to reload when the config source cannot be watched.
+constexpr const DWORD g_dwConfigPollIntervalMSecs = 30000;
+
+// How often to check whether readers are done with replaced snapshots.
+constexpr const DWORD g_dwConfigReclaimIntervalMSecs = 1000;
+
+CEventProcessorConfigCache::CEventProcessorConfigCache()
+    : m_pSource(nullptr),
+    m_pCurrent(nullptr),
+    m_pRetired(nullptr),
+    m_cAcquiring(0),
+    m_cReloads(0),
+    m_hStopEvent(NULL),
+    m_hReadyEvent(NULL),
+    m_hWatchThread(NULL)
+{
+    m_stEmpty.objConfig.SetLoadResult(HRESULT_FROM_WIN32(ERROR_NOT_READY));
+}
+
+CEventProcessorConfigCache::~CEventProcessorConfigCache()
+{
+    Close();
+}
+
+HRESULT CEventProcessorConfigCache::Open(
+    CConfigSource* pSource)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        if (!pSource)
+        {
+            hr = E_OUTOFMEMORY;
+            break;
+        }
+
+        if (m_pSource)
+        {
+            ATLTRACE(L"The config cache has been previously opened.\n");
+            delete pSource;
+            return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+        }
+
+        m_pSource = pSource;
+
+        m_hStopEvent = ::CreateEventW(
+            nullptr, // lpEventAttributes
+            TRUE, // bManualReset
+            FALSE, // bInitialState
+            nullptr); // lpName
+        m_hReadyEvent = ::CreateEventW(
+            nullptr, // lpEventAttributes
+            TRUE, // bManualReset
+            FALSE, // bInitialState
+            nullptr); // lpName
+        if (!m_hStopEvent || !m_hReadyEvent)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateEventW failed, hr=%x\n", hr);
+            break;
+        }
+
+        m_hWatchThread = ::CreateThread(
+            nullptr, // lpThreadAttributes
+            0, // dwStackSize
+            WatchThreadProc,
+            this, // lpParameter
+            0, // dwCreationFlags
+            nullptr); // lpThreadId
+        if (!m_hWatchThread)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateThread failed, hr=%x\n", hr);
+            break;
+        }
+
+        // The watcher loads the first snapshot. Change notifications belong to the thread that asks for them.
+        HANDLE rghWait[] = { m_hReadyEvent, m_hWatchThread };
+        ::WaitForMultipleObjects(ARRAYSIZE(rghWait), rghWait, FALSE, INFINITE);
+    } while (false);
+
+    if (FAILED(hr) && m_pSource)
+    {
+        // Load once without watching so events can still be delivered.
+        ATLTRACE(L"Not watching for config changes, hr=%x\n", hr);
+        HANDLE hChange = NULL;
+        Reload(OUT hChange);
+        hr = S_OK;
+    }
+
+    return hr;
+}
+
+void CEventProcessorConfigCache::Close()
+{
+    if (m_hWatchThread)
+    {
+        ::SetEvent(m_hStopEvent);
+        ::WaitForSingleObject(m_hWatchThread, INFINITE);
+        ::CloseHandle(m_hWatchThread);
+        m_hWatchThread = NULL;
+    }
+
+    if (m_hStopEvent)
+    {
+        ::CloseHandle(m_hStopEvent);
+        m_hStopEvent = NULL;
+    }
+
+    if (m_hReadyEvent)
+    {
+        ::CloseHandle(m_hReadyEvent);
+        m_hReadyEvent = NULL;
+    }
+
+    if (m_pSource)
+    {
+        m_pSource->Close();
+        delete m_pSource;
+        m_pSource = nullptr;
+    }
+
+    Snapshot* pOld = static_cast<Snapshot*>(::InterlockedExchangePointer(
+        reinterpret_cast<PVOID volatile*>(&m_pCurrent),
+        nullptr));
+    if (pOld)
+    {
+        pOld->pNextRetired = m_pRetired;
+        m_pRetired = pOld;
+    }
+
+    FreeRetired(true);
+}
+
+const CEventProcessorConfig* CEventProcessorConfigCache::Acquire()
+{
+    // While m_cAcquiring is non-zero, the watcher does not free any snapshot,
+    // so the one read here cannot go away before its reference is taken.
+    ::InterlockedIncrement(&m_cAcquiring);
+
+    Snapshot* pSnapshot = m_pCurrent;
+    if (!pSnapshot)
+    {
+        pSnapshot = &m_stEmpty;
+    }
+
+    ::InterlockedIncrement(&pSnapshot->cRefs);
+    ::InterlockedDecrement(&m_cAcquiring);
+
+    return &pSnapshot->objConfig;
+}
+
+void CEventProcessorConfigCache::Release(
+    const CEventProcessorConfig* pConfig)
+{
+    if (!pConfig)
+    {
+        return;
+    }
+
+    Snapshot* pSnapshot = CONTAINING_RECORD(
+        const_cast<CEventProcessorConfig*>(pConfig),
+        Snapshot,
+        objConfig);
+    ::InterlockedDecrement(&pSnapshot->cRefs);
+}
+
+CConfigSource* CEventProcessorConfigCache::CreateDefaultSource()
+{
+#ifdef PMI_TEST_HOOKS
+    // Only in DLLs built for TestConsoleApp. A CA is always configured from the registry.
+    CStaticBuffer<WCHAR, MAX_PATH + 1> strPath;
+    DWORD cch = ::GetEnvironmentVariableW(
+        g_pwszConfigFileVariable,
+        strPath.Get(),
+        (DWORD)strPath.GetLength());
+    if (cch > 0 && cch < strPath.GetLength())
+    {
+        ATLTRACE(L"Using config file [%s]\n", strPath.Get());
+        return new CFileConfigSource(strPath.Get());
+    }
+#endif
+
+    return new CRegistryConfigSource(HKEY_LOCAL_MACHINE, g_pwszRegSubkey);
+}
+
+void CEventProcessorConfigCache::Reload(
+    OUT HANDLE& hChange)
+{
+    hChange = NULL;
+
+    Snapshot* pNew = new Snapshot();
+    if (!pNew)
+    {
+        ATLTRACE(L"Failed to alloc config snapshot.\n");
+        return;
+    }
+
+    // Reopen each time so a key that was deleted and created again is picked up.
+    HRESULT hr = m_pSource->Open();
+    if (SUCCEEDED(hr))
+    {
+        // Watch before loading so a change made during the load is not missed.
+        HRESULT hrWatch = m_pSource->ArmChangeNotification(OUT hChange);
+        if (FAILED(hrWatch))
+        {
+            ATLTRACE(L"Polling for config changes, hr=%x\n", hrWatch);
+            hChange = NULL;
+        }
+
+        hr = pNew->objConfig.Load(*m_pSource);
+    }
+    else
+    {
+        pNew->objConfig.SetLoadResult(hr);
+    }
+
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"Failed to load the event processor config, hr=%x\n", hr);
+    }
+
+    Snapshot* pOld = static_cast<Snapshot*>(::InterlockedExchangePointer(
+        reinterpret_cast<PVOID volatile*>(&m_pCurrent),
+        pNew));
+    if (pOld)
+    {
+        pOld->pNextRetired = m_pRetired;
+        m_pRetired = pOld;
+    }
+
+    LONG cReloads = ::InterlockedIncrement(&m_cReloads);
+    ATLTRACE(L"Loaded config snapshot %d, hr=%x\n", cReloads, hr);
+}
+
+void CEventProcessorConfigCache::FreeRetired(
+    bool fForce)
+{
+    // A reader between reading m_pCurrent and taking its reference could hold any retired snapshot.
+    if (!fForce && m_cAcquiring != 0)
+    {
+        return;
+    }
+
+    Snapshot** ppNext = &m_pRetired;
+    while (*ppNext)
+    {
+        Snapshot* pSnapshot = *ppNext;
+        if (fForce || pSnapshot->cRefs == 0)
+        {
+            *ppNext = pSnapshot->pNextRetired;
+            delete pSnapshot;
+        }
+        else
+        {
+            ppNext = &pSnapshot->pNextRetired;
+        }
+    }
+}
+
+DWORD WINAPI CEventProcessorConfigCache::WatchThreadProc(
+    LPVOID pvParam)
+{
+    CEventProcessorConfigCache* pThis = static_cast<CEventProcessorConfigCache*>(pvParam);
+    pThis->RunWatch();
+    return 0;
+}
+
+void CEventProcessorConfigCache::RunWatch()
+{
+    for (;;)
+    {
+        HANDLE hChange = NULL;
+        Reload(OUT hChange);
+        ::SetEvent(m_hReadyEvent);
+
+        HANDLE rghWait[] = { m_hStopEvent, hChange };
+        DWORD cWait = hChange ? ARRAYSIZE(rghWait) : 1;
+        ULONGLONG ullNextPoll = ::GetTickCount64() + g_dwConfigPollIntervalMSecs;
+        DWORD dwRes = WAIT_TIMEOUT;
+
+        for (;;)
+        {
+            FreeRetired(false);
+
+            DWORD dwTimeout = INFINITE;
+            if (!hChange)
+            {
+                ULONGLONG ullNow = ::GetTickCount64();
+                if (ullNow >= ullNextPoll)
+                {
+                    break;
+                }
+
+                dwTimeout = (DWORD)(ullNextPoll - ullNow);
+            }
+
+            if (m_pRetired && dwTimeout > g_dwConfigReclaimIntervalMSecs)
+            {
+                dwTimeout = g_dwConfigReclaimIntervalMSecs;
+            }
+
+            dwRes = ::WaitForMultipleObjects(cWait, rghWait, FALSE, dwTimeout);
+            if (dwRes != WAIT_TIMEOUT)
+            {
+                break;
+            }
+        }
+
+        if (dwRes == WAIT_OBJECT_0)
+        {
+            break;
+        }
+        else if (dwRes == WAIT_FAILED)
+        {
+            ATLTRACE(L"WaitForMultipleObjects failed, hr=%x\n", HRESULT_FROM_WIN32(::GetLastError()));
+            if (::WaitForSingleObject(m_hStopEvent, g_dwConfigPollIntervalMSecs) == WAIT_OBJECT_0)
+            {
+                break;
+            }
+        }
+
+        // The config changed or a poll is due.
+    }
+}
@@ -0,0 +1,199 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventProcessorConfigCache.h
+
+    Abstract:
+
+        CEventProcessorConfigCache and CEventProcessorConfigRef class declarations.
+
+--*/
+
+#include "EventProcessorConfig.h"
+
+class CConfigSource;
+
+/*++
+
+    Abstract:
+
+        Keeps the current event processor config for the lifetime of the exit module.
+
+    Remarks:
+
+        The config is loaded once into a snapshot that is never modified. A watcher thread
+        waits for the config source to change, loads a new snapshot and swaps it in.
+        Readers take a reference to the current snapshot with interlocked operations only.
+        They never lock or query the config source.
+
+        A replaced snapshot is freed by the watcher thread once no reader holds it.
+
+        If the source cannot be watched, for example because the registry key does not exist
+        yet, the watcher reloads every g_dwConfigPollIntervalMSecs instead.
+--*/
+class CEventProcessorConfigCache
+{
+public:
+    CEventProcessorConfigCache();
+    ~CEventProcessorConfigCache();
+
+    /*++
+
+        Abstract:
+
+            Loads the first snapshot and starts watching for changes.
+
+        Parameters:
+
+            pSource - the config source. Ownership always transfers to the cache.
+
+        Returns:
+
+            S_OK - success. Check GetLoadResult() on the snapshot for config errors.
+            other - error code. The cache is not open.
+    --*/
+    HRESULT Open(
+        CConfigSource* pSource);
+
+    /*++
+
+        Abstract:
+
+            Stops watching for changes and frees the snapshots.
+
+        Remarks:
+
+            Call after every reference has been released.
+    --*/
+    void Close();
+
+    /*++
+
+        Abstract:
+
+            Takes a reference to the current snapshot.
+
+        Returns:
+
+            The snapshot. Never nullptr. Pass it to Release() when done.
+
+        Remarks:
+
+            Before Open() and after Close(), returns an empty snapshot whose load result is
+            HRESULT_FROM_WIN32(ERROR_NOT_READY).
+    --*/
+    const CEventProcessorConfig* Acquire();
+
+    /*++
+
+        Abstract:
+
+            Releases a reference taken by Acquire().
+
+    --*/
+    void Release(
+        const CEventProcessorConfig* pConfig);
+
+    inline LONG GetReloadCount() const
+    {
+        return m_cReloads;
+    }
+
+    /*++
+
+        Abstract:
+
+            Creates the config source for the exit module.
+
+        Returns:
+
+            A new source, or nullptr if out of memory.
+
+        Remarks:
+
+            Returns a CRegistryConfigSource for HKLM\Software\Microsoft\PMI\PMIExitModule.
+            In a DLL built with PMI_TEST_HOOKS, returns a CFileConfigSource instead if the
+            PMIEXITMODULE_CONFIG_FILE environment variable names a file. Code that links the
+            exit module sources directly, like the benchmarks, passes its own source to Open().
+    --*/
+    static CConfigSource* CreateDefaultSource();
+
+private:
+    /*++
+
+        Abstract:
+
+            A config snapshot and the number of readers that hold it.
+
+    --*/
+    struct Snapshot
+    {
+        Snapshot()
+            : cRefs(0), pNextRetired(nullptr)
+        {
+        }
+
+        CEventProcessorConfig objConfig;
+        volatile LONG cRefs;
+        Snapshot* pNextRetired;
+    };
+
+    CConfigSource* m_pSource;
+    Snapshot* volatile m_pCurrent;
+    Snapshot m_stEmpty;
+    Snapshot* m_pRetired;
+    volatile LONG m_cAcquiring;
+    volatile LONG m_cReloads;
+    HANDLE m_hStopEvent;
+    HANDLE m_hReadyEvent;
+    HANDLE m_hWatchThread;
+
+    void Reload(
+        OUT HANDLE& hChange);
+    void FreeRetired(
+        bool fForce);
+    static DWORD WINAPI WatchThreadProc(
+        LPVOID pvParam);
+    void RunWatch();
+
+    CEventProcessorConfigCache(const CEventProcessorConfigCache&) = delete;
+    CEventProcessorConfigCache& operator=(const CEventProcessorConfigCache&) = delete;
+};
+
+/*++
+
+    Abstract:
+
+        Holds a reference to a config snapshot for the lifetime of the object.
+
+--*/
+class CEventProcessorConfigRef
+{
+public:
+    CEventProcessorConfigRef(
+        CEventProcessorConfigCache& objCache)
+        : m_objCache(objCache), m_pConfig(objCache.Acquire())
+    {
+    }
+
+    ~CEventProcessorConfigRef()
+    {
+        m_objCache.Release(m_pConfig);
+    }
+
+    inline const CEventProcessorConfig& Get() const
+    {
+        return *m_pConfig;
+    }
+
+private:
+    CEventProcessorConfigCache& m_objCache;
+    const CEventProcessorConfig* m_pConfig;
+
+    CEventProcessorConfigRef(const CEventProcessorConfigRef&) = delete;
+    CEventProcessorConfigRef& operator=(const CEventProcessorConfigRef&) = delete;
+};
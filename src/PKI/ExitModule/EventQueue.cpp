@@ -0,0 +1,140 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventQueue.cpp
+
+    Abstract:
+
+        CEventQueue class impl.
+
+--*/
+
+#include "pch.h"
+#include "CertIssuedEvent.h"
+#include "EventQueue.h"
+#include "PerfCounters.h"
+
+CEventQueue::CEventQueue()
+    : m_iHead(0), m_cCount(0), m_fClosed(false), m_cDepth(0), m_cHighWaterMark(0)
+{
+    ::InitializeSRWLock(&m_lock);
+    ::InitializeConditionVariable(&m_cvNotEmpty);
+}
+
+CEventQueue::~CEventQueue()
+{
+    for (size_t i = 0; i < m_cCount; i++)
+    {
+        delete m_bufSlots.Get()[(m_iHead + i) % m_bufSlots.GetLength()];
+    }
+
+    CPerfCounters::Get().Add(PerfCounterQueueDepth, -(LONGLONG)m_cCount);
+}
+
+HRESULT CEventQueue::Init(
+    size_t cCapacity)
+{
+    if (m_bufSlots.GetLength() > 0)
+    {
+        ATLTRACE(L"The queue has been previously initialized.\n");
+        return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+    }
+
+    if (cCapacity == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    if (!m_bufSlots.Alloc(cCapacity))
+    {
+        ATLTRACE(L"Failed to alloc %d queue slots.\n", cCapacity);
+        return E_OUTOFMEMORY;
+    }
+
+    return S_OK;
+}
+
+bool CEventQueue::TryEnqueue(
+    CCertIssuedEvent* pEvent)
+{
+    bool fResult = false;
+
+    ::AcquireSRWLockExclusive(&m_lock);
+    if (!m_fClosed && m_cCount < m_bufSlots.GetLength())
+    {
+        m_bufSlots.Get()[(m_iHead + m_cCount) % m_bufSlots.GetLength()] = pEvent;
+        m_cCount++;
+
+        LONG cDepth = ::InterlockedIncrement(&m_cDepth);
+        CPerfCounters::Get().Add(PerfCounterQueueDepth);
+        if (cDepth > m_cHighWaterMark)
+        {
+            m_cHighWaterMark = cDepth;
+        }
+
+        fResult = true;
+    }
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+
+    if (fResult)
+    {
+        ::WakeConditionVariable(&m_cvNotEmpty);
+    }
+
+    return fResult;
+}
+
+CCertIssuedEvent* CEventQueue::Dequeue(
+    DWORD dwMilliseconds)
+{
+    CCertIssuedEvent* pEvent = nullptr;
+    ULONGLONG ullDeadline = ::GetTickCount64() + dwMilliseconds;
+
+    ::AcquireSRWLockExclusive(&m_lock);
+    while (m_cCount == 0 && !m_fClosed)
+    {
+        DWORD dwWait = INFINITE;
+        if (dwMilliseconds != INFINITE)
+        {
+            ULONGLONG ullNow = ::GetTickCount64();
+            if (ullNow >= ullDeadline)
+            {
+                break;
+            }
+
+            dwWait = (DWORD)(ullDeadline - ullNow);
+        }
+
+        ::SleepConditionVariableSRW(
+            &m_cvNotEmpty,
+            &m_lock,
+            dwWait,
+            0); // Flags
+    }
+
+    if (m_cCount > 0)
+    {
+        pEvent = m_bufSlots.Get()[m_iHead];
+        m_bufSlots.Get()[m_iHead] = nullptr;
+        m_iHead = (m_iHead + 1) % m_bufSlots.GetLength();
+        m_cCount--;
+        ::InterlockedDecrement(&m_cDepth);
+        CPerfCounters::Get().Add(PerfCounterQueueDepth, -1);
+    }
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+    return pEvent;
+}
+
+void CEventQueue::Close()
+{
+    ::AcquireSRWLockExclusive(&m_lock);
+    m_fClosed = true;
+    ::ReleaseSRWLockExclusive(&m_lock);
+
+    ::WakeAllConditionVariable(&m_cvNotEmpty);
+}
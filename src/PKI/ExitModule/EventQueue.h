@@ -0,0 +1,138 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventQueue.h
+
+    Abstract:
+
+        CEventQueue class declaration.
+
+--*/
+
+class CCertIssuedEvent;
+
+/*++
+
+    Abstract:
+
+        Bounded, thread-safe FIFO of events waiting for delivery.
+
+    Remarks:
+
+        The queue owns the events it holds. Any events still queued when the
+        queue is destroyed are deleted.
+--*/
+class CEventQueue
+{
+public:
+    CEventQueue();
+    ~CEventQueue();
+
+    /*++
+
+        Abstract:
+
+            Allocates the slots for the queue.
+
+        Parameters:
+
+            cCapacity - the maximum number of events the queue can hold.
+
+        Returns:
+
+            S_OK - success.
+            E_OUTOFMEMORY - failed to allocate the slots.
+    --*/
+    HRESULT Init(
+        size_t cCapacity);
+
+    /*++
+
+        Abstract:
+
+            Adds an event to the tail of the queue without blocking.
+
+        Parameters:
+
+            pEvent - the event to add.
+
+        Returns:
+
+            true - the queue took ownership of the event.
+            false - the queue is full or closed. The caller still owns the event.
+    --*/
+    bool TryEnqueue(
+        CCertIssuedEvent* pEvent);
+
+    /*++
+
+        Abstract:
+
+            Removes the event at the head of the queue, waiting for one if the queue is empty.
+
+        Parameters:
+
+            dwMilliseconds - how long to wait for an event. INFINITE to wait until the queue is closed.
+
+        Returns:
+
+            The event. The caller takes ownership.
+            nullptr - the queue is closed and empty, or the wait timed out.
+    --*/
+    CCertIssuedEvent* Dequeue(
+        DWORD dwMilliseconds = INFINITE);
+
+    /*++
+
+        Abstract:
+
+            Closes the queue.
+
+        Remarks:
+
+            No more events are accepted. Events already in the queue can still be dequeued.
+            Threads blocked in Dequeue() are woken up.
+    --*/
+    void Close();
+
+    /*++
+
+        Abstract:
+
+            Gets the number of events currently waiting in the queue.
+
+    --*/
+    inline LONG GetDepth() const
+    {
+        return m_cDepth;
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets the largest depth the queue has reached.
+
+    --*/
+    inline LONG GetHighWaterMark() const
+    {
+        return m_cHighWaterMark;
+    }
+
+private:
+    SRWLOCK m_lock;
+    CONDITION_VARIABLE m_cvNotEmpty;
+    CHeapBuffer<CCertIssuedEvent*> m_bufSlots;
+    size_t m_iHead;
+    size_t m_cCount;
+    bool m_fClosed;
+    volatile LONG m_cDepth;
+    volatile LONG m_cHighWaterMark;
+
+    CEventQueue(const CEventQueue&) = delete;
+    CEventQueue& operator=(const CEventQueue&) = delete;
+};
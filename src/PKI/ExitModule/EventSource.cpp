@@ -20,11 +20,19 @@
 --*/
 
 #include "pch.h"
+#include "EventLogWriter.h"
 #include "EventSource.h"
 
+#ifdef PMI_TEST_HOOKS
+LPCWSTR g_pwszEventLogFileVariable = L"PMIEXITMODULE_EVENTLOG_FILE";
+#endif
+
+// Events the background writer can hold before new ones are dropped.
+constexpr const size_t g_cEventLogWriterCapacity = 1024;
+
 CEventSource::CEventSource(
     LPCWSTR pwszProviderName)
-    : m_pwszProviderName(pwszProviderName), m_hEventLog(NULL)
+    : m_pwszProviderName(pwszProviderName), m_pSink(nullptr), m_pWriter(nullptr)
 {
 }
 
@@ -37,13 +45,74 @@ HRESULT CEventSource::Open()
 {
     HRESULT hr = S_OK;
     Close();
-    m_hEventLog = ::RegisterEventSourceW(
-        NULL, // lpUNCServerName
-        m_pwszProviderName); // lpSourceName
-    if (!m_hEventLog)
+
+    do
+    {
+        hr = OpenSink();
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        m_pWriter = new CEventLogWriter();
+        if (!m_pWriter)
+        {
+            // Not fatal. Events are written on the calling thread.
+            ATLTRACE(L"Failed to alloc the event log writer.\n");
+            break;
+        }
+
+        HRESULT hrWriter = m_pWriter->Start(m_pSink, g_cEventLogWriterCapacity);
+        if (FAILED(hrWriter))
+        {
+            // Not fatal. Events are written on the calling thread.
+            ATLTRACE(L"Failed to start the event log writer, hr=%x\n", hrWriter);
+        }
+    } while (false);
+
+    return hr;
+}
+
+HRESULT CEventSource::OpenSink()
+{
+    HRESULT hr = S_OK;
+
+#ifdef PMI_TEST_HOOKS
+    // Only in DLLs built for TestConsoleApp. A CA's events always go to the event log.
+    CStaticBuffer<WCHAR, MAX_PATH + 1> strPath;
+    DWORD cch = ::GetEnvironmentVariableW(
+        g_pwszEventLogFileVariable,
+        strPath.Get(),
+        (DWORD)strPath.GetLength());
+    if (cch > 0 && cch < strPath.GetLength())
+    {
+        ATLTRACE(L"Writing events to [%s]\n", strPath.Get());
+        CFileEventLogSink* pFileSink = new CFileEventLogSink();
+        if (!pFileSink)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        m_pSink = pFileSink;
+        hr = pFileSink->Open(strPath.Get());
+    }
+    else
+#endif
     {
-        hr = HRESULT_FROM_WIN32(::GetLastError());
-        ATLTRACE(L"RegisterEventSourceW(%s) failed, hr=%x\n", m_pwszProviderName, hr);
+        CReportEventSink* pReportEventSink = new CReportEventSink();
+        if (!pReportEventSink)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        m_pSink = pReportEventSink;
+        hr = pReportEventSink->Open(m_pwszProviderName);
+    }
+
+    if (FAILED(hr))
+    {
+        delete m_pSink;
+        m_pSink = nullptr;
     }
 
     return hr;
@@ -51,10 +120,26 @@ HRESULT CEventSource::Open()
 
 void CEventSource::Close()
 {
-    if (m_hEventLog)
+    // The writer can still be writing to the sink.
+    if (m_pWriter)
+    {
+        m_pWriter->Stop();
+        delete m_pWriter;
+        m_pWriter = nullptr;
+    }
+
+    if (m_pSink)
+    {
+        delete m_pSink;
+        m_pSink = nullptr;
+    }
+}
+
+void CEventSource::StopWriter()
+{
+    if (m_pWriter)
     {
-        ::DeregisterEventSource(m_hEventLog);
-        m_hEventLog = NULL;
+        m_pWriter->Stop();
     }
 }
 
@@ -67,27 +152,41 @@ HRESULT CEventSource::ReportEvent(
     const PSID pUserSid /* = nullptr */) const
 {
     HRESULT hr = S_OK;
-    if (!m_hEventLog)
+    if (!m_pSink)
     {
         return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
     }
 
-    if (!::ReportEventW(
-        m_hEventLog,
-        wType,
-        wCategory,
-        dwEventID,
-        pUserSid,
-        (WORD)bufStrings.GetLength(),
-        (DWORD)bufData.GetSize(),
-        const_cast<LPCWSTR*>(bufStrings.Get()),
-        const_cast<LPBYTE>(bufData.Get())))
+    if (bufStrings.GetLength() > MAXWORD || bufData.GetSize() > MAXDWORD)
     {
-        hr = HRESULT_FROM_WIN32(::GetLastError());
-        ATLTRACE(L"ReportEventW failed, hr=%x\n", hr);
+        return E_INVALIDARG;
     }
 
-    return hr;
+    if (m_pWriter)
+    {
+        hr = m_pWriter->Post(wType, wCategory, dwEventID, bufStrings, bufData, pUserSid);
+        if (hr != HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION) && hr != E_OUTOFMEMORY)
+        {
+            // Queued, or dropped because the writer is too far behind.
+            return hr;
+        }
+    }
+
+    // No writer. The record points at the caller's memory, since it is written before returning.
+    EventLogRecord stRecord;
+    stRecord.wType = wType;
+    stRecord.wCategory = wCategory;
+    stRecord.dwEventID = dwEventID;
+    stRecord.pUserSid = pUserSid;
+    stRecord.cStrings = (WORD)bufStrings.GetLength();
+    stRecord.cbData = (DWORD)bufData.GetSize();
+    stRecord.rgpwszStrings = const_cast<LPCWSTR*>(bufStrings.Get());
+    stRecord.pbData = bufData.Get();
+    ::GetSystemTimeAsFileTime(&stRecord.ftReported);
+
+    const EventLogRecord* rgpRecords[] = { &stRecord };
+    CRefBuffer<const EventLogRecord*> bufRecords(rgpRecords, 1);
+    return m_pSink->Write(bufRecords);
 }
 
 HRESULT CEventSource::ReportEvent(
@@ -21,11 +21,24 @@
 
 --*/
 
+class CEventLogSink;
+class CEventLogWriter;
+
 /*++
 
     Abstract:
 
         Wraps Win32 APIs for interacting with an event source.
+
+    Remarks:
+
+        Events are handed to a CEventLogWriter and written on its thread, so reporting an
+        event does not wait on the event log. If the writer cannot be started, or after
+        StopWriter(), events are written on the calling thread.
+
+        In a DLL built with PMI_TEST_HOOKS, if the PMIEXITMODULE_EVENTLOG_FILE environment
+        variable names a file, events are appended to it by a CFileEventLogSink instead of
+        going to the event log. Other builds ignore the variable.
 --*/
 class CEventSource
 {
@@ -37,10 +50,11 @@ public:
     
         Abstract:
 
-            Opens the event source by calling the Win32 RegisterEventSource API.
+            Opens the event source by calling the Win32 RegisterEventSource API and starts
+            the background writer.
 
         Returns:
-            S_OK - success.
+            S_OK - success. The writer may still have failed to start.
             other - error.
     --*/
     HRESULT Open();
@@ -49,11 +63,37 @@ public:
     
         Abstract:
 
-            Closes the event log.
+            Writes queued events and closes the event log.
 
     --*/
     void Close();
 
+    /*++
+
+        Abstract:
+
+            Writes queued events and stops the background writer. Later events are
+            written on the calling thread.
+
+        Remarks:
+
+            Call when the threads that report events are stopped, before reporting the
+            writer's own stats.
+    --*/
+    void StopWriter();
+
+    /*++
+
+        Abstract:
+
+            Gets the background writer, or nullptr if the source is not open.
+
+    --*/
+    inline const CEventLogWriter* GetWriter() const
+    {
+        return m_pWriter;
+    }
+
     /*++
     
         Abstract:
@@ -71,7 +111,7 @@ public:
 
         Returns:
 
-            S_OK - success.
+            S_OK - success. The event may still be queued.
             other - error.
     --*/
     HRESULT ReportEvent(
@@ -110,9 +150,53 @@ public:
         const CBuffer<BYTE>& bufData,
         const PSID pUserSid = nullptr) const;
 
+    /*++
+
+        Abstract:
+
+            Formats the arguments on the stack and reports them as the event's strings.
+
+        Arguments:
+
+            wType - event type.
+            wCategory - event category.
+            dwEventID - event ID.
+            args - the values of the insertion strings, in order. See CEventArgFormatter
+                for the types.
+
+        Returns:
+
+            S_OK - success. The event may still be queued.
+            other - error.
+    --*/
+    template<typename... TArgs>
+    HRESULT ReportEventArgs(
+        WORD wType,
+        WORD wCategory,
+        DWORD dwEventID,
+        const TArgs&... args) const
+    {
+        CEventArgFormatter<sizeof...(TArgs)> objArgs;
+        HRESULT hr = objArgs.Format(args...);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        return ReportEvent(
+            wType,
+            wCategory,
+            dwEventID,
+            objArgs.GetStrings(),
+            CRefBuffer<BYTE>());
+    }
+
 private:
     LPCWSTR m_pwszProviderName;
-    HANDLE m_hEventLog;
+    CEventLogSink* m_pSink;
+    CEventLogWriter* m_pWriter;
+
+    HRESULT OpenSink();
 
     CEventSource(const CEventSource&) = delete;
     CEventSource& operator=(const CEventSource&) = delete;
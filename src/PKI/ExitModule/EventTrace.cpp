@@ -0,0 +1,448 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventTrace.cpp
+
+    Abstract:
+
+        CEventTrace class impl.
+
+--*/
+
+#include "pch.h"
+#include <sddl.h>
+#include "CertIssuedEvent.h"
+#include "TraceFormat.h"
+#include "EventTrace.h"
+
+// Only SYSTEM and Administrators can read a trace. It has every cert issued while it ran.
+LPCWSTR g_pwszTraceFileSDDL = L"D:P(A;;FA;;;SY)(A;;FA;;;BA)";
+
+constexpr const size_t g_cbTraceBuffer = 256 * 1024;
+
+// How often the writer writes a partly filled buffer.
+constexpr const DWORD g_dwTraceFlushIntervalMSecs = 1000;
+
+namespace
+{
+    inline size_t AlignRecord(
+        size_t cb)
+    {
+        return (cb + EVENT_TRACE_RECORD_ALIGNMENT - 1) & ~((size_t)EVENT_TRACE_RECORD_ALIGNMENT - 1);
+    }
+
+    inline size_t GetStringLength(
+        LPCWSTR pwsz)
+    {
+        return pwsz ? wcslen(pwsz) : 0;
+    }
+
+    inline BYTE* AppendBytes(
+        BYTE* pbCurrent,
+        const void* pv,
+        size_t cb)
+    {
+        if (cb > 0)
+        {
+            CopyMemory(pbCurrent, pv, cb);
+        }
+
+        return pbCurrent + cb;
+    }
+}
+
+CEventTrace::CEventTrace()
+    : m_hFile(INVALID_HANDLE_VALUE),
+    m_iActive(0),
+    m_cbActive(0),
+    m_cbFull(0),
+    m_fStopping(false),
+    m_hStopEvent(NULL),
+    m_hFullEvent(NULL),
+    m_hWriterThread(NULL),
+    m_cRecords(0),
+    m_cDropped(0)
+{
+    ::InitializeSRWLock(&m_lock);
+    m_liStart.QuadPart = 0;
+    m_liFrequency.QuadPart = 1;
+}
+
+CEventTrace::~CEventTrace()
+{
+    Close();
+}
+
+HRESULT CEventTrace::Open(
+    LPCWSTR pwszDirectory)
+{
+    HRESULT hr = S_OK;
+    CHeapWString strDirectory;
+    CHeapWString strPath;
+    PSECURITY_DESCRIPTOR pSD = nullptr;
+    SECURITY_ATTRIBUTES stAttributes;
+    ZeroMemory(&stAttributes, sizeof(stAttributes));
+    stAttributes.nLength = sizeof(stAttributes);
+
+    do
+    {
+        if (IsOpen())
+        {
+            ATLTRACE(L"The event trace has been previously opened.\n");
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+            break;
+        }
+
+        DWORD cch = ::ExpandEnvironmentStringsW(pwszDirectory, nullptr, 0);
+        if (cch == 0 || !strDirectory.Alloc(cch))
+        {
+            hr = (cch == 0) ? HRESULT_FROM_WIN32(::GetLastError()) : E_OUTOFMEMORY;
+            ATLTRACE(L"ExpandEnvironmentStringsW(%s) failed, hr=%x\n", pwszDirectory, hr);
+            break;
+        }
+
+        if (::ExpandEnvironmentStringsW(pwszDirectory, strDirectory.Get(), cch) == 0)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"ExpandEnvironmentStringsW(%s) failed, hr=%x\n", pwszDirectory, hr);
+            break;
+        }
+
+        EventTraceFileHeader stHeader;
+        ZeroMemory(&stHeader, sizeof(stHeader));
+        stHeader.dwMagic = EVENT_TRACE_FILE_MAGIC;
+        stHeader.wVersion = EVENT_TRACE_VERSION;
+        stHeader.cbHeader = sizeof(stHeader);
+        stHeader.dwProcessId = ::GetCurrentProcessId();
+        ::GetSystemTimeAsFileTime(&stHeader.ftStart);
+
+        SYSTEMTIME stStart;
+        ::FileTimeToSystemTime(&stHeader.ftStart, &stStart);
+
+        size_t cchPath = wcslen(strDirectory.Get()) + 64;
+        if (!strPath.Alloc(cchPath))
+        {
+            hr = E_OUTOFMEMORY;
+            break;
+        }
+
+        hr = ::StringCchPrintfW(
+            strPath.Get(),
+            cchPath,
+            L"%s\\PMITrace.%04u%02u%02u%02u%02u%02u.%u.dat",
+            strDirectory.Get(),
+            stStart.wYear,
+            stStart.wMonth,
+            stStart.wDay,
+            stStart.wHour,
+            stStart.wMinute,
+            stStart.wSecond,
+            stHeader.dwProcessId);
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        if (!::ConvertStringSecurityDescriptorToSecurityDescriptorW(
+            g_pwszTraceFileSDDL,
+            SDDL_REVISION_1,
+            &pSD,
+            nullptr)) // SecurityDescriptorSize
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"ConvertStringSecurityDescriptorToSecurityDescriptorW failed, hr=%x\n", hr);
+            break;
+        }
+
+        stAttributes.lpSecurityDescriptor = pSD;
+
+        if (!m_bufBuffers.Alloc(2 * g_cbTraceBuffer))
+        {
+            hr = E_OUTOFMEMORY;
+            break;
+        }
+
+        ::QueryPerformanceFrequency(&m_liFrequency);
+        ::QueryPerformanceCounter(&m_liStart);
+        m_iActive = 0;
+        AppendBytes(GetBuffer(m_iActive), &stHeader, sizeof(stHeader));
+        m_cbActive = sizeof(stHeader);
+        m_cbFull = 0;
+        m_fStopping = false;
+
+        // Readers can follow the trace while it is written.
+        m_hFile = ::CreateFileW(
+            strPath.Get(),
+            GENERIC_WRITE,
+            FILE_SHARE_READ,
+            &stAttributes,
+            CREATE_NEW,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+            NULL); // hTemplateFile
+        if (m_hFile == INVALID_HANDLE_VALUE)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateFileW(%s) failed, hr=%x\n", strPath.Get(), hr);
+            break;
+        }
+
+        m_hStopEvent = ::CreateEventW(
+            nullptr, // lpEventAttributes
+            TRUE, // bManualReset
+            FALSE, // bInitialState
+            nullptr); // lpName
+        m_hFullEvent = ::CreateEventW(
+            nullptr, // lpEventAttributes
+            FALSE, // bManualReset
+            FALSE, // bInitialState
+            nullptr); // lpName
+        if (!m_hStopEvent || !m_hFullEvent)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateEventW failed, hr=%x\n", hr);
+            break;
+        }
+
+        m_hWriterThread = ::CreateThread(
+            nullptr, // lpThreadAttributes
+            0, // dwStackSize
+            WriterThreadProc,
+            this, // lpParameter
+            0, // dwCreationFlags
+            nullptr); // lpThreadId
+        if (!m_hWriterThread)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateThread failed, hr=%x\n", hr);
+            break;
+        }
+
+        ATLTRACE(L"Event trace opened [%s]\n", strPath.Get());
+    } while (false);
+
+    if (pSD)
+    {
+        ::LocalFree(pSD);
+    }
+
+    if (FAILED(hr))
+    {
+        Close();
+    }
+
+    return hr;
+}
+
+HRESULT CEventTrace::Append(
+    LONG lExitEvent,
+    LONG lContext,
+    const CCertIssuedEvent* pEvent)
+{
+    if (!IsOpen())
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+    }
+
+    LPCWSTR pwszSubjectKeyIdentifier = pEvent ? pEvent->GetSubjectKeyIdentifier() : nullptr;
+    LPCWSTR pwszSerialNumber = pEvent ? pEvent->GetSerialNumber() : nullptr;
+    LPCWSTR pwszRequesterName = pEvent ? pEvent->GetRequesterName() : nullptr;
+    const BYTE* pbRawCert = pEvent ? pEvent->GetRawCert().Get() : nullptr;
+
+    EventTraceRecordHeader stHeader;
+    ZeroMemory(&stHeader, sizeof(stHeader));
+    stHeader.dwMagic = EVENT_TRACE_RECORD_MAGIC;
+    stHeader.lExitEvent = lExitEvent;
+    stHeader.lContext = lContext;
+    stHeader.cchSubjectKeyIdentifier = (DWORD)GetStringLength(pwszSubjectKeyIdentifier);
+    stHeader.cchSerialNumber = (DWORD)GetStringLength(pwszSerialNumber);
+    stHeader.cchRequesterName = (DWORD)GetStringLength(pwszRequesterName);
+    stHeader.cbRawCert = pEvent ? (DWORD)pEvent->GetRawCert().GetSize() : 0;
+
+    size_t cbRecord =
+        sizeof(stHeader) +
+        ((size_t)stHeader.cchSubjectKeyIdentifier + stHeader.cchSerialNumber + stHeader.cchRequesterName) * sizeof(WCHAR) +
+        stHeader.cbRawCert;
+    size_t cbAligned = AlignRecord(cbRecord);
+    if (cbAligned > g_cbTraceBuffer)
+    {
+        ATLTRACE(L"Event of %d bytes does not fit in the trace buffer.\n", cbRecord);
+        ::InterlockedIncrement(&m_cDropped);
+        return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+    }
+
+    stHeader.cbRecord = (DWORD)cbRecord;
+
+    HRESULT hr = S_OK;
+    ::AcquireSRWLockExclusive(&m_lock);
+
+    do
+    {
+        if (m_hFile == INVALID_HANDLE_VALUE || m_fStopping)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+            break;
+        }
+
+        if (m_cbActive + cbAligned > g_cbTraceBuffer)
+        {
+            if (m_cbFull > 0)
+            {
+                // The writer has not finished the other buffer. Dropping beats waiting on the disk.
+                hr = HRESULT_FROM_WIN32(ERROR_BUSY);
+                break;
+            }
+
+            SwapBuffers();
+            ::SetEvent(m_hFullEvent);
+        }
+
+        // Taken under the lock, so the records in the file are in time order.
+        LARGE_INTEGER liNow;
+        ::QueryPerformanceCounter(&liNow);
+        ULONGLONG ullTicks = (ULONGLONG)(liNow.QuadPart - m_liStart.QuadPart);
+        ULONGLONG ullFrequency = (ULONGLONG)m_liFrequency.QuadPart;
+        stHeader.ullUSecs = (ullTicks / ullFrequency) * 1000000 + (ullTicks % ullFrequency) * 1000000 / ullFrequency;
+
+        BYTE* pbCurrent = GetBuffer(m_iActive) + m_cbActive;
+        pbCurrent = AppendBytes(pbCurrent, &stHeader, sizeof(stHeader));
+        pbCurrent = AppendBytes(
+            pbCurrent,
+            pwszSubjectKeyIdentifier,
+            stHeader.cchSubjectKeyIdentifier * sizeof(WCHAR));
+        pbCurrent = AppendBytes(
+            pbCurrent,
+            pwszSerialNumber,
+            stHeader.cchSerialNumber * sizeof(WCHAR));
+        pbCurrent = AppendBytes(
+            pbCurrent,
+            pwszRequesterName,
+            stHeader.cchRequesterName * sizeof(WCHAR));
+        pbCurrent = AppendBytes(pbCurrent, pbRawCert, stHeader.cbRawCert);
+        ZeroMemory(pbCurrent, cbAligned - cbRecord);
+        m_cbActive += cbAligned;
+    } while (false);
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+
+    ::InterlockedIncrement(SUCCEEDED(hr) ? &m_cRecords : &m_cDropped);
+    return hr;
+}
+
+void CEventTrace::Close()
+{
+    // Nothing is appended once the writer starts its last pass.
+    ::AcquireSRWLockExclusive(&m_lock);
+    m_fStopping = true;
+    ::ReleaseSRWLockExclusive(&m_lock);
+
+    if (m_hWriterThread)
+    {
+        ::SetEvent(m_hStopEvent);
+
+        // The writer writes both buffers before it exits.
+        ::WaitForSingleObject(m_hWriterThread, INFINITE);
+        ::CloseHandle(m_hWriterThread);
+        m_hWriterThread = NULL;
+    }
+
+    if (m_hStopEvent)
+    {
+        ::CloseHandle(m_hStopEvent);
+        m_hStopEvent = NULL;
+    }
+
+    if (m_hFullEvent)
+    {
+        ::CloseHandle(m_hFullEvent);
+        m_hFullEvent = NULL;
+    }
+
+    ::AcquireSRWLockExclusive(&m_lock);
+
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        ::CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+        ATLTRACE(L"Event trace closed. Records=%d, dropped=%d\n", m_cRecords, m_cDropped);
+    }
+
+    m_bufBuffers.Clear();
+    m_cbActive = 0;
+    m_cbFull = 0;
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+}
+
+BYTE* CEventTrace::GetBuffer(
+    size_t iBuffer)
+{
+    return m_bufBuffers.Get() + iBuffer * g_cbTraceBuffer;
+}
+
+void CEventTrace::SwapBuffers()
+{
+    // Called under the lock, only when the other buffer is free.
+    m_cbFull = m_cbActive;
+    m_iActive ^= 1;
+    m_cbActive = 0;
+}
+
+DWORD WINAPI CEventTrace::WriterThreadProc(
+    LPVOID pvParam)
+{
+    static_cast<CEventTrace*>(pvParam)->RunWriter();
+    return 0;
+}
+
+void CEventTrace::RunWriter()
+{
+    HANDLE rghWait[] = { m_hStopEvent, m_hFullEvent };
+    while (::WaitForMultipleObjects(
+        ARRAYSIZE(rghWait),
+        rghWait,
+        FALSE, // bWaitAll
+        g_dwTraceFlushIntervalMSecs) != WAIT_OBJECT_0)
+    {
+        WriteFull();
+    }
+
+    // Once for a buffer that filled up, once more for the rest.
+    WriteFull();
+    WriteFull();
+}
+
+void CEventTrace::WriteFull()
+{
+    ::AcquireSRWLockExclusive(&m_lock);
+
+    // A partly filled buffer is written too, so a crash loses at most one interval.
+    if (m_cbFull == 0 && m_cbActive > 0)
+    {
+        SwapBuffers();
+    }
+
+    // Append() does not touch the full buffer until m_cbFull goes back to 0.
+    const BYTE* pbFull = GetBuffer(m_iActive ^ 1);
+    size_t cbFull = m_cbFull;
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+
+    if (cbFull == 0)
+    {
+        return;
+    }
+
+    DWORD cbWritten = 0;
+    if (!::WriteFile(m_hFile, pbFull, (DWORD)cbFull, &cbWritten, nullptr))
+    {
+        // The records are dropped rather than retried, so the file stays in record order.
+        ATLTRACE(L"Failed to write the event trace, hr=%x\n", HRESULT_FROM_WIN32(::GetLastError()));
+    }
+
+    ::AcquireSRWLockExclusive(&m_lock);
+    m_cbFull = 0;
+    ::ReleaseSRWLockExclusive(&m_lock);
+}
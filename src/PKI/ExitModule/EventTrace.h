@@ -0,0 +1,133 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventTrace.h
+
+    Abstract:
+
+        CEventTrace class declaration.
+
+--*/
+
+class CCertIssuedEvent;
+
+/*++
+
+    Abstract:
+
+        Captures every ICertExit::Notify() call to a trace file that can be replayed later.
+
+    Remarks:
+
+        Each event is a record with the event type, the time, and for issued certs the
+        properties the module copied and the raw cert. See TraceFormat.h for the layout.
+
+        Records are appended to one of two g_cbTraceBuffer buffers under a lock. When it is
+        full, the buffers are swapped and a writer thread writes the full one outside the
+        lock, so Notify() never waits on the disk. The writer also writes whatever is
+        buffered every g_dwTraceFlushIntervalMSecs, so a CertSvc crash loses about that much
+        of the capture. If both buffers are full because the disk cannot keep up, new records
+        are dropped and counted.
+
+        The trace has the raw certs and requester names, so the file is only accessible to
+        SYSTEM and Administrators.
+--*/
+class CEventTrace
+{
+public:
+    CEventTrace();
+    ~CEventTrace();
+
+    /*++
+
+        Abstract:
+
+            Starts a new trace file.
+
+        Parameters:
+
+            pwszDirectory - directory for the file. Environment variables are expanded. The
+                file is named PMITrace.<UTC time>.<process id>.dat.
+
+        Returns:
+
+            S_OK - success.
+            other - error code. The trace is not open.
+    --*/
+    HRESULT Open(
+        LPCWSTR pwszDirectory);
+
+    /*++
+
+        Abstract:
+
+            Appends a record for one event.
+
+        Parameters:
+
+            lExitEvent - the event passed to Notify().
+            lContext - the context passed to Notify().
+            pEvent - the properties of an issued cert, or nullptr for other events.
+
+        Returns:
+
+            S_OK - success.
+            HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION) - the trace is not open.
+            HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE) - the record is bigger than the buffer.
+            HRESULT_FROM_WIN32(ERROR_BUSY) - both buffers are full. The record is dropped.
+    --*/
+    HRESULT Append(
+        LONG lExitEvent,
+        LONG lContext,
+        const CCertIssuedEvent* pEvent);
+
+    /*++
+
+        Abstract:
+
+            Stops the writer thread, which writes the buffered records, and closes the file.
+
+    --*/
+    void Close();
+
+    inline bool IsOpen() const
+    {
+        return m_hFile != INVALID_HANDLE_VALUE;
+    }
+
+private:
+    SRWLOCK m_lock;
+    HANDLE m_hFile;
+
+    // Two halves of g_cbTraceBuffer. Records are appended to m_iActive.
+    CHeapBuffer<BYTE> m_bufBuffers;
+    size_t m_iActive;
+    size_t m_cbActive;
+
+    // Bytes in the other half waiting for the writer, or 0 if it is free.
+    size_t m_cbFull;
+
+    bool m_fStopping;
+    HANDLE m_hStopEvent;
+    HANDLE m_hFullEvent;
+    HANDLE m_hWriterThread;
+    LARGE_INTEGER m_liStart;
+    LARGE_INTEGER m_liFrequency;
+    volatile LONG m_cRecords;
+    volatile LONG m_cDropped;
+
+    BYTE* GetBuffer(
+        size_t iBuffer);
+    void SwapBuffers();
+    static DWORD WINAPI WriterThreadProc(
+        LPVOID pvParam);
+    void RunWriter();
+    void WriteFull();
+
+    CEventTrace(const CEventTrace&) = delete;
+    CEventTrace& operator=(const CEventTrace&) = delete;
+};
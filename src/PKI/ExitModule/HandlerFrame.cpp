@@ -0,0 +1,171 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        HandlerFrame.cpp
+
+    Abstract:
+
+        CHandlerFrame class impl.
+
+--*/
+
+#include "pch.h"
+#include "HandlerProtocol.h"
+#include "HandlerFrame.h"
+#include "Pipe.h"
+
+namespace
+{
+    inline BYTE* AppendField(
+        BYTE* pbCurrent,
+        const void* pvField,
+        DWORD cbField)
+    {
+        CopyMemory(pbCurrent, &cbField, sizeof(cbField));
+        pbCurrent += sizeof(cbField);
+        CopyMemory(pbCurrent, pvField, cbField);
+        return pbCurrent + cbField;
+    }
+}
+
+CHandlerFrame::CHandlerFrame()
+    : m_cbFrame(0), m_dwSequence(0)
+{
+}
+
+CHandlerFrame::~CHandlerFrame()
+{
+}
+
+HRESULT CHandlerFrame::FormatCertIssued(
+    DWORD dwSequence,
+    LPCWSTR pwszSubjectKeyIdentifier,
+    LPCWSTR pwszSerialNumber,
+    const CBuffer<BYTE>& bufRawCert)
+{
+    size_t cbSubjectKeyIdentifier = wcslen(pwszSubjectKeyIdentifier) * sizeof(WCHAR);
+    size_t cbSerialNumber = wcslen(pwszSerialNumber) * sizeof(WCHAR);
+    size_t cbPayload =
+        3 * sizeof(DWORD) +
+        cbSubjectKeyIdentifier +
+        cbSerialNumber +
+        bufRawCert.GetSize();
+    if (cbPayload > MAXDWORD - sizeof(HandlerFrameHeader))
+    {
+        return HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+    }
+
+    size_t cbFrame = sizeof(HandlerFrameHeader) + cbPayload;
+    if (m_bufFrame.GetLength() < cbFrame && !m_bufFrame.Alloc(cbFrame))
+    {
+        ATLTRACE(L"Failed to alloc %d bytes for frame.\n", cbFrame);
+        return E_OUTOFMEMORY;
+    }
+
+    HandlerFrameHeader stHeader;
+    stHeader.dwMagic = HANDLER_FRAME_MAGIC;
+    stHeader.wVersion = HANDLER_PROTOCOL_VERSION;
+    stHeader.wType = HANDLER_FRAME_CERTISSUED;
+    stHeader.dwSequence = dwSequence;
+    stHeader.cbPayload = (DWORD)cbPayload;
+
+    BYTE* pbCurrent = m_bufFrame.Get();
+    CopyMemory(pbCurrent, &stHeader, sizeof(stHeader));
+    pbCurrent += sizeof(stHeader);
+    pbCurrent = AppendField(pbCurrent, pwszSubjectKeyIdentifier, (DWORD)cbSubjectKeyIdentifier);
+    pbCurrent = AppendField(pbCurrent, pwszSerialNumber, (DWORD)cbSerialNumber);
+    AppendField(pbCurrent, bufRawCert.Get(), (DWORD)bufRawCert.GetSize());
+
+    m_cbFrame = cbFrame;
+    m_dwSequence = dwSequence;
+    return S_OK;
+}
+
+HRESULT CHandlerFrame::Send(
+    CPipe& pipeRequest,
+    DWORD dwTimeoutMSecs) const
+{
+    HRESULT hr = pipeRequest.Write(
+        m_bufFrame.Get(),
+        m_cbFrame,
+        dwTimeoutMSecs);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"Failed to write frame %d, hr=%x\n", m_dwSequence, hr);
+    }
+
+    return hr;
+}
+
+HRESULT CHandlerFrame::ReceiveAck(
+    CPipe& pipeAck,
+    DWORD dwTimeoutMSecs,
+    OUT LONG& lStatus) const
+{
+    HandlerAckFrame stAck;
+    lStatus = 0;
+
+    HRESULT hr = pipeAck.Read(
+        reinterpret_cast<BYTE*>(&stAck),
+        sizeof(stAck),
+        dwTimeoutMSecs);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"Failed to read ack for frame %d, hr=%x\n", m_dwSequence, hr);
+        return hr;
+    }
+
+    if (stAck.stHeader.dwMagic != HANDLER_FRAME_MAGIC ||
+        stAck.stHeader.wType != HANDLER_FRAME_ACK ||
+        stAck.stHeader.dwSequence != m_dwSequence ||
+        stAck.stHeader.cbPayload != sizeof(stAck.lStatus))
+    {
+        ATLTRACE(
+            L"Invalid ack. Magic=%x, Type=%d, Sequence=%d, Expected Sequence=%d\n",
+            stAck.stHeader.dwMagic,
+            stAck.stHeader.wType,
+            stAck.stHeader.dwSequence,
+            m_dwSequence);
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    lStatus = stAck.lStatus;
+    return S_OK;
+}
+
+HRESULT CHandlerFrame::Exchange(
+    CPipe& pipeRequest,
+    CPipe& pipeAck,
+    DWORD dwTimeoutMSecs,
+    OUT LONG& lStatus) const
+{
+    lStatus = 0;
+    ULONGLONG ullDeadline = ::GetTickCount64() + dwTimeoutMSecs;
+
+    HRESULT hr = Send(pipeRequest, dwTimeoutMSecs);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // The ack gets what is left of the timeout.
+    DWORD dwAckMSecs = INFINITE;
+    if (dwTimeoutMSecs != INFINITE)
+    {
+        ULONGLONG ullNow = ::GetTickCount64();
+        dwAckMSecs = (ullNow < ullDeadline) ? (DWORD)(ullDeadline - ullNow) : 0;
+    }
+
+    return ReceiveAck(pipeAck, dwAckMSecs, OUT lStatus);
+}
+
+bool CHandlerFrame::IsPipeClosed(
+    HRESULT hr)
+{
+    return hr == HRESULT_FROM_WIN32(ERROR_BROKEN_PIPE) ||
+        hr == HRESULT_FROM_WIN32(ERROR_NO_DATA) ||
+        hr == HRESULT_FROM_WIN32(ERROR_PIPE_NOT_CONNECTED);
+}
@@ -0,0 +1,149 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        HandlerFrame.h
+
+    Abstract:
+
+        CHandlerFrame class declaration.
+
+--*/
+
+class CPipe;
+
+/*++
+
+    Abstract:
+
+        A request frame sent to a handler over its stdin. See HandlerProtocol.h.
+
+    Remarks:
+
+        The buffer keeps the size of the largest frame, so steady state sends do not allocate.
+--*/
+class CHandlerFrame
+{
+public:
+    CHandlerFrame();
+    ~CHandlerFrame();
+
+    /*++
+
+        Abstract:
+
+            Formats a HANDLER_FRAME_CERTISSUED frame.
+
+        Parameters:
+
+            dwSequence - sequence number of the frame.
+            pwszSubjectKeyIdentifier - subject key identifier of the cert.
+            pwszSerialNumber - serial number of the cert.
+            bufRawCert - raw DER bytes of the cert.
+
+        Returns:
+
+            S_OK - success.
+            E_OUTOFMEMORY - out of memory.
+            HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW) - the cert is too large for a frame.
+    --*/
+    HRESULT FormatCertIssued(
+        DWORD dwSequence,
+        LPCWSTR pwszSubjectKeyIdentifier,
+        LPCWSTR pwszSerialNumber,
+        const CBuffer<BYTE>& bufRawCert);
+
+    /*++
+
+        Abstract:
+
+            Writes the frame to the handler's stdin.
+
+        Parameters:
+
+            pipeRequest - the handler's stdin.
+            dwTimeoutMSecs - time to wait for the handler to read the frame.
+
+        Returns:
+
+            S_OK - success.
+            other - pipe error. See IsPipeClosed().
+    --*/
+    HRESULT Send(
+        CPipe& pipeRequest,
+        DWORD dwTimeoutMSecs) const;
+
+    /*++
+
+        Abstract:
+
+            Reads the handler's ack for the frame.
+
+        Parameters:
+
+            pipeAck - the handler's stdout.
+            dwTimeoutMSecs - time to wait for the ack.
+            lStatus - on success, receives the status from the ack.
+
+        Returns:
+
+            S_OK - the handler acked the frame. Check lStatus.
+            HRESULT_FROM_WIN32(ERROR_INVALID_DATA) - the ack was malformed or out of sequence.
+            other - pipe error. See IsPipeClosed().
+    --*/
+    HRESULT ReceiveAck(
+        CPipe& pipeAck,
+        DWORD dwTimeoutMSecs,
+        OUT LONG& lStatus) const;
+
+    /*++
+
+        Abstract:
+
+            Writes the frame and reads the handler's ack.
+
+        Parameters:
+
+            pipeRequest - the handler's stdin.
+            pipeAck - the handler's stdout.
+            dwTimeoutMSecs - time to wait for the write and the ack together.
+            lStatus - on success, receives the status from the ack.
+
+        Returns:
+
+            S_OK - the handler acked the frame. Check lStatus.
+            HRESULT_FROM_WIN32(ERROR_INVALID_DATA) - the ack was malformed or out of sequence.
+            other - pipe error. See IsPipeClosed().
+    --*/
+    HRESULT Exchange(
+        CPipe& pipeRequest,
+        CPipe& pipeAck,
+        DWORD dwTimeoutMSecs,
+        OUT LONG& lStatus) const;
+
+    inline DWORD GetSequence() const
+    {
+        return m_dwSequence;
+    }
+
+    /*++
+
+        Abstract:
+
+            Checks if a pipe error means the handler closed its end or exited.
+
+    --*/
+    static bool IsPipeClosed(
+        HRESULT hr);
+
+private:
+    CHeapBuffer<BYTE> m_bufFrame;
+    size_t m_cbFrame;
+    DWORD m_dwSequence;
+
+    CHandlerFrame(const CHandlerFrame&) = delete;
+    CHandlerFrame& operator=(const CHandlerFrame&) = delete;
+};
@@ -0,0 +1,37 @@
+/*++
+
+	Copyright (C) Microsoft Corp. All rights reserved.
+
+	Abstract:
+
+		Definition of properties used by CPMIExitModule.
+
+--*/
+
+#include "pch.h"
+#include "HandlerLatencyManageProperty.h"
+#include "PerfCounters.h"
+
+/*++
+	Gets the value of the property.
+
+	Parameters:
+		rvarResult - reference to the variant to receive the value.
+
+	Returns:
+		S_OK - success
+		Other - error code.
+--*/
+HRESULT CHandlerLatencyManageProperty::GetValue(VARIANT& rvarResult) const
+{
+	DWORD dwMSecs = 0;
+	HRESULT hr = CPerfCounters::Get().GetHandlerLatencyPercentile(m_dwPercentile, OUT dwMSecs);
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	rvarResult.lVal = (LONG)min(dwMSecs, (DWORD)MAXLONG);
+	rvarResult.vt = VT_I4;
+	return S_OK;
+}
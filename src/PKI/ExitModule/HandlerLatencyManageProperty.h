@@ -0,0 +1,52 @@
+#pragma once
+/*++
+
+	Copyright (C) Microsoft Corp. All rights reserved.
+
+	Abstract:
+
+		Definition of properties used by CPMIExitModule.
+
+--*/
+#include "ManageProperty.h"
+
+/*++
+
+	Abstract:
+
+		A percentile of the handler latency from CPerfCounters, in milliseconds as VT_I4.
+--*/
+class CHandlerLatencyManageProperty :
+	public CManageProperty
+{
+public:
+	/*++
+		Abstract:
+
+			Initializes a new instance of the CHandlerLatencyManageProperty class.
+
+		Parameters:
+			pwszName - static string for the property name.
+			dwPercentile - the percentile, 1 to 100.
+
+	--*/
+	CHandlerLatencyManageProperty(LPCWSTR pwszName, DWORD dwPercentile)
+		: CManageProperty(pwszName), m_dwPercentile(dwPercentile)
+	{
+	}
+
+	/*++
+		Gets the value of the property.
+
+		Parameters:
+			rvarResult - reference to the variant to receive the value.
+
+		Returns:
+			S_OK - success
+			Other - error code.
+	--*/
+	virtual HRESULT GetValue(VARIANT& rvarResult) const;
+
+private:
+	DWORD m_dwPercentile;
+};
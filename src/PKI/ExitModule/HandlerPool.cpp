@@ -0,0 +1,435 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        HandlerPool.cpp
+
+    Abstract:
+
+        CHandlerPool class impl.
+
+--*/
+
+#include "pch.h"
+#include "PMIExitModuleEventSource.h"
+#include "EventProcessorConfig.h"
+#include "EventProcessorConfigCache.h"
+#include "HandlerFrame.h"
+#include "HandlerPool.h"
+
+// Time a warm handler gets to exit after its stdin is closed.
+constexpr const DWORD g_dwStandbyStopTimeoutMSecs = 5000;
+constexpr const DWORD g_dwStandbyResetExitCode = 1;
+
+// How often to check for warm handlers that exited or no longer match the config.
+constexpr const DWORD g_dwStandbyCheckIntervalMSecs = 5000;
+
+// A warm handler gets one frame, so every frame has the same sequence number.
+constexpr const DWORD g_dwStandbyFrameSequence = 1;
+
+CHandlerPool::CHandlerPool(
+    const CPMIExitModuleEventSource& objEventSource,
+    CEventProcessorConfigCache& objConfigCache)
+    : m_objEventSource(objEventSource),
+    m_objConfigCache(objConfigCache),
+    m_pIdle(nullptr),
+    m_hStopEvent(NULL),
+    m_hRefillEvent(NULL),
+    m_hRefillThread(NULL),
+    m_cHits(0),
+    m_cMisses(0)
+{
+    ::InitializeSRWLock(&m_lock);
+}
+
+CHandlerPool::~CHandlerPool()
+{
+    Stop();
+}
+
+HRESULT CHandlerPool::Start()
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        if (m_hRefillThread)
+        {
+            ATLTRACE(L"The handler pool has been previously started.\n");
+            return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+        }
+
+        m_hStopEvent = ::CreateEventW(
+            nullptr, // lpEventAttributes
+            TRUE, // bManualReset
+            FALSE, // bInitialState
+            nullptr); // lpName
+        m_hRefillEvent = ::CreateEventW(
+            nullptr, // lpEventAttributes
+            FALSE, // bManualReset
+            FALSE, // bInitialState
+            nullptr); // lpName
+        if (!m_hStopEvent || !m_hRefillEvent)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateEventW failed, hr=%x\n", hr);
+            break;
+        }
+
+        m_hRefillThread = ::CreateThread(
+            nullptr, // lpThreadAttributes
+            0, // dwStackSize
+            RefillThreadProc,
+            this, // lpParameter
+            0, // dwCreationFlags
+            nullptr); // lpThreadId
+        if (!m_hRefillThread)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateThread failed, hr=%x\n", hr);
+            break;
+        }
+    } while (false);
+
+    if (FAILED(hr))
+    {
+        Stop();
+    }
+
+    return hr;
+}
+
+void CHandlerPool::Stop()
+{
+    if (m_hRefillThread)
+    {
+        ::SetEvent(m_hStopEvent);
+        ::WaitForSingleObject(m_hRefillThread, INFINITE);
+        ::CloseHandle(m_hRefillThread);
+        m_hRefillThread = NULL;
+    }
+
+    if (m_hStopEvent)
+    {
+        ::CloseHandle(m_hStopEvent);
+        m_hStopEvent = NULL;
+    }
+
+    if (m_hRefillEvent)
+    {
+        ::CloseHandle(m_hRefillEvent);
+        m_hRefillEvent = NULL;
+    }
+
+    ::AcquireSRWLockExclusive(&m_lock);
+    Standby* pIdle = m_pIdle;
+    m_pIdle = nullptr;
+    ::ReleaseSRWLockExclusive(&m_lock);
+
+    while (pIdle)
+    {
+        Standby* pNext = pIdle->pNext;
+        StopStandby(pIdle, true); // fWait
+        pIdle = pNext;
+    }
+
+    if (m_cHits > 0 || m_cMisses > 0)
+    {
+        m_objEventSource.ReportHandlerPoolStats(m_cHits, m_cMisses);
+        ATLTRACE(L"Handler pool stopped. Hits=%d, misses=%d\n", m_cHits, m_cMisses);
+        m_cHits = 0;
+        m_cMisses = 0;
+    }
+}
+
+HRESULT CHandlerPool::NotifyCertIssued(
+    const CEventProcessorConfig& objConfig,
+    LPCWSTR pwszSubjectKeyIdentifier,
+    LPCWSTR pwszSerialNumber,
+    const CBuffer<BYTE>& bufRawCert,
+    DWORD dwTimeoutMSecs,
+    OUT LONG& lStatus,
+    OUT DWORD& dwProcessID)
+{
+    HRESULT hr = S_OK;
+    CHeapBuffer<WCHAR> bufCommandLine;
+    CHandlerFrame objFrame;
+    Standby* pStandby = nullptr;
+    lStatus = 0;
+    dwProcessID = 0;
+
+    // Warm handlers started from an older config have a different command line.
+    hr = objConfig.GetStandbyTemplate().Format(CommandLineValues(), OUT bufCommandLine);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"CCommandLineTemplate::Format failed, hr=%x\n", hr);
+        return hr;
+    }
+
+    hr = objFrame.FormatCertIssued(
+        g_dwStandbyFrameSequence,
+        pwszSubjectKeyIdentifier,
+        pwszSerialNumber,
+        bufRawCert);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"CHandlerFrame::FormatCertIssued failed, hr=%x\n", hr);
+        return hr;
+    }
+
+    for (pStandby = Take(bufCommandLine.Get()); pStandby; pStandby = Take(bufCommandLine.Get()))
+    {
+        hr = objFrame.Send(pStandby->pipeRequest, dwTimeoutMSecs);
+        if (SUCCEEDED(hr))
+        {
+            break;
+        }
+
+        // The handler exited while it was waiting. Nothing was delivered, so try the next one.
+        ATLTRACE(
+            L"Warm handler %d did not take the event, hr=%x\n",
+            pStandby->objProcess.GetProcessID(),
+            hr);
+        StopStandby(pStandby, false); // fWait
+    }
+
+    if (m_hRefillEvent)
+    {
+        ::SetEvent(m_hRefillEvent);
+    }
+
+    if (!pStandby)
+    {
+        ::InterlockedIncrement(&m_cMisses);
+        return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+    }
+
+    ::InterlockedIncrement(&m_cHits);
+    dwProcessID = pStandby->objProcess.GetProcessID();
+
+    hr = objFrame.ReceiveAck(pStandby->pipeAck, dwTimeoutMSecs, OUT lStatus);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"CHandlerFrame::ReceiveAck failed, hr=%x\n", hr);
+    }
+
+    // A handler that acked exits on its own. One that did not is not given more time.
+    StopStandby(pStandby, SUCCEEDED(hr)); // fWait
+    return hr;
+}
+
+CHandlerPool::Standby* CHandlerPool::Take(
+    LPCWSTR pwszCommandLine)
+{
+    Standby* pStandby = nullptr;
+
+    ::AcquireSRWLockExclusive(&m_lock);
+
+    Standby** ppNext = &m_pIdle;
+    while (*ppNext)
+    {
+        if (wcscmp((*ppNext)->objProcess.GetCommandLine(), pwszCommandLine) == 0)
+        {
+            pStandby = *ppNext;
+            *ppNext = pStandby->pNext;
+            pStandby->pNext = nullptr;
+            break;
+        }
+
+        ppNext = &(*ppNext)->pNext;
+    }
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+    return pStandby;
+}
+
+HRESULT CHandlerPool::StartStandby(
+    const CEventProcessorConfig& objConfig,
+    OUT Standby*& pStandby)
+{
+    HRESULT hr = S_OK;
+    Standby* pNew = nullptr;
+    pStandby = nullptr;
+
+    do
+    {
+        pNew = new Standby();
+        if (!pNew)
+        {
+            hr = E_OUTOFMEMORY;
+            break;
+        }
+
+        pNew->pNext = nullptr;
+
+        hr = pNew->pipeRequest.Create(true); // fOutbound
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"Failed to create request pipe, hr=%x\n", hr);
+            break;
+        }
+
+        hr = pNew->pipeAck.Create(false); // fOutbound
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"Failed to create ack pipe, hr=%x\n", hr);
+            break;
+        }
+
+        hr = pNew->objProcess.Create(
+            objConfig.GetExePath(),
+            objConfig.GetStandbyTemplate(),
+            CommandLineValues(),
+            NORMAL_PRIORITY_CLASS | CREATE_NEW_CONSOLE | CREATE_NEW_PROCESS_GROUP,
+            pNew->pipeRequest.GetClientHandle(), // hStdInput
+            pNew->pipeAck.GetClientHandle()); // hStdOutput
+        if (FAILED(hr))
+        {
+            // Not reported here. The next event falls back to starting a handler, which reports it.
+            ATLTRACE(L"CProcess::Create failed, hr=%x\n", hr);
+            break;
+        }
+
+        // The child has its own copies. Closing ours lets a broken pipe signal that it exited.
+        pNew->pipeRequest.CloseClient();
+        pNew->pipeAck.CloseClient();
+
+        m_objEventSource.ReportProcessStartSucceeded(
+            objConfig.GetExePath(),
+            pNew->objProcess.GetCommandLine(),
+            pNew->objProcess.GetProcessID(),
+            pNew->objProcess.GetThreadID(),
+            nullptr); // pwszSerialNumber
+
+        pStandby = pNew;
+        pNew = nullptr;
+    } while (false);
+
+    delete pNew;
+    return hr;
+}
+
+void CHandlerPool::StopStandby(
+    Standby* pStandby,
+    bool fWait)
+{
+    // EOF on stdin asks the handler to exit.
+    pStandby->pipeRequest.Close();
+
+    HRESULT hr = pStandby->objProcess.Wait(fWait ? g_dwStandbyStopTimeoutMSecs : 0);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"Warm handler did not exit, hr=%x. Terminating it.\n", hr);
+        pStandby->objProcess.Terminate(g_dwStandbyResetExitCode);
+    }
+
+    delete pStandby;
+}
+
+void CHandlerPool::Refill()
+{
+    CEventProcessorConfigRef objConfigRef(m_objConfigCache);
+    const CEventProcessorConfig& objConfig = objConfigRef.Get();
+    CHeapBuffer<WCHAR> bufCommandLine;
+    Standby* pStale = nullptr;
+    size_t cTarget = 0;
+    size_t cIdle = 0;
+
+    if (SUCCEEDED(objConfig.GetLoadResult()) &&
+        objConfig.GetHandlerMode() == HandlerModeProcessPerEvent &&
+        objConfig.GetWarmHandlers() > 0)
+    {
+        HRESULT hr = objConfig.GetStandbyTemplate().Format(CommandLineValues(), OUT bufCommandLine);
+        if (SUCCEEDED(hr))
+        {
+            cTarget = objConfig.GetWarmHandlers();
+        }
+        else
+        {
+            ATLTRACE(L"CCommandLineTemplate::Format failed, hr=%x\n", hr);
+        }
+    }
+
+    // Keep up to cTarget handlers that are still running and match the config.
+    ::AcquireSRWLockExclusive(&m_lock);
+
+    Standby** ppNext = &m_pIdle;
+    while (*ppNext)
+    {
+        Standby* pStandby = *ppNext;
+        if (cIdle < cTarget &&
+            wcscmp(pStandby->objProcess.GetCommandLine(), bufCommandLine.Get()) == 0 &&
+            pStandby->objProcess.Wait(0) == HRESULT_FROM_WIN32(ERROR_TIMEOUT))
+        {
+            cIdle++;
+            ppNext = &pStandby->pNext;
+        }
+        else
+        {
+            *ppNext = pStandby->pNext;
+            pStandby->pNext = pStale;
+            pStale = pStandby;
+        }
+    }
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+
+    while (pStale)
+    {
+        Standby* pNext = pStale->pNext;
+        StopStandby(pStale, true); // fWait
+        pStale = pNext;
+    }
+
+    for (; cIdle < cTarget; cIdle++)
+    {
+        Standby* pStandby = nullptr;
+        HRESULT hr = StartStandby(objConfig, OUT pStandby);
+        if (FAILED(hr))
+        {
+            // Try again at the next check.
+            ATLTRACE(L"CHandlerPool::StartStandby failed, hr=%x\n", hr);
+            break;
+        }
+
+        ::AcquireSRWLockExclusive(&m_lock);
+        pStandby->pNext = m_pIdle;
+        m_pIdle = pStandby;
+        ::ReleaseSRWLockExclusive(&m_lock);
+    }
+}
+
+DWORD WINAPI CHandlerPool::RefillThreadProc(
+    LPVOID pvParam)
+{
+    CHandlerPool* pThis = static_cast<CHandlerPool*>(pvParam);
+    pThis->RunRefill();
+    return 0;
+}
+
+void CHandlerPool::RunRefill()
+{
+    HANDLE rghWait[] = { m_hStopEvent, m_hRefillEvent };
+
+    for (;;)
+    {
+        Refill();
+
+        DWORD dwRes = ::WaitForMultipleObjects(
+            ARRAYSIZE(rghWait),
+            rghWait,
+            FALSE, // bWaitAll
+            g_dwStandbyCheckIntervalMSecs);
+        if (dwRes == WAIT_OBJECT_0)
+        {
+            break;
+        }
+        else if (dwRes == WAIT_FAILED)
+        {
+            ATLTRACE(L"WaitForMultipleObjects failed, hr=%x\n", HRESULT_FROM_WIN32(::GetLastError()));
+            break;
+        }
+    }
+}
@@ -0,0 +1,150 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        HandlerPool.h
+
+    Abstract:
+
+        CHandlerPool class declaration.
+
+--*/
+
+#include "Pipe.h"
+#include "Process.h"
+
+class CEventProcessorConfig;
+class CEventProcessorConfigCache;
+class CPMIExitModuleEventSource;
+
+/*++
+
+    Abstract:
+
+        Handler processes that are started ahead of events so their startup is not on the
+        delivery path.
+
+    Remarks:
+
+        Each warm handler is started with the registered ExePath, the static Arguments and
+        the standby operation, then blocks reading its stdin. An event is written to one warm
+        handler as a frame described in HandlerProtocol.h. The handler acks it on stdout and
+        exits, so each event still gets its own process.
+
+        A background thread keeps WarmHandlers processes started. It refills the pool after
+        each event, and replaces handlers that exited or were started with a command line
+        that no longer matches the config.
+
+        When no warm handler is ready, the caller starts a handler the usual way. The
+        number of events served by a warm handler (hits) and the number that were not
+        (misses) are reported when the pool stops.
+--*/
+class CHandlerPool
+{
+public:
+    CHandlerPool(
+        const CPMIExitModuleEventSource& objEventSource,
+        CEventProcessorConfigCache& objConfigCache);
+    ~CHandlerPool();
+
+    /*++
+
+        Abstract:
+
+            Starts the thread that keeps handlers started.
+
+        Returns:
+
+            S_OK - success.
+            other - error code.
+    --*/
+    HRESULT Start();
+
+    /*++
+
+        Abstract:
+
+            Stops the refill thread and the warm handlers that did not get an event.
+
+    --*/
+    void Stop();
+
+    /*++
+
+        Abstract:
+
+            Sends an issued certificate to a warm handler and waits for its ack.
+
+        Parameters:
+
+            objConfig - the config snapshot for the event.
+            pwszSubjectKeyIdentifier - subject key identifier of the cert.
+            pwszSerialNumber - serial number of the cert.
+            bufRawCert - raw DER bytes of the cert.
+            dwTimeoutMSecs - time to wait for the ack.
+            lStatus - on success, receives the status from the handler's ack.
+            dwProcessID - receives the process ID of the handler that got the event.
+
+        Returns:
+
+            S_OK - the handler acked the event. Check lStatus.
+            HRESULT_FROM_WIN32(ERROR_NOT_FOUND) - no warm handler was ready. Nothing was sent.
+            other - the handler got the event but did not ack it.
+    --*/
+    HRESULT NotifyCertIssued(
+        const CEventProcessorConfig& objConfig,
+        LPCWSTR pwszSubjectKeyIdentifier,
+        LPCWSTR pwszSerialNumber,
+        const CBuffer<BYTE>& bufRawCert,
+        DWORD dwTimeoutMSecs,
+        OUT LONG& lStatus,
+        OUT DWORD& dwProcessID);
+
+    inline LONG GetHits() const
+    {
+        return m_cHits;
+    }
+
+    inline LONG GetMisses() const
+    {
+        return m_cMisses;
+    }
+
+private:
+    struct Standby
+    {
+        CProcess objProcess;
+        CPipe pipeRequest;
+        CPipe pipeAck;
+        Standby* pNext;
+    };
+
+    const CPMIExitModuleEventSource& m_objEventSource;
+    CEventProcessorConfigCache& m_objConfigCache;
+    SRWLOCK m_lock;
+    Standby* m_pIdle;
+    HANDLE m_hStopEvent;
+    HANDLE m_hRefillEvent;
+    HANDLE m_hRefillThread;
+    volatile LONG m_cHits;
+    volatile LONG m_cMisses;
+
+    Standby* Take(
+        LPCWSTR pwszCommandLine);
+    HRESULT StartStandby(
+        const CEventProcessorConfig& objConfig,
+        OUT Standby*& pStandby);
+    void StopStandby(
+        Standby* pStandby,
+        bool fWait);
+    void Refill();
+    void RunRefill();
+    static DWORD WINAPI RefillThreadProc(
+        LPVOID pvParam);
+
+    CHandlerPool(const CHandlerPool&) = delete;
+    CHandlerPool& operator=(const CHandlerPool&) = delete;
+};
@@ -0,0 +1,102 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        HandlerProtocol.h
+
+    Abstract:
+
+        Wire format between the exit module and a persistent event processor.
+
+    Remarks:
+
+        This header is shared with the event processor side. It only depends on Windows types.
+
+        The exit module writes request frames to the handler's stdin. The handler writes
+        one ack frame to its stdout for each request, in order. All integers are little endian.
+
+        Request frame:
+            HandlerFrameHeader
+            cbPayload bytes of payload.
+
+        HANDLER_FRAME_CERTISSUED payload is a sequence of length-prefixed fields:
+            DWORD cb, cb bytes of the subject key identifier (UTF-16LE, no null terminator).
+            DWORD cb, cb bytes of the serial number (UTF-16LE, no null terminator).
+            DWORD cb, cb bytes of the raw DER certificate.
+
+        Ack frame:
+            HandlerFrameHeader with wType=HANDLER_FRAME_ACK and cbPayload=sizeof(LONG).
+            LONG status. 0 is success. Anything else is the handler's failure code.
+
+        Handlers must skip the payload of frame types they do not understand and ack them with 0.
+
+        A standby handler gets the same frames, but exits after it acks the first HANDLER_FRAME_CERTISSUED.
+        It must also exit when stdin is closed before any frame arrives.
+--*/
+
+#define HANDLER_FRAME_MAGIC 0x464D5050 // 'PPMF'
+#define HANDLER_PROTOCOL_VERSION 1
+
+// Operation passed to the handler on its command line in place of certissued.
+#define WSZ_HANDLER_OPERATION_EVENTSTREAM L"eventstream"
+
+// Operation for a pre-started handler. It reads one request frame, acks it and exits.
+#define WSZ_HANDLER_OPERATION_STANDBY L"standby"
+
+/*++
+
+    Abstract:
+
+        Frame types.
+
+--*/
+enum HandlerFrameType : WORD
+{
+    HANDLER_FRAME_ACK = 0,
+    HANDLER_FRAME_CERTISSUED = 1,
+};
+
+#pragma pack(push, 1)
+
+/*++
+
+    Abstract:
+
+        Fixed header in front of every frame.
+
+--*/
+struct HandlerFrameHeader
+{
+    // HANDLER_FRAME_MAGIC.
+    DWORD dwMagic;
+
+    // HANDLER_PROTOCOL_VERSION.
+    WORD wVersion;
+
+    // HandlerFrameType.
+    WORD wType;
+
+    // Request sequence number. An ack echoes the sequence number of its request.
+    DWORD dwSequence;
+
+    // Number of bytes following the header.
+    DWORD cbPayload;
+};
+
+/*++
+
+    Abstract:
+
+        A complete ack frame.
+
+--*/
+struct HandlerAckFrame
+{
+    HandlerFrameHeader stHeader;
+    LONG lStatus;
+};
+
+#pragma pack(pop)
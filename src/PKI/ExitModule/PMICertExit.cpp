@@ -2,7 +2,16 @@
 
 #include "pch.h"
 #include "PMIExitModuleEventSource.h"
-#include "EventProcessor.h"
+#include "EventLogWriter.h"
+#include "ErrorMessageCache.h"
+#include "PerfCounters.h"
+#include "StageTimer.h"
+#include "EventJournal.h"
+#include "EventTrace.h"
+#include "EventDispatcher.h"
+#include "EventProcessorConfigCache.h"
+#include "CertIssuedEvent.h"
+#include "CertServerExitCache.h"
 #include "PMICertExit.h"
 #include "PMIExitModule.h"
 #include "CertServerExit.h"
@@ -17,6 +26,9 @@
     EXITEVENT_SHUTDOWN | \
     EXITEVENT_CERTIMPORTED)
 
+constexpr const size_t g_cMaxQueuedEvents = 1024;
+LPCWSTR g_pwszDefaultJournalPath = L"%ProgramData%\\Microsoft\\PMI\\PMIExitModule\\Journal";
+
 const IID* CPMICertExit::s_rgErrorInfoInterfaces[] =
 {
     &IID_ICertExit,
@@ -62,7 +74,14 @@ const IID* CPMICertExit::s_rgErrorInfoInterfaces[] =
             break;
         }
 
-        hr = objServer.Init();
+        hr = CCertIssuedEvent::InitPropertySet(OUT m_objCertProperties);
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"Failed to init the cert property set, hr=%x\n", hr);
+            break;
+        }
+
+        hr = m_objServerCache.Init(0L, OUT objServer);
         if (FAILED(hr))
         {
             ATLTRACE(L"Failed to init objServer, hr=%x\n", hr);
@@ -88,6 +107,56 @@ const IID* CPMICertExit::s_rgErrorInfoInterfaces[] =
         ATLTRACE(L"m_strRegStorageLoc=%s\n", m_strRegStorageLoc.Get());
         ATLTRACE(L"m_eCAType=%d\n", m_eCAType);
 
+        hr = m_objConfigCache.Open(CEventProcessorConfigCache::CreateDefaultSource());
+        if (FAILED(hr))
+        {
+            // Not fatal. Events fail with an internal error until the config can be loaded.
+            ATLTRACE(L"Failed to open the config cache, hr=%x\n", hr);
+            hr = S_OK;
+        }
+
+        // Optional values keep their defaults if the config fails to load.
+        CEventProcessorConfigRef objConfigRef(m_objConfigCache);
+        const CEventProcessorConfig& objConfig = objConfigRef.Get();
+
+        hr = CPerfCounters::Get().Publish();
+        if (FAILED(hr))
+        {
+            // Not fatal. The counters are still read through CPMIExitModule.
+            ATLTRACE(L"Failed to publish the perf counter section, hr=%x\n", hr);
+            hr = S_OK;
+        }
+
+        hr = m_objEventSource.StartCoalescing(objConfig.GetEventCoalesceWindowSecs());
+        if (FAILED(hr))
+        {
+            // Not fatal. Every event is written.
+            ATLTRACE(L"Failed to start the event coalescer, hr=%x\n", hr);
+            hr = S_OK;
+        }
+
+        hr = m_objDispatcher.Start(objConfig.GetHandlerConcurrency(), g_cMaxQueuedEvents);
+        if (FAILED(hr))
+        {
+            // Not fatal. Events get delivered inline by Notify().
+            ATLTRACE(L"Failed to start the event dispatcher, hr=%x\n", hr);
+            hr = S_OK;
+        }
+
+        // Events journaled before CertSvc stopped are delivered before any new ones.
+        OpenJournal(objConfig.GetJournalPath() ? objConfig.GetJournalPath() : g_pwszDefaultJournalPath);
+
+        if (objConfig.GetTracePath())
+        {
+            hr = m_objTrace.Open(objConfig.GetTracePath());
+            if (FAILED(hr))
+            {
+                // Not fatal. Events are delivered, just not captured.
+                ATLTRACE(L"Failed to open the event trace [%s], hr=%x\n", objConfig.GetTracePath(), hr);
+                hr = S_OK;
+            }
+        }
+
     } while (false);
 
     ATLTRACE(L"Leave CPMICertExit::Initialize. hr=%x\n", hr);
@@ -98,40 +167,55 @@ STDMETHODIMP CPMICertExit::Notify(
     /* [in] */ LONG ExitEvent,
     /* [in] */ LONG Context)
 {
+    PMI_STAGE_TIMER(PerfStageNotify);
     HRESULT hr = S_OK;
     ATLTRACE(L"Enter CPMICertExit::Notify. ExitEvent=%x, Context=%x\n", ExitEvent, Context);
 
+    if (m_objTrace.IsOpen() && ExitEvent != EXITEVENT_CERTISSUED)
+    {
+        // Issued certs are captured with their properties by NotifyCertIssued().
+        m_objTrace.Append(ExitEvent, Context, nullptr);
+    }
+
     switch (ExitEvent)
     {
     case EXITEVENT_CERTISSUED:
+        CPerfCounters::Get().Add(PerfCounterEventsCertIssued);
         hr = NotifyCertIssued(Context);
         break;
 
     case EXITEVENT_CERTPENDING:
+        CPerfCounters::Get().Add(PerfCounterEventsCertPending);
         hr = NotifyCertPending(Context);
         break;
 
     case EXITEVENT_CERTDENIED:
+        CPerfCounters::Get().Add(PerfCounterEventsCertDenied);
         hr = NotifyCertDenied(Context);
         break;
 
     case EXITEVENT_CERTREVOKED:
+        CPerfCounters::Get().Add(PerfCounterEventsCertRevoked);
         hr = NotifyCertRevoked(Context);
         break;
 
     case EXITEVENT_CERTRETRIEVEPENDING:
+        CPerfCounters::Get().Add(PerfCounterEventsCertRetrievePending);
         hr = NotifyCertRetrievePending(Context);
         break;
 
     case EXITEVENT_CRLISSUED:
+        CPerfCounters::Get().Add(PerfCounterEventsCRLIssued);
         hr = NotifyCRLIssued(Context);
         break;
 
     case EXITEVENT_SHUTDOWN:
+        CPerfCounters::Get().Add(PerfCounterEventsShutdown);
         hr = NotifyShutdown(Context);
         break;
 
     case EXITEVENT_CERTIMPORTED:
+        CPerfCounters::Get().Add(PerfCounterEventsCertImported);
         hr = NotifyCertImported(Context);
         break;
 
@@ -202,66 +286,153 @@ STDMETHODIMP CPMICertExit::GetManageModule(
 HRESULT CPMICertExit::NotifyCertIssued(
     IN CCertServerExit& objServer)
 {
-    HRESULT hr = S_OK;
-    CHeapBuffer<BYTE> buf;
-    CHeapWString strSubjectKeyIdentifier;
-    CHeapWString strSerialNumber;
-    CEventProcessor objEventProcessor(m_objEventSource);
+    CCertIssuedEvent* pEvent = new CCertIssuedEvent(
+        EXITEVENT_CERTISSUED,
+        objServer.GetContext());
+    if (!pEvent)
+    {
+        ATLTRACE(L"Failed to alloc CCertIssuedEvent.\n");
+        return E_OUTOFMEMORY;
+    }
 
-    do
+    HRESULT hr = pEvent->Snapshot(objServer, m_objCertProperties);
+    if (FAILED(hr))
     {
-        hr = objServer.GetCertificateSubjectKeyIdentifierProperty(OUT strSubjectKeyIdentifier);
-        if (FAILED(hr))
-        {
-            ATLTRACE(L"CCertServerExit::GetCertificateSubjectKeyIdentifierProperty failed, hr=%x\n");
-            break;
-        }
+        ATLTRACE(L"CCertIssuedEvent::Snapshot failed, hr=%x\n", hr);
+        delete pEvent;
+        return hr;
+    }
 
-        hr = objServer.GetCertificateSerialNumberProperty(OUT strSerialNumber);
-        if (FAILED(hr))
-        {
-            ATLTRACE(L"CCertServerExit::GetCertificateSerialNumberProperty failed, hr=%x\n", hr);
-            break;
-        }
+    if (m_objTrace.IsOpen())
+    {
+        // Before Post(). A worker can take the raw cert out of the event once it is queued.
+        m_objTrace.Append(EXITEVENT_CERTISSUED, pEvent->GetContext(), pEvent);
+    }
 
-        hr = objServer.GetRawCertificateProperty(OUT buf);
-        if (FAILED(hr))
-        {
-            ATLTRACE(L"CCertServerExit::GetRawCertificateProperty failed, hr=%x\n", hr);
-            break;
-        }
+    // Ownership of the event transfers to the dispatcher.
+    hr = m_objDispatcher.Post(pEvent);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"CEventDispatcher::Post failed, hr=%x\n", hr);
+    }
 
-        ATLTRACE(
-            L"Cert created. Subject Key Identifier=[%s], SerialNumber=[%s]\n",
-            strSubjectKeyIdentifier.Get(),
-            strSerialNumber.Get());
-        ATLTRACE(L"Raw cert size in bytes=%x\n", buf.GetSize());
+    return hr;
+}
 
-        hr = objEventProcessor.Init();
-        if (FAILED(hr))
-        {
-            ATLTRACE(L"CEventProcessor::Init failed, hr=%x\n", hr);
-            break;
-        }
+HRESULT CPMICertExit::NotifyCRLIssued(
+    IN CCertServerExit& /* objServer */)
+{
+    return S_OK;
+}
 
-        hr = objEventProcessor.NotifyCertIssued(
-            strSubjectKeyIdentifier.Get(),
-            strSerialNumber.Get(),
-            buf);
-        if (FAILED(hr))
+void CPMICertExit::OpenJournal(
+    LPCWSTR pwszJournalPath)
+{
+    HRESULT hr = m_objJournal.Open(pwszJournalPath);
+    if (FAILED(hr))
+    {
+        // Not fatal. Events are still delivered, they just do not survive a restart.
+        ATLTRACE(L"Failed to open the journal [%s], hr=%x\n", pwszJournalPath, hr);
+        return;
+    }
+
+    size_t cReplayed = m_objJournal.Replay(m_objDispatcher, m_objEventSource);
+    ATLTRACE(L"Replayed %d events from the journal.\n", cReplayed);
+}
+
+void CPMICertExit::ReportServerCacheStats() const
+{
+    LONG cActivations = m_objServerCache.GetActivations();
+    LONG cReuses = m_objServerCache.GetReuses();
+    ULONGLONG ullActivationUSecs = m_objServerCache.GetActivationUSecs();
+    if (cActivations == 0)
+    {
+        return;
+    }
+
+    // Each reuse would have cost an activation without the cache.
+    ULONGLONG ullSavedUSecs = ullActivationUSecs * cReuses / cActivations;
+    ATLTRACE(
+        L"ICertServerExit cache: activations=%d, activation=%I64uus, reuses=%d, saved=%I64uus\n",
+        cActivations,
+        ullActivationUSecs,
+        cReuses,
+        ullSavedUSecs);
+    m_objEventSource.ReportServerCacheStats(
+        (DWORD)cActivations,
+        (DWORD)min(ullActivationUSecs, (ULONGLONG)MAXDWORD),
+        (DWORD)cReuses,
+        (DWORD)min(ullSavedUSecs, (ULONGLONG)MAXDWORD));
+}
+
+void CPMICertExit::ReportPropertyStats() const
+{
+    for (size_t i = 0; i < m_objCertProperties.GetCount(); i++)
+    {
+        const CertPropertyDescriptor& stDescriptor = m_objCertProperties.GetDescriptor(i);
+        const CertPropertyStats& stStats = m_objCertProperties.GetStats(i);
+        if (stStats.cFetches == 0)
         {
-            ATLTRACE(L"CEventProcessor::NotifyCertIssued failed, hr=%x\n", hr);
-            break;
+            continue;
         }
-    } while (false);
 
-    return hr;
+        ULONGLONG ullTotalUSecs = m_objCertProperties.ToMicroseconds(stStats.llTicks);
+        ULONGLONG ullMaxUSecs = m_objCertProperties.ToMicroseconds(stStats.llMaxTicks);
+        ATLTRACE(
+            L"Property [%s]: fetches=%d, failures=%d, total=%I64uus, max=%I64uus\n",
+            stDescriptor.pwszName,
+            stStats.cFetches,
+            stStats.cFailures,
+            ullTotalUSecs,
+            ullMaxUSecs);
+        m_objEventSource.ReportPropertyStats(
+            stDescriptor.pwszName,
+            (DWORD)stStats.cFetches,
+            (DWORD)stStats.cFailures,
+            (DWORD)(ullTotalUSecs / stStats.cFetches),
+            (DWORD)min(ullMaxUSecs, (ULONGLONG)MAXDWORD));
+    }
 }
 
-HRESULT CPMICertExit::NotifyCRLIssued(
-    IN CCertServerExit& /* objServer */)
+void CPMICertExit::ReportErrorMessageCacheStats() const
 {
-    return S_OK;
+    const CErrorMessageCache& objCache = CErrorMessageEventArg::GetCache();
+    if (objCache.GetHits() + objCache.GetMisses() == 0)
+    {
+        return;
+    }
+
+    ATLTRACE(
+        L"Error message cache: hits=%d, misses=%d, entries=%d\n",
+        objCache.GetHits(),
+        objCache.GetMisses(),
+        objCache.GetCount());
+    m_objEventSource.ReportErrorMessageCacheStats(
+        (DWORD)objCache.GetHits(),
+        (DWORD)objCache.GetMisses(),
+        (DWORD)objCache.GetCount());
+}
+
+void CPMICertExit::ReportEventLogWriterStats()
+{
+    // Write what is queued first, so the counts are final and this event is not queued behind it.
+    m_objEventSource.StopWriter();
+
+    const CEventLogWriter* pWriter = m_objEventSource.GetWriter();
+    if (!pWriter || pWriter->GetWritten() + pWriter->GetDropped() == 0)
+    {
+        return;
+    }
+
+    ATLTRACE(
+        L"Event log writer: written=%d, batches=%d, dropped=%d\n",
+        pWriter->GetWritten(),
+        pWriter->GetBatches(),
+        pWriter->GetDropped());
+    m_objEventSource.ReportEventLogWriterStats(
+        (DWORD)pWriter->GetWritten(),
+        (DWORD)pWriter->GetBatches(),
+        (DWORD)pWriter->GetDropped());
 }
 
 STDMETHODIMP CPMICertExit::InterfaceSupportsErrorInfo(
@@ -284,7 +455,7 @@ STDMETHODIMP CPMICertExit::InterfaceSupportsErrorInfo(
 HRESULT CPMICertExit::NotifyCertIssued(LONG lContext)
 {
     CCertServerExit obj;
-    HRESULT hr = obj.Init(lContext);
+    HRESULT hr = m_objServerCache.Init(lContext, OUT obj);
     if (SUCCEEDED(hr))
     {
         hr = NotifyCertIssued(obj);
@@ -316,7 +487,7 @@ HRESULT CPMICertExit::NotifyCertRetrievePending(LONG /* lContext */)
 HRESULT CPMICertExit::NotifyCRLIssued(LONG lContext)
 {
     CCertServerExit obj;
-    HRESULT hr = obj.Init(lContext);
+    HRESULT hr = m_objServerCache.Init(lContext, OUT obj);
     if (SUCCEEDED(hr))
     {
         hr = NotifyCRLIssued(obj);
@@ -327,6 +498,20 @@ HRESULT CPMICertExit::NotifyCRLIssued(LONG lContext)
 
 HRESULT CPMICertExit::NotifyShutdown(LONG /* lContext */)
 {
+    // Deliver whatever is still queued before CertSvc unloads the module.
+    m_objDispatcher.Stop();
+    m_objJournal.Close();
+    m_objTrace.Close();
+    m_objConfigCache.Close();
+
+    ReportServerCacheStats();
+    ReportPropertyStats();
+    ReportErrorMessageCacheStats();
+
+    // Summaries of open windows go out before the writer stops.
+    m_objEventSource.StopCoalescing();
+    ReportEventLogWriterStats();
+    m_objServerCache.Clear();
     return S_OK;
 }
 
@@ -24,6 +24,7 @@ class ATL_NO_VTABLE CPMICertExit :
 {
 public:
 	CPMICertExit()
+		: m_objDispatcher(m_objEventSource, m_objConfigCache, m_objJournal)
 	{
 	}
 
@@ -48,6 +49,13 @@ END_COM_MAP()
 
 	void FinalRelease()
 	{
+		m_objDispatcher.Stop();
+		m_objJournal.Close();
+		m_objTrace.Close();
+		m_objConfigCache.Close();
+		m_objServerCache.Clear();
+		m_objEventSource.StopCoalescing();
+		m_objEventSource.Close();
 	}
 
 public:
@@ -85,6 +93,14 @@ protected:
 	HRESULT NotifyCertIssued(IN CCertServerExit& objServer);
 	HRESULT NotifyCRLIssued(IN CCertServerExit& objServer);
 
+	void OpenJournal(
+		LPCWSTR pwszJournalPath);
+
+	void ReportServerCacheStats() const;
+	void ReportPropertyStats() const;
+	void ReportErrorMessageCacheStats() const;
+	void ReportEventLogWriterStats();
+
 private:
 	/*
 		Array of interfaces that support error info.
@@ -95,6 +111,12 @@ private:
 	CHeapWString m_strRegStorageLoc;
 	ENUM_CATYPES m_eCAType;
 	CPMIExitModuleEventSource m_objEventSource;
+	CEventProcessorConfigCache m_objConfigCache;
+	CEventJournal m_objJournal;
+	CEventTrace m_objTrace;
+	CEventDispatcher m_objDispatcher;
+	CCertServerExitCache m_objServerCache;
+	CCertPropertySet m_objCertProperties;
 
 	HRESULT NotifyCertIssued(LONG lContext);
 	HRESULT NotifyCertPending(LONG lContext);
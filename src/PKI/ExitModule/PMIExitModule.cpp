@@ -2,7 +2,10 @@
 
 #include "pch.h"
 #include "PMIExitModule.h"
+#include "HandlerLatencyManageProperty.h"
+#include "PerfCounterManageProperty.h"
 #include "ResourceStringManageProperty.h"
+#include "StageLatencyManageProperty.h"
 
 const CResourceStringManageProperty propName(
     wszCMM_PROP_NAME,
@@ -19,6 +22,136 @@ const CResourceStringManageProperty propFileVer(
 const CResourceStringManageProperty propProductVer(
     wszCMM_PROP_PRODUCTVER,
     IDS_PMIEXITMODULE_PRODUCTVER);
+// Live counters. See CPerfCounters.
+const CPerfCounterManageProperty propEventsCertIssued(
+    L"EventsCertIssued",
+    PerfCounterEventsCertIssued);
+const CPerfCounterManageProperty propEventsCertPending(
+    L"EventsCertPending",
+    PerfCounterEventsCertPending);
+const CPerfCounterManageProperty propEventsCertDenied(
+    L"EventsCertDenied",
+    PerfCounterEventsCertDenied);
+const CPerfCounterManageProperty propEventsCertRevoked(
+    L"EventsCertRevoked",
+    PerfCounterEventsCertRevoked);
+const CPerfCounterManageProperty propEventsCertRetrievePending(
+    L"EventsCertRetrievePending",
+    PerfCounterEventsCertRetrievePending);
+const CPerfCounterManageProperty propEventsCRLIssued(
+    L"EventsCRLIssued",
+    PerfCounterEventsCRLIssued);
+const CPerfCounterManageProperty propEventsCertImported(
+    L"EventsCertImported",
+    PerfCounterEventsCertImported);
+const CPerfCounterManageProperty propEventsShutdown(
+    L"EventsShutdown",
+    PerfCounterEventsShutdown);
+const CPerfCounterManageProperty propHandlerSpawns(
+    L"HandlerSpawns",
+    PerfCounterHandlerSpawns);
+const CPerfCounterManageProperty propHandlerSpawnFailures(
+    L"HandlerSpawnFailures",
+    PerfCounterHandlerSpawnFailures);
+const CPerfCounterManageProperty propHandlerFailures(
+    L"HandlerFailures",
+    PerfCounterHandlerFailures);
+const CPerfCounterManageProperty propHandlerTimeouts(
+    L"HandlerTimeouts",
+    PerfCounterHandlerTimeouts);
+const CPerfCounterManageProperty propQueueDepth(
+    L"QueueDepth",
+    PerfCounterQueueDepth);
+const CPerfCounterManageProperty propTempFilesPreserved(
+    L"TempFilesPreserved",
+    PerfCounterTempFilesPreserved);
+const CPerfCounterManageProperty propBytesWritten(
+    L"BytesWritten",
+    PerfCounterBytesWritten);
+const CHandlerLatencyManageProperty propHandlerLatencyP50MSecs(
+    L"HandlerLatencyP50MSecs",
+    50);
+const CHandlerLatencyManageProperty propHandlerLatencyP90MSecs(
+    L"HandlerLatencyP90MSecs",
+    90);
+const CHandlerLatencyManageProperty propHandlerLatencyP99MSecs(
+    L"HandlerLatencyP99MSecs",
+    99);
+const CHandlerLatencyManageProperty propHandlerLatencyMaxMSecs(
+    L"HandlerLatencyMaxMSecs",
+    100);
+const CStageLatencyManageProperty propNotifyLatencyP50USecs(
+    L"NotifyLatencyP50USecs",
+    PerfStageNotify,
+    500);
+const CStageLatencyManageProperty propNotifyLatencyP99USecs(
+    L"NotifyLatencyP99USecs",
+    PerfStageNotify,
+    990);
+const CStageLatencyManageProperty propNotifyLatencyP999USecs(
+    L"NotifyLatencyP999USecs",
+    PerfStageNotify,
+    999);
+const CStageLatencyManageProperty propPropertyReadLatencyP50USecs(
+    L"PropertyReadLatencyP50USecs",
+    PerfStagePropertyRead,
+    500);
+const CStageLatencyManageProperty propPropertyReadLatencyP99USecs(
+    L"PropertyReadLatencyP99USecs",
+    PerfStagePropertyRead,
+    990);
+const CStageLatencyManageProperty propPropertyReadLatencyP999USecs(
+    L"PropertyReadLatencyP999USecs",
+    PerfStagePropertyRead,
+    999);
+const CStageLatencyManageProperty propTempFileCreateLatencyP50USecs(
+    L"TempFileCreateLatencyP50USecs",
+    PerfStageTempFileCreate,
+    500);
+const CStageLatencyManageProperty propTempFileCreateLatencyP99USecs(
+    L"TempFileCreateLatencyP99USecs",
+    PerfStageTempFileCreate,
+    990);
+const CStageLatencyManageProperty propTempFileCreateLatencyP999USecs(
+    L"TempFileCreateLatencyP999USecs",
+    PerfStageTempFileCreate,
+    999);
+const CStageLatencyManageProperty propTempFileWriteLatencyP50USecs(
+    L"TempFileWriteLatencyP50USecs",
+    PerfStageTempFileWrite,
+    500);
+const CStageLatencyManageProperty propTempFileWriteLatencyP99USecs(
+    L"TempFileWriteLatencyP99USecs",
+    PerfStageTempFileWrite,
+    990);
+const CStageLatencyManageProperty propTempFileWriteLatencyP999USecs(
+    L"TempFileWriteLatencyP999USecs",
+    PerfStageTempFileWrite,
+    999);
+const CStageLatencyManageProperty propProcessCreateLatencyP50USecs(
+    L"ProcessCreateLatencyP50USecs",
+    PerfStageProcessCreate,
+    500);
+const CStageLatencyManageProperty propProcessCreateLatencyP99USecs(
+    L"ProcessCreateLatencyP99USecs",
+    PerfStageProcessCreate,
+    990);
+const CStageLatencyManageProperty propProcessCreateLatencyP999USecs(
+    L"ProcessCreateLatencyP999USecs",
+    PerfStageProcessCreate,
+    999);
+const CStageLatencyManageProperty propProcessWaitLatencyP50USecs(
+    L"ProcessWaitLatencyP50USecs",
+    PerfStageProcessWait,
+    500);
+const CStageLatencyManageProperty propProcessWaitLatencyP99USecs(
+    L"ProcessWaitLatencyP99USecs",
+    PerfStageProcessWait,
+    990);
+const CStageLatencyManageProperty propProcessWaitLatencyP999USecs(
+    L"ProcessWaitLatencyP999USecs",
+    PerfStageProcessWait,
+    999);
 const CManageProperty* CPMIExitModule::s_rgProperties[] =
 {
     &propName,
@@ -26,6 +159,43 @@ const CManageProperty* CPMIExitModule::s_rgProperties[] =
     &propCopyright,
     &propFileVer,
     &propProductVer,
+    &propEventsCertIssued,
+    &propEventsCertPending,
+    &propEventsCertDenied,
+    &propEventsCertRevoked,
+    &propEventsCertRetrievePending,
+    &propEventsCRLIssued,
+    &propEventsCertImported,
+    &propEventsShutdown,
+    &propHandlerSpawns,
+    &propHandlerSpawnFailures,
+    &propHandlerFailures,
+    &propHandlerTimeouts,
+    &propQueueDepth,
+    &propTempFilesPreserved,
+    &propBytesWritten,
+    &propHandlerLatencyP50MSecs,
+    &propHandlerLatencyP90MSecs,
+    &propHandlerLatencyP99MSecs,
+    &propHandlerLatencyMaxMSecs,
+    &propNotifyLatencyP50USecs,
+    &propNotifyLatencyP99USecs,
+    &propNotifyLatencyP999USecs,
+    &propPropertyReadLatencyP50USecs,
+    &propPropertyReadLatencyP99USecs,
+    &propPropertyReadLatencyP999USecs,
+    &propTempFileCreateLatencyP50USecs,
+    &propTempFileCreateLatencyP99USecs,
+    &propTempFileCreateLatencyP999USecs,
+    &propTempFileWriteLatencyP50USecs,
+    &propTempFileWriteLatencyP99USecs,
+    &propTempFileWriteLatencyP999USecs,
+    &propProcessCreateLatencyP50USecs,
+    &propProcessCreateLatencyP99USecs,
+    &propProcessCreateLatencyP999USecs,
+    &propProcessWaitLatencyP50USecs,
+    &propProcessWaitLatencyP99USecs,
+    &propProcessWaitLatencyP999USecs,
 };
 
 // CPMIExitModule
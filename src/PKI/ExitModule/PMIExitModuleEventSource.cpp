@@ -26,28 +26,80 @@
 
 const LPCWSTR CPMIExitModuleEventSource::s_pwszProviderName = WSZ_PMIEXITMODULE_PROVIDERNAME;
 
+HRESULT CPMIExitModuleEventSource::StartCoalescing(
+    DWORD dwWindowSecs)
+{
+    HRESULT hr = S_OK;
+    StopCoalescing();
+    if (dwWindowSecs == 0)
+    {
+        return S_OK;
+    }
+
+    do
+    {
+        m_pCoalescer = new CEventCoalescer();
+        if (!m_pCoalescer)
+        {
+            hr = E_OUTOFMEMORY;
+            ATLTRACE(L"Failed to alloc the event coalescer.\n");
+            break;
+        }
+
+        hr = m_pCoalescer->Start(dwWindowSecs * 1000, OnEventsCoalesced, this);
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"CEventCoalescer::Start failed, hr=%x\n", hr);
+            break;
+        }
+    } while (false);
+
+    if (FAILED(hr))
+    {
+        StopCoalescing();
+    }
+
+    return hr;
+}
+
+void CPMIExitModuleEventSource::StopCoalescing()
+{
+    if (m_pCoalescer)
+    {
+        m_pCoalescer->Stop();
+        ATLTRACE(L"Event coalescer: suppressed=%d\n", m_pCoalescer->GetSuppressed());
+        delete m_pCoalescer;
+        m_pCoalescer = nullptr;
+    }
+}
+
+bool CPMIExitModuleEventSource::ShouldReport(
+    DWORD dwEventID,
+    DWORD dwCode,
+    LPCWSTR pwszSerialNumber) const
+{
+    return !m_pCoalescer || m_pCoalescer->ShouldReport(dwEventID, dwCode, pwszSerialNumber);
+}
+
+void CPMIExitModuleEventSource::OnEventsCoalesced(
+    const CoalescedEvent& stEvent,
+    PVOID pvContext)
+{
+    static_cast<const CPMIExitModuleEventSource*>(pvContext)->ReportEventsCoalesced(stEvent);
+}
+
 void CPMIExitModuleEventSource::ReportProcessSucceeded(
     DWORD dwProcessID,
     DWORD dwThreadID,
     DWORD dwExitCode) const
 {
-    CNumericEventArg<DWORD> argProcessID(dwProcessID);
-    CNumericEventArg<DWORD> argThreadID(dwThreadID);
-    CNumericEventArg<DWORD> argExitCode(dwExitCode);
-    CEventArg* rgArgs[] =
-    {
-        &argProcessID,
-        &argThreadID,
-        &argExitCode,
-    };
-
-    CRefBuffer<CEventArg*> bufArgs(rgArgs, sizeof(rgArgs) / sizeof(rgArgs[0]));
-    HRESULT hr = ReportEvent(
+    HRESULT hr = ReportEventArgs(
         EVENTLOG_INFORMATION_TYPE,
         GENERAL_CATEGORY,
         MSG_PROCESS_SUCCEEDED,
-        bufArgs,
-        CRefBuffer<BYTE>());
+        dwProcessID,
+        dwThreadID,
+        dwExitCode);
     if (FAILED(hr))
     {
         ATLTRACE(L"ReportProcessSucceeded failed, hr=%x\n", hr);
@@ -58,27 +110,22 @@ void CPMIExitModuleEventSource::ReportProcessFailed(
     DWORD dwProcessID,
     DWORD dwThreadID,
     DWORD dwExitCode,
-    LPCWSTR pwszTempFilePath) const
+    LPCWSTR pwszTempFilePath,
+    LPCWSTR pwszSerialNumber) const
 {
-    CNumericEventArg<DWORD> argProcessID(dwProcessID);
-    CNumericEventArg<DWORD> argThreadID(dwThreadID);
-    CNumericEventArg<DWORD> argExitCode(dwExitCode);
-    CStringEventArg argTempFile(pwszTempFilePath);
-    CEventArg* rgArgs[] =
+    if (!ShouldReport(MSG_PROCESS_FAILED, dwExitCode, pwszSerialNumber))
     {
-        &argProcessID,
-        &argThreadID,
-        &argExitCode,
-        &argTempFile,
-    };
+        return;
+    }
 
-    CRefBuffer<CEventArg*> bufArgs(rgArgs, sizeof(rgArgs) / sizeof(rgArgs[0]));
-    HRESULT hr = ReportEvent(
+    HRESULT hr = ReportEventArgs(
         EVENTLOG_ERROR_TYPE,
         GENERAL_CATEGORY,
         MSG_PROCESS_FAILED,
-        bufArgs,
-        CRefBuffer<BYTE>());
+        dwProcessID,
+        dwThreadID,
+        dwExitCode,
+        pwszTempFilePath);
     if (FAILED(hr))
     {
         ATLTRACE(L"ReportProcessFailed failed, hr=%x\n", hr);
@@ -89,27 +136,22 @@ void CPMIExitModuleEventSource::ReportProcessTimedOut(
     DWORD dwSeconds,
     DWORD dwProcessID,
     DWORD dwThreadID,
-    LPCWSTR pwszTempFilePath) const
+    LPCWSTR pwszTempFilePath,
+    LPCWSTR pwszSerialNumber) const
 {
-    CNumericEventArg<DWORD> argSeconds(dwSeconds);
-    CNumericEventArg<DWORD> argProcessID(dwProcessID);
-    CNumericEventArg<DWORD> argThreadID(dwThreadID);
-    CStringEventArg argTempFile(pwszTempFilePath);
-    CEventArg* rgArgs[] =
+    if (!ShouldReport(MSG_PROCESS_TIMEDOUT, HRESULT_FROM_WIN32(ERROR_TIMEOUT), pwszSerialNumber))
     {
-        &argSeconds,
-        &argProcessID,
-        &argThreadID,
-        &argTempFile,
-    };
+        return;
+    }
 
-    CRefBuffer<CEventArg*> bufArgs(rgArgs, sizeof(rgArgs) / sizeof(rgArgs[0]));
-    HRESULT hr = ReportEvent(
+    HRESULT hr = ReportEventArgs(
         EVENTLOG_WARNING_TYPE,
         GENERAL_CATEGORY,
         MSG_PROCESS_TIMEDOUT,
-        bufArgs,
-        CRefBuffer<BYTE>());
+        dwSeconds,
+        dwProcessID,
+        dwThreadID,
+        pwszTempFilePath);
     if (FAILED(hr))
     {
         ATLTRACE(L"ReportProcessTimedOut failed, hr=%x\n", hr);
@@ -120,28 +162,22 @@ void CPMIExitModuleEventSource::ReportProcessStartSucceeded(
     LPCWSTR pwszExePath,
     LPCWSTR pwszCmdLine,
     DWORD dwProcessID,
-    DWORD dwThreadID) const
+    DWORD dwThreadID,
+    LPCWSTR pwszSerialNumber) const
 {
-    CStringEventArg argExePath(pwszExePath);
-    CStringEventArg argCmdLine(pwszCmdLine);
-    CNumericEventArg<DWORD> argProcessID(dwProcessID);
-    CNumericEventArg<DWORD> argThreadID(dwThreadID);
-
-    CEventArg* rgArgs[] =
+    if (!ShouldReport(MSG_PROCESS_START_SUCCEEDED, S_OK, pwszSerialNumber))
     {
-        &argExePath,
-        &argCmdLine,
-        &argProcessID,
-        &argThreadID,
-    };
+        return;
+    }
 
-    CRefBuffer<CEventArg*> bufArgs(rgArgs, sizeof(rgArgs) / sizeof(rgArgs[0]));
-    HRESULT hr = ReportEvent(
+    HRESULT hr = ReportEventArgs(
         EVENTLOG_INFORMATION_TYPE,
         GENERAL_CATEGORY,
         MSG_PROCESS_START_SUCCEEDED,
-        bufArgs,
-        CRefBuffer<BYTE>());
+        pwszExePath,
+        pwszCmdLine,
+        dwProcessID,
+        dwThreadID);
     if (FAILED(hr))
     {
         ATLTRACE(L"ReportProcessStartSucceeded failed, hr=%x\n", hr);
@@ -151,28 +187,22 @@ void CPMIExitModuleEventSource::ReportProcessStartSucceeded(
 void CPMIExitModuleEventSource::ReportProcessStartFailed(
     LPCWSTR pwszExePath,
     LPCWSTR pwszCmdLine,
-    HRESULT hrError) const
+    HRESULT hrError,
+    LPCWSTR pwszSerialNumber) const
 {
-    CStringEventArg argExePath(pwszExePath);
-    CStringEventArg argCmdLine(pwszCmdLine);
-    CNumericEventArg<HRESULT> argError(hrError);
-    CErrorMessageEventArg argErrorMessage(hrError);
-
-    CEventArg* rgArgs[] =
+    if (!ShouldReport(MSG_PROCESS_START_FAILED, hrError, pwszSerialNumber))
     {
-        &argExePath,
-        &argCmdLine,
-        &argError,
-        &argErrorMessage,
-    };
+        return;
+    }
 
-    CRefBuffer<CEventArg*> bufArgs(rgArgs, sizeof(rgArgs) / sizeof(rgArgs[0]));
-    HRESULT hr = ReportEvent(
+    HRESULT hr = ReportEventArgs(
         EVENTLOG_ERROR_TYPE,
         GENERAL_CATEGORY,
         MSG_PROCESS_START_FAILED,
-        bufArgs,
-        CRefBuffer<BYTE>());
+        pwszExePath,
+        pwszCmdLine,
+        hrError,
+        ErrorMessageText(hrError));
     if (FAILED(hr))
     {
         ATLTRACE(L"ReportProcessStartFailed failed, hr=%x\n", hr);
@@ -184,28 +214,239 @@ void CPMIExitModuleEventSource::ReportNotifyFailedInternalError(
     LONG lContext,
     HRESULT hrError) const
 {
-    CNumericEventArg<LONG> argExitEvent(lExitEvent);
-    CNumericEventArg<LONG> argContext(lContext);
-    CNumericEventArg<HRESULT> argError(hrError);
-    CErrorMessageEventArg argErrorMessage(hrError);
-
-    CEventArg* rgArgs[] =
+    if (!ShouldReport(MSG_NOTIFY_FAILED, hrError, nullptr))
     {
-        &argExitEvent,
-        &argContext,
-        &argError,
-        &argErrorMessage,
-    };
+        return;
+    }
 
-    CRefBuffer<CEventArg*> bufArgs(rgArgs, sizeof(rgArgs) / sizeof(rgArgs[0]));
-    HRESULT hr = ReportEvent(
+    HRESULT hr = ReportEventArgs(
         EVENTLOG_ERROR_TYPE,
         GENERAL_CATEGORY,
         MSG_NOTIFY_FAILED,
-        bufArgs,
-        CRefBuffer<BYTE>());
+        lExitEvent,
+        lContext,
+        hrError,
+        ErrorMessageText(hrError));
     if (FAILED(hr))
     {
         ATLTRACE(L"ReportNotifyFailedInternalError failed, hr=%x\n", hr);
     }
-}
\ No newline at end of file
+}
+
+void CPMIExitModuleEventSource::ReportHandlerEventFailed(
+    DWORD dwProcessID,
+    LPCWSTR pwszSerialNumber,
+    LONG lStatus,
+    LPCWSTR pwszTempFilePath) const
+{
+    if (!ShouldReport(MSG_HANDLER_EVENT_FAILED, lStatus, pwszSerialNumber))
+    {
+        return;
+    }
+
+    HRESULT hr = ReportEventArgs(
+        EVENTLOG_ERROR_TYPE,
+        GENERAL_CATEGORY,
+        MSG_HANDLER_EVENT_FAILED,
+        dwProcessID,
+        pwszSerialNumber,
+        lStatus,
+        pwszTempFilePath);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"ReportHandlerEventFailed failed, hr=%x\n", hr);
+    }
+}
+
+void CPMIExitModuleEventSource::ReportHandlerExited(
+    DWORD dwProcessID,
+    DWORD dwThreadID,
+    HRESULT hrError) const
+{
+    if (!ShouldReport(MSG_HANDLER_EXITED, hrError, nullptr))
+    {
+        return;
+    }
+
+    HRESULT hr = ReportEventArgs(
+        EVENTLOG_WARNING_TYPE,
+        GENERAL_CATEGORY,
+        MSG_HANDLER_EXITED,
+        dwProcessID,
+        dwThreadID,
+        hrError,
+        ErrorMessageText(hrError));
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"ReportHandlerExited failed, hr=%x\n", hr);
+    }
+}
+
+void CPMIExitModuleEventSource::ReportHandlerEventSucceeded(
+    DWORD dwProcessID,
+    LPCWSTR pwszSerialNumber) const
+{
+    HRESULT hr = ReportEventArgs(
+        EVENTLOG_INFORMATION_TYPE,
+        GENERAL_CATEGORY,
+        MSG_HANDLER_EVENT_SUCCEEDED,
+        dwProcessID,
+        pwszSerialNumber);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"ReportHandlerEventSucceeded failed, hr=%x\n", hr);
+    }
+}
+
+void CPMIExitModuleEventSource::ReportWorkerStats(
+    DWORD dwWorker,
+    DWORD dwEvents,
+    DWORD dwUtilization,
+    DWORD dwAverageWaitMSecs,
+    DWORD dwAverageRunMSecs) const
+{
+    HRESULT hr = ReportEventArgs(
+        EVENTLOG_INFORMATION_TYPE,
+        GENERAL_CATEGORY,
+        MSG_WORKER_STATS,
+        dwWorker,
+        dwEvents,
+        dwUtilization,
+        dwAverageWaitMSecs,
+        dwAverageRunMSecs);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"ReportWorkerStats failed, hr=%x\n", hr);
+    }
+}
+
+void CPMIExitModuleEventSource::ReportHandlerPoolStats(
+    DWORD dwHits,
+    DWORD dwMisses) const
+{
+    HRESULT hr = ReportEventArgs(
+        EVENTLOG_INFORMATION_TYPE,
+        GENERAL_CATEGORY,
+        MSG_HANDLER_POOL_STATS,
+        dwHits,
+        dwMisses);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"ReportHandlerPoolStats failed, hr=%x\n", hr);
+    }
+}
+
+void CPMIExitModuleEventSource::ReportServerCacheStats(
+    DWORD dwActivations,
+    DWORD dwActivationUSecs,
+    DWORD dwReuses,
+    DWORD dwSavedUSecs) const
+{
+    HRESULT hr = ReportEventArgs(
+        EVENTLOG_INFORMATION_TYPE,
+        GENERAL_CATEGORY,
+        MSG_SERVER_CACHE_STATS,
+        dwActivations,
+        dwActivationUSecs,
+        dwReuses,
+        dwSavedUSecs);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"ReportServerCacheStats failed, hr=%x\n", hr);
+    }
+}
+
+void CPMIExitModuleEventSource::ReportPropertyStats(
+    LPCWSTR pwszName,
+    DWORD dwFetches,
+    DWORD dwFailures,
+    DWORD dwAverageUSecs,
+    DWORD dwMaxUSecs) const
+{
+    HRESULT hr = ReportEventArgs(
+        EVENTLOG_INFORMATION_TYPE,
+        GENERAL_CATEGORY,
+        MSG_PROPERTY_STATS,
+        pwszName,
+        dwFetches,
+        dwFailures,
+        dwAverageUSecs,
+        dwMaxUSecs);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"ReportPropertyStats failed, hr=%x\n", hr);
+    }
+}
+
+void CPMIExitModuleEventSource::ReportEventLogWriterStats(
+    DWORD dwWritten,
+    DWORD dwBatches,
+    DWORD dwDropped) const
+{
+    HRESULT hr = ReportEventArgs(
+        dwDropped > 0 ? EVENTLOG_WARNING_TYPE : EVENTLOG_INFORMATION_TYPE,
+        GENERAL_CATEGORY,
+        MSG_EVENT_LOG_WRITER_STATS,
+        dwWritten,
+        dwBatches,
+        dwDropped);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"ReportEventLogWriterStats failed, hr=%x\n", hr);
+    }
+}
+
+void CPMIExitModuleEventSource::ReportEventsCoalesced(
+    const CoalescedEvent& stEvent) const
+{
+    // Event Viewer shows the ID without the severity and facility bits.
+    HRESULT hr = ReportEventArgs(
+        EVENTLOG_WARNING_TYPE,
+        GENERAL_CATEGORY,
+        MSG_EVENTS_COALESCED,
+        stEvent.dwEventID & 0xFFFF,
+        (HRESULT)stEvent.dwCode,
+        stEvent.cRepeats,
+        stEvent.dwSeconds,
+        stEvent.wszFirstSerialNumber,
+        stEvent.wszLastSerialNumber);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"ReportEventsCoalesced failed, hr=%x\n", hr);
+    }
+}
+
+void CPMIExitModuleEventSource::ReportErrorMessageCacheStats(
+    DWORD dwHits,
+    DWORD dwMisses,
+    DWORD dwEntries) const
+{
+    HRESULT hr = ReportEventArgs(
+        EVENTLOG_INFORMATION_TYPE,
+        GENERAL_CATEGORY,
+        MSG_ERROR_MESSAGE_CACHE_STATS,
+        dwHits,
+        dwMisses,
+        dwEntries);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"ReportErrorMessageCacheStats failed, hr=%x\n", hr);
+    }
+}
+
+void CPMIExitModuleEventSource::ReportJournalRecordQuarantined(
+    HRESULT hrError,
+    LPCWSTR pwszQuarantinePath) const
+{
+    HRESULT hr = ReportEventArgs(
+        EVENTLOG_WARNING_TYPE,
+        GENERAL_CATEGORY,
+        MSG_JOURNAL_RECORD_QUARANTINED,
+        hrError,
+        ErrorMessageText(hrError),
+        pwszQuarantinePath);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"ReportJournalRecordQuarantined failed, hr=%x\n", hr);
+    }
+}
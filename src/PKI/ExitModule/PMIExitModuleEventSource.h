@@ -21,6 +21,7 @@
 --*/
 
 #include "EventSource.h"
+#include "EventCoalescer.h"
 
 /*++
 
@@ -28,19 +29,56 @@
 
         Event Source for this module.
 
+    Remarks:
+
+        After StartCoalescing(), the failure events and the process start event are passed
+        through a CEventCoalescer. A broken handler then writes one event
+        and one MSG_EVENTS_COALESCED summary per window, not two events per certificate.
+
 --*/
 class CPMIExitModuleEventSource : public CEventSource
 {
 public:
     inline CPMIExitModuleEventSource()
-        : CEventSource(s_pwszProviderName)
+        : CEventSource(s_pwszProviderName), m_pCoalescer(nullptr)
     {
     }
 
     inline ~CPMIExitModuleEventSource()
     {
+        StopCoalescing();
     }
 
+    /*++
+
+        Abstract:
+
+            Starts collapsing repeats of the same failure into summary events.
+
+        Parameters:
+
+            dwWindowSecs - how long repeats of a written event are counted. 0 does nothing.
+
+        Returns:
+
+            S_OK - success.
+            other - error code. Every event is written.
+    --*/
+    HRESULT StartCoalescing(
+        DWORD dwWindowSecs);
+
+    /*++
+
+        Abstract:
+
+            Reports the summaries of open windows and writes every later event.
+
+        Remarks:
+
+            Call before StopWriter(), so the summaries are queued with the other events.
+    --*/
+    void StopCoalescing();
+
     /*++
     
         Abstract:
@@ -73,20 +111,22 @@ public:
             dwThreadID - thread id.
             dwExitCode - process exit code.
             pwszTempFilePath - path to the temp file that will not be deleted.
+            pwszSerialNumber - serial number of the certificate, or nullptr. Only used to coalesce repeats.
 
     --*/
     void ReportProcessFailed(
         DWORD dwProcessID,
         DWORD dwThreadID,
         DWORD dwExitCode,
-        LPCWSTR pwszTempFilePath) const;
+        LPCWSTR pwszTempFilePath,
+        LPCWSTR pwszSerialNumber) const;
 
     /*++
 
         Abstract:
 
             Reports a message with text similar to:
-            Timed out waiting %1 seconds for process [%2] with main thread id [%3]. The process was not killed and could still be running. The temp file [%4] will be preserved for debugging.
+            Timed out waiting %1 seconds for process [%2] with main thread id [%3]. The process and any processes it started were terminated. The temp file [%4] will be preserved for debugging.
 
         Parameters:
 
@@ -94,13 +134,15 @@ public:
             dwProcessID - the process id.
             dwThreadID - the thread id.
             pwszTempFilePath - path to the temp file that will not get deleted.
+            pwszSerialNumber - serial number of the certificate, or nullptr. Only used to coalesce repeats.
 
     --*/
     void ReportProcessTimedOut(
         DWORD dwSeconds,
         DWORD dwProcessID,
         DWORD dwThreadID,
-        LPCWSTR pwszTempFilePath) const;
+        LPCWSTR pwszTempFilePath,
+        LPCWSTR pwszSerialNumber) const;
 
     /*++
 
@@ -115,13 +157,19 @@ public:
             pwszCmdLine - full command line.
             dwProcessID - process ID of the started process.
             dwThreadID - main thread ID of the started process.
+            pwszSerialNumber - serial number of the certificate, or nullptr. Only used to coalesce repeats.
 
+        Remarks:
+
+            Coalesced too. With the full command line it is the largest event a failing
+            handler produces for each certificate.
     --*/
     void ReportProcessStartSucceeded(
         LPCWSTR pwszExePath,
         LPCWSTR pwszCmdLine,
         DWORD dwProcessID,
-        DWORD dwThreadID) const;
+        DWORD dwThreadID,
+        LPCWSTR pwszSerialNumber) const;
 
     /*++
 
@@ -135,6 +183,7 @@ public:
             pwszExePath - Path to the exe that was attempted.
             pwszCmdLine - full command line.
             hrError - error code.
+            pwszSerialNumber - serial number of the certificate, or nullptr. Only used to coalesce repeats.
 
         Remarks:
 
@@ -143,7 +192,8 @@ public:
     void ReportProcessStartFailed(
         LPCWSTR pwszExePath,
         LPCWSTR pwszCmdLine, 
-        HRESULT hrError) const;
+        HRESULT hrError,
+        LPCWSTR pwszSerialNumber) const;
 
     /*++
      
@@ -164,7 +214,239 @@ public:
         LONG lContext,
         HRESULT hrError) const;
 
+    /*++
+
+        Abstract:
+
+            Reports a message with text similar to:
+            The handler process [%1] failed to process the certificate with serial number [%2]. Status=[%3]. The temp file [%4] will be preserved for debugging.
+
+        Parameters:
+
+            dwProcessID - process ID of the handler.
+            pwszSerialNumber - serial number of the certificate.
+            lStatus - status the handler returned for the certificate, or the HRESULT of the failure.
+            pwszTempFilePath - path to the temp file that will not get deleted.
+
+    --*/
+    void ReportHandlerEventFailed(
+        DWORD dwProcessID,
+        LPCWSTR pwszSerialNumber,
+        LONG lStatus,
+        LPCWSTR pwszTempFilePath) const;
+
+    /*++
+
+        Abstract:
+
+            Reports a message with text similar to:
+            The persistent handler process [%1] with main thread id [%2] stopped responding or closed its pipe. HRESULT=%3. %4 The process was terminated and will be restarted.
+
+        Parameters:
+
+            dwProcessID - process ID of the persistent handler.
+            dwThreadID - main thread ID of the persistent handler.
+            hrError - the error from the pipe.
+
+    --*/
+    void ReportHandlerExited(
+        DWORD dwProcessID,
+        DWORD dwThreadID,
+        HRESULT hrError) const;
+
+    /*++
+
+        Abstract:
+
+            Reports a message with text similar to:
+            The handler process [%1] processed the certificate with serial number [%2].
+
+        Parameters:
+
+            dwProcessID - process ID of the handler.
+            pwszSerialNumber - serial number of the certificate.
+
+    --*/
+    void ReportHandlerEventSucceeded(
+        DWORD dwProcessID,
+        LPCWSTR pwszSerialNumber) const;
+
+    /*++
+
+        Abstract:
+
+            Reports a message with text similar to:
+            Dispatcher worker [%1] delivered [%2] events. Utilization=[%3]%. Average queue wait=[%4]ms. Average run time=[%5]ms.
+
+        Parameters:
+
+            dwWorker - index of the worker.
+            dwEvents - number of events the worker delivered.
+            dwUtilization - percent of the time the worker was busy.
+            dwAverageWaitMSecs - average time an event waited in the queue.
+            dwAverageRunMSecs - average time to deliver an event.
+
+    --*/
+    void ReportWorkerStats(
+        DWORD dwWorker,
+        DWORD dwEvents,
+        DWORD dwUtilization,
+        DWORD dwAverageWaitMSecs,
+        DWORD dwAverageRunMSecs) const;
+
+    /*++
+
+        Abstract:
+
+            Reports a message with text similar to:
+            The warm handler pool delivered [%1] events to pre-started handlers. [%2] events found no warm handler ready and started one.
+
+        Parameters:
+
+            dwHits - number of events delivered to a warm handler.
+            dwMisses - number of events that started a handler instead.
+
+    --*/
+    void ReportHandlerPoolStats(
+        DWORD dwHits,
+        DWORD dwMisses) const;
+
+    /*++
+
+        Abstract:
+
+            Reports a message with text similar to:
+            Created [%1] ICertServerExit instances in [%2]us and reused them for [%3] events. Reusing them saved about [%4]us of COM activation.
+
+        Parameters:
+
+            dwActivations - number of instances created with CoCreateInstance.
+            dwActivationUSecs - total time spent creating them.
+            dwReuses - number of events that reused an instance.
+            dwSavedUSecs - the average activation time multiplied by the reuses.
+
+    --*/
+    void ReportServerCacheStats(
+        DWORD dwActivations,
+        DWORD dwActivationUSecs,
+        DWORD dwReuses,
+        DWORD dwSavedUSecs) const;
+
+    /*++
+
+        Abstract:
+
+            Reports a message with text similar to:
+            Fetched the [%1] property [%2] times with [%3] failures. Average=[%4]us. Max=[%5]us.
+
+        Parameters:
+
+            pwszName - the property name.
+            dwFetches - number of times the property was fetched.
+            dwFailures - number of fetches that failed.
+            dwAverageUSecs - average time of a fetch.
+            dwMaxUSecs - longest fetch.
+
+    --*/
+    void ReportPropertyStats(
+        LPCWSTR pwszName,
+        DWORD dwFetches,
+        DWORD dwFailures,
+        DWORD dwAverageUSecs,
+        DWORD dwMaxUSecs) const;
+
+    /*++
+
+        Abstract:
+
+            Reports a message with text similar to:
+            The event log writer wrote [%1] events in [%2] batches. [%3] events were dropped because the queue was full.
+
+        Parameters:
+
+            dwWritten - number of events the writer thread wrote.
+            dwBatches - number of batches they were written in.
+            dwDropped - number of events dropped because the queue was full.
+
+        Remarks:
+
+            Call after StopWriter(), so the event is written and the counts are final.
+    --*/
+    void ReportEventLogWriterStats(
+        DWORD dwWritten,
+        DWORD dwBatches,
+        DWORD dwDropped) const;
+
+    /*++
+
+        Abstract:
+
+            Reports a message with text similar to:
+            Event [%1] with code [%2] was reported [%3] more times in the [%4] seconds after it was last written. Those reports were not written. First serial number [%5]. Last serial number [%6].
+
+        Parameters:
+
+            stEvent - the summary from the coalescer.
+
+    --*/
+    void ReportEventsCoalesced(
+        const CoalescedEvent& stEvent) const;
+
+    /*++
+
+        Abstract:
+
+            Reports a message with text similar to:
+            Error message text was found in the cache [%1] times and formatted [%2] times. The cache holds [%3] messages.
+
+        Parameters:
+
+            dwHits - number of messages served from the cache.
+            dwMisses - number of messages formatted with FormatMessageW.
+            dwEntries - number of messages in the cache.
+
+    --*/
+    void ReportErrorMessageCacheStats(
+        DWORD dwHits,
+        DWORD dwMisses,
+        DWORD dwEntries) const;
+
+    /*++
+
+        Abstract:
+
+            Reports a message with text similar to:
+            A journaled event could not be replayed. HRESULT=%1. %2 The record was copied to [%3] and will not be delivered.
+
+        Parameters:
+
+            hrError - why the record could not be read.
+            pwszQuarantinePath - the copy of the record, or an empty string if it could not be written.
+
+    --*/
+    void ReportJournalRecordQuarantined(
+        HRESULT hrError,
+        LPCWSTR pwszQuarantinePath) const;
+
 private:
     static const LPCWSTR s_pwszProviderName;
+
+    CEventCoalescer* m_pCoalescer;
+
+    /*++
+
+        Abstract:
+
+            Gets whether an event is written, or only counted in a summary.
+
+    --*/
+    bool ShouldReport(
+        DWORD dwEventID,
+        DWORD dwCode,
+        LPCWSTR pwszSerialNumber) const;
+
+    static void OnEventsCoalesced(
+        const CoalescedEvent& stEvent,
+        PVOID pvContext);
 };
 
@@ -0,0 +1,36 @@
+/*++
+
+	Copyright (C) Microsoft Corp. All rights reserved.
+
+	Abstract:
+
+		Definition of properties used by CPMIExitModule.
+
+--*/
+
+#include "pch.h"
+#include "PerfCounterManageProperty.h"
+
+/*++
+	Gets the value of the property.
+
+	Parameters:
+		rvarResult - reference to the variant to receive the value.
+
+	Returns:
+		S_OK - success
+		Other - error code.
+--*/
+HRESULT CPerfCounterManageProperty::GetValue(VARIANT& rvarResult) const
+{
+	LONGLONG llValue = 0;
+	HRESULT hr = CPerfCounters::Get().GetValue(m_eCounter, OUT llValue);
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	rvarResult.llVal = llValue;
+	rvarResult.vt = VT_I8;
+	return S_OK;
+}
@@ -0,0 +1,53 @@
+#pragma once
+/*++
+
+	Copyright (C) Microsoft Corp. All rights reserved.
+
+	Abstract:
+
+		Definition of properties used by CPMIExitModule.
+
+--*/
+#include "ManageProperty.h"
+#include "PerfCounters.h"
+
+/*++
+
+	Abstract:
+
+		A live counter from CPerfCounters, as VT_I8.
+--*/
+class CPerfCounterManageProperty :
+	public CManageProperty
+{
+public:
+	/*++
+		Abstract:
+
+			Initializes a new instance of the CPerfCounterManageProperty class.
+
+		Parameters:
+			pwszName - static string for the property name.
+			eCounter - the counter.
+
+	--*/
+	CPerfCounterManageProperty(LPCWSTR pwszName, PerfCounter eCounter)
+		: CManageProperty(pwszName), m_eCounter(eCounter)
+	{
+	}
+
+	/*++
+		Gets the value of the property.
+
+		Parameters:
+			rvarResult - reference to the variant to receive the value.
+
+		Returns:
+			S_OK - success
+			Other - error code.
+	--*/
+	virtual HRESULT GetValue(VARIANT& rvarResult) const;
+
+private:
+	PerfCounter m_eCounter;
+};
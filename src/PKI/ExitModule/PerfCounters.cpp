@@ -0,0 +1,462 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        PerfCounters.cpp
+
+    Abstract:
+
+        CPerfCounters class impl.
+
+--*/
+
+#include "pch.h"
+#include <sddl.h>
+#include "PerfCounters.h"
+
+LPCWSTR g_pwszPerfCounterSectionSDDL = L"D:P(A;;GA;;;SY)(A;;GR;;;BA)(A;;GR;;;MU)";
+
+// The shards until the section is published.
+alignas(64) PerfCounterShard g_rgPerfCounterShards[CPerfCounters::s_cMaxShards];
+
+CPerfCounters g_objPerfCounters;
+
+const LPCWSTR CPerfCounters::s_pwszSectionName = L"Global\\PMIExitModulePerfCounters";
+
+CPerfCounters::CPerfCounters()
+    : m_pShards(g_rgPerfCounterShards),
+    m_hSection(NULL),
+    m_pbView(nullptr),
+    m_fPublishCalled(false),
+    m_llTicksPerSecond(0)
+{
+    LARGE_INTEGER liFrequency;
+    if (::QueryPerformanceFrequency(&liFrequency))
+    {
+        m_llTicksPerSecond = liFrequency.QuadPart;
+    }
+}
+
+CPerfCounters::~CPerfCounters()
+{
+    m_pShards = g_rgPerfCounterShards;
+    if (m_pbView)
+    {
+        ::UnmapViewOfFile(m_pbView);
+        m_pbView = nullptr;
+    }
+
+    if (m_hSection)
+    {
+        ::CloseHandle(m_hSection);
+        m_hSection = NULL;
+    }
+}
+
+CPerfCounters& CPerfCounters::Get()
+{
+    return g_objPerfCounters;
+}
+
+HRESULT CPerfCounters::Publish()
+{
+    HRESULT hr = S_OK;
+    PSECURITY_DESCRIPTOR pSD = nullptr;
+    SECURITY_ATTRIBUTES stAttributes;
+    ZeroMemory(&stAttributes, sizeof(stAttributes));
+    stAttributes.nLength = sizeof(stAttributes);
+    size_t cbSection = sizeof(PerfCounterSectionHeader) + sizeof(g_rgPerfCounterShards);
+
+    // Even if publishing fails, this process is the one counting, so it reads its own shards.
+    m_fPublishCalled = true;
+
+    if (m_pbView)
+    {
+        return S_OK;
+    }
+
+    do
+    {
+        if (!::ConvertStringSecurityDescriptorToSecurityDescriptorW(
+            g_pwszPerfCounterSectionSDDL,
+            SDDL_REVISION_1,
+            &pSD,
+            nullptr)) // SecurityDescriptorSize
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"ConvertStringSecurityDescriptorToSecurityDescriptorW failed, hr=%x\n", hr);
+            break;
+        }
+
+        stAttributes.lpSecurityDescriptor = pSD;
+        m_hSection = ::CreateFileMappingW(
+            INVALID_HANDLE_VALUE, // hFile
+            &stAttributes,
+            PAGE_READWRITE,
+            0, // dwMaximumSizeHigh
+            (DWORD)cbSection,
+            s_pwszSectionName);
+        if (!m_hSection)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateFileMappingW(%s) failed, hr=%x\n", s_pwszSectionName, hr);
+            break;
+        }
+
+        if (::GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            // Another process owns the name. Do not write counters into its section.
+            hr = HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+            ATLTRACE(L"The section [%s] already exists.\n", s_pwszSectionName);
+            break;
+        }
+
+        m_pbView = static_cast<BYTE*>(::MapViewOfFile(
+            m_hSection,
+            FILE_MAP_READ | FILE_MAP_WRITE,
+            0, // dwFileOffsetHigh
+            0, // dwFileOffsetLow
+            cbSection));
+        if (!m_pbView)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"MapViewOfFile(%s) failed, hr=%x\n", s_pwszSectionName, hr);
+            break;
+        }
+
+        // The view is page aligned, so the shards after the 64 byte header are cache line aligned.
+        PerfCounterSectionHeader* pHeader = reinterpret_cast<PerfCounterSectionHeader*>(m_pbView);
+        PerfCounterShard* pShards = reinterpret_cast<PerfCounterShard*>(m_pbView + sizeof(PerfCounterSectionHeader));
+        ::CopyMemory(pShards, g_rgPerfCounterShards, sizeof(g_rgPerfCounterShards));
+
+        pHeader->wVersion = PerfCounterSectionHeader::s_wVersion;
+        pHeader->cbHeader = sizeof(PerfCounterSectionHeader);
+        pHeader->cbShard = sizeof(PerfCounterShard);
+        pHeader->cShards = (DWORD)s_cMaxShards;
+        pHeader->cCounters = PerfCounterCount;
+        pHeader->cStages = PerfStageCount;
+        pHeader->cLatencyBuckets = (DWORD)PerfHistogram::s_cBuckets;
+        pHeader->dwProcessID = ::GetCurrentProcessId();
+        ::GetSystemTimeAsFileTime(&pHeader->ftPublished);
+
+        // A reader that sees the magic sees the rest of the header.
+        ::InterlockedExchange(reinterpret_cast<volatile LONG*>(&pHeader->dwMagic), (LONG)PerfCounterSectionHeader::s_dwMagic);
+        m_pShards = pShards;
+    } while (false);
+
+    if (FAILED(hr))
+    {
+        if (m_pbView)
+        {
+            ::UnmapViewOfFile(m_pbView);
+            m_pbView = nullptr;
+        }
+
+        if (m_hSection)
+        {
+            ::CloseHandle(m_hSection);
+            m_hSection = NULL;
+        }
+    }
+
+    if (pSD)
+    {
+        ::LocalFree(pSD);
+    }
+
+    return hr;
+}
+
+void CPerfCounters::RecordHandlerLatency(
+    DWORD dwMSecs)
+{
+    PerfCounterShard& stShard = GetShard();
+    Record(stShard.stHandlerLatency, dwMSecs);
+    ::InterlockedExchangeAddNoFence64(&stShard.rgllCounters[PerfCounterHandlerLatencyMSecs], dwMSecs);
+}
+
+void CPerfCounters::RecordStageLatency(
+    PerfStage eStage,
+    LONGLONG llTicks)
+{
+    if (m_llTicksPerSecond == 0 || llTicks < 0)
+    {
+        return;
+    }
+
+    // Split so the multiply does not overflow for long waits.
+    LONGLONG llUSecs = (llTicks / m_llTicksPerSecond) * 1000000 +
+        (llTicks % m_llTicksPerSecond) * 1000000 / m_llTicksPerSecond;
+    DWORD dwUSecs = (DWORD)min(llUSecs, (LONGLONG)MAXDWORD);
+
+    PerfCounterShard& stShard = GetShard();
+    Record(stShard.rgStageLatency[eStage], dwUSecs);
+    ::InterlockedExchangeAddNoFence64(&stShard.rgllStageUSecs[eStage], llUSecs);
+}
+
+HRESULT CPerfCounters::GetTotals(
+    OUT PerfCounterTotals& stTotals) const
+{
+    HRESULT hr = S_OK;
+
+    if (m_fPublishCalled)
+    {
+        AddShards(reinterpret_cast<const BYTE*>(m_pShards), sizeof(PerfCounterShard), s_cMaxShards, OUT stTotals);
+        return S_OK;
+    }
+
+    // Not the CA process. Its shards are all 0, so read what certsrv.exe published.
+    HANDLE hSection = ::OpenFileMappingW(
+        FILE_MAP_READ,
+        FALSE, // bInheritHandle
+        s_pwszSectionName);
+    if (!hSection)
+    {
+        DWORD dwError = ::GetLastError();
+        hr = (dwError == ERROR_FILE_NOT_FOUND) ? HRESULT_FROM_WIN32(ERROR_NOT_READY) : HRESULT_FROM_WIN32(dwError);
+        ATLTRACE(L"OpenFileMappingW(%s) failed, hr=%x\n", s_pwszSectionName, hr);
+        return hr;
+    }
+
+    const BYTE* pbView = static_cast<const BYTE*>(::MapViewOfFile(
+        hSection,
+        FILE_MAP_READ,
+        0, // dwFileOffsetHigh
+        0, // dwFileOffsetLow
+        0)); // dwNumberOfBytesToMap
+    if (!pbView)
+    {
+        hr = HRESULT_FROM_WIN32(::GetLastError());
+        ATLTRACE(L"MapViewOfFile(%s) failed, hr=%x\n", s_pwszSectionName, hr);
+        ::CloseHandle(hSection);
+        return hr;
+    }
+
+    MEMORY_BASIC_INFORMATION stInfo;
+    ZeroMemory(&stInfo, sizeof(stInfo));
+    ::VirtualQuery(pbView, &stInfo, sizeof(stInfo));
+
+    const PerfCounterSectionHeader* pHeader = nullptr;
+    hr = ReadSection(pbView, stInfo.RegionSize, OUT pHeader, OUT stTotals);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"CPerfCounters::ReadSection failed, hr=%x\n", hr);
+    }
+
+    ::UnmapViewOfFile(pbView);
+    ::CloseHandle(hSection);
+    return hr;
+}
+
+HRESULT CPerfCounters::GetValue(
+    PerfCounter eCounter,
+    OUT LONGLONG& llValue) const
+{
+    PerfCounterTotals stTotals;
+    llValue = 0;
+
+    HRESULT hr = GetTotals(OUT stTotals);
+    if (SUCCEEDED(hr))
+    {
+        llValue = stTotals.rgllCounters[eCounter];
+    }
+
+    return hr;
+}
+
+HRESULT CPerfCounters::GetHandlerLatencyPercentile(
+    DWORD dwPercentile,
+    OUT DWORD& dwMSecs) const
+{
+    PerfCounterTotals stTotals;
+    dwMSecs = 0;
+
+    HRESULT hr = GetTotals(OUT stTotals);
+    if (SUCCEEDED(hr))
+    {
+        dwMSecs = GetPermille(stTotals.stHandlerLatency, min(dwPercentile, (DWORD)100) * 10);
+    }
+
+    return hr;
+}
+
+HRESULT CPerfCounters::GetStageLatencyPermille(
+    PerfStage eStage,
+    DWORD dwPermille,
+    OUT DWORD& dwUSecs) const
+{
+    PerfCounterTotals stTotals;
+    dwUSecs = 0;
+
+    HRESULT hr = GetTotals(OUT stTotals);
+    if (SUCCEEDED(hr))
+    {
+        dwUSecs = GetPermille(stTotals.rgStageLatency[eStage], dwPermille);
+    }
+
+    return hr;
+}
+
+HRESULT CPerfCounters::ReadSection(
+    const BYTE* pbView,
+    size_t cbView,
+    OUT const PerfCounterSectionHeader*& pstHeader,
+    OUT PerfCounterTotals& stTotals)
+{
+    pstHeader = nullptr;
+    if (!pbView || cbView < sizeof(PerfCounterSectionHeader))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    const PerfCounterSectionHeader* pHeader = reinterpret_cast<const PerfCounterSectionHeader*>(pbView);
+    if (pHeader->dwMagic != PerfCounterSectionHeader::s_dwMagic)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    if (pHeader->wVersion != PerfCounterSectionHeader::s_wVersion ||
+        pHeader->cbHeader != sizeof(PerfCounterSectionHeader) ||
+        pHeader->cbShard != sizeof(PerfCounterShard) ||
+        pHeader->cCounters != PerfCounterCount ||
+        pHeader->cStages != PerfStageCount ||
+        pHeader->cLatencyBuckets != PerfHistogram::s_cBuckets)
+    {
+        ATLTRACE(L"Counter section version=%d, expected %d\n", pHeader->wVersion, PerfCounterSectionHeader::s_wVersion);
+        return HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH);
+    }
+
+    if ((cbView - pHeader->cbHeader) / pHeader->cbShard < pHeader->cShards)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    AddShards(pbView + pHeader->cbHeader, pHeader->cbShard, pHeader->cShards, OUT stTotals);
+    pstHeader = pHeader;
+    return S_OK;
+}
+
+DWORD CPerfCounters::GetPermille(
+    const PerfHistogramTotals& stTotals,
+    DWORD dwPermille)
+{
+    ULONGLONG cTotal = 0;
+    for (size_t iBucket = 0; iBucket < PerfHistogram::s_cBuckets; iBucket++)
+    {
+        cTotal += stTotals.rgcBuckets[iBucket];
+    }
+
+    if (cTotal == 0)
+    {
+        return 0;
+    }
+
+    // The rank of the percentile, rounded up so p100 is the slowest one.
+    ULONGLONG cRank = (cTotal * min(dwPermille, (DWORD)1000) + 999) / 1000;
+    ULONGLONG cSeen = 0;
+    for (size_t iBucket = 0; iBucket < PerfHistogram::s_cBuckets; iBucket++)
+    {
+        cSeen += stTotals.rgcBuckets[iBucket];
+        if (cSeen >= max(cRank, 1ULL))
+        {
+            return GetBucketUpperBound(iBucket);
+        }
+    }
+
+    return GetBucketUpperBound(PerfHistogram::s_cBuckets - 1);
+}
+
+void CPerfCounters::AddShards(
+    const BYTE* pbShards,
+    size_t cbShard,
+    size_t cShards,
+    OUT PerfCounterTotals& stTotals)
+{
+    ZeroMemory(&stTotals, sizeof(stTotals));
+    for (size_t i = 0; i < cShards; i++)
+    {
+        const PerfCounterShard* pShard = reinterpret_cast<const PerfCounterShard*>(pbShards + i * cbShard);
+        for (size_t iCounter = 0; iCounter < PerfCounterCount; iCounter++)
+        {
+            stTotals.rgllCounters[iCounter] += pShard->rgllCounters[iCounter];
+        }
+
+        for (size_t iStage = 0; iStage < PerfStageCount; iStage++)
+        {
+            stTotals.rgllStageUSecs[iStage] += pShard->rgllStageUSecs[iStage];
+        }
+    }
+
+    AddHistogram(
+        pbShards,
+        cbShard,
+        cShards,
+        offsetof(PerfCounterShard, stHandlerLatency),
+        OUT stTotals.stHandlerLatency);
+    for (size_t iStage = 0; iStage < PerfStageCount; iStage++)
+    {
+        AddHistogram(
+            pbShards,
+            cbShard,
+            cShards,
+            offsetof(PerfCounterShard, rgStageLatency) + iStage * sizeof(PerfHistogram),
+            OUT stTotals.rgStageLatency[iStage]);
+    }
+}
+
+void CPerfCounters::AddHistogram(
+    const BYTE* pbShards,
+    size_t cbShard,
+    size_t cShards,
+    size_t cbOffset,
+    OUT PerfHistogramTotals& stTotals)
+{
+    ZeroMemory(&stTotals, sizeof(stTotals));
+    for (size_t i = 0; i < cShards; i++)
+    {
+        const PerfHistogram* pHistogram = reinterpret_cast<const PerfHistogram*>(pbShards + i * cbShard + cbOffset);
+        for (size_t iBucket = 0; iBucket < PerfHistogram::s_cBuckets; iBucket++)
+        {
+            stTotals.rgcBuckets[iBucket] += (ULONG)pHistogram->rgcBuckets[iBucket];
+        }
+    }
+}
+
+void CPerfCounters::Record(
+    PerfHistogram& stHistogram,
+    DWORD dwValue)
+{
+    ::InterlockedIncrementNoFence(&stHistogram.rgcBuckets[GetBucket(dwValue)]);
+}
+
+size_t CPerfCounters::GetBucket(
+    DWORD dwValue)
+{
+    if (dwValue < PerfHistogram::s_cSubBuckets)
+    {
+        return dwValue;
+    }
+
+    // The highest bit picks the power of two and the next three bits the eighth of it.
+    DWORD dwHighBit = 0;
+    _BitScanReverse(&dwHighBit, dwValue);
+    return PerfHistogram::s_cSubBuckets +
+        (dwHighBit - 3) * PerfHistogram::s_cSubBuckets +
+        ((dwValue >> (dwHighBit - 3)) & 7);
+}
+
+DWORD CPerfCounters::GetBucketUpperBound(
+    size_t iBucket)
+{
+    if (iBucket < PerfHistogram::s_cSubBuckets)
+    {
+        return (DWORD)iBucket;
+    }
+
+    DWORD dwShift = (DWORD)((iBucket - PerfHistogram::s_cSubBuckets) / PerfHistogram::s_cSubBuckets);
+    DWORD dwEighth = (DWORD)((iBucket - PerfHistogram::s_cSubBuckets) % PerfHistogram::s_cSubBuckets);
+    ULONGLONG ullUpper = ((ULONGLONG)(PerfHistogram::s_cSubBuckets + dwEighth + 1) << dwShift) - 1;
+    return (DWORD)min(ullUpper, (ULONGLONG)MAXDWORD);
+}
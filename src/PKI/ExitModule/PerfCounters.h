@@ -0,0 +1,503 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        PerfCounters.h
+
+    Abstract:
+
+        CPerfCounters class declaration.
+
+--*/
+
+#include "Buffer.h"
+
+/*++
+
+    Abstract:
+
+        The live counters of the module.
+
+--*/
+enum PerfCounter
+{
+    PerfCounterEventsCertIssued = 0,
+    PerfCounterEventsCertPending,
+    PerfCounterEventsCertDenied,
+    PerfCounterEventsCertRevoked,
+    PerfCounterEventsCertRetrievePending,
+    PerfCounterEventsCRLIssued,
+    PerfCounterEventsCertImported,
+    PerfCounterEventsShutdown,
+
+    // CreateProcessW calls, for every kind of handler.
+    PerfCounterHandlerSpawns,
+    PerfCounterHandlerSpawnFailures,
+
+    // Handlers started for an event or a batch that exited with a non zero code, and that timed out.
+    PerfCounterHandlerFailures,
+    PerfCounterHandlerTimeouts,
+
+    // Events posted to the dispatcher and not yet taken by a worker.
+    PerfCounterQueueDepth,
+    PerfCounterTempFilesPreserved,
+
+    // Bytes written to temp files and handler pipes.
+    PerfCounterBytesWritten,
+
+    // Sum of the handler latencies in milliseconds, for the mean.
+    PerfCounterHandlerLatencyMSecs,
+
+    PerfCounterCount
+};
+
+/*++
+
+    Abstract:
+
+        Stages of the Notify path that are timed by CStageTimer.
+
+--*/
+enum PerfStage
+{
+    // All of CPMICertExit::Notify(), on the CertSvc thread.
+    PerfStageNotify = 0,
+
+    // One ICertServerExit property read.
+    PerfStagePropertyRead,
+    PerfStageTempFileCreate,
+    PerfStageTempFileWrite,
+
+    // CProcess::Create(), including CreateProcessW and the job.
+    PerfStageProcessCreate,
+
+    // CProcess::Wait(), so how long the handler ran after it was started.
+    PerfStageProcessWait,
+
+    PerfStageCount
+};
+
+/*++
+
+    Abstract:
+
+        A log-linear latency histogram.
+
+    Remarks:
+
+        Values 0-7 have their own buckets. Above that, each power of two is split into 8
+        buckets, so a percentile is within 12.5% of the true value.
+--*/
+struct PerfHistogram
+{
+    static const size_t s_cSubBuckets = 8;
+    static const size_t s_cBuckets = s_cSubBuckets + 29 * s_cSubBuckets;
+
+    volatile LONG rgcBuckets[s_cBuckets];
+};
+
+/*++
+
+    Abstract:
+
+        The counters of one processor, as laid out in the shared memory section.
+
+--*/
+struct PerfCounterShard
+{
+    static const size_t s_cbCounters =
+        sizeof(LONGLONG) * PerfCounterCount +
+        sizeof(PerfHistogram) +
+        sizeof(LONGLONG) * PerfStageCount +
+        sizeof(PerfHistogram) * PerfStageCount;
+
+    volatile LONGLONG rgllCounters[PerfCounterCount];
+
+    // Milliseconds from CreateProcessW to the exit, or the timeout.
+    PerfHistogram stHandlerLatency;
+
+    // Sum of the stage latencies in microseconds, for the mean.
+    volatile LONGLONG rgllStageUSecs[PerfStageCount];
+
+    // Microseconds spent in each stage.
+    PerfHistogram rgStageLatency[PerfStageCount];
+
+    // Rounds the shard up to whole cache lines.
+    BYTE rgbPadding[64 - s_cbCounters % 64];
+};
+
+static_assert(sizeof(PerfCounterShard) % 64 == 0, "A shard must not share a cache line with the next one.");
+
+/*++
+
+    Abstract:
+
+        Fixed header at the start of the shared memory section.
+
+    Remarks:
+
+        cShards shards follow the header, cbShard bytes apart. A reader checks dwMagic,
+        wVersion and the sizes before it reads them. wVersion changes whenever the layout
+        of PerfCounterShard does, including when a counter or a stage is added.
+--*/
+struct PerfCounterSectionHeader
+{
+    static const DWORD s_dwMagic = 0x43494D50; // 'PMIC'
+    static const WORD s_wVersion = 2;
+
+    DWORD dwMagic;
+    WORD wVersion;
+    WORD wReserved;
+    DWORD cbHeader;
+    DWORD cbShard;
+    DWORD cShards;
+    DWORD cCounters;
+    DWORD cStages;
+    DWORD cLatencyBuckets;
+
+    // certsrv.exe, and when it published the section.
+    DWORD dwProcessID;
+    FILETIME ftPublished;
+    BYTE rgbReserved[20];
+};
+
+static_assert(sizeof(PerfCounterSectionHeader) == 64, "The shards after the header must start on a cache line.");
+
+/*++
+
+    Abstract:
+
+        The buckets of a histogram added up over every shard.
+
+--*/
+struct PerfHistogramTotals
+{
+    ULONGLONG rgcBuckets[PerfHistogram::s_cBuckets];
+};
+
+/*++
+
+    Abstract:
+
+        The shards of a process added up.
+
+--*/
+struct PerfCounterTotals
+{
+    LONGLONG rgllCounters[PerfCounterCount];
+    PerfHistogramTotals stHandlerLatency;
+    LONGLONG rgllStageUSecs[PerfStageCount];
+    PerfHistogramTotals rgStageLatency[PerfStageCount];
+};
+
+/*++
+
+    Abstract:
+
+        Counters and latency histograms that are updated on the hot path and read through
+        ICertManageModule::GetProperty and a named shared memory section.
+
+    Remarks:
+
+        Each processor updates its own shard, on its own cache lines, with an interlocked
+        add that has no fence. Threads on different processors never touch the same line,
+        and a thread that moves to another processor between picking the shard and the add
+        is still counted exactly once. Reads add up the shards, so a value read while it
+        is being updated can be a few counts behind, never torn.
+
+        There is one instance per process, shared by every CPMICertExit and CPMIExitModule.
+        Until Publish() is called, the shards live in the instance. After it, they live in
+        the section, so a collector in another process reads the same memory the hot path
+        updates and the module does no work for it.
+
+        The getters read the shards of this process only if CPMICertExit called Publish()
+        in it, as in certsrv.exe. The CA snap-in and monitoring clients create
+        CPMIExitModule in their own process, where nothing is counted, so there the getters
+        read the section that certsrv.exe published.
+--*/
+class CPerfCounters
+{
+public:
+    // Shards kept. Processors beyond this share shards.
+    static const size_t s_cMaxShards = 64;
+
+    // Name of the section. Global, so a collector in another session can open it.
+    static const LPCWSTR s_pwszSectionName;
+
+    CPerfCounters();
+    ~CPerfCounters();
+
+    /*++
+
+        Abstract:
+
+            Gets the counters of this process.
+
+    --*/
+    static CPerfCounters& Get();
+
+    /*++
+
+        Abstract:
+
+            Moves the shards into a new shared memory section named s_pwszSectionName.
+
+        Returns:
+
+            S_OK - success, or the section was already published.
+            other - error code. The counters stay in the process.
+
+        Remarks:
+
+            Counts added on other threads while the shards are copied can be lost, so call
+            this before events arrive. The section stays mapped until the DLL unloads.
+            SYSTEM can write it. Administrators and Performance Monitor Users can read it.
+    --*/
+    HRESULT Publish();
+
+    /*++
+
+        Abstract:
+
+            Adds to a counter.
+
+        Parameters:
+
+            eCounter - the counter.
+            llDelta - the amount. Negative for gauges going down.
+
+    --*/
+    inline void Add(
+        PerfCounter eCounter,
+        LONGLONG llDelta = 1)
+    {
+        ::InterlockedExchangeAddNoFence64(&GetShard().rgllCounters[eCounter], llDelta);
+    }
+
+    /*++
+
+        Abstract:
+
+            Counts how long a handler took.
+
+        Parameters:
+
+            dwMSecs - from CreateProcessW to the exit, or the timeout.
+
+    --*/
+    void RecordHandlerLatency(
+        DWORD dwMSecs);
+
+    /*++
+
+        Abstract:
+
+            Counts how long a stage took.
+
+        Parameters:
+
+            eStage - the stage.
+            llTicks - QueryPerformanceCounter() ticks spent in it.
+
+    --*/
+    void RecordStageLatency(
+        PerfStage eStage,
+        LONGLONG llTicks);
+
+    /*++
+
+        Abstract:
+
+            Adds up the counters of the CA.
+
+        Parameters:
+
+            stTotals - receives the totals.
+
+        Returns:
+
+            S_OK - success.
+            HRESULT_FROM_WIN32(ERROR_NOT_READY) - this is not the CA process and the CA has
+                not published the section, for example because CertSvc is stopped.
+            other - the section could not be read.
+
+        Remarks:
+
+            Reads the shards of this process if Publish() was called in it, or else maps
+            the section read-only. Needs Administrators or Performance Monitor Users then.
+    --*/
+    HRESULT GetTotals(
+        OUT PerfCounterTotals& stTotals) const;
+
+    /*++
+
+        Abstract:
+
+            Gets the sum of a counter over every shard.
+
+        Returns:
+
+            S_OK - success.
+            other - error code from GetTotals().
+    --*/
+    HRESULT GetValue(
+        PerfCounter eCounter,
+        OUT LONGLONG& llValue) const;
+
+    /*++
+
+        Abstract:
+
+            Gets a handler latency percentile.
+
+        Parameters:
+
+            dwPercentile - 1 to 100.
+            dwMSecs - receives the upper bound in milliseconds of the bucket that holds the
+                percentile, or 0 if no handler has finished yet.
+
+        Returns:
+
+            S_OK - success.
+            other - error code from GetTotals().
+    --*/
+    HRESULT GetHandlerLatencyPercentile(
+        DWORD dwPercentile,
+        OUT DWORD& dwMSecs) const;
+
+    /*++
+
+        Abstract:
+
+            Gets a stage latency percentile.
+
+        Parameters:
+
+            eStage - the stage.
+            dwPermille - 1 to 1000, so 999 for p99.9.
+            dwUSecs - receives the upper bound in microseconds of the bucket that holds the
+                percentile, or 0 if the stage has not run yet.
+
+        Returns:
+
+            S_OK - success.
+            other - error code from GetTotals().
+    --*/
+    HRESULT GetStageLatencyPermille(
+        PerfStage eStage,
+        DWORD dwPermille,
+        OUT DWORD& dwUSecs) const;
+
+    /*++
+
+        Abstract:
+
+            Adds up the shards of a section mapped by another process.
+
+        Parameters:
+
+            pbView - the mapped view.
+            cbView - the size of the view.
+            pstHeader - receives a pointer to the header in the view.
+            stTotals - receives the totals.
+
+        Returns:
+
+            S_OK - success.
+            HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) - the section has another layout.
+            HRESULT_FROM_WIN32(ERROR_INVALID_DATA) - the section is not a counter section.
+    --*/
+    static HRESULT ReadSection(
+        const BYTE* pbView,
+        size_t cbView,
+        OUT const PerfCounterSectionHeader*& pstHeader,
+        OUT PerfCounterTotals& stTotals);
+
+    /*++
+
+        Abstract:
+
+            Gets a percentile of a histogram.
+
+        Parameters:
+
+            stTotals - the histogram.
+            dwPermille - 1 to 1000.
+
+        Returns:
+
+            The upper bound of the bucket that holds the percentile, or 0 if the histogram
+            is empty.
+    --*/
+    static DWORD GetPermille(
+        const PerfHistogramTotals& stTotals,
+        DWORD dwPermille);
+
+    /*++
+
+        Abstract:
+
+            Gets the largest value that is counted in a histogram bucket.
+
+    --*/
+    static DWORD GetBucketUpperBound(
+        size_t iBucket);
+
+private:
+    // The shards in the process, or in the section once it is published. Page or cache
+    // line aligned either way.
+    PerfCounterShard* volatile m_pShards;
+    HANDLE m_hSection;
+    BYTE* m_pbView;
+
+    // Publish() was called, so this is the CA process and the getters read m_pShards.
+    volatile bool m_fPublishCalled;
+
+    // QueryPerformanceFrequency(). It does not change while the system runs.
+    LONGLONG m_llTicksPerSecond;
+
+    inline PerfCounterShard& GetShard()
+    {
+        return m_pShards[::GetCurrentProcessorNumber() % s_cMaxShards];
+    }
+
+    /*++
+
+        Abstract:
+
+            Adds up every counter and histogram of the shards.
+
+    --*/
+    static void AddShards(
+        const BYTE* pbShards,
+        size_t cbShard,
+        size_t cShards,
+        OUT PerfCounterTotals& stTotals);
+
+    /*++
+
+        Abstract:
+
+            Adds up one histogram, at cbOffset in each shard.
+
+    --*/
+    static void AddHistogram(
+        const BYTE* pbShards,
+        size_t cbShard,
+        size_t cShards,
+        size_t cbOffset,
+        OUT PerfHistogramTotals& stTotals);
+
+    static void Record(
+        PerfHistogram& stHistogram,
+        DWORD dwValue);
+
+    static size_t GetBucket(
+        DWORD dwValue);
+
+    CPerfCounters(const CPerfCounters&) = delete;
+    CPerfCounters& operator=(const CPerfCounters&) = delete;
+};
@@ -0,0 +1,254 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        PersistentHandler.cpp
+
+    Abstract:
+
+        CPersistentHandler class impl.
+
+--*/
+
+#include "pch.h"
+#include "PMIExitModuleEventSource.h"
+#include "EventProcessorConfig.h"
+#include "HandlerFrame.h"
+#include "PersistentHandler.h"
+#include "Process.h"
+
+// Time the handler gets to exit after its stdin is closed.
+constexpr const DWORD g_dwHandlerStopTimeoutMSecs = 5000;
+constexpr const DWORD g_dwHandlerResetExitCode = 1;
+
+CPersistentHandler::CPersistentHandler(const CPMIExitModuleEventSource& objEventSource)
+    : m_objEventSource(objEventSource), m_pProcess(nullptr), m_dwSequence(0)
+{
+    ::InitializeSRWLock(&m_lock);
+}
+
+CPersistentHandler::~CPersistentHandler()
+{
+    Stop();
+}
+
+HRESULT CPersistentHandler::NotifyCertIssued(
+    const CEventProcessorConfig& objConfig,
+    LPCWSTR pwszSubjectKeyIdentifier,
+    LPCWSTR pwszSerialNumber,
+    const CBuffer<BYTE>& bufRawCert,
+    OUT LONG& lStatus,
+    OUT DWORD& dwProcessID)
+{
+    HRESULT hr = S_OK;
+    CHeapBuffer<WCHAR> bufCommandLine;
+    lStatus = 0;
+    dwProcessID = 0;
+
+    // A handler started before Arguments or EscapeForPS changed has a different command line.
+    hr = objConfig.GetEventStreamTemplate().Format(CommandLineValues(), OUT bufCommandLine);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"CCommandLineTemplate::Format failed, hr=%x\n", hr);
+        return hr;
+    }
+
+    ::AcquireSRWLockExclusive(&m_lock);
+
+    do
+    {
+        if (!objConfig.GetExePath())
+        {
+            ATLTRACE(L"No Process registered.\n");
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+            break;
+        }
+
+        hr = m_objFrame.FormatCertIssued(
+            ++m_dwSequence,
+            pwszSubjectKeyIdentifier,
+            pwszSerialNumber,
+            bufRawCert);
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"CHandlerFrame::FormatCertIssued failed, hr=%x\n", hr);
+            break;
+        }
+
+        for (int nAttempt = 0; nAttempt < 2; nAttempt++)
+        {
+            if (m_pProcess &&
+                (_wcsicmp(m_strExePath.Get(), objConfig.GetExePath()) != 0 ||
+                wcscmp(m_pProcess->GetCommandLine(), bufCommandLine.Get()) != 0))
+            {
+                ATLTRACE(L"ExePath or Arguments changed. Restarting the handler.\n");
+                StopLocked();
+            }
+
+            if (!m_pProcess)
+            {
+                hr = Start(objConfig);
+                if (FAILED(hr))
+                {
+                    ATLTRACE(L"CPersistentHandler::Start failed, hr=%x\n", hr);
+                    break;
+                }
+            }
+
+            dwProcessID = m_pProcess->GetProcessID();
+            hr = m_objFrame.Exchange(
+                m_pipeRequest,
+                m_pipeAck,
+                objConfig.GetHandlerTimeoutMSecs(),
+                OUT lStatus);
+            if (SUCCEEDED(hr))
+            {
+                break;
+            }
+
+            ATLTRACE(L"CHandlerFrame::Exchange failed, hr=%x\n", hr);
+            Reset(hr);
+
+            // A timed out event is not sent again. It could be what hangs the handler.
+            if (!CHandlerFrame::IsPipeClosed(hr))
+            {
+                break;
+            }
+        }
+    } while (false);
+
+    ::ReleaseSRWLockExclusive(&m_lock);
+    return hr;
+}
+
+void CPersistentHandler::Stop()
+{
+    ::AcquireSRWLockExclusive(&m_lock);
+    StopLocked();
+    ::ReleaseSRWLockExclusive(&m_lock);
+}
+
+HRESULT CPersistentHandler::Start(
+    const CEventProcessorConfig& objConfig)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        hr = m_strExePath.CopyFrom(objConfig.GetExePath());
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        hr = m_pipeRequest.Create(true); // fOutbound
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"Failed to create request pipe, hr=%x\n", hr);
+            break;
+        }
+
+        hr = m_pipeAck.Create(false); // fOutbound
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"Failed to create ack pipe, hr=%x\n", hr);
+            break;
+        }
+
+        m_pProcess = new CProcess();
+        if (!m_pProcess)
+        {
+            hr = E_OUTOFMEMORY;
+            break;
+        }
+
+        hr = m_pProcess->Create(
+            objConfig.GetExePath(),
+            objConfig.GetEventStreamTemplate(),
+            CommandLineValues(),
+            NORMAL_PRIORITY_CLASS | CREATE_NEW_CONSOLE | CREATE_NEW_PROCESS_GROUP,
+            m_pipeRequest.GetClientHandle(), // hStdInput
+            m_pipeAck.GetClientHandle()); // hStdOutput
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"CProcess::Create failed, hr=%x\n", hr);
+            m_objEventSource.ReportProcessStartFailed(
+                objConfig.GetExePath(),
+                m_pProcess->GetCommandLine(),
+                hr,
+                nullptr); // pwszSerialNumber
+            break;
+        }
+
+        // The child has its own copies. Closing ours lets a broken pipe signal that it exited.
+        m_pipeRequest.CloseClient();
+        m_pipeAck.CloseClient();
+
+        m_objEventSource.ReportProcessStartSucceeded(
+            objConfig.GetExePath(),
+            m_pProcess->GetCommandLine(),
+            m_pProcess->GetProcessID(),
+            m_pProcess->GetThreadID(),
+            nullptr); // pwszSerialNumber
+    } while (false);
+
+    if (FAILED(hr))
+    {
+        delete m_pProcess;
+        m_pProcess = nullptr;
+        m_pipeRequest.Close();
+        m_pipeAck.Close();
+    }
+
+    return hr;
+}
+
+void CPersistentHandler::Reset(
+    HRESULT hrReason)
+{
+    if (!m_pProcess)
+    {
+        return;
+    }
+
+    m_objEventSource.ReportHandlerExited(
+        m_pProcess->GetProcessID(),
+        m_pProcess->GetThreadID(),
+        hrReason);
+
+    HRESULT hr = m_pProcess->Terminate(g_dwHandlerResetExitCode);
+    if (FAILED(hr))
+    {
+        // Expected if the process already exited.
+        ATLTRACE(L"CProcess::Terminate failed, hr=%x\n", hr);
+    }
+
+    delete m_pProcess;
+    m_pProcess = nullptr;
+    m_pipeRequest.Close();
+    m_pipeAck.Close();
+}
+
+void CPersistentHandler::StopLocked()
+{
+    if (!m_pProcess)
+    {
+        return;
+    }
+
+    // EOF on stdin asks the handler to exit.
+    m_pipeRequest.Close();
+
+    HRESULT hr = m_pProcess->Wait(g_dwHandlerStopTimeoutMSecs);
+    if (FAILED(hr))
+    {
+        ATLTRACE(L"Handler did not exit, hr=%x. Terminating it.\n", hr);
+        m_pProcess->Terminate(g_dwHandlerResetExitCode);
+    }
+
+    delete m_pProcess;
+    m_pProcess = nullptr;
+    m_pipeAck.Close();
+}
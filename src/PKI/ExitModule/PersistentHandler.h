@@ -0,0 +1,108 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        PersistentHandler.h
+
+    Abstract:
+
+        CPersistentHandler class declaration.
+
+--*/
+
+#include "HandlerFrame.h"
+#include "Pipe.h"
+
+class CEventProcessorConfig;
+class CPMIExitModuleEventSource;
+class CProcess;
+
+/*++
+
+    Abstract:
+
+        A long-lived handler process that receives events over a pipe.
+
+    Remarks:
+
+        The process is started on the first event with the registered ExePath, the static
+        Arguments and the eventstream operation. Events are written to its stdin as frames
+        described in HandlerProtocol.h and the handler answers each one with an ack on stdout.
+        If the pipe breaks or an ack does not arrive in time, the process is terminated
+        and a new one is started for the next event. It is also restarted when the
+        registered ExePath or its command line changes.
+
+        Events are exchanged one at a time. Concurrent callers are serialized.
+--*/
+class CPersistentHandler
+{
+public:
+    CPersistentHandler(const CPMIExitModuleEventSource& objEventSource);
+    ~CPersistentHandler();
+
+    /*++
+
+        Abstract:
+
+            Sends an issued certificate to the handler and waits for its ack.
+
+        Parameters:
+
+            objConfig - the current event processor config.
+            pwszSubjectKeyIdentifier - subject key identifier of the cert.
+            pwszSerialNumber - serial number of the cert.
+            bufRawCert - raw DER bytes of the cert.
+            lStatus - on success, receives the status from the handler's ack.
+            dwProcessID - receives the process ID of the handler that got the event.
+
+        Returns:
+
+            S_OK - the handler acked the event. Check lStatus.
+            other - the event could not be exchanged with a handler.
+
+        Remarks:
+
+            If the running handler has exited, it is restarted and the event is sent once more.
+    --*/
+    HRESULT NotifyCertIssued(
+        const CEventProcessorConfig& objConfig,
+        LPCWSTR pwszSubjectKeyIdentifier,
+        LPCWSTR pwszSerialNumber,
+        const CBuffer<BYTE>& bufRawCert,
+        OUT LONG& lStatus,
+        OUT DWORD& dwProcessID);
+
+    /*++
+
+        Abstract:
+
+            Closes the handler's stdin and waits for it to exit.
+
+        Remarks:
+
+            The handler is terminated if it does not exit in time.
+    --*/
+    void Stop();
+
+private:
+    const CPMIExitModuleEventSource& m_objEventSource;
+    SRWLOCK m_lock;
+    CProcess* m_pProcess;
+    CPipe m_pipeRequest;
+    CPipe m_pipeAck;
+    CHeapWString m_strExePath;
+    CHandlerFrame m_objFrame;
+    DWORD m_dwSequence;
+
+    HRESULT Start(
+        const CEventProcessorConfig& objConfig);
+    void Reset(
+        HRESULT hrReason);
+    void StopLocked();
+
+    CPersistentHandler(const CPersistentHandler&) = delete;
+    CPersistentHandler& operator=(const CPersistentHandler&) = delete;
+};
@@ -0,0 +1,391 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        Pipe.cpp
+
+    Abstract:
+
+        CPipe class impl.
+
+--*/
+#include "pch.h"
+#include <sddl.h>
+#include "PerfCounters.h"
+#include "Pipe.h"
+
+constexpr const DWORD g_cbPipeBuffer = 64 * 1024;
+volatile LONG g_lPipeCounter = 0;
+
+// SYSTEM and the user the module runs as, which handlers also run as. %s is that user's SID.
+LPCWSTR g_pwszPipeSDDLFormat = L"D:P(A;;GA;;;SY)(A;;GA;;;%s)";
+
+namespace
+{
+    /*++
+
+        Abstract:
+
+            Builds the security descriptor for a pipe.
+
+        Parameters:
+
+            pSD - receives the security descriptor. Free it with LocalFree().
+
+        Remarks:
+
+            Without one, the pipe gets the default DACL of the process token, which can let
+            other local accounts open the predictable pipe name and read cert data or write
+            acks. The handler gets the client end by inheritance, so it never opens the name.
+    --*/
+    HRESULT CreatePipeSecurityDescriptor(
+        OUT PSECURITY_DESCRIPTOR& pSD)
+    {
+        HRESULT hr = S_OK;
+        HANDLE hToken = NULL;
+        LPWSTR pwszSid = nullptr;
+        struct
+        {
+            TOKEN_USER stUser;
+            BYTE rgbSid[SECURITY_MAX_SID_SIZE];
+        } stTokenUser;
+        CStaticBuffer<WCHAR, 256> strSDDL;
+
+        pSD = nullptr;
+
+        do
+        {
+            if (!::OpenProcessToken(::GetCurrentProcess(), TOKEN_QUERY, &hToken))
+            {
+                hr = HRESULT_FROM_WIN32(::GetLastError());
+                ATLTRACE(L"OpenProcessToken failed, hr=%x\n", hr);
+                break;
+            }
+
+            DWORD cbTokenUser = 0;
+            if (!::GetTokenInformation(
+                hToken,
+                TokenUser,
+                &stTokenUser,
+                sizeof(stTokenUser),
+                &cbTokenUser))
+            {
+                hr = HRESULT_FROM_WIN32(::GetLastError());
+                ATLTRACE(L"GetTokenInformation failed, hr=%x\n", hr);
+                break;
+            }
+
+            if (!::ConvertSidToStringSidW(stTokenUser.stUser.User.Sid, &pwszSid))
+            {
+                hr = HRESULT_FROM_WIN32(::GetLastError());
+                ATLTRACE(L"ConvertSidToStringSidW failed, hr=%x\n", hr);
+                break;
+            }
+
+            hr = ::StringCchPrintfW(
+                strSDDL.Get(),
+                strSDDL.GetLength(),
+                g_pwszPipeSDDLFormat,
+                pwszSid);
+            if (FAILED(hr))
+            {
+                break;
+            }
+
+            if (!::ConvertStringSecurityDescriptorToSecurityDescriptorW(
+                strSDDL.Get(),
+                SDDL_REVISION_1,
+                &pSD,
+                nullptr)) // SecurityDescriptorSize
+            {
+                hr = HRESULT_FROM_WIN32(::GetLastError());
+                ATLTRACE(L"ConvertStringSecurityDescriptorToSecurityDescriptorW failed, hr=%x\n", hr);
+                break;
+            }
+        } while (false);
+
+        if (pwszSid)
+        {
+            ::LocalFree(pwszSid);
+        }
+
+        if (hToken)
+        {
+            ::CloseHandle(hToken);
+        }
+
+        return hr;
+    }
+}
+
+CPipe::CPipe()
+    : m_hServer(INVALID_HANDLE_VALUE), m_hClient(INVALID_HANDLE_VALUE), m_hEvent(NULL)
+{
+}
+
+CPipe::~CPipe()
+{
+    Close();
+}
+
+HRESULT CPipe::Create(
+    bool fOutbound)
+{
+    HRESULT hr = S_OK;
+    CStaticBuffer<WCHAR, 64> strName;
+    SECURITY_ATTRIBUTES stInherit;
+    ZeroMemory(&stInherit, sizeof(stInherit));
+    stInherit.nLength = sizeof(stInherit);
+    stInherit.bInheritHandle = TRUE;
+    SECURITY_ATTRIBUTES stServer;
+    ZeroMemory(&stServer, sizeof(stServer));
+    stServer.nLength = sizeof(stServer);
+    PSECURITY_DESCRIPTOR pSD = nullptr;
+
+    do
+    {
+        Close();
+
+        hr = CreatePipeSecurityDescriptor(OUT pSD);
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"CreatePipeSecurityDescriptor failed, hr=%x\n", hr);
+            break;
+        }
+
+        stServer.lpSecurityDescriptor = pSD;
+
+        hr = ::StringCchPrintfW(
+            strName.Get(),
+            strName.GetLength(),
+            L"\\\\.\\pipe\\PMIExitModule.%u.%u",
+            ::GetCurrentProcessId(),
+            (ULONG)::InterlockedIncrement(&g_lPipeCounter));
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        m_hEvent = ::CreateEventW(
+            nullptr, // lpEventAttributes
+            TRUE, // bManualReset
+            FALSE, // bInitialState
+            nullptr); // lpName
+        if (!m_hEvent)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateEventW failed, hr=%x\n", hr);
+            break;
+        }
+
+        // FILE_FLAG_FIRST_PIPE_INSTANCE fails if another process created the name first.
+        m_hServer = ::CreateNamedPipeW(
+            strName.Get(),
+            (fOutbound ? PIPE_ACCESS_OUTBOUND : PIPE_ACCESS_INBOUND) | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+            PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+            1, // nMaxInstances
+            g_cbPipeBuffer, // nOutBufferSize
+            g_cbPipeBuffer, // nInBufferSize
+            0, // nDefaultTimeOut
+            &stServer);
+        if (m_hServer == INVALID_HANDLE_VALUE)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateNamedPipeW(%s) failed, hr=%x\n", strName.Get(), hr);
+            break;
+        }
+
+        m_hClient = ::CreateFileW(
+            strName.Get(),
+            fOutbound ? GENERIC_READ : GENERIC_WRITE,
+            0, // dwShareMode
+            &stInherit,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL,
+            NULL); // hTemplateFile
+        if (m_hClient == INVALID_HANDLE_VALUE)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateFileW(%s) failed, hr=%x\n", strName.Get(), hr);
+            break;
+        }
+    } while (false);
+
+    if (pSD)
+    {
+        ::LocalFree(pSD);
+    }
+
+    if (FAILED(hr))
+    {
+        Close();
+    }
+
+    return hr;
+}
+
+void CPipe::CloseClient()
+{
+    if (m_hClient != INVALID_HANDLE_VALUE)
+    {
+        ::CloseHandle(m_hClient);
+        m_hClient = INVALID_HANDLE_VALUE;
+    }
+}
+
+void CPipe::Close()
+{
+    CloseClient();
+
+    if (m_hServer != INVALID_HANDLE_VALUE)
+    {
+        ::CloseHandle(m_hServer);
+        m_hServer = INVALID_HANDLE_VALUE;
+    }
+
+    if (m_hEvent)
+    {
+        ::CloseHandle(m_hEvent);
+        m_hEvent = NULL;
+    }
+}
+
+HRESULT CPipe::Write(
+    const BYTE* pbData,
+    size_t cbData,
+    DWORD dwMilliseconds)
+{
+    HRESULT hr = S_OK;
+
+    // One deadline for all the chunks, so a child that moves a few bytes at a time can't extend it.
+    ULONGLONG ullDeadline = ::GetTickCount64() + dwMilliseconds;
+
+    if (m_hServer == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+    }
+
+    while (cbData > 0)
+    {
+        OVERLAPPED stOverlapped;
+        ZeroMemory(&stOverlapped, sizeof(stOverlapped));
+        stOverlapped.hEvent = m_hEvent;
+
+        DWORD cbTransferred = 0;
+        DWORD cbChunk = (DWORD)min(cbData, (size_t)MAXDWORD);
+        BOOL fResult = ::WriteFile(
+            m_hServer,
+            pbData,
+            cbChunk,
+            nullptr, // lpNumberOfBytesWritten
+            &stOverlapped);
+        hr = CompleteIo(fResult, dwMilliseconds, ullDeadline, OUT cbTransferred, stOverlapped);
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"Pipe write failed, hr=%x\n", hr);
+            break;
+        }
+
+        pbData += cbTransferred;
+        cbData -= cbTransferred;
+        CPerfCounters::Get().Add(PerfCounterBytesWritten, cbTransferred);
+    }
+
+    return hr;
+}
+
+HRESULT CPipe::Read(
+    BYTE* pbData,
+    size_t cbData,
+    DWORD dwMilliseconds)
+{
+    HRESULT hr = S_OK;
+
+    // See Write().
+    ULONGLONG ullDeadline = ::GetTickCount64() + dwMilliseconds;
+
+    if (m_hServer == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+    }
+
+    while (cbData > 0)
+    {
+        OVERLAPPED stOverlapped;
+        ZeroMemory(&stOverlapped, sizeof(stOverlapped));
+        stOverlapped.hEvent = m_hEvent;
+
+        DWORD cbTransferred = 0;
+        DWORD cbChunk = (DWORD)min(cbData, (size_t)MAXDWORD);
+        BOOL fResult = ::ReadFile(
+            m_hServer,
+            pbData,
+            cbChunk,
+            nullptr, // lpNumberOfBytesRead
+            &stOverlapped);
+        hr = CompleteIo(fResult, dwMilliseconds, ullDeadline, OUT cbTransferred, stOverlapped);
+        if (SUCCEEDED(hr) && cbTransferred == 0)
+        {
+            // End of file.
+            hr = HRESULT_FROM_WIN32(ERROR_BROKEN_PIPE);
+        }
+
+        if (FAILED(hr))
+        {
+            ATLTRACE(L"Pipe read failed, hr=%x\n", hr);
+            break;
+        }
+
+        pbData += cbTransferred;
+        cbData -= cbTransferred;
+    }
+
+    return hr;
+}
+
+HRESULT CPipe::CompleteIo(
+    BOOL fResult,
+    DWORD dwMilliseconds,
+    ULONGLONG ullDeadline,
+    OUT DWORD& cbTransferred,
+    OVERLAPPED& stOverlapped)
+{
+    if (!fResult)
+    {
+        DWORD dwError = ::GetLastError();
+        if (dwError != ERROR_IO_PENDING)
+        {
+            return HRESULT_FROM_WIN32(dwError);
+        }
+
+        DWORD dwWait = INFINITE;
+        if (dwMilliseconds != INFINITE)
+        {
+            // Past the deadline, still takes an I/O that has already completed.
+            ULONGLONG ullNow = ::GetTickCount64();
+            dwWait = (ullNow < ullDeadline) ? (DWORD)(ullDeadline - ullNow) : 0;
+        }
+
+        DWORD dwRes = ::WaitForSingleObject(stOverlapped.hEvent, dwWait);
+        if (dwRes != WAIT_OBJECT_0)
+        {
+            HRESULT hr = (dwRes == WAIT_TIMEOUT) ?
+                HRESULT_FROM_WIN32(ERROR_TIMEOUT) :
+                HRESULT_FROM_WIN32(::GetLastError());
+            ::CancelIoEx(m_hServer, &stOverlapped);
+
+            // Wait for the cancellation so the OVERLAPPED on the stack is not used after return.
+            ::GetOverlappedResult(m_hServer, &stOverlapped, &cbTransferred, TRUE);
+            return hr;
+        }
+    }
+
+    if (!::GetOverlappedResult(m_hServer, &stOverlapped, &cbTransferred, FALSE))
+    {
+        return HRESULT_FROM_WIN32(::GetLastError());
+    }
+
+    return S_OK;
+}
@@ -0,0 +1,161 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        Pipe.h
+
+    Abstract:
+
+        CPipe class declaration.
+
+--*/
+
+/*++
+
+    Abstract:
+
+        One-way pipe between the exit module and a child process.
+
+    Remarks:
+
+        The exit module keeps the server end, which is opened for overlapped I/O so reads
+        and writes can time out. The client end is inheritable and gets passed to the
+        child as a standard handle. Close the client end after the child is created so
+        the server end sees a broken pipe when the child exits.
+
+        Only SYSTEM and the user the module runs as can open the pipe, and creating it
+        fails if the name is already taken, so another process can't stand in for either end.
+--*/
+class CPipe
+{
+public:
+    CPipe();
+    ~CPipe();
+
+    /*++
+
+        Abstract:
+
+            Creates both ends of the pipe.
+
+        Parameters:
+
+            fOutbound - true if the exit module writes and the child reads.
+                        false if the child writes and the exit module reads.
+
+        Returns:
+
+            S_OK - success.
+            other - error code.
+    --*/
+    HRESULT Create(
+        bool fOutbound);
+
+    /*++
+
+        Abstract:
+
+            Gets the inheritable handle for the child process.
+
+    --*/
+    inline HANDLE GetClientHandle() const
+    {
+        return m_hClient;
+    }
+
+    /*++
+
+        Abstract:
+
+            Closes this process's copy of the client handle.
+
+    --*/
+    void CloseClient();
+
+    /*++
+
+        Abstract:
+
+            Closes both ends of the pipe.
+
+    --*/
+    void Close();
+
+    /*++
+
+        Abstract:
+
+            Writes all the bytes to the pipe.
+
+        Parameters:
+
+            pbData - bytes to write.
+            cbData - number of bytes to write.
+            dwMilliseconds - time to wait for the child to read all of the data, or INFINITE.
+
+        Returns:
+
+            S_OK - all bytes were written.
+            HRESULT_FROM_WIN32(ERROR_TIMEOUT) - the write timed out.
+            HRESULT_FROM_WIN32(ERROR_BROKEN_PIPE) - the child closed its end.
+            other - error code.
+    --*/
+    HRESULT Write(
+        const BYTE* pbData,
+        size_t cbData,
+        DWORD dwMilliseconds);
+
+    /*++
+
+        Abstract:
+
+            Reads exactly the requested number of bytes from the pipe.
+
+        Parameters:
+
+            pbData - receives the bytes.
+            cbData - number of bytes to read.
+            dwMilliseconds - time to wait for the child to write all of the data, or INFINITE.
+
+        Returns:
+
+            S_OK - all bytes were read.
+            HRESULT_FROM_WIN32(ERROR_TIMEOUT) - the read timed out.
+            HRESULT_FROM_WIN32(ERROR_BROKEN_PIPE) - the child closed its end.
+            other - error code.
+    --*/
+    HRESULT Read(
+        BYTE* pbData,
+        size_t cbData,
+        DWORD dwMilliseconds);
+
+private:
+    HANDLE m_hServer;
+    HANDLE m_hClient;
+    HANDLE m_hEvent;
+
+    /*++
+
+        Abstract:
+
+            Waits for an overlapped ReadFile() or WriteFile() until the deadline.
+
+        Parameters:
+
+            dwMilliseconds - the timeout passed to Read() or Write(). INFINITE ignores ullDeadline.
+            ullDeadline - GetTickCount64() when that timeout runs out.
+
+    --*/
+    HRESULT CompleteIo(
+        BOOL fResult,
+        DWORD dwMilliseconds,
+        ULONGLONG ullDeadline,
+        OUT DWORD& cbTransferred,
+        OVERLAPPED& stOverlapped);
+
+    CPipe(const CPipe&) = delete;
+    CPipe& operator=(const CPipe&) = delete;
+};
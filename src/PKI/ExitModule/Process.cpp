@@ -19,11 +19,13 @@
 
 --*/
 #include "pch.h"
+#include "CommandLineTemplate.h"
+#include "StageTimer.h"
 #include "Process.h"
 
-constexpr const size_t g_cchMaxCommandLine = 32768;
-
 CProcess::CProcess()
+    : m_hJob(NULL),
+    m_ullStartTicks(0)
 {
     ZeroMemory(&m_stProcInfo, sizeof(m_stProcInfo));
     m_stProcInfo.hProcess = INVALID_HANDLE_VALUE;
@@ -41,17 +43,31 @@ CProcess::~CProcess()
     {
         ::CloseHandle(m_stProcInfo.hThread);
     }
+
+    if (m_hJob)
+    {
+        ::CloseHandle(m_hJob);
+    }
 }
 
 HRESULT CProcess::Create(
     LPCWSTR pwszApplicationName,
-    const CBuffer<LPCWSTR>& bufArguments,
-    DWORD dwCreationFlags)
+    const CCommandLineTemplate& objTemplate,
+    const CommandLineValues& stValues,
+    DWORD dwCreationFlags,
+    HANDLE hStdInput /* = INVALID_HANDLE_VALUE */,
+    HANDLE hStdOutput /* = INVALID_HANDLE_VALUE */)
 {
+    PMI_STAGE_TIMER(PerfStageProcessCreate);
     HRESULT hr = S_OK;
-    STARTUPINFOW stStartupInfo;
+    STARTUPINFOEXW stStartupInfo;
     ZeroMemory(&stStartupInfo, sizeof(stStartupInfo));
-    stStartupInfo.cb = sizeof(PROCESS_INFORMATION);
+    stStartupInfo.StartupInfo.cb = sizeof(STARTUPINFOW);
+
+    HANDLE rghInherit[2];
+    DWORD cInherit = 0;
+    CHeapBuffer<BYTE> bufAttributeList;
+    BOOL fInheritHandles = FALSE;
 
     if (m_stProcInfo.hProcess != INVALID_HANDLE_VALUE)
     {
@@ -59,20 +75,62 @@ HRESULT CProcess::Create(
         return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
     }
 
-    if (!m_bufCmdLine.Alloc(g_cchMaxCommandLine))
+    hr = objTemplate.Format(stValues, OUT m_bufCmdLine);
+    if (FAILED(hr))
     {
-        ATLTRACE(L"Failed to alloc buffer for command line.\n");
-        return E_OUTOFMEMORY;
+        ATLTRACE(L"CCommandLineTemplate::Format failed, hr=%x\n", hr);
+        return hr;
     }
 
-    hr = FormatCommandLine(
-        pwszApplicationName,
-        bufArguments,
-        OUT m_bufCmdLine);
-    if (FAILED(hr))
+    if (hStdInput != INVALID_HANDLE_VALUE || hStdOutput != INVALID_HANDLE_VALUE)
     {
-        ATLTRACE("CProcess::FormatCommandLine failed, hr=%x\n", hr);
-        return hr;
+        stStartupInfo.StartupInfo.dwFlags |= STARTF_USESTDHANDLES;
+        stStartupInfo.StartupInfo.hStdInput = hStdInput;
+        stStartupInfo.StartupInfo.hStdOutput = hStdOutput;
+        if (hStdInput != INVALID_HANDLE_VALUE)
+        {
+            rghInherit[cInherit++] = hStdInput;
+        }
+
+        if (hStdOutput != INVALID_HANDLE_VALUE)
+        {
+            rghInherit[cInherit++] = hStdOutput;
+        }
+
+        // Limit inheritance to the pipe handles. Other inheritable handles in CertSvc stay private.
+        SIZE_T cbAttributeList = 0;
+        ::InitializeProcThreadAttributeList(nullptr, 1, 0, &cbAttributeList);
+        if (!bufAttributeList.Alloc(cbAttributeList))
+        {
+            ATLTRACE(L"Failed to alloc attribute list.\n");
+            return E_OUTOFMEMORY;
+        }
+
+        stStartupInfo.lpAttributeList = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(bufAttributeList.Get());
+        if (!::InitializeProcThreadAttributeList(stStartupInfo.lpAttributeList, 1, 0, &cbAttributeList))
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"InitializeProcThreadAttributeList failed, hr=%x\n", hr);
+            return hr;
+        }
+
+        if (!::UpdateProcThreadAttribute(
+            stStartupInfo.lpAttributeList,
+            0, // dwFlags
+            PROC_THREAD_ATTRIBUTE_HANDLE_LIST,
+            rghInherit,
+            cInherit * sizeof(HANDLE),
+            nullptr, // lpPreviousValue
+            nullptr)) // lpReturnSize
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"UpdateProcThreadAttribute failed, hr=%x\n", hr);
+            ::DeleteProcThreadAttributeList(stStartupInfo.lpAttributeList);
+            return hr;
+        }
+
+        dwCreationFlags |= EXTENDED_STARTUPINFO_PRESENT;
+        fInheritHandles = TRUE;
     }
 
     ATLTRACE(
@@ -84,22 +142,72 @@ HRESULT CProcess::Create(
         m_bufCmdLine.Get(), // lpCommandLine
         NULL, // lpProcessAttributes
         NULL, // lpThreadAttributes
-        FALSE, // bInheritHandles
-        dwCreationFlags, // dwCreationFlags
+        fInheritHandles, // bInheritHandles
+        dwCreationFlags | CREATE_SUSPENDED, // dwCreationFlags
         NULL, // lpEnvironment
         NULL, // lpCurrentDirectory
-        &stStartupInfo, // lpStartupInfo
+        &stStartupInfo.StartupInfo, // lpStartupInfo
         &m_stProcInfo)) // lpProcessInformation
     {
         hr = HRESULT_FROM_WIN32(::GetLastError());
         ATLTRACE(L"CreateProcessW failed, hr=%x\n", hr);
+        m_stProcInfo.hProcess = INVALID_HANDLE_VALUE;
+        m_stProcInfo.hThread = INVALID_HANDLE_VALUE;
+        CPerfCounters::Get().Add(PerfCounterHandlerSpawnFailures);
+    }
+    else
+    {
+        m_ullStartTicks = ::GetTickCount64();
+        CPerfCounters::Get().Add(PerfCounterHandlerSpawns);
+        ATLTRACE(
+            L"Process created. ProcessID=%d, ThreadID=%d\n",
+            m_stProcInfo.dwProcessId,
+            m_stProcInfo.dwThreadId);
+
+        // Started suspended so the job is assigned before the process can start children.
+        HRESULT hrJob = AssignJob();
+        if (FAILED(hrJob))
+        {
+            ATLTRACE(L"AssignJob failed, hr=%x. Only the process can be terminated.\n", hrJob);
+        }
+
+        if (::ResumeThread(m_stProcInfo.hThread) == (DWORD)-1)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"ResumeThread failed, hr=%x\n", hr);
+            Terminate((UINT)hr);
+        }
+    }
+
+    if (stStartupInfo.lpAttributeList)
+    {
+        ::DeleteProcThreadAttributeList(stStartupInfo.lpAttributeList);
+    }
+
+    return hr;
+}
+
+HRESULT CProcess::AssignJob()
+{
+    HRESULT hr = S_OK;
+
+    m_hJob = ::CreateJobObjectW(
+        nullptr, // lpJobAttributes
+        nullptr); // lpName
+    if (!m_hJob)
+    {
+        hr = HRESULT_FROM_WIN32(::GetLastError());
+        ATLTRACE(L"CreateJobObjectW failed, hr=%x\n", hr);
         return hr;
     }
 
-    ATLTRACE(
-        L"Process created. ProcessID=%d, ThreadID=%d\n",
-        m_stProcInfo.dwProcessId, 
-        m_stProcInfo.dwThreadId);
+    if (!::AssignProcessToJobObject(m_hJob, m_stProcInfo.hProcess))
+    {
+        hr = HRESULT_FROM_WIN32(::GetLastError());
+        ATLTRACE(L"AssignProcessToJobObject failed, hr=%x\n", hr);
+        ::CloseHandle(m_hJob);
+        m_hJob = NULL;
+    }
 
     return hr;
 }
@@ -107,6 +215,7 @@ HRESULT CProcess::Create(
 HRESULT CProcess::Wait(
     DWORD dwMilliseconds)
 {
+    PMI_STAGE_TIMER(PerfStageProcessWait);
     DWORD dwRes = ::WaitForSingleObject(
         m_stProcInfo.hProcess,
         dwMilliseconds);
@@ -136,124 +245,23 @@ HRESULT CProcess::GetExitCode(
     return S_OK;
 }
 
-HRESULT CProcess::FormatCommandLine(
-    LPCWSTR pwszApplicationName,
-    const CBuffer<LPCWSTR>& bufArgs,
-    OUT CBuffer<WCHAR>& bufResult)
+HRESULT CProcess::Terminate(
+    UINT uExitCode)
 {
-    HRESULT hr = S_OK;
-    LPWSTR pwszCurrent = bufResult.Get();
-    size_t cchMax = bufResult.GetLength();
-
-    hr = WriteArgument(
-        pwszCurrent,
-        cchMax,
-        pwszApplicationName);
-    if (FAILED(hr))
+    if (m_hJob)
     {
-        return hr;
-    }
-
-    // NOTE: Not using StringCchCat* because it repeats evaluation of string lengths.
-    for (const LPCWSTR* p = bufArgs.Get();
-        p != bufArgs.Get() + bufArgs.GetLength();
-        p++)
-    {
-        LPCWSTR pwszArg = *p;
-
-        // Add argument separator.
-        hr = ::StringCchCopyExW(
-            pwszCurrent,
-            cchMax,
-            L" ",
-            &pwszCurrent,
-            &cchMax,
-            STRSAFE_IGNORE_NULLS);
-        if (FAILED(hr))
+        if (!::TerminateJobObject(m_hJob, uExitCode))
         {
-            break;
+            return HRESULT_FROM_WIN32(::GetLastError());
         }
 
-        hr = WriteArgument(pwszCurrent, cchMax, pwszArg);
-        if (FAILED(hr))
-        {
-            break;
-        }
+        return S_OK;
     }
 
-    return S_OK;
-}
-
-bool CProcess::HasWhiteSpace(LPCWSTR pwsz)
-{
-    for (const WCHAR* p = pwsz;
-        *p;
-        p++)
+    if (!::TerminateProcess(m_stProcInfo.hProcess, uExitCode))
     {
-        if (*p == L' ')
-        {
-            return true;
-        }
+        return HRESULT_FROM_WIN32(::GetLastError());
     }
 
-    return false;
+    return S_OK;
 }
-
-HRESULT CProcess::WriteArgument(
-    LPWSTR& pwszCurrent,
-    size_t& cchMax,
-    LPCWSTR pwszArg)
-{
-    // NOTE: This isn't full feastured argument escaping. 
-    // It handles the current use case of embedded spaces.
-    // It does not handle embedded quotes.
-    bool fEscape = HasWhiteSpace(pwszArg);
-    HRESULT hr = S_OK;
-
-    do
-    {
-        if (fEscape)
-        {
-            hr = ::StringCchCopyExW(
-                pwszCurrent,
-                cchMax,
-                L"\"",
-                &pwszCurrent,
-                &cchMax,
-                STRSAFE_IGNORE_NULLS);
-            if (FAILED(hr))
-            {
-                break;
-            }
-        }
-
-        hr = ::StringCchCopyExW(
-            pwszCurrent,
-            cchMax,
-            pwszArg,
-            &pwszCurrent,
-            &cchMax,
-            STRSAFE_IGNORE_NULLS);
-        if (FAILED(hr))
-        {
-            break;
-        }
-
-        if (fEscape)
-        {
-            hr = ::StringCchCopyExW(
-                pwszCurrent,
-                cchMax,
-                L"\"",
-                &pwszCurrent,
-                &cchMax,
-                STRSAFE_IGNORE_NULLS);
-            if (FAILED(hr))
-            {
-                break;
-            }
-        }
-    } while (false);
-
-    return hr;
-}
\ No newline at end of file
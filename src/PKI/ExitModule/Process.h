@@ -20,11 +20,20 @@
 
 --*/
 
+class CCommandLineTemplate;
+struct CommandLineValues;
+
 /*++
 
     Abstract:
 
         Win32 Process wrapper.
+
+    Remarks:
+
+        The process is started in its own job object, so Terminate() also ends any
+        processes it started. The job does not kill them when it is closed, so children
+        of a process that exited normally keep running.
 --*/
 class CProcess
 {
@@ -62,6 +71,21 @@ public:
         return m_stProcInfo.dwThreadId;
     }
 
+    /*++
+
+        Abstract:
+
+            Gets the process handle, for waiting on the process.
+
+        Returns:
+
+            the process handle, or INVALID_HANDLE_VALUE if the process was not created.
+    --*/
+    inline HANDLE GetProcessHandle() const
+    {
+        return m_stProcInfo.hProcess;
+    }
+
     /*++
     
         Abstract:
@@ -70,12 +94,25 @@ public:
 
         Returns:
 
-            The formatted command line after a call to Create.
+            The formatted command line after a call to Create, or an empty string if it
+            was not formatted.
 
     --*/
     inline LPCWSTR GetCommandLine() const
     {
-        return m_bufCmdLine.Get();
+        return m_bufCmdLine.Get() ? m_bufCmdLine.Get() : L"";
+    }
+
+    /*++
+
+        Abstract:
+
+            Gets the GetTickCount64() value when the process was created, or 0 if it was not.
+
+    --*/
+    inline ULONGLONG GetStartTicks() const
+    {
+        return m_ullStartTicks;
     }
 
     /*++
@@ -86,19 +123,31 @@ public:
 
         Parameters:
 
-            pwszApplicationName - path to exe.
-            bufArguments - array of args.
+            pwszApplicationName - path to exe, for tracing.
+            objTemplate - the compiled command line.
+            stValues - values for the placeholders in the command line.
             dwCreationFlags - flags to pass to CreateProcessW.
+            hStdInput - optional inheritable handle for the child's stdin.
+            hStdOutput - optional inheritable handle for the child's stdout.
 
         Returns:
 
             S_OK - success.
             other - error code.
+
+        Remarks:
+
+            Only the standard handles passed in are inherited by the child. If the job
+            object cannot be created, the process still runs but Terminate() only ends it
+            and not its children.
     --*/
     HRESULT Create(
         LPCWSTR pwszApplicationName,
-        const CBuffer<LPCWSTR>& bufArguments,
-        DWORD dwCreationFlags);
+        const CCommandLineTemplate& objTemplate,
+        const CommandLineValues& stValues,
+        DWORD dwCreationFlags,
+        HANDLE hStdInput = INVALID_HANDLE_VALUE,
+        HANDLE hStdOutput = INVALID_HANDLE_VALUE);
 
     /*++
     
@@ -138,20 +187,31 @@ public:
     HRESULT GetExitCode(
         OUT DWORD& dwExitCode);
 
+    /*++
+
+        Abstract:
+
+            Terminates the process and any processes it started.
+
+        Parameters:
+
+            uExitCode - the exit code for the process.
+
+        Returns:
+
+            S_OK - success.
+            Other - error code.
+    --*/
+    HRESULT Terminate(
+        UINT uExitCode);
+
 private:
     PROCESS_INFORMATION m_stProcInfo;
     CHeapBuffer<WCHAR> m_bufCmdLine;
+    HANDLE m_hJob;
+    ULONGLONG m_ullStartTicks;
 
-    static HRESULT FormatCommandLine(
-        LPCWSTR pwszApplicationName,
-        const CBuffer<LPCWSTR>& args,
-        OUT CBuffer<WCHAR>& bufResult);
-
-    static bool HasWhiteSpace(LPCWSTR pwsz);
-    static HRESULT WriteArgument(
-        LPWSTR& pwszCurrent,
-        size_t& cchMax,
-        LPCWSTR pwszArg);
+    HRESULT AssignJob();
 
     CProcess(const CProcess&) = delete;
     CProcess& operator=(const CProcess&) = delete;
@@ -0,0 +1,240 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        ProcessReaper.cpp
+
+    Abstract:
+
+        CProcessReaper class impl.
+
+--*/
+
+#include "pch.h"
+#include "Process.h"
+#include "ProcessReaper.h"
+
+// One thread runs the callbacks. The waits themselves are multiplexed by the thread pool.
+constexpr const DWORD g_cWaiterThreads = 1;
+
+// How often a terminated process that has not exited yet is traced.
+constexpr const DWORD g_dwTerminateWaitMSecs = 5000;
+
+namespace
+{
+    inline void SetWaitTimeout(
+        PTP_WAIT pWait,
+        HANDLE hProcess,
+        DWORD dwTimeoutMSecs)
+    {
+        // A negative due time is relative, in 100ns units.
+        ULARGE_INTEGER uliDueTime;
+        uliDueTime.QuadPart = (ULONGLONG)(-((LONGLONG)dwTimeoutMSecs * 10000));
+        FILETIME ftDueTime;
+        ftDueTime.dwLowDateTime = uliDueTime.LowPart;
+        ftDueTime.dwHighDateTime = uliDueTime.HighPart;
+
+        ::SetThreadpoolWait(pWait, hProcess, &ftDueTime);
+    }
+}
+
+CProcessReaper::CProcessReaper()
+    : m_pPool(nullptr),
+    m_hSlots(NULL),
+    m_cSlots(0),
+    m_cReaped(0),
+    m_cKilled(0)
+{
+    ::InitializeThreadpoolEnvironment(&m_stEnviron);
+}
+
+CProcessReaper::~CProcessReaper()
+{
+    Stop();
+    ::DestroyThreadpoolEnvironment(&m_stEnviron);
+}
+
+HRESULT CProcessReaper::Start(
+    size_t cMaxProcesses)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        if (m_pPool)
+        {
+            ATLTRACE(L"The reaper has been previously started.\n");
+            return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+        }
+
+        if (cMaxProcesses == 0 || cMaxProcesses > MAXLONG)
+        {
+            return E_INVALIDARG;
+        }
+
+        m_hSlots = ::CreateSemaphoreW(
+            nullptr, // lpSemaphoreAttributes
+            (LONG)cMaxProcesses, // lInitialCount
+            (LONG)cMaxProcesses, // lMaximumCount
+            nullptr); // lpName
+        if (!m_hSlots)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateSemaphoreW failed, hr=%x\n", hr);
+            break;
+        }
+
+        m_cSlots = cMaxProcesses;
+
+        m_pPool = ::CreateThreadpool(nullptr);
+        if (!m_pPool)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"CreateThreadpool failed, hr=%x\n", hr);
+            break;
+        }
+
+        ::SetThreadpoolThreadMaximum(m_pPool, g_cWaiterThreads);
+        if (!::SetThreadpoolThreadMinimum(m_pPool, g_cWaiterThreads))
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ATLTRACE(L"SetThreadpoolThreadMinimum failed, hr=%x\n", hr);
+            break;
+        }
+
+        ::SetThreadpoolCallbackPool(&m_stEnviron, m_pPool);
+
+        // Keeps the DLL loaded until the last callback returns.
+        ::SetThreadpoolCallbackLibrary(&m_stEnviron, _AtlBaseModule.GetModuleInstance());
+    } while (false);
+
+    if (FAILED(hr))
+    {
+        Stop();
+    }
+
+    return hr;
+}
+
+void CProcessReaper::Stop()
+{
+    if (m_hSlots)
+    {
+        // Every slot comes back once its process is reaped.
+        for (size_t i = 0; m_pPool && i < m_cSlots; i++)
+        {
+            ::WaitForSingleObject(m_hSlots, INFINITE);
+        }
+
+        ::CloseHandle(m_hSlots);
+        m_hSlots = NULL;
+        m_cSlots = 0;
+    }
+
+    if (m_pPool)
+    {
+        ::CloseThreadpool(m_pPool);
+        m_pPool = nullptr;
+
+        ATLTRACE(L"Reaper stopped. Reaped=%d, killed=%d\n", m_cReaped, m_cKilled);
+    }
+}
+
+bool CProcessReaper::AcquireSlot()
+{
+    if (!m_pPool)
+    {
+        return false;
+    }
+
+    return ::WaitForSingleObject(m_hSlots, INFINITE) == WAIT_OBJECT_0;
+}
+
+void CProcessReaper::ReleaseSlot()
+{
+    ::ReleaseSemaphore(m_hSlots, 1, nullptr);
+}
+
+HRESULT CProcessReaper::Track(
+    CProcess& objProcess,
+    DWORD dwTimeoutMSecs,
+    PFN_PROCESS_REAPED pfnReaped,
+    PVOID pvContext)
+{
+    if (!m_pPool)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_OPERATION);
+    }
+
+    Tracked* pTracked = new Tracked();
+    if (!pTracked)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    pTracked->pThis = this;
+    pTracked->pProcess = &objProcess;
+    pTracked->pfnReaped = pfnReaped;
+    pTracked->pvContext = pvContext;
+    pTracked->fTerminated = false;
+
+    PTP_WAIT pWait = ::CreateThreadpoolWait(WaitCallback, pTracked, &m_stEnviron);
+    if (!pWait)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(::GetLastError());
+        ATLTRACE(L"CreateThreadpoolWait failed, hr=%x\n", hr);
+        delete pTracked;
+        return hr;
+    }
+
+    SetWaitTimeout(pWait, objProcess.GetProcessHandle(), dwTimeoutMSecs);
+    return S_OK;
+}
+
+VOID CALLBACK CProcessReaper::WaitCallback(
+    PTP_CALLBACK_INSTANCE pInstance,
+    PVOID pvContext,
+    PTP_WAIT pWait,
+    TP_WAIT_RESULT dwWaitResult)
+{
+    UNREFERENCED_PARAMETER(pInstance);
+
+    Tracked* pTracked = static_cast<Tracked*>(pvContext);
+    CProcessReaper* pThis = pTracked->pThis;
+
+    if (dwWaitResult == WAIT_TIMEOUT)
+    {
+        if (!pTracked->fTerminated)
+        {
+            pTracked->fTerminated = true;
+            ::InterlockedIncrement(&pThis->m_cKilled);
+
+            HRESULT hr = pTracked->pProcess->Terminate(ERROR_TIMEOUT);
+            if (FAILED(hr))
+            {
+                // Expected if the process exited just as the wait timed out.
+                ATLTRACE(L"CProcess::Terminate failed, hr=%x\n", hr);
+            }
+        }
+        else
+        {
+            ATLTRACE(L"Terminated process %d has not exited yet.\n", pTracked->pProcess->GetProcessID());
+        }
+
+        // Termination is asynchronous. pfnReaped cleans up the files the process may still
+        // have open, so it waits until the process is gone.
+        SetWaitTimeout(pWait, pTracked->pProcess->GetProcessHandle(), g_dwTerminateWaitMSecs);
+        return;
+    }
+
+    HRESULT hrExit = pTracked->fTerminated ? HRESULT_FROM_WIN32(ERROR_TIMEOUT) : S_OK;
+    pTracked->pfnReaped(hrExit, pTracked->pvContext);
+    ::InterlockedIncrement(&pThis->m_cReaped);
+
+    // Freed after this callback returns.
+    ::CloseThreadpoolWait(pWait);
+    delete pTracked;
+    pThis->ReleaseSlot();
+}
@@ -0,0 +1,170 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        ProcessReaper.h
+
+    Abstract:
+
+        CProcessReaper class declaration.
+
+--*/
+
+class CProcess;
+
+/*++
+
+    Abstract:
+
+        Waits for handler processes to exit without blocking a thread for each one.
+
+    Remarks:
+
+        Each tracked process gets a thread pool wait on its process handle. The waits run
+        on a private pool with a single thread, so any number of processes are reaped by
+        one waiter. A process that is still running when its timeout expires is terminated
+        with its job, which also ends the processes it started. Termination is asynchronous,
+        so the wait is set again and the callback runs only once the process has exited.
+
+        The reaper also limits the number of tracked processes. A caller takes a slot
+        before it starts a process, and the slot is released when the process is reaped.
+--*/
+class CProcessReaper
+{
+public:
+    /*++
+
+        Abstract:
+
+            Called on the waiter thread after a tracked process exited or was terminated.
+
+        Parameters:
+
+            hrExit - S_OK if the process exited, or HRESULT_FROM_WIN32(ERROR_TIMEOUT) if it
+                was terminated.
+            pvContext - the context passed to Track().
+
+    --*/
+    typedef void (*PFN_PROCESS_REAPED)(
+        HRESULT hrExit,
+        PVOID pvContext);
+
+    CProcessReaper();
+    ~CProcessReaper();
+
+    /*++
+
+        Abstract:
+
+            Starts the waiter.
+
+        Parameters:
+
+            cMaxProcesses - the number of processes that can be tracked at once.
+
+        Returns:
+
+            S_OK - success.
+            other - error code.
+    --*/
+    HRESULT Start(
+        size_t cMaxProcesses);
+
+    /*++
+
+        Abstract:
+
+            Waits for the tracked processes to be reaped and stops the waiter.
+
+        Remarks:
+
+            Each process is terminated at its timeout, so this does not wait longer than the
+            longest timeout. Safe to call more than once.
+    --*/
+    void Stop();
+
+    /*++
+
+        Abstract:
+
+            Waits for a free slot.
+
+        Returns:
+
+            true - the caller has a slot. Pass it to Track(), or call ReleaseSlot().
+            false - the reaper is not running.
+    --*/
+    bool AcquireSlot();
+
+    /*++
+
+        Abstract:
+
+            Releases a slot that was not passed to Track().
+
+    --*/
+    void ReleaseSlot();
+
+    /*++
+
+        Abstract:
+
+            Reaps a process on the waiter thread.
+
+        Parameters:
+
+            objProcess - the process. Must stay valid until pfnReaped is called.
+            dwTimeoutMSecs - the time the process has left before it is terminated.
+            pfnReaped - called once after the process exits or is terminated.
+            pvContext - passed to pfnReaped.
+
+        Returns:
+
+            S_OK - the reaper owns the caller's slot and calls pfnReaped.
+            other - error code. The caller still owns its slot, and pfnReaped is not called.
+    --*/
+    HRESULT Track(
+        CProcess& objProcess,
+        DWORD dwTimeoutMSecs,
+        PFN_PROCESS_REAPED pfnReaped,
+        PVOID pvContext);
+
+    inline LONG GetReapedCount() const
+    {
+        return m_cReaped;
+    }
+
+    inline LONG GetKilledCount() const
+    {
+        return m_cKilled;
+    }
+
+private:
+    struct Tracked
+    {
+        CProcessReaper* pThis;
+        CProcess* pProcess;
+        PFN_PROCESS_REAPED pfnReaped;
+        PVOID pvContext;
+        bool fTerminated;
+    };
+
+    PTP_POOL m_pPool;
+    TP_CALLBACK_ENVIRON m_stEnviron;
+    HANDLE m_hSlots;
+    size_t m_cSlots;
+    volatile LONG m_cReaped;
+    volatile LONG m_cKilled;
+
+    static VOID CALLBACK WaitCallback(
+        PTP_CALLBACK_INSTANCE pInstance,
+        PVOID pvContext,
+        PTP_WAIT pWait,
+        TP_WAIT_RESULT dwWaitResult);
+
+    CProcessReaper(const CProcessReaper&) = delete;
+    CProcessReaper& operator=(const CProcessReaper&) = delete;
+};
@@ -0,0 +1,36 @@
+/*++
+
+	Copyright (C) Microsoft Corp. All rights reserved.
+
+	Abstract:
+
+		Definition of properties used by CPMIExitModule.
+
+--*/
+
+#include "pch.h"
+#include "StageLatencyManageProperty.h"
+
+/*++
+	Gets the value of the property.
+
+	Parameters:
+		rvarResult - reference to the variant to receive the value.
+
+	Returns:
+		S_OK - success
+		Other - error code.
+--*/
+HRESULT CStageLatencyManageProperty::GetValue(VARIANT& rvarResult) const
+{
+	DWORD dwUSecs = 0;
+	HRESULT hr = CPerfCounters::Get().GetStageLatencyPermille(m_eStage, m_dwPermille, OUT dwUSecs);
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	rvarResult.lVal = (LONG)min(dwUSecs, (DWORD)MAXLONG);
+	rvarResult.vt = VT_I4;
+	return S_OK;
+}
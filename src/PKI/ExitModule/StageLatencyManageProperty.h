@@ -0,0 +1,55 @@
+#pragma once
+/*++
+
+	Copyright (C) Microsoft Corp. All rights reserved.
+
+	Abstract:
+
+		Definition of properties used by CPMIExitModule.
+
+--*/
+#include "ManageProperty.h"
+#include "PerfCounters.h"
+
+/*++
+
+	Abstract:
+
+		A percentile of the latency of a stage from CPerfCounters, in microseconds as VT_I4.
+--*/
+class CStageLatencyManageProperty :
+	public CManageProperty
+{
+public:
+	/*++
+		Abstract:
+
+			Initializes a new instance of the CStageLatencyManageProperty class.
+
+		Parameters:
+			pwszName - static string for the property name.
+			eStage - the stage.
+			dwPermille - the percentile in tenths, 1 to 1000.
+
+	--*/
+	CStageLatencyManageProperty(LPCWSTR pwszName, PerfStage eStage, DWORD dwPermille)
+		: CManageProperty(pwszName), m_eStage(eStage), m_dwPermille(dwPermille)
+	{
+	}
+
+	/*++
+		Gets the value of the property.
+
+		Parameters:
+			rvarResult - reference to the variant to receive the value.
+
+		Returns:
+			S_OK - success
+			Other - error code.
+	--*/
+	virtual HRESULT GetValue(VARIANT& rvarResult) const;
+
+private:
+	PerfStage m_eStage;
+	DWORD m_dwPermille;
+};
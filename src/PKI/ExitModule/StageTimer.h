@@ -0,0 +1,66 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        StageTimer.h
+
+    Abstract:
+
+        CStageTimer class declaration and the PMI_STAGE_TIMER macro.
+
+--*/
+
+#include "PerfCounters.h"
+
+// Build with /DPMI_STAGE_TIMERS=0 to compile the stage timers out. The histograms in the
+// counter section stay, and stay empty.
+#ifndef PMI_STAGE_TIMERS
+#define PMI_STAGE_TIMERS 1
+#endif
+
+/*++
+
+    Abstract:
+
+        Counts the time from its construction to the end of its scope in the histogram of
+        a stage.
+
+    Remarks:
+
+        Costs two QueryPerformanceCounter() calls and two interlocked adds on the shard of
+        the processor. Use PMI_STAGE_TIMER() rather than declaring one, so the timer goes
+        away when PMI_STAGE_TIMERS is 0.
+--*/
+class CStageTimer
+{
+public:
+    inline explicit CStageTimer(
+        PerfStage eStage)
+        : m_eStage(eStage)
+    {
+        ::QueryPerformanceCounter(&m_liStart);
+    }
+
+    inline ~CStageTimer()
+    {
+        LARGE_INTEGER liEnd;
+        ::QueryPerformanceCounter(&liEnd);
+        CPerfCounters::Get().RecordStageLatency(m_eStage, liEnd.QuadPart - m_liStart.QuadPart);
+    }
+
+private:
+    PerfStage m_eStage;
+    LARGE_INTEGER m_liStart;
+
+    CStageTimer(const CStageTimer&) = delete;
+    CStageTimer& operator=(const CStageTimer&) = delete;
+};
+
+#if PMI_STAGE_TIMERS
+#define PMI_STAGE_TIMER(eStage) CStageTimer objStageTimer(eStage)
+#else
+#define PMI_STAGE_TIMER(eStage)
+#endif
@@ -19,6 +19,7 @@
 
 --*/
 #include "pch.h"
+#include "StageTimer.h"
 #include "TempFile.h"
 
 CTempFile::~CTempFile()
@@ -46,6 +47,7 @@ CTempFile::~CTempFile()
 
 HRESULT CTempFile::Create(LPCWSTR pwszPath)
 {
+    PMI_STAGE_TIMER(PerfStageTempFileCreate);
     if (m_strPath.GetLength() > 0)
     {
         ATLTRACE(L"The temp file has been previously initialized.\n");
@@ -108,6 +110,11 @@ void CTempFile::Close()
 
 void CTempFile::Preserve()
 {
+    if (!m_fPreserve && m_strPath.GetLength() > 0)
+    {
+        CPerfCounters::Get().Add(PerfCounterTempFilesPreserved);
+    }
+
     m_fPreserve = true;
 }
 
@@ -117,6 +124,7 @@ HRESULT CTempFile::Write(
     size_t cbCount,
     OUT size_t& cbWritten)
 {
+    PMI_STAGE_TIMER(PerfStageTempFileWrite);
     if (m_hFile == INVALID_HANDLE_VALUE)
     {
         ATLTRACE(L"File not open.");
@@ -137,6 +145,7 @@ HRESULT CTempFile::Write(
     }
 
     cbWritten = nBytesWritten;
+    CPerfCounters::Get().Add(PerfCounterBytesWritten, nBytesWritten);
 
     return S_OK;
 }
\ No newline at end of file
@@ -0,0 +1,98 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        TraceFormat.h
+
+    Abstract:
+
+        File format of the exit event traces written by CEventTrace.
+
+    Remarks:
+
+        This header is shared with the replay tool. It only depends on Windows types.
+
+        A trace is an EventTraceFileHeader followed by records, each one an
+        EventTraceRecordHeader and its data, padded with zeros to EVENT_TRACE_RECORD_ALIGNMENT.
+        All integers are little endian. Records are only appended, so a reader can map the
+        file a window at a time and stream through it, even while it is being written.
+
+        Record data, in order:
+            cchSubjectKeyIdentifier WCHARs of the subject key identifier.
+            cchSerialNumber WCHARs of the serial number.
+            cchRequesterName WCHARs of the requester name.
+            cbRawCert bytes of the raw DER certificate.
+        Strings have no null terminator. Only EXITEVENT_CERTISSUED records have data.
+
+        A reader stops at the first record with the wrong magic, or that runs past the end of
+        the file. That is where the writer stopped, if CertSvc did not shut down cleanly.
+--*/
+
+#define EVENT_TRACE_FILE_MAGIC 0x46544D50 // 'PMTF'
+#define EVENT_TRACE_RECORD_MAGIC 0x52544D50 // 'PMTR'
+#define EVENT_TRACE_VERSION 1
+#define EVENT_TRACE_RECORD_ALIGNMENT 8
+
+/*++
+
+    Abstract:
+
+        Fixed header at the start of a trace file.
+
+--*/
+struct EventTraceFileHeader
+{
+    // EVENT_TRACE_FILE_MAGIC.
+    DWORD dwMagic;
+
+    // EVENT_TRACE_VERSION.
+    WORD wVersion;
+
+    // Size of this header. The first record starts here.
+    WORD cbHeader;
+
+    // UTC time the capture started. Record times are relative to it.
+    FILETIME ftStart;
+
+    // The CertSvc process that wrote the trace.
+    DWORD dwProcessId;
+
+    BYTE rgbReserved[44];
+};
+
+static_assert(sizeof(EventTraceFileHeader) == 64, "The trace file header is 64 bytes.");
+
+/*++
+
+    Abstract:
+
+        Fixed header in front of every record.
+
+--*/
+struct EventTraceRecordHeader
+{
+    // EVENT_TRACE_RECORD_MAGIC.
+    DWORD dwMagic;
+
+    // Size of the header and the data, without the padding.
+    DWORD cbRecord;
+
+    // Microseconds from the start of the capture until the event was recorded. An issued
+    // cert is recorded once its properties are copied, the others when Notify() is called.
+    ULONGLONG ullUSecs;
+
+    // The ICertExit::Notify() arguments.
+    LONG lExitEvent;
+    LONG lContext;
+
+    // Lengths of the record data.
+    DWORD cchSubjectKeyIdentifier;
+    DWORD cchSerialNumber;
+    DWORD cchRequesterName;
+    DWORD cbRawCert;
+};
+
+static_assert(sizeof(EventTraceRecordHeader) == 40, "The trace record header is 40 bytes.");
@@ -8,11 +8,78 @@ param (
   [Parameter(Mandatory=$false)]
   [string]$SerialNumber,
 
-  [Parameter(Mandatory=$true)]
-  [string]$RawCertPath
+  [Parameter(Mandatory=$false)]
+  [string]$RawCertPath,
+
+  [Parameter(Mandatory=$false)]
+  [switch]$RawCertStdIn,
+
+  [Parameter(Mandatory=$false)]
+  [string]$MetadataPath,
+
+  [Parameter(Mandatory=$false)]
+  [string]$Manifest,
+
+  [Parameter(Mandatory=$false)]
+  [string]$ResultPath
 )
 
-if ($Operation -eq 'certissued') {
+if ($Operation -eq 'certissued' -and $MetadataPath) {
+  # CertMetadata is set. The fields are already parsed, so the cert does not need to be loaded.
+  if ($RawCertStdIn) {
+    [Console]::OpenStandardInput().CopyTo([System.IO.Stream]::Null)
+  }
+
+  $metadata = Get-Content -Raw -Encoding UTF8 -Path $MetadataPath | ConvertFrom-Json
+  $metadata | fl > "$env:TEMP\$SerialNumber.txt"
+}
+elseif ($Operation -eq 'certissued' -and $RawCertStdIn) {
+  $stream = [System.IO.MemoryStream]::new()
+  [Console]::OpenStandardInput().CopyTo($stream)
+  $cert = [System.Security.Cryptography.X509Certificates.X509Certificate2]::new($stream.ToArray())
+  $cert | fl > "$env:TEMP\$SerialNumber.txt"
+}
+elseif ($Operation -eq 'certissued') {
   $cert = [System.Security.Cryptography.X509Certificates.X509Certificate2]::new($RawCertPath)
   $cert | fl > "$RawCertPath.txt"
-}
\ No newline at end of file
+}
+
+if ($Operation -eq 'standby') {
+  # Pre-started by the WarmHandlers pool. Read one frame from stdin. See ExitModule\HandlerProtocol.h.
+  $reader = [System.IO.BinaryReader]::new([Console]::OpenStandardInput())
+  try {
+    $magic = $reader.ReadUInt32()
+    $version = $reader.ReadUInt16()
+    $type = $reader.ReadUInt16()
+    $sequence = $reader.ReadUInt32()
+    $cbPayload = $reader.ReadUInt32()
+  }
+  catch [System.IO.EndOfStreamException] {
+    # The exit module stopped the pool.
+    exit 0
+  }
+
+  $SubjectKeyIdentifier = [System.Text.Encoding]::Unicode.GetString($reader.ReadBytes($reader.ReadUInt32()))
+  $SerialNumber = [System.Text.Encoding]::Unicode.GetString($reader.ReadBytes($reader.ReadUInt32()))
+  $cert = [System.Security.Cryptography.X509Certificates.X509Certificate2]::new($reader.ReadBytes($reader.ReadUInt32()))
+  $cert | fl > "$env:TEMP\$SerialNumber.txt"
+
+  $writer = [System.IO.BinaryWriter]::new([Console]::OpenStandardOutput())
+  $writer.Write([uint32]0x464D5050)
+  $writer.Write([uint16]1)
+  $writer.Write([uint16]0)
+  $writer.Write([uint32]$sequence)
+  $writer.Write([uint32]4)
+  $writer.Write([int32]0)
+  $writer.Flush()
+}
+
+if ($Operation -eq 'certissuedbatch') {
+  $results = foreach ($item in Import-Csv -Path $Manifest -Delimiter "`t") {
+    $cert = [System.Security.Cryptography.X509Certificates.X509Certificate2]::new($item.rawcertpath)
+    $cert | fl > "$($item.rawcertpath).txt"
+    [pscustomobject]@{ index = $item.index; status = 0 }
+  }
+
+  $results | Export-Csv -Path $ResultPath -Delimiter "`t" -NoTypeInformation
+}
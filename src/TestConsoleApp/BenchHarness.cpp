@@ -0,0 +1,252 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        BenchHarness.cpp
+
+    Abstract:
+
+        CBenchSuite class impl.
+
+--*/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "BenchHarness.h"
+
+namespace
+{
+    std::atomic<unsigned long long> g_cAllocations(0);
+    std::atomic<unsigned long long> g_cbAllocated(0);
+
+    // Keeps the compiler from dropping the operations.
+    volatile unsigned long long g_cSucceeded = 0;
+
+    void* CountedAlloc(
+        size_t cb) noexcept
+    {
+        g_cAllocations.fetch_add(1, std::memory_order_relaxed);
+        g_cbAllocated.fetch_add(cb, std::memory_order_relaxed);
+        return std::malloc(cb ? cb : 1);
+    }
+
+    /*++
+
+        Abstract:
+
+            Runs cIterations operations and returns the time they took in ns.
+
+    --*/
+    double RunSample(
+        unsigned long long cIterations,
+        const CBenchSuite::BenchOperation& fnOperation,
+        unsigned long long& cFailures)
+    {
+        unsigned long long cSucceeded = 0;
+        auto tStart = std::chrono::steady_clock::now();
+        for (unsigned long long i = 0; i < cIterations; i++)
+        {
+            if (fnOperation(i))
+            {
+                cSucceeded++;
+            }
+        }
+
+        auto tEnd = std::chrono::steady_clock::now();
+        g_cSucceeded += cSucceeded;
+        cFailures += cIterations - cSucceeded;
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(tEnd - tStart).count();
+    }
+
+    void WriteJsonString(
+        std::ostream& os,
+        const std::string& str)
+    {
+        os << '"';
+        for (char ch : str)
+        {
+            if (ch == '"' || ch == '\\')
+            {
+                os << '\\' << ch;
+            }
+            else if ((unsigned char)ch < 0x20)
+            {
+                char szEscape[8];
+                std::snprintf(szEscape, sizeof(szEscape), "\\u%04x", (unsigned)ch);
+                os << szEscape;
+            }
+            else
+            {
+                os << ch;
+            }
+        }
+
+        os << '"';
+    }
+}
+
+// Every allocation in the process goes through these, so the benchmarks can count them.
+void* operator new(
+    size_t cb)
+{
+    void* pv = CountedAlloc(cb);
+    if (!pv)
+    {
+        throw std::bad_alloc();
+    }
+
+    return pv;
+}
+
+void* operator new[](
+    size_t cb)
+{
+    return operator new(cb);
+}
+
+void* operator new(
+    size_t cb,
+    const std::nothrow_t&) noexcept
+{
+    return CountedAlloc(cb);
+}
+
+void* operator new[](
+    size_t cb,
+    const std::nothrow_t&) noexcept
+{
+    return CountedAlloc(cb);
+}
+
+void operator delete(
+    void* pv) noexcept
+{
+    std::free(pv);
+}
+
+void operator delete[](
+    void* pv) noexcept
+{
+    std::free(pv);
+}
+
+void operator delete(
+    void* pv,
+    size_t) noexcept
+{
+    std::free(pv);
+}
+
+void operator delete[](
+    void* pv,
+    size_t) noexcept
+{
+    std::free(pv);
+}
+
+void operator delete(
+    void* pv,
+    const std::nothrow_t&) noexcept
+{
+    std::free(pv);
+}
+
+void operator delete[](
+    void* pv,
+    const std::nothrow_t&) noexcept
+{
+    std::free(pv);
+}
+
+CBenchSuite::CBenchSuite(
+    unsigned long long cIterations,
+    const std::string& strFilter)
+    : m_cIterations(std::max(cIterations, 1ULL)),
+    m_strFilter(strFilter)
+{
+}
+
+void CBenchSuite::Run(
+    const char* pszName,
+    const BenchOperation& fnOperation)
+{
+    if (!m_strFilter.empty() && std::string(pszName).find(m_strFilter) == std::string::npos)
+    {
+        return;
+    }
+
+    BenchResult stResult;
+    stResult.strName = pszName;
+    stResult.cIterations = m_cIterations;
+
+    // Fills caches, and the lazily allocated state of the code under test.
+    unsigned long long cWarmUpFailures = 0;
+    RunSample(std::min(m_cIterations, 1000ULL), fnOperation, cWarmUpFailures);
+
+    double rgdblNSecs[s_cSamples];
+    unsigned long long cAllocations = g_cAllocations.load(std::memory_order_relaxed);
+    unsigned long long cbAllocated = g_cbAllocated.load(std::memory_order_relaxed);
+    for (unsigned long iSample = 0; iSample < s_cSamples; iSample++)
+    {
+        rgdblNSecs[iSample] = RunSample(m_cIterations, fnOperation, stResult.cFailures) / m_cIterations;
+    }
+
+    cAllocations = g_cAllocations.load(std::memory_order_relaxed) - cAllocations;
+    cbAllocated = g_cbAllocated.load(std::memory_order_relaxed) - cbAllocated;
+
+    std::sort(rgdblNSecs, rgdblNSecs + s_cSamples);
+    stResult.dblNSecsPerOp = rgdblNSecs[s_cSamples / 2];
+    stResult.dblMinNSecsPerOp = rgdblNSecs[0];
+    stResult.dblAllocsPerOp = (double)cAllocations / (m_cIterations * s_cSamples);
+    stResult.dblBytesPerOp = (double)cbAllocated / (m_cIterations * s_cSamples);
+    m_vecResults.push_back(stResult);
+}
+
+void CBenchSuite::WriteJson(
+    std::ostream& os,
+    const std::string& strPlatform) const
+{
+    os << "{\n";
+    os << "  \"platform\": ";
+    WriteJsonString(os, strPlatform);
+    os << ",\n";
+    os << "  \"samples\": " << s_cSamples << ",\n";
+    os << "  \"benchmarks\": [";
+    for (size_t i = 0; i < m_vecResults.size(); i++)
+    {
+        const BenchResult& stResult = m_vecResults[i];
+        os << (i == 0 ? "\n" : ",\n");
+        os << "    {\n";
+        os << "      \"name\": ";
+        WriteJsonString(os, stResult.strName);
+        os << ",\n";
+        os << "      \"iterations\": " << stResult.cIterations << ",\n";
+        os << "      \"failures\": " << stResult.cFailures << ",\n";
+        os << "      \"ns_per_op\": " << stResult.dblNSecsPerOp << ",\n";
+        os << "      \"min_ns_per_op\": " << stResult.dblMinNSecsPerOp << ",\n";
+        os << "      \"allocs_per_op\": " << stResult.dblAllocsPerOp << ",\n";
+        os << "      \"bytes_per_op\": " << stResult.dblBytesPerOp << "\n";
+        os << "    }";
+    }
+
+    os << (m_vecResults.empty() ? "]\n" : "\n  ]\n");
+    os << "}\n";
+}
+
+bool CBenchSuite::Succeeded() const
+{
+    for (const BenchResult& stResult : m_vecResults)
+    {
+        if (stResult.cFailures > 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,145 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        BenchHarness.h
+
+    Abstract:
+
+        CBenchSuite class declaration.
+
+    Remarks:
+
+        Only uses the C++ standard library, so it builds with any C++14 compiler. The cases
+        that call into the exit module are in MicroBench.cpp.
+--*/
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*++
+
+    Abstract:
+
+        What one benchmark measured.
+
+--*/
+struct BenchResult
+{
+    std::string strName;
+
+    // Operations in each sample, and the failed ones over all samples.
+    unsigned long long cIterations = 0;
+    unsigned long long cFailures = 0;
+
+    // Median and fastest of the samples.
+    double dblNSecsPerOp = 0;
+    double dblMinNSecsPerOp = 0;
+
+    // Global operator new calls and bytes, over all samples.
+    double dblAllocsPerOp = 0;
+    double dblBytesPerOp = 0;
+};
+
+/*++
+
+    Abstract:
+
+        Runs benchmarks and writes their results as JSON.
+
+    Remarks:
+
+        Each benchmark runs a warm up, then s_cSamples samples of cIterations operations.
+        Allocations are counted by replacing the global operator new, which is what
+        CHeapBuffer and the std containers allocate with. HeapAlloc, SysAllocString and
+        other allocators are not counted.
+
+        Benchmarks run on the calling thread, one at a time.
+--*/
+class CBenchSuite
+{
+public:
+    static const unsigned long s_cSamples = 5;
+
+    /*++
+
+        Abstract:
+
+            One operation. Returns false if it failed.
+
+        Parameters:
+
+            i - the index of the operation in the sample, to vary the input.
+
+    --*/
+    typedef std::function<bool(unsigned long long i)> BenchOperation;
+
+    /*++
+
+        Abstract:
+
+            Initializes a new instance of the CBenchSuite class.
+
+        Parameters:
+
+            cIterations - operations in each sample.
+            strFilter - only benchmarks whose name contains this run. Empty runs all.
+
+    --*/
+    CBenchSuite(
+        unsigned long long cIterations,
+        const std::string& strFilter);
+
+    /*++
+
+        Abstract:
+
+            Runs a benchmark, unless the filter skips it, and keeps its result.
+
+    --*/
+    void Run(
+        const char* pszName,
+        const BenchOperation& fnOperation);
+
+    /*++
+
+        Abstract:
+
+            Writes the results as one JSON object.
+
+        Parameters:
+
+            os - receives the JSON.
+            strPlatform - written as the platform of the run.
+
+    --*/
+    void WriteJson(
+        std::ostream& os,
+        const std::string& strPlatform) const;
+
+    inline const std::vector<BenchResult>& GetResults() const
+    {
+        return m_vecResults;
+    }
+
+    /*++
+
+        Abstract:
+
+            Checks that every operation of every benchmark succeeded.
+
+    --*/
+    bool Succeeded() const;
+
+private:
+    unsigned long long m_cIterations;
+    std::string m_strFilter;
+    std::vector<BenchResult> m_vecResults;
+
+    CBenchSuite(const CBenchSuite&) = delete;
+    CBenchSuite& operator=(const CBenchSuite&) = delete;
+};
@@ -0,0 +1,206 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        DerBench.cpp
+
+    Abstract:
+
+        Compares parsing cert fields from DER with fetching them from ICertServerExit.
+
+--*/
+#include <windows.h>
+#include <wincrypt.h>
+#include <certsrv.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <vector>
+#include "..\PKI\ExitModule\Buffer.h"
+#include "..\PKI\ExitModule\CertFields.h"
+#include "FakeCertServerExit.h"
+#include "DerBench.h"
+
+namespace
+{
+    double ElapsedUSecs(
+        const LARGE_INTEGER& liStart,
+        const LARGE_INTEGER& liEnd,
+        const LARGE_INTEGER& liFrequency)
+    {
+        return (double)(liEnd.QuadPart - liStart.QuadPart) * 1000000.0 / (double)liFrequency.QuadPart;
+    }
+
+    /*++
+
+        Abstract:
+
+            Fetches and decodes the fields the way the exit module would without CCertFields.
+
+    --*/
+    bool FetchFromServer(
+        ICertServerExit* pServer,
+        BSTR bstrNotAfter,
+        BSTR bstrTemplate,
+        BSTR bstrEnhancedKeyUsage,
+        BSTR bstrSubjectAltName)
+    {
+        bool fSucceeded = true;
+        VARIANT varValue;
+
+        ::VariantInit(&varValue);
+        fSucceeded &= SUCCEEDED(pServer->GetCertificateProperty(bstrNotAfter, PROPTYPE_DATE, &varValue));
+        ::VariantClear(&varValue);
+
+        fSucceeded &= SUCCEEDED(pServer->GetCertificateProperty(bstrTemplate, PROPTYPE_STRING, &varValue));
+        ::VariantClear(&varValue);
+
+        const struct
+        {
+            BSTR bstrOid;
+            LPCSTR pszStructType;
+        } rgExtensions[] =
+        {
+            { bstrEnhancedKeyUsage, X509_ENHANCED_KEY_USAGE },
+            { bstrSubjectAltName, X509_ALTERNATE_NAME },
+        };
+
+        for (const auto& stExtension : rgExtensions)
+        {
+            if (FAILED(pServer->GetCertificateExtension(stExtension.bstrOid, PROPTYPE_BINARY, &varValue)))
+            {
+                fSucceeded = false;
+                continue;
+            }
+
+            // Then the bytes still have to be decoded and formatted.
+            void* pvDecoded = nullptr;
+            DWORD cbDecoded = 0;
+            if (::CryptDecodeObjectEx(
+                X509_ASN_ENCODING,
+                stExtension.pszStructType,
+                reinterpret_cast<const BYTE*>(varValue.bstrVal),
+                ::SysStringByteLen(varValue.bstrVal),
+                CRYPT_DECODE_ALLOC_FLAG,
+                nullptr, // pDecodePara
+                &pvDecoded,
+                &cbDecoded))
+            {
+                ::LocalFree(pvDecoded);
+            }
+            else
+            {
+                fSucceeded = false;
+            }
+
+            ::VariantClear(&varValue);
+        }
+
+        return fSucceeded;
+    }
+
+    void PrintField(
+        LPCWSTR pwszName,
+        LPCWSTR pwszValue)
+    {
+        std::wcout << pwszName << (pwszValue ? pwszValue : L"<not found>") << std::endl;
+    }
+}
+
+int RunDerBench(
+    const DerBenchOptions& objOptions)
+{
+    FakeCertProperties objProperties;
+    std::ifstream stmCert(objOptions.strCertPath, std::ios::binary);
+    if (!stmCert)
+    {
+        std::wcerr << L"Failed to open " << objOptions.strCertPath << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    objProperties.vecRawCert.assign(std::istreambuf_iterator<char>(stmCert), std::istreambuf_iterator<char>());
+    HRESULT hr = LoadFakeCertProperties(objProperties.vecRawCert, OUT objProperties);
+    if (FAILED(hr))
+    {
+        std::wcerr << L"Failed to decode " << objOptions.strCertPath << L", hr=" << std::hex << hr << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    CRefBuffer<BYTE> bufCert(objProperties.vecRawCert.data(), objProperties.vecRawCert.size());
+
+    // 8K of text, so not on the stack of the main thread next to everything else.
+    std::unique_ptr<CCertFields> pFields(new CCertFields());
+    hr = pFields->Parse(bufCert);
+    if (FAILED(hr))
+    {
+        std::wcerr << L"CCertFields::Parse failed, hr=" << std::hex << hr << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    PrintField(L"{issuer}:             ", pFields->Get(CertFieldIssuer));
+    PrintField(L"{notafter}:           ", pFields->Get(CertFieldNotAfter));
+    PrintField(L"{template}:           ", pFields->Get(CertFieldTemplate));
+    PrintField(L"{eku}:                ", pFields->Get(CertFieldEnhancedKeyUsage));
+    PrintField(L"{san}:                ", pFields->Get(CertFieldSubjectAltName));
+
+    LARGE_INTEGER liFrequency;
+    LARGE_INTEGER liStart;
+    LARGE_INTEGER liEnd;
+    ::QueryPerformanceFrequency(&liFrequency);
+
+    ::QueryPerformanceCounter(&liStart);
+    for (unsigned long i = 0; i < objOptions.cIterations; i++)
+    {
+        pFields->Parse(bufCert);
+    }
+
+    ::QueryPerformanceCounter(&liEnd);
+    double dParseUSecs = ElapsedUSecs(liStart, liEnd, liFrequency);
+
+    // The exit module allocates the names once at Initialize.
+    BSTR bstrNotAfter = ::SysAllocString(wszPROPCERTIFICATENOTAFTERDATE);
+    BSTR bstrTemplate = ::SysAllocString(wszPROPCERTIFICATETEMPLATE);
+    BSTR bstrEnhancedKeyUsage = ::SysAllocString(TEXT(szOID_ENHANCED_KEY_USAGE));
+    BSTR bstrSubjectAltName = ::SysAllocString(TEXT(szOID_SUBJECT_ALT_NAME2));
+    if (!bstrNotAfter || !bstrTemplate || !bstrEnhancedKeyUsage || !bstrSubjectAltName)
+    {
+        std::wcerr << L"Out of memory." << std::endl;
+        ::SysFreeString(bstrNotAfter);
+        ::SysFreeString(bstrTemplate);
+        ::SysFreeString(bstrEnhancedKeyUsage);
+        ::SysFreeString(bstrSubjectAltName);
+        return EXIT_FAILURE;
+    }
+
+    CFakeCertServerExit objServer(objProperties);
+    bool fComComplete = FetchFromServer(&objServer, bstrNotAfter, bstrTemplate, bstrEnhancedKeyUsage, bstrSubjectAltName);
+
+    ::QueryPerformanceCounter(&liStart);
+    for (unsigned long i = 0; i < objOptions.cIterations; i++)
+    {
+        objServer.SetContext((LONG)i);
+        FetchFromServer(&objServer, bstrNotAfter, bstrTemplate, bstrEnhancedKeyUsage, bstrSubjectAltName);
+    }
+
+    ::QueryPerformanceCounter(&liEnd);
+    double dComUSecs = ElapsedUSecs(liStart, liEnd, liFrequency);
+
+    ::SysFreeString(bstrNotAfter);
+    ::SysFreeString(bstrTemplate);
+    ::SysFreeString(bstrEnhancedKeyUsage);
+    ::SysFreeString(bstrSubjectAltName);
+
+    unsigned long cIterations = max(objOptions.cIterations, 1UL);
+    std::wcout << L"Iterations:            " << objOptions.cIterations << std::endl;
+    std::wcout << L"DER parse avg us:      " << dParseUSecs / cIterations << std::endl;
+    std::wcout << L"Fake COM + decode us:  " << dComUSecs / cIterations << std::endl;
+    if (!fComComplete)
+    {
+        std::wcout << L"The cert is missing a template, EKU or SAN extension, so the COM path did less work." << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        DerBench.h
+
+    Abstract:
+
+        Compares parsing cert fields from DER with fetching them from ICertServerExit.
+
+--*/
+#include <string>
+
+/*++
+
+    Abstract:
+
+        Options for the DER benchmark.
+
+--*/
+struct DerBenchOptions
+{
+    // Path to a DER encoded certificate.
+    std::wstring strCertPath;
+
+    // Number of times each path runs.
+    unsigned long cIterations = 10000;
+};
+
+/*++
+
+    Abstract:
+
+        Times CCertFields::Parse() against the ICertServerExit calls and decoding it replaces.
+
+    Parameters:
+
+        objOptions - the options.
+
+    Returns:
+
+        0 - success.
+        1 - error.
+
+    Remarks:
+
+        The COM side calls the fake ICertServerExit in process, so it is a lower bound.
+        In CertSvc each call also goes through the CA database.
+--*/
+int RunDerBench(
+    const DerBenchOptions& objOptions);
@@ -0,0 +1,230 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventArgBench.cpp
+
+    Abstract:
+
+        Compares formatting event arguments with CEventArg objects and with CEventArgFormatter.
+
+--*/
+#include <windows.h>
+#include <strsafe.h>
+#include <functional>
+#include <iostream>
+#include "..\PKI\ExitModule\Buffer.h"
+#include "..\PKI\ExitModule\EventArg.h"
+#include "EventArgBench.h"
+
+namespace
+{
+    LPCWSTR g_pwszBenchExePath = L"C:\\Program Files\\Contoso\\EventProcessor.exe";
+    LPCWSTR g_pwszBenchCmdLine =
+        L"\"C:\\Program Files\\Contoso\\EventProcessor.exe\" certissued -subjectkeyidentifier "
+        L"\"01 23 45 67 89 ab cd ef 01 23 45 67 89 ab cd ef 01 23 45 67\" -serialnumber "
+        L"1a00000002f6b5a1f1d2a3b4c5000000000002 -rawcertpath \"C:\\Windows\\Temp\\PMI1234.tmp\"";
+
+    // Keeps the compiler from dropping the formatting.
+    volatile size_t g_cchFormatted = 0;
+
+    double ElapsedUSecs(
+        const LARGE_INTEGER& liStart,
+        const LARGE_INTEGER& liEnd,
+        const LARGE_INTEGER& liFrequency)
+    {
+        return (double)(liEnd.QuadPart - liStart.QuadPart) * 1000000.0 / (double)liFrequency.QuadPart;
+    }
+
+    void Consume(
+        const CBuffer<LPCWSTR>& bufStrings)
+    {
+        size_t cch = 0;
+        for (size_t i = 0; i < bufStrings.GetLength(); i++)
+        {
+            cch += bufStrings.Get()[i] ? wcslen(bufStrings.Get()[i]) : 0;
+        }
+
+        g_cchFormatted += cch;
+    }
+
+    /*++
+
+        Abstract:
+
+            What CEventSource::ReportEvent() does with an array of CEventArg before it reports.
+
+    --*/
+    HRESULT FormatEventArgs(
+        const CBuffer<CEventArg*>& bufArgs)
+    {
+        CHeapBuffer<LPCWSTR> bufStrings;
+        if (!bufStrings.Alloc(bufArgs.GetLength()))
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        for (size_t i = 0; i < bufArgs.GetLength(); i++)
+        {
+            HRESULT hr = bufArgs.Get()[i]->Format(OUT bufStrings.Get()[i]);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+        }
+
+        Consume(bufStrings);
+        return S_OK;
+    }
+
+    // MSG_PROCESS_SUCCEEDED. Every certificate reports it.
+    HRESULT ProcessSucceededWithEventArgs(
+        DWORD i)
+    {
+        CNumericEventArg<DWORD> argProcessID(4000 + i % 1000);
+        CNumericEventArg<DWORD> argThreadID(8000 + i % 1000);
+        CNumericEventArg<DWORD> argExitCode(0);
+        CEventArg* rgArgs[] =
+        {
+            &argProcessID,
+            &argThreadID,
+            &argExitCode,
+        };
+
+        CRefBuffer<CEventArg*> bufArgs(rgArgs, sizeof(rgArgs) / sizeof(rgArgs[0]));
+        return FormatEventArgs(bufArgs);
+    }
+
+    HRESULT ProcessSucceededWithFormatter(
+        DWORD i)
+    {
+        CEventArgFormatter<3> objArgs;
+        HRESULT hr = objArgs.Format(
+            (DWORD)(4000 + i % 1000),
+            (DWORD)(8000 + i % 1000),
+            (DWORD)0);
+        if (SUCCEEDED(hr))
+        {
+            Consume(objArgs.GetStrings());
+        }
+
+        return hr;
+    }
+
+    // MSG_PROCESS_START_FAILED. A broken handler reports it for every certificate.
+    HRESULT ProcessStartFailedWithEventArgs(
+        DWORD /* i */)
+    {
+        HRESULT hrError = HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+        CStringEventArg argExePath(g_pwszBenchExePath);
+        CStringEventArg argCmdLine(g_pwszBenchCmdLine);
+        CNumericEventArg<HRESULT> argError(hrError);
+        CErrorMessageEventArg argErrorMessage(hrError);
+        CEventArg* rgArgs[] =
+        {
+            &argExePath,
+            &argCmdLine,
+            &argError,
+            &argErrorMessage,
+        };
+
+        CRefBuffer<CEventArg*> bufArgs(rgArgs, sizeof(rgArgs) / sizeof(rgArgs[0]));
+        return FormatEventArgs(bufArgs);
+    }
+
+    HRESULT ProcessStartFailedWithFormatter(
+        DWORD /* i */)
+    {
+        HRESULT hrError = HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+        CEventArgFormatter<4> objArgs;
+        HRESULT hr = objArgs.Format(
+            g_pwszBenchExePath,
+            g_pwszBenchCmdLine,
+            hrError,
+            ErrorMessageText(hrError));
+        if (SUCCEEDED(hr))
+        {
+            Consume(objArgs.GetStrings());
+        }
+
+        return hr;
+    }
+
+    /*++
+
+        Abstract:
+
+            Runs fnFormat cIterations times and returns the average time per call in ns.
+
+    --*/
+    double TimePath(
+        const EventArgBenchOptions& objOptions,
+        const LARGE_INTEGER& liFrequency,
+        const std::function<HRESULT(DWORD)>& fnFormat,
+        OUT unsigned long& cFailures)
+    {
+        LARGE_INTEGER liStart;
+        LARGE_INTEGER liEnd;
+        cFailures = 0;
+
+        // The first error message call fills the cache. Keep it out of the timing.
+        fnFormat(0);
+
+        ::QueryPerformanceCounter(&liStart);
+        for (DWORD i = 0; i < objOptions.cIterations; i++)
+        {
+            if (FAILED(fnFormat(i)))
+            {
+                cFailures++;
+            }
+        }
+
+        ::QueryPerformanceCounter(&liEnd);
+        return ElapsedUSecs(liStart, liEnd, liFrequency) * 1000.0 / max(objOptions.cIterations, 1UL);
+    }
+
+    bool CompareShape(
+        LPCWSTR pwszName,
+        const EventArgBenchOptions& objOptions,
+        const LARGE_INTEGER& liFrequency,
+        const std::function<HRESULT(DWORD)>& fnEventArgs,
+        const std::function<HRESULT(DWORD)>& fnFormatter)
+    {
+        unsigned long cEventArgFailures = 0;
+        unsigned long cFormatterFailures = 0;
+        double dEventArgNSecs = TimePath(objOptions, liFrequency, fnEventArgs, OUT cEventArgFailures);
+        double dFormatterNSecs = TimePath(objOptions, liFrequency, fnFormatter, OUT cFormatterFailures);
+
+        std::wcout << pwszName << std::endl;
+        std::wcout << L"  CEventArg ns/event:          " << dEventArgNSecs << std::endl;
+        std::wcout << L"  CEventArgFormatter ns/event: " << dFormatterNSecs << std::endl;
+        std::wcout << L"  Speedup:                     " << dEventArgNSecs / max(dFormatterNSecs, 0.001) << L"x" << std::endl;
+        std::wcout << L"  Failures:                    " << cEventArgFailures << L" / " << cFormatterFailures << std::endl;
+        return cEventArgFailures == 0 && cFormatterFailures == 0;
+    }
+}
+
+int RunEventArgBench(
+    const EventArgBenchOptions& objOptions)
+{
+    LARGE_INTEGER liFrequency;
+    ::QueryPerformanceFrequency(&liFrequency);
+
+    std::wcout << L"Iterations:                    " << objOptions.cIterations << std::endl;
+    bool fSucceeded = CompareShape(
+        L"Process succeeded (3 numbers):",
+        objOptions,
+        liFrequency,
+        ProcessSucceededWithEventArgs,
+        ProcessSucceededWithFormatter);
+    fSucceeded = CompareShape(
+        L"Process start failed (2 strings, HRESULT, error message):",
+        objOptions,
+        liFrequency,
+        ProcessStartFailedWithEventArgs,
+        ProcessStartFailedWithFormatter) && fSucceeded;
+
+    return fSucceeded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,50 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventArgBench.h
+
+    Abstract:
+
+        Compares formatting event arguments with CEventArg objects and with CEventArgFormatter.
+
+--*/
+
+/*++
+
+    Abstract:
+
+        Options for the event argument benchmark.
+
+--*/
+struct EventArgBenchOptions
+{
+    // Number of events each path formats for each shape.
+    unsigned long cIterations = 1000000;
+};
+
+/*++
+
+    Abstract:
+
+        Formats the arguments of two common events both ways and prints the time per event.
+
+    Parameters:
+
+        objOptions - the options.
+
+    Returns:
+
+        0 - success.
+        1 - error.
+
+    Remarks:
+
+        Only the formatting is timed. Both paths hand the same strings to ReportEvent, so
+        the sink costs the same either way.
+--*/
+int RunEventArgBench(
+    const EventArgBenchOptions& objOptions);
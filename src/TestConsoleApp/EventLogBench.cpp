@@ -0,0 +1,225 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventLogBench.cpp
+
+    Abstract:
+
+        Compares writing event log records on the calling thread with posting them to CEventLogWriter.
+
+--*/
+#include <windows.h>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "..\PKI\ExitModule\Buffer.h"
+#include "..\PKI\ExitModule\EventLogWriter.h"
+#include "EventLogBench.h"
+
+namespace
+{
+    // MSG_PROCESS_SUCCEEDED, the event every certificate reports.
+    constexpr const DWORD g_dwBenchEventID = 0x40000100;
+
+    /*++
+
+        Abstract:
+
+            Per-thread results.
+
+    --*/
+    struct ThreadResult
+    {
+        unsigned long cEvents = 0;
+        unsigned long cFailures = 0;
+        double dTotalUSecs = 0.0;
+        double dMaxUSecs = 0.0;
+    };
+
+    /*++
+
+        Abstract:
+
+            Results of one pass.
+
+    --*/
+    struct PassResult
+    {
+        ThreadResult objTotal;
+        double dReportMSecs = 0.0;
+        double dDrainMSecs = 0.0;
+    };
+
+    double ElapsedUSecs(
+        const LARGE_INTEGER& liStart,
+        const LARGE_INTEGER& liEnd,
+        const LARGE_INTEGER& liFrequency)
+    {
+        return (double)(liEnd.QuadPart - liStart.QuadPart) * 1000000.0 / (double)liFrequency.QuadPart;
+    }
+
+    /*++
+
+        Abstract:
+
+            Calls fnReport cEvents times spread over cThreads threads.
+
+    --*/
+    ThreadResult ReportFromThreads(
+        const EventLogBenchOptions& objOptions,
+        const LARGE_INTEGER& liFrequency,
+        const std::function<HRESULT(const CBuffer<LPCWSTR>&)>& fnReport)
+    {
+        volatile LONG lNextEvent = 0;
+        std::vector<ThreadResult> vecResults(objOptions.cThreads);
+        std::vector<std::thread> vecThreads;
+
+        for (unsigned long iThread = 0; iThread < objOptions.cThreads; iThread++)
+        {
+            vecThreads.emplace_back([&, iThread]()
+            {
+                ThreadResult& objResult = vecResults[iThread];
+                std::wstring strProcessID = std::to_wstring(::GetCurrentProcessId());
+                std::wstring strThreadID = std::to_wstring(::GetCurrentThreadId());
+                LONG iEvent = 0;
+                while ((iEvent = ::InterlockedIncrement(&lNextEvent)) <= (LONG)objOptions.cEvents)
+                {
+                    std::wstring strExitCode = std::to_wstring(iEvent);
+                    LPCWSTR rgpwszStrings[] =
+                    {
+                        strProcessID.c_str(),
+                        strThreadID.c_str(),
+                        strExitCode.c_str(),
+                    };
+
+                    CRefBuffer<LPCWSTR> bufStrings(rgpwszStrings, sizeof(rgpwszStrings) / sizeof(rgpwszStrings[0]));
+                    LARGE_INTEGER liBefore;
+                    LARGE_INTEGER liAfter;
+                    ::QueryPerformanceCounter(&liBefore);
+                    HRESULT hr = fnReport(bufStrings);
+                    ::QueryPerformanceCounter(&liAfter);
+
+                    double dUSecs = ElapsedUSecs(liBefore, liAfter, liFrequency);
+                    objResult.cEvents++;
+                    objResult.dTotalUSecs += dUSecs;
+                    objResult.dMaxUSecs = max(objResult.dMaxUSecs, dUSecs);
+                    if (FAILED(hr))
+                    {
+                        objResult.cFailures++;
+                    }
+                }
+            });
+        }
+
+        for (std::thread& objThread : vecThreads)
+        {
+            objThread.join();
+        }
+
+        ThreadResult objTotal;
+        for (const ThreadResult& objResult : vecResults)
+        {
+            objTotal.cEvents += objResult.cEvents;
+            objTotal.cFailures += objResult.cFailures;
+            objTotal.dTotalUSecs += objResult.dTotalUSecs;
+            objTotal.dMaxUSecs = max(objTotal.dMaxUSecs, objResult.dMaxUSecs);
+        }
+
+        return objTotal;
+    }
+
+    void PrintPass(
+        LPCWSTR pwszName,
+        const PassResult& objPass)
+    {
+        const ThreadResult& objTotal = objPass.objTotal;
+        std::wcout << pwszName << std::endl;
+        std::wcout << L"  Events:            " << objTotal.cEvents << std::endl;
+        std::wcout << L"  Failures:          " << objTotal.cFailures << std::endl;
+        std::wcout << L"  Report avg us:     " << objTotal.dTotalUSecs / max(objTotal.cEvents, 1UL) << std::endl;
+        std::wcout << L"  Report max us:     " << objTotal.dMaxUSecs << std::endl;
+        std::wcout << L"  Report rate:       " << objTotal.cEvents * 1000.0 / objPass.dReportMSecs << L"/s" << std::endl;
+        std::wcout << L"  Drain ms:          " << objPass.dDrainMSecs << std::endl;
+    }
+}
+
+int RunEventLogBench(
+    const EventLogBenchOptions& objOptions)
+{
+    CFileEventLogSink objSink;
+    HRESULT hr = objSink.Open(objOptions.strOutputPath.c_str());
+    if (FAILED(hr))
+    {
+        std::wcerr << L"Failed to open " << objOptions.strOutputPath << L", hr=" << std::hex << hr << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    LARGE_INTEGER liFrequency;
+    LARGE_INTEGER liStart;
+    LARGE_INTEGER liReported;
+    LARGE_INTEGER liDrained;
+    ::QueryPerformanceFrequency(&liFrequency);
+
+    // What CEventSource does without a writer.
+    PassResult objSync;
+    ::QueryPerformanceCounter(&liStart);
+    objSync.objTotal = ReportFromThreads(objOptions, liFrequency, [&](const CBuffer<LPCWSTR>& bufStrings)
+    {
+        EventLogRecord stRecord = {};
+        stRecord.wType = EVENTLOG_INFORMATION_TYPE;
+        stRecord.wCategory = 1; // GENERAL_CATEGORY
+        stRecord.dwEventID = g_dwBenchEventID;
+        stRecord.cStrings = (WORD)bufStrings.GetLength();
+        stRecord.rgpwszStrings = const_cast<LPCWSTR*>(bufStrings.Get());
+        ::GetSystemTimeAsFileTime(&stRecord.ftReported);
+
+        const EventLogRecord* rgpRecords[] = { &stRecord };
+        CRefBuffer<const EventLogRecord*> bufRecords(rgpRecords, 1);
+        return objSink.Write(bufRecords);
+    });
+
+    ::QueryPerformanceCounter(&liReported);
+    objSync.dReportMSecs = ElapsedUSecs(liStart, liReported, liFrequency) / 1000.0;
+
+    PassResult objAsync;
+    CEventLogWriter objWriter;
+    hr = objWriter.Start(&objSink, objOptions.cCapacity);
+    if (FAILED(hr))
+    {
+        std::wcerr << L"CEventLogWriter::Start failed, hr=" << std::hex << hr << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    ::QueryPerformanceCounter(&liStart);
+    objAsync.objTotal = ReportFromThreads(objOptions, liFrequency, [&](const CBuffer<LPCWSTR>& bufStrings)
+    {
+        return objWriter.Post(
+            EVENTLOG_INFORMATION_TYPE,
+            1, // GENERAL_CATEGORY
+            g_dwBenchEventID,
+            bufStrings,
+            CRefBuffer<BYTE>(),
+            nullptr); // pUserSid
+    });
+
+    ::QueryPerformanceCounter(&liReported);
+    objWriter.Stop();
+    ::QueryPerformanceCounter(&liDrained);
+    objAsync.dReportMSecs = ElapsedUSecs(liStart, liReported, liFrequency) / 1000.0;
+    objAsync.dDrainMSecs = ElapsedUSecs(liReported, liDrained, liFrequency) / 1000.0;
+
+    std::wcout << L"Threads:             " << objOptions.cThreads << std::endl;
+    PrintPass(L"Synchronous:", objSync);
+    PrintPass(L"CEventLogWriter:", objAsync);
+    std::wcout << L"  Written:           " << objWriter.GetWritten() << std::endl;
+    std::wcout << L"  Batches:           " << objWriter.GetBatches() << std::endl;
+    std::wcout << L"  Dropped:           " << objWriter.GetDropped() << std::endl;
+    std::wcout << L"  Avg batch:         " << (double)objWriter.GetWritten() / max(objWriter.GetBatches(), 1L) << std::endl;
+
+    return (objSync.objTotal.cFailures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,61 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        EventLogBench.h
+
+    Abstract:
+
+        Compares writing event log records on the calling thread with posting them to CEventLogWriter.
+
+--*/
+#include <string>
+
+/*++
+
+    Abstract:
+
+        Options for the event log writer benchmark.
+
+--*/
+struct EventLogBenchOptions
+{
+    // File the records are appended to. Each pass appends Count lines.
+    std::wstring strOutputPath;
+
+    // Number of records each pass writes.
+    unsigned long cEvents = 100000;
+
+    // Number of threads reporting events at the same time.
+    unsigned long cThreads = 4;
+
+    // Slots in the writer's ring.
+    unsigned long cCapacity = 1024;
+};
+
+/*++
+
+    Abstract:
+
+        Writes the same events through a CFileEventLogSink on the reporting threads, then
+        through a CEventLogWriter in front of it, and prints the time each reporting call took.
+
+    Parameters:
+
+        objOptions - the options.
+
+    Returns:
+
+        0 - success.
+        1 - error.
+
+    Remarks:
+
+        The file sink is cheaper than ReportEventW, so the synchronous numbers are a lower
+        bound for what the event log costs a CertSvc thread.
+--*/
+int RunEventLogBench(
+    const EventLogBenchOptions& objOptions);
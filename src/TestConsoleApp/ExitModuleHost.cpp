@@ -0,0 +1,101 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        ExitModuleHost.cpp
+
+    Abstract:
+
+        CExitModuleHost class impl.
+
+--*/
+#include "ExitModuleHost.h"
+
+// coclass PMICertExit from ExitModule.idl.
+static const CLSID g_clsidPMICertExit =
+{ 0x58f3c2bd, 0xd361, 0x46ef, { 0xa5, 0x91, 0x8e, 0xe3, 0x15, 0x52, 0x64, 0x7a } };
+
+typedef HRESULT (STDAPICALLTYPE* PFNDllGetClassObject)(REFCLSID, REFIID, LPVOID*);
+
+CExitModuleHost::CExitModuleHost()
+    : m_hModule(NULL), m_pExit(nullptr)
+{
+}
+
+CExitModuleHost::~CExitModuleHost()
+{
+    Unload();
+}
+
+HRESULT CExitModuleHost::Load(
+    const std::wstring& strModulePath)
+{
+    HRESULT hr = S_OK;
+    IClassFactory* pFactory = nullptr;
+
+    do
+    {
+        Unload();
+
+        m_hModule = ::LoadLibraryExW(
+            strModulePath.c_str(),
+            NULL, // hFile
+            LOAD_WITH_ALTERED_SEARCH_PATH);
+        if (!m_hModule)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            break;
+        }
+
+        PFNDllGetClassObject pfnDllGetClassObject = reinterpret_cast<PFNDllGetClassObject>(
+            ::GetProcAddress(m_hModule, "DllGetClassObject"));
+        if (!pfnDllGetClassObject)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            break;
+        }
+
+        hr = pfnDllGetClassObject(
+            g_clsidPMICertExit,
+            IID_IClassFactory,
+            reinterpret_cast<LPVOID*>(&pFactory));
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        hr = pFactory->CreateInstance(
+            nullptr, // pUnkOuter
+            IID_ICertExit,
+            reinterpret_cast<LPVOID*>(&m_pExit));
+    } while (false);
+
+    if (pFactory)
+    {
+        pFactory->Release();
+    }
+
+    if (FAILED(hr))
+    {
+        Unload();
+    }
+
+    return hr;
+}
+
+void CExitModuleHost::Unload()
+{
+    if (m_pExit)
+    {
+        m_pExit->Release();
+        m_pExit = nullptr;
+    }
+
+    if (m_hModule)
+    {
+        ::FreeLibrary(m_hModule);
+        m_hModule = NULL;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        ExitModuleHost.h
+
+    Abstract:
+
+        CExitModuleHost class declaration.
+
+--*/
+#include <windows.h>
+#include <certexit.h>
+#include <string>
+
+/*++
+
+    Abstract:
+
+        Loads ExitModule.dll directly and creates the PMICertExit object the way CertSvc would.
+
+    Remarks:
+
+        The DLL does not need to be registered. The class object is obtained from
+        DllGetClassObject so several builds can be compared side by side.
+--*/
+class CExitModuleHost
+{
+public:
+    CExitModuleHost();
+    ~CExitModuleHost();
+
+    /*++
+
+        Abstract:
+
+            Loads the DLL and creates the exit module.
+
+        Parameters:
+
+            strModulePath - path to ExitModule.dll.
+
+        Returns:
+
+            S_OK - success.
+            other - error code.
+    --*/
+    HRESULT Load(
+        const std::wstring& strModulePath);
+
+    /*++
+
+        Abstract:
+
+            Releases the exit module and unloads the DLL.
+
+    --*/
+    void Unload();
+
+    inline ICertExit* GetExit() const
+    {
+        return m_pExit;
+    }
+
+private:
+    HMODULE m_hModule;
+    ICertExit* m_pExit;
+
+    CExitModuleHost(const CExitModuleHost&) = delete;
+    CExitModuleHost& operator=(const CExitModuleHost&) = delete;
+};
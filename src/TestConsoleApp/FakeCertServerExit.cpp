@@ -0,0 +1,470 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        FakeCertServerExit.cpp
+
+    Abstract:
+
+        CFakeCertServerExit and CFakeCertServerExitFactory class impls.
+
+--*/
+#include "FakeCertServerExit.h"
+#include <wincrypt.h>
+#include <strsafe.h>
+
+namespace
+{
+    std::wstring ToWide(
+        LPCSTR psz)
+    {
+        return std::wstring(psz, psz + strlen(psz));
+    }
+
+    /*++
+
+        Abstract:
+
+            Formats the key identifier the way CertSvc does, as hex bytes separated by spaces.
+
+    --*/
+    std::wstring FormatKeyIdentifier(
+        const BYTE* pbKeyId,
+        DWORD cbKeyId)
+    {
+        static const WCHAR s_rgwchHex[] = L"0123456789abcdef";
+        std::wstring str;
+        for (DWORD i = 0; i < cbKeyId; i++)
+        {
+            if (i > 0)
+            {
+                str += L' ';
+            }
+
+            str += s_rgwchHex[pbKeyId[i] >> 4];
+            str += s_rgwchHex[pbKeyId[i] & 0xf];
+        }
+
+        return str;
+    }
+}
+
+HRESULT LoadFakeCertProperties(
+    const std::vector<BYTE>& vecCert,
+    OUT FakeCertProperties& objProperties)
+{
+    PCCERT_CONTEXT pCert = ::CertCreateCertificateContext(
+        X509_ASN_ENCODING,
+        vecCert.data(),
+        (DWORD)vecCert.size());
+    if (!pCert)
+    {
+        return HRESULT_FROM_WIN32(::GetLastError());
+    }
+
+    // The SubjectKeyIdentifier extension, or a hash of the public key without one.
+    BYTE rgbKeyId[64];
+    DWORD cbKeyId = sizeof(rgbKeyId);
+    if (::CertGetCertificateContextProperty(pCert, CERT_KEY_IDENTIFIER_PROP_ID, rgbKeyId, &cbKeyId))
+    {
+        objProperties.strSubjectKeyIdentifier = FormatKeyIdentifier(rgbKeyId, cbKeyId);
+    }
+
+    SYSTEMTIME stNotAfter;
+    if (::FileTimeToSystemTime(&pCert->pCertInfo->NotAfter, &stNotAfter))
+    {
+        ::SystemTimeToVariantTime(&stNotAfter, &objProperties.dateNotAfter);
+    }
+
+    for (DWORD i = 0; i < pCert->pCertInfo->cExtension; i++)
+    {
+        const CERT_EXTENSION& stExtension = pCert->pCertInfo->rgExtension[i];
+        objProperties.mapExtensions[ToWide(stExtension.pszObjId)].assign(
+            stExtension.Value.pbData,
+            stExtension.Value.pbData + stExtension.Value.cbData);
+
+        if (strcmp(stExtension.pszObjId, szOID_CERTIFICATE_TEMPLATE) == 0)
+        {
+            CERT_TEMPLATE_EXT* pTemplate = nullptr;
+            DWORD cbTemplate = 0;
+            if (::CryptDecodeObjectEx(
+                X509_ASN_ENCODING,
+                X509_CERTIFICATE_TEMPLATE,
+                stExtension.Value.pbData,
+                stExtension.Value.cbData,
+                CRYPT_DECODE_ALLOC_FLAG,
+                nullptr, // pDecodePara
+                &pTemplate,
+                &cbTemplate))
+            {
+                objProperties.strCertificateTemplate = ToWide(pTemplate->pszObjId);
+                ::LocalFree(pTemplate);
+            }
+        }
+    }
+
+    ::CertFreeCertificateContext(pCert);
+    return S_OK;
+}
+
+CFakeCertServerExit::CFakeCertServerExit(const FakeCertProperties& objProperties)
+    : m_cRef(1), m_lContext(0), m_rgProperties(&objProperties), m_cProperties(1)
+{
+}
+
+CFakeCertServerExit::CFakeCertServerExit(const FakeCertProperties* rgProperties, size_t cProperties)
+    : m_cRef(1), m_lContext(0), m_rgProperties(rgProperties), m_cProperties(cProperties)
+{
+}
+
+CFakeCertServerExit::~CFakeCertServerExit()
+{
+}
+
+STDMETHODIMP CFakeCertServerExit::QueryInterface(REFIID riid, void** ppv)
+{
+    if (!ppv)
+    {
+        return E_POINTER;
+    }
+
+    if (riid == IID_IUnknown || riid == IID_IDispatch || riid == IID_ICertServerExit)
+    {
+        *ppv = static_cast<ICertServerExit*>(this);
+        AddRef();
+        return S_OK;
+    }
+
+    *ppv = nullptr;
+    return E_NOINTERFACE;
+}
+
+STDMETHODIMP_(ULONG) CFakeCertServerExit::AddRef()
+{
+    return ::InterlockedIncrement(&m_cRef);
+}
+
+STDMETHODIMP_(ULONG) CFakeCertServerExit::Release()
+{
+    LONG cRef = ::InterlockedDecrement(&m_cRef);
+    if (cRef == 0)
+    {
+        delete this;
+    }
+
+    return cRef;
+}
+
+STDMETHODIMP CFakeCertServerExit::GetTypeInfoCount(UINT* /* pctinfo */)
+{
+    return E_NOTIMPL;
+}
+
+STDMETHODIMP CFakeCertServerExit::GetTypeInfo(UINT /* iTInfo */, LCID /* lcid */, ITypeInfo** /* ppTInfo */)
+{
+    return E_NOTIMPL;
+}
+
+STDMETHODIMP CFakeCertServerExit::GetIDsOfNames(REFIID /* riid */, LPOLESTR* /* rgszNames */, UINT /* cNames */, LCID /* lcid */, DISPID* /* rgDispId */)
+{
+    return E_NOTIMPL;
+}
+
+STDMETHODIMP CFakeCertServerExit::Invoke(DISPID /* dispIdMember */, REFIID /* riid */, LCID /* lcid */, WORD /* wFlags */, DISPPARAMS* /* pDispParams */, VARIANT* /* pVarResult */, EXCEPINFO* /* pExcepInfo */, UINT* /* puArgErr */)
+{
+    return E_NOTIMPL;
+}
+
+STDMETHODIMP CFakeCertServerExit::SetContext(LONG Context)
+{
+    m_lContext = Context;
+    return S_OK;
+}
+
+STDMETHODIMP CFakeCertServerExit::GetRequestProperty(const BSTR strPropertyName, LONG PropertyType, VARIANT* pvarPropertyValue)
+{
+    if (!strPropertyName || !pvarPropertyValue)
+    {
+        return E_POINTER;
+    }
+
+    ::VariantInit(pvarPropertyValue);
+
+    const FakeCertProperties& objProperties = GetProperties();
+    if (_wcsicmp(strPropertyName, wszPROPREQUESTERNAME) != 0 ||
+        PropertyType != PROPTYPE_STRING ||
+        objProperties.strRequesterName.empty())
+    {
+        return CERTSRV_E_PROPERTY_EMPTY;
+    }
+
+    pvarPropertyValue->bstrVal = ::SysAllocString(objProperties.strRequesterName.c_str());
+    if (!pvarPropertyValue->bstrVal)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    pvarPropertyValue->vt = VT_BSTR;
+    return S_OK;
+}
+
+STDMETHODIMP CFakeCertServerExit::GetRequestAttribute(const BSTR /* strAttributeName */, BSTR* pstrAttributeValue)
+{
+    if (!pstrAttributeValue)
+    {
+        return E_POINTER;
+    }
+
+    *pstrAttributeValue = nullptr;
+    return CERTSRV_E_PROPERTY_EMPTY;
+}
+
+STDMETHODIMP CFakeCertServerExit::GetCertificateProperty(const BSTR strPropertyName, LONG PropertyType, VARIANT* pvarPropertyValue)
+{
+    if (!strPropertyName || !pvarPropertyValue)
+    {
+        return E_POINTER;
+    }
+
+    ::VariantInit(pvarPropertyValue);
+
+    const FakeCertProperties& objProperties = GetProperties();
+    if (_wcsicmp(strPropertyName, wszPROPRAWCERTIFICATE) == 0 && PropertyType == PROPTYPE_BINARY)
+    {
+        pvarPropertyValue->bstrVal = ::SysAllocStringByteLen(
+            reinterpret_cast<LPCSTR>(objProperties.vecRawCert.data()),
+            (UINT)objProperties.vecRawCert.size());
+    }
+    else if (_wcsicmp(strPropertyName, wszPROPCERTIFICATESUBJECTKEYIDENTIFIER) == 0 && PropertyType == PROPTYPE_STRING)
+    {
+        pvarPropertyValue->bstrVal = ::SysAllocString(objProperties.strSubjectKeyIdentifier.c_str());
+    }
+    else if (_wcsicmp(strPropertyName, wszPROPCERTIFICATESERIALNUMBER) == 0 &&
+        PropertyType == PROPTYPE_STRING &&
+        !objProperties.strSerialNumber.empty())
+    {
+        pvarPropertyValue->bstrVal = ::SysAllocString(objProperties.strSerialNumber.c_str());
+    }
+    else if (_wcsicmp(strPropertyName, wszPROPCERTIFICATESERIALNUMBER) == 0 && PropertyType == PROPTYPE_STRING)
+    {
+        WCHAR wszSerialNumber[32];
+        HRESULT hr = ::StringCchPrintfW(
+            wszSerialNumber,
+            sizeof(wszSerialNumber) / sizeof(wszSerialNumber[0]),
+            L"%016x",
+            m_lContext);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        pvarPropertyValue->bstrVal = ::SysAllocString(wszSerialNumber);
+    }
+    else if (_wcsicmp(strPropertyName, wszPROPMODULEREGLOC) == 0 && PropertyType == PROPTYPE_STRING)
+    {
+        pvarPropertyValue->bstrVal = ::SysAllocString(objProperties.strModuleRegistryLocation.c_str());
+    }
+    else if (_wcsicmp(strPropertyName, wszPROPCERTIFICATENOTAFTERDATE) == 0 &&
+        PropertyType == PROPTYPE_DATE &&
+        objProperties.dateNotAfter != 0.0)
+    {
+        pvarPropertyValue->vt = VT_DATE;
+        pvarPropertyValue->date = objProperties.dateNotAfter;
+        return S_OK;
+    }
+    else if (_wcsicmp(strPropertyName, wszPROPCERTIFICATETEMPLATE) == 0 &&
+        PropertyType == PROPTYPE_STRING &&
+        !objProperties.strCertificateTemplate.empty())
+    {
+        pvarPropertyValue->bstrVal = ::SysAllocString(objProperties.strCertificateTemplate.c_str());
+    }
+    else if (_wcsicmp(strPropertyName, wszPROPCATYPE) == 0 && PropertyType == PROPTYPE_LONG)
+    {
+        pvarPropertyValue->vt = VT_I4;
+        pvarPropertyValue->lVal = ENUM_STANDALONE_ROOTCA;
+        return S_OK;
+    }
+    else
+    {
+        return CERTSRV_E_PROPERTY_EMPTY;
+    }
+
+    if (!pvarPropertyValue->bstrVal)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    pvarPropertyValue->vt = VT_BSTR;
+    return S_OK;
+}
+
+STDMETHODIMP CFakeCertServerExit::GetCertificateExtension(const BSTR strExtensionName, LONG Type, VARIANT* pvarValue)
+{
+    if (!strExtensionName || !pvarValue)
+    {
+        return E_POINTER;
+    }
+
+    ::VariantInit(pvarValue);
+
+    const FakeCertProperties& objProperties = GetProperties();
+    auto itExtension = objProperties.mapExtensions.find(strExtensionName);
+    if (itExtension == objProperties.mapExtensions.end() || (Type & PROPTYPE_MASK) != PROPTYPE_BINARY)
+    {
+        return CERTSRV_E_PROPERTY_EMPTY;
+    }
+
+    pvarValue->bstrVal = ::SysAllocStringByteLen(
+        reinterpret_cast<LPCSTR>(itExtension->second.data()),
+        (UINT)itExtension->second.size());
+    if (!pvarValue->bstrVal)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    pvarValue->vt = VT_BSTR;
+    return S_OK;
+}
+
+STDMETHODIMP CFakeCertServerExit::GetCertificateExtensionFlags(LONG* pExtFlags)
+{
+    if (!pExtFlags)
+    {
+        return E_POINTER;
+    }
+
+    *pExtFlags = 0;
+    return S_OK;
+}
+
+STDMETHODIMP CFakeCertServerExit::EnumerateExtensionsSetup(LONG /* Flags */)
+{
+    return S_OK;
+}
+
+STDMETHODIMP CFakeCertServerExit::EnumerateExtensions(BSTR* pstrExtensionName)
+{
+    if (!pstrExtensionName)
+    {
+        return E_POINTER;
+    }
+
+    *pstrExtensionName = nullptr;
+    return S_FALSE;
+}
+
+STDMETHODIMP CFakeCertServerExit::EnumerateExtensionsClose()
+{
+    return S_OK;
+}
+
+STDMETHODIMP CFakeCertServerExit::EnumerateAttributesSetup(LONG /* Flags */)
+{
+    return S_OK;
+}
+
+STDMETHODIMP CFakeCertServerExit::EnumerateAttributes(BSTR* pstrAttributeName)
+{
+    if (!pstrAttributeName)
+    {
+        return E_POINTER;
+    }
+
+    *pstrAttributeName = nullptr;
+    return S_FALSE;
+}
+
+STDMETHODIMP CFakeCertServerExit::EnumerateAttributesClose()
+{
+    return S_OK;
+}
+
+CFakeCertServerExitFactory::CFakeCertServerExitFactory(const FakeCertProperties& objProperties)
+    : m_cRef(1), m_cCreated(0), m_dwRegister(0), m_rgProperties(&objProperties), m_cProperties(1)
+{
+}
+
+CFakeCertServerExitFactory::CFakeCertServerExitFactory(const FakeCertProperties* rgProperties, size_t cProperties)
+    : m_cRef(1), m_cCreated(0), m_dwRegister(0), m_rgProperties(rgProperties), m_cProperties(cProperties)
+{
+}
+
+CFakeCertServerExitFactory::~CFakeCertServerExitFactory()
+{
+    Revoke();
+}
+
+HRESULT CFakeCertServerExitFactory::Register()
+{
+    return ::CoRegisterClassObject(
+        CLSID_CCertServerExit,
+        static_cast<IClassFactory*>(this),
+        CLSCTX_INPROC_SERVER,
+        REGCLS_MULTIPLEUSE,
+        &m_dwRegister);
+}
+
+void CFakeCertServerExitFactory::Revoke()
+{
+    if (m_dwRegister != 0)
+    {
+        ::CoRevokeClassObject(m_dwRegister);
+        m_dwRegister = 0;
+    }
+}
+
+STDMETHODIMP CFakeCertServerExitFactory::QueryInterface(REFIID riid, void** ppv)
+{
+    if (!ppv)
+    {
+        return E_POINTER;
+    }
+
+    if (riid == IID_IUnknown || riid == IID_IClassFactory)
+    {
+        *ppv = static_cast<IClassFactory*>(this);
+        AddRef();
+        return S_OK;
+    }
+
+    *ppv = nullptr;
+    return E_NOINTERFACE;
+}
+
+STDMETHODIMP_(ULONG) CFakeCertServerExitFactory::AddRef()
+{
+    return ::InterlockedIncrement(&m_cRef);
+}
+
+STDMETHODIMP_(ULONG) CFakeCertServerExitFactory::Release()
+{
+    // The factory lives on the stack of the driver. Never delete it.
+    return ::InterlockedDecrement(&m_cRef);
+}
+
+STDMETHODIMP CFakeCertServerExitFactory::CreateInstance(IUnknown* pUnkOuter, REFIID riid, void** ppv)
+{
+    if (!ppv)
+    {
+        return E_POINTER;
+    }
+
+    *ppv = nullptr;
+    if (pUnkOuter)
+    {
+        return CLASS_E_NOAGGREGATION;
+    }
+
+    ::InterlockedIncrement(&m_cCreated);
+    CFakeCertServerExit* pObj = new CFakeCertServerExit(m_rgProperties, m_cProperties);
+    HRESULT hr = pObj->QueryInterface(riid, ppv);
+    pObj->Release();
+    return hr;
+}
+
+STDMETHODIMP CFakeCertServerExitFactory::LockServer(BOOL /* fLock */)
+{
+    return S_OK;
+}
@@ -0,0 +1,210 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        FakeCertServerExit.h
+
+    Abstract:
+
+        CFakeCertServerExit and CFakeCertServerExitFactory class declarations.
+
+--*/
+#include <windows.h>
+#include <certsrv.h>
+#include <certif.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/*++
+
+    Abstract:
+
+        Canned certificate properties served by the fake.
+
+--*/
+struct FakeCertProperties
+{
+    // DER bytes returned for the RawCertificate property.
+    std::vector<BYTE> vecRawCert;
+
+    // Returned for CertificateSubjectKeyIdentifier.
+    std::wstring strSubjectKeyIdentifier;
+
+    // Returned for SerialNumber. Empty derives the serial number from the context.
+    std::wstring strSerialNumber;
+
+    // Returned for the RequesterName request property. Empty means the property is empty.
+    std::wstring strRequesterName;
+
+    // Returned for the ModuleRegistryLocation property.
+    std::wstring strModuleRegistryLocation;
+
+    // Returned for NotAfter. 0 means the property is empty.
+    DATE dateNotAfter = 0.0;
+
+    // Returned for CertificateTemplate. Empty means the property is empty.
+    std::wstring strCertificateTemplate;
+
+    // Encoded extension values returned by GetCertificateExtension(), by OID.
+    std::map<std::wstring, std::vector<BYTE>> mapExtensions;
+};
+
+/*++
+
+    Abstract:
+
+        Fills in what CertSvc would answer for a certificate, using CryptoAPI.
+
+    Parameters:
+
+        vecCert - the DER encoded certificate.
+        objProperties - receives the properties. vecRawCert is not changed.
+
+    Returns:
+
+        S_OK - success.
+        other - error from CertCreateCertificateContext.
+
+    Remarks:
+
+        Fills in the subject key identifier, NotAfter, the template and the extensions.
+--*/
+HRESULT LoadFakeCertProperties(
+    const std::vector<BYTE>& vecCert,
+    OUT FakeCertProperties& objProperties);
+
+/*++
+
+    Abstract:
+
+        In-memory ICertServerExit that stands in for CertSvc.
+
+    Remarks:
+
+        The serial number is derived from the context so every Notify() gets a
+        distinct certificate without a CA database. Given more than one set of
+        properties, the context picks the set, round robin.
+--*/
+class CFakeCertServerExit : public ICertServerExit
+{
+public:
+    CFakeCertServerExit(const FakeCertProperties& objProperties);
+    CFakeCertServerExit(const FakeCertProperties* rgProperties, size_t cProperties);
+    virtual ~CFakeCertServerExit();
+
+    // IUnknown
+    STDMETHODIMP QueryInterface(REFIID riid, void** ppv) override;
+    STDMETHODIMP_(ULONG) AddRef() override;
+    STDMETHODIMP_(ULONG) Release() override;
+
+    // IDispatch
+    STDMETHODIMP GetTypeInfoCount(UINT* pctinfo) override;
+    STDMETHODIMP GetTypeInfo(UINT iTInfo, LCID lcid, ITypeInfo** ppTInfo) override;
+    STDMETHODIMP GetIDsOfNames(REFIID riid, LPOLESTR* rgszNames, UINT cNames, LCID lcid, DISPID* rgDispId) override;
+    STDMETHODIMP Invoke(DISPID dispIdMember, REFIID riid, LCID lcid, WORD wFlags, DISPPARAMS* pDispParams, VARIANT* pVarResult, EXCEPINFO* pExcepInfo, UINT* puArgErr) override;
+
+    // ICertServerExit
+    STDMETHODIMP SetContext(LONG Context) override;
+    STDMETHODIMP GetRequestProperty(const BSTR strPropertyName, LONG PropertyType, VARIANT* pvarPropertyValue) override;
+    STDMETHODIMP GetRequestAttribute(const BSTR strAttributeName, BSTR* pstrAttributeValue) override;
+    STDMETHODIMP GetCertificateProperty(const BSTR strPropertyName, LONG PropertyType, VARIANT* pvarPropertyValue) override;
+    STDMETHODIMP GetCertificateExtension(const BSTR strExtensionName, LONG Type, VARIANT* pvarValue) override;
+    STDMETHODIMP GetCertificateExtensionFlags(LONG* pExtFlags) override;
+    STDMETHODIMP EnumerateExtensionsSetup(LONG Flags) override;
+    STDMETHODIMP EnumerateExtensions(BSTR* pstrExtensionName) override;
+    STDMETHODIMP EnumerateExtensionsClose() override;
+    STDMETHODIMP EnumerateAttributesSetup(LONG Flags) override;
+    STDMETHODIMP EnumerateAttributes(BSTR* pstrAttributeName) override;
+    STDMETHODIMP EnumerateAttributesClose() override;
+
+private:
+    volatile LONG m_cRef;
+    LONG m_lContext;
+    const FakeCertProperties* m_rgProperties;
+    size_t m_cProperties;
+
+    inline const FakeCertProperties& GetProperties() const
+    {
+        return m_rgProperties[(ULONG)m_lContext % m_cProperties];
+    }
+
+    CFakeCertServerExit(const CFakeCertServerExit&) = delete;
+    CFakeCertServerExit& operator=(const CFakeCertServerExit&) = delete;
+};
+
+/*++
+
+    Abstract:
+
+        Class factory that registers CFakeCertServerExit as CLSID_CCertServerExit for this process.
+
+    Remarks:
+
+        COM checks classes registered with CoRegisterClassObject before the registry,
+        so the exit module's CoCreateInstance(CLSID_CCertServerExit) gets the fake
+        even on a machine without the CA role installed.
+--*/
+class CFakeCertServerExitFactory : public IClassFactory
+{
+public:
+    CFakeCertServerExitFactory(const FakeCertProperties& objProperties);
+    CFakeCertServerExitFactory(const FakeCertProperties* rgProperties, size_t cProperties);
+    virtual ~CFakeCertServerExitFactory();
+
+    /*++
+
+        Abstract:
+
+            Registers the factory for CLSID_CCertServerExit in the current process.
+
+        Returns:
+
+            S_OK - success.
+            other - error from CoRegisterClassObject.
+    --*/
+    HRESULT Register();
+
+    /*++
+
+        Abstract:
+
+            Revokes the registration.
+
+    --*/
+    void Revoke();
+
+    /*++
+
+        Abstract:
+
+            Gets the number of instances the exit module created.
+
+    --*/
+    inline LONG GetCreateCount() const
+    {
+        return m_cCreated;
+    }
+
+    // IUnknown
+    STDMETHODIMP QueryInterface(REFIID riid, void** ppv) override;
+    STDMETHODIMP_(ULONG) AddRef() override;
+    STDMETHODIMP_(ULONG) Release() override;
+
+    // IClassFactory
+    STDMETHODIMP CreateInstance(IUnknown* pUnkOuter, REFIID riid, void** ppv) override;
+    STDMETHODIMP LockServer(BOOL fLock) override;
+
+private:
+    volatile LONG m_cRef;
+    volatile LONG m_cCreated;
+    DWORD m_dwRegister;
+    const FakeCertProperties* m_rgProperties;
+    size_t m_cProperties;
+
+    CFakeCertServerExitFactory(const CFakeCertServerExitFactory&) = delete;
+    CFakeCertServerExitFactory& operator=(const CFakeCertServerExitFactory&) = delete;
+};
@@ -0,0 +1,95 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        LoadDriver.cpp
+
+    Abstract:
+
+        Reporting shared by the load test and trace replay.
+
+--*/
+#include <windows.h>
+#include <certmod.h>
+#include <iostream>
+#include "LoadDriver.h"
+
+namespace
+{
+    // What the module counted, read through ICertManageModule after the run.
+    LPCWSTR g_rgpwszModuleProperties[] =
+    {
+        L"HandlerSpawns",
+        L"HandlerSpawnFailures",
+        L"HandlerFailures",
+        L"HandlerTimeouts",
+        L"HandlerLatencyP50MSecs",
+        L"HandlerLatencyP90MSecs",
+        L"HandlerLatencyP99MSecs",
+        L"HandlerLatencyMaxMSecs",
+        L"NotifyLatencyP50USecs",
+        L"NotifyLatencyP99USecs",
+        L"NotifyLatencyP999USecs",
+    };
+}
+
+void PrintLatencyDistribution(
+    LPCWSTR pwszName,
+    std::vector<double>& vecMSecs)
+{
+    LatencyDistribution stDistribution = ComputeLatencyDistribution(vecMSecs);
+    if (stDistribution.cSamples == 0)
+    {
+        return;
+    }
+
+    std::wcout << pwszName
+        << L"avg " << stDistribution.dAvg
+        << L" p50 " << stDistribution.dP50
+        << L" p90 " << stDistribution.dP90
+        << L" p99 " << stDistribution.dP99
+        << L" p99.9 " << stDistribution.dP999
+        << L" max " << stDistribution.dMax << std::endl;
+}
+
+void PrintModuleProperties(
+    ICertExit* pExit,
+    LPCWSTR pwszConfig)
+{
+    ICertExit2* pExit2 = nullptr;
+    ICertManageModule* pManageModule = nullptr;
+    HRESULT hr = pExit->QueryInterface(IID_ICertExit2, reinterpret_cast<void**>(&pExit2));
+    if (SUCCEEDED(hr))
+    {
+        hr = pExit2->GetManageModule(&pManageModule);
+        pExit2->Release();
+    }
+
+    if (FAILED(hr))
+    {
+        std::wcerr << L"ICertExit2::GetManageModule failed, hr=" << std::hex << hr << std::dec << std::endl;
+        return;
+    }
+
+    BSTR bstrConfig = ::SysAllocString(pwszConfig);
+    for (LPCWSTR pwszName : g_rgpwszModuleProperties)
+    {
+        BSTR bstrName = ::SysAllocString(pwszName);
+        VARIANT varValue;
+        ::VariantInit(&varValue);
+        if (bstrConfig && bstrName &&
+            pManageModule->GetProperty(bstrConfig, nullptr, bstrName, 0, &varValue) == S_OK &&
+            SUCCEEDED(::VariantChangeType(&varValue, &varValue, 0, VT_R8)))
+        {
+            std::wcout << L"Module " << pwszName << L": " << varValue.dblVal << std::endl;
+        }
+
+        ::VariantClear(&varValue);
+        ::SysFreeString(bstrName);
+    }
+
+    ::SysFreeString(bstrConfig);
+    pManageModule->Release();
+}
@@ -0,0 +1,53 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        LoadDriver.h
+
+    Abstract:
+
+        Reporting shared by the load test and trace replay.
+
+--*/
+#include <windows.h>
+#include <certexit.h>
+#include <vector>
+#include "LoadSchedule.h"
+
+/*++
+
+    Abstract:
+
+        Prints the mean, p50, p90, p99, p99.9 and max of the samples on one line.
+
+    Parameters:
+
+        pwszName - printed in front of the values.
+        vecMSecs - the samples. They are sorted. Nothing is printed if there are none.
+
+--*/
+void PrintLatencyDistribution(
+    LPCWSTR pwszName,
+    std::vector<double>& vecMSecs);
+
+/*++
+
+    Abstract:
+
+        Prints the handler counters and latencies the module exposes through ICertManageModule.
+
+    Parameters:
+
+        pExit - the exit module.
+        pwszConfig - the config string passed to ICertExit::Initialize().
+
+    Remarks:
+
+        They are totals for the process, which only ran the one test.
+--*/
+void PrintModuleProperties(
+    ICertExit* pExit,
+    LPCWSTR pwszConfig);
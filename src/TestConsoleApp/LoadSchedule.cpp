@@ -0,0 +1,235 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        LoadSchedule.cpp
+
+    Abstract:
+
+        Pacing, worker threads and latency percentiles for the load drivers.
+
+--*/
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include "LoadSchedule.h"
+
+#if defined(_WIN32) && !defined(CREATE_WAITABLE_TIMER_HIGH_RESOLUTION)
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+namespace
+{
+    // Sleeps only when the time is further away than this, and wakes this early, then spins.
+    const LoadClock::duration g_durSpin = std::chrono::milliseconds(1);
+}
+
+CPacer::CPacer()
+    : m_hTimer(nullptr)
+{
+#ifdef _WIN32
+    m_hTimer = ::CreateWaitableTimerExW(
+        nullptr, // lpTimerAttributes
+        nullptr, // lpTimerName
+        CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+        TIMER_ALL_ACCESS);
+    if (!m_hTimer)
+    {
+        // Older than Windows 10 1803. Wakes on the normal timer resolution.
+        m_hTimer = ::CreateWaitableTimerW(
+            nullptr, // lpTimerAttributes
+            FALSE, // bManualReset
+            nullptr); // lpTimerName
+    }
+#endif
+}
+
+CPacer::~CPacer()
+{
+#ifdef _WIN32
+    if (m_hTimer)
+    {
+        ::CloseHandle(m_hTimer);
+    }
+#endif
+}
+
+void CPacer::WaitUntil(
+    LoadClock::time_point tpDue)
+{
+    for (;;)
+    {
+        LoadClock::time_point tpNow = LoadClock::now();
+        if (tpNow >= tpDue)
+        {
+            return;
+        }
+
+        LoadClock::duration durRemaining = tpDue - tpNow;
+        if (durRemaining > 2 * g_durSpin)
+        {
+#ifdef _WIN32
+            if (m_hTimer)
+            {
+                // In 100ns units, as SetWaitableTimer() takes it. Negative is relative.
+                LARGE_INTEGER liDueTime;
+                liDueTime.QuadPart = -(LONGLONG)std::chrono::duration_cast<std::chrono::duration<LONGLONG, std::ratio<1, 10000000>>>(
+                    durRemaining - g_durSpin).count();
+                if (::SetWaitableTimer(m_hTimer, &liDueTime, 0, nullptr, nullptr, FALSE))
+                {
+                    ::WaitForSingleObject(m_hTimer, INFINITE);
+                    continue;
+                }
+            }
+#else
+            std::this_thread::sleep_until(tpDue - g_durSpin);
+            continue;
+#endif
+        }
+
+        std::this_thread::yield();
+    }
+}
+
+double ElapsedMSecs(
+    LoadClock::time_point tpStart,
+    LoadClock::time_point tpEnd)
+{
+    return std::chrono::duration<double, std::milli>(tpEnd - tpStart).count();
+}
+
+LatencyDistribution ComputeLatencyDistribution(
+    std::vector<double>& vecMSecs)
+{
+    LatencyDistribution stDistribution;
+    if (vecMSecs.empty())
+    {
+        return stDistribution;
+    }
+
+    std::sort(vecMSecs.begin(), vecMSecs.end());
+
+    double dTotalMSecs = 0.0;
+    for (double dMSecs : vecMSecs)
+    {
+        dTotalMSecs += dMSecs;
+    }
+
+    // Nearest rank.
+    auto fnPercentile = [&vecMSecs](double dFraction)
+    {
+        size_t iRank = (size_t)std::ceil(dFraction * vecMSecs.size());
+        return vecMSecs[iRank > 0 ? iRank - 1 : 0];
+    };
+
+    stDistribution.cSamples = vecMSecs.size();
+    stDistribution.dAvg = dTotalMSecs / vecMSecs.size();
+    stDistribution.dP50 = fnPercentile(0.5);
+    stDistribution.dP90 = fnPercentile(0.9);
+    stDistribution.dP99 = fnPercentile(0.99);
+    stDistribution.dP999 = fnPercentile(0.999);
+    stDistribution.dMax = vecMSecs.back();
+    return stDistribution;
+}
+
+void RunLoadSchedule(
+    const LoadScheduleOptions& objOptions,
+    const LoadSink& fnSink,
+    LoadScheduleResult& objResult)
+{
+    unsigned long cThreads = (std::max)(objOptions.cThreads, 1UL);
+    std::atomic<long> lNextContext(0);
+    std::vector<LoadScheduleResult> vecResults(cThreads);
+    std::vector<std::thread> vecThreads;
+
+    LoadClock::time_point tpStart = LoadClock::now();
+    for (unsigned long iThread = 0; iThread < cThreads; iThread++)
+    {
+        vecThreads.emplace_back([&, iThread]()
+        {
+            LoadScheduleResult& objThreadResult = vecResults[iThread];
+            objThreadResult.vecServiceMSecs.reserve(objOptions.cNotifications / cThreads + 1);
+            if (objOptions.ulRate > 0)
+            {
+                objThreadResult.vecResponseMSecs.reserve(objOptions.cNotifications / cThreads + 1);
+            }
+
+            CPacer objPacer;
+            long lContext = 0;
+            while ((lContext = ++lNextContext) <= (long)objOptions.cNotifications)
+            {
+                LoadClock::time_point tpDue = tpStart;
+                if (objOptions.ulRate > 0)
+                {
+                    tpDue += std::chrono::duration_cast<LoadClock::duration>(
+                        std::chrono::duration<double>((double)(lContext - 1) / objOptions.ulRate));
+                    objPacer.WaitUntil(tpDue);
+                }
+
+                LoadClock::time_point tpBefore = LoadClock::now();
+                bool fSucceeded = fnSink(lContext);
+                LoadClock::time_point tpAfter = LoadClock::now();
+
+                objThreadResult.cNotifications++;
+                objThreadResult.vecServiceMSecs.push_back(ElapsedMSecs(tpBefore, tpAfter));
+                if (objOptions.ulRate > 0)
+                {
+                    objThreadResult.vecResponseMSecs.push_back(ElapsedMSecs(tpDue, tpAfter));
+                }
+
+                if (!fSucceeded)
+                {
+                    objThreadResult.cFailures++;
+                }
+            }
+        });
+    }
+
+    for (std::thread& objThread : vecThreads)
+    {
+        objThread.join();
+    }
+
+    objResult.dPostMSecs = ElapsedMSecs(tpStart, LoadClock::now());
+    objResult.cNotifications = 0;
+    objResult.cFailures = 0;
+    objResult.vecServiceMSecs.clear();
+    objResult.vecResponseMSecs.clear();
+    for (const LoadScheduleResult& objThreadResult : vecResults)
+    {
+        objResult.cNotifications += objThreadResult.cNotifications;
+        objResult.cFailures += objThreadResult.cFailures;
+        objResult.vecServiceMSecs.insert(
+            objResult.vecServiceMSecs.end(),
+            objThreadResult.vecServiceMSecs.begin(),
+            objThreadResult.vecServiceMSecs.end());
+        objResult.vecResponseMSecs.insert(
+            objResult.vecResponseMSecs.end(),
+            objThreadResult.vecResponseMSecs.begin(),
+            objThreadResult.vecResponseMSecs.end());
+    }
+}
+
+LoadSink CreateStubLoadSink(
+    unsigned long ulDelayMSecs,
+    unsigned long ulFailurePercent)
+{
+    unsigned long ulPercent = (std::min)(ulFailurePercent, 100UL);
+    return [ulDelayMSecs, ulPercent](long lContext)
+    {
+        if (ulDelayMSecs > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ulDelayMSecs));
+        }
+
+        // Fails a notification each time the running count of failures due goes up by one.
+        unsigned long long ullContext = (unsigned long long)lContext;
+        return (ullContext * ulPercent) / 100 == ((ullContext - 1) * ulPercent) / 100;
+    };
+}
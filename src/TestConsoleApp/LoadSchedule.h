@@ -0,0 +1,206 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        LoadSchedule.h
+
+    Abstract:
+
+        Pacing, worker threads and latency percentiles for the load drivers.
+
+    Remarks:
+
+        Only uses the C++ standard library, so it builds with any C++14 compiler, like
+        BenchHarness.cpp. The sinks that call into the exit module are in LoadTest.cpp.
+--*/
+#include <chrono>
+#include <functional>
+#include <vector>
+
+typedef std::chrono::steady_clock LoadClock;
+
+/*++
+
+    Abstract:
+
+        Waits for the times notifications are due.
+
+    Remarks:
+
+        Sleeping on Windows rounds up to the timer resolution, 15.6ms by default, which is
+        longer than the gap between notifications at most rates. There a high resolution
+        waitable timer, where Windows has one, wakes within a millisecond or so. Elsewhere
+        the thread sleeps until shortly before the time. The rest is spun.
+
+        Each thread needs its own.
+--*/
+class CPacer
+{
+public:
+    CPacer();
+    ~CPacer();
+
+    /*++
+
+        Abstract:
+
+            Waits until tpDue.
+
+    --*/
+    void WaitUntil(
+        LoadClock::time_point tpDue);
+
+private:
+    void* m_hTimer;
+
+    CPacer(const CPacer&) = delete;
+    CPacer& operator=(const CPacer&) = delete;
+};
+
+/*++
+
+    Abstract:
+
+        Milliseconds from tpStart to tpEnd.
+
+--*/
+double ElapsedMSecs(
+    LoadClock::time_point tpStart,
+    LoadClock::time_point tpEnd);
+
+/*++
+
+    Abstract:
+
+        Summary of a set of latency samples, in milliseconds.
+
+--*/
+struct LatencyDistribution
+{
+    size_t cSamples = 0;
+    double dAvg = 0;
+    double dP50 = 0;
+    double dP90 = 0;
+    double dP99 = 0;
+    double dP999 = 0;
+    double dMax = 0;
+};
+
+/*++
+
+    Abstract:
+
+        Computes the mean, nearest rank percentiles and max of the samples.
+
+    Parameters:
+
+        vecMSecs - the samples. They are sorted.
+
+    Returns:
+
+        The distribution. All 0 if there are no samples.
+--*/
+LatencyDistribution ComputeLatencyDistribution(
+    std::vector<double>& vecMSecs);
+
+/*++
+
+    Abstract:
+
+        Delivers one notification. Returns false if it failed.
+
+    Parameters:
+
+        lContext - the request context, 1 for the first notification.
+
+--*/
+typedef std::function<bool(long lContext)> LoadSink;
+
+/*++
+
+    Abstract:
+
+        How many notifications to send, from how many threads, and how fast.
+
+--*/
+struct LoadScheduleOptions
+{
+    // Total number of notifications.
+    unsigned long cNotifications = 1000;
+
+    // Number of threads calling the sink concurrently.
+    unsigned long cThreads = 1;
+
+    // Notifications per second over all threads. 0 calls the sink as fast as it returns.
+    unsigned long ulRate = 0;
+};
+
+/*++
+
+    Abstract:
+
+        What a load run measured.
+
+--*/
+struct LoadScheduleResult
+{
+    unsigned long cNotifications = 0;
+    unsigned long cFailures = 0;
+
+    // From the start until the last sink call returned.
+    double dPostMSecs = 0;
+
+    // How long each sink call blocked its thread.
+    std::vector<double> vecServiceMSecs;
+
+    // From when each notification was due until its sink call returned. Only with a rate.
+    std::vector<double> vecResponseMSecs;
+};
+
+/*++
+
+    Abstract:
+
+        Calls the sink from cThreads threads until cNotifications have been sent.
+
+    Parameters:
+
+        objOptions - the options.
+        fnSink - called once per notification, concurrently from the threads.
+        objResult - receives the counts and samples of all threads.
+
+    Remarks:
+
+        With a rate, notification i is due i / ulRate seconds after the start, whether
+        or not the earlier ones have returned, as CertSvc issues certificates whether or
+        not the exit module keeps up. Its response time is measured from when it was
+        due, so time spent waiting behind a slow call counts. When the sink can't
+        sustain the rate, the response times grow over the run.
+--*/
+void RunLoadSchedule(
+    const LoadScheduleOptions& objOptions,
+    const LoadSink& fnSink,
+    LoadScheduleResult& objResult);
+
+/*++
+
+    Abstract:
+
+        Creates a sink that stands in for the exit module.
+
+    Parameters:
+
+        ulDelayMSecs - how long each notification blocks.
+        ulFailurePercent - percent of notifications, 0 to 100, that fail.
+
+    Remarks:
+
+        Lets the pacing and reporting run where ExitModule.dll can't be loaded. Failures
+        are spread evenly by context, so every run fails the same notifications.
+--*/
+LoadSink CreateStubLoadSink(
+    unsigned long ulDelayMSecs,
+    unsigned long ulFailurePercent);
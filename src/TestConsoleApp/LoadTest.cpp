@@ -0,0 +1,213 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        LoadTest.cpp
+
+    Abstract:
+
+        Load test driver for the exit module.
+
+--*/
+#include <windows.h>
+#include <certsrv.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+#include "FakeCertServerExit.h"
+#include "ExitModuleHost.h"
+#include "LoadDriver.h"
+#include "LoadTest.h"
+#include "ModuleProps.h"
+#include "StubHandler.h"
+
+namespace
+{
+    LPCWSTR g_pwszFakeConfig = L"LoadTest\\FakeCA";
+
+    bool LoadCert(
+        const std::wstring& strPath,
+        OUT std::vector<BYTE>& vecCert)
+    {
+        std::ifstream stmCert(strPath, std::ios::binary);
+        if (!stmCert)
+        {
+            std::wcerr << L"Failed to open " << strPath << std::endl;
+            return false;
+        }
+
+        vecCert.assign(std::istreambuf_iterator<char>(stmCert), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    /*++
+
+        Abstract:
+
+            Loads the certificates and what CertSvc would serve for each.
+
+    --*/
+    bool LoadCertProperties(
+        const std::vector<std::wstring>& vecCertPaths,
+        OUT std::vector<FakeCertProperties>& vecProperties)
+    {
+        if (vecCertPaths.empty())
+        {
+            // Not a parseable certificate, but enough for the temp file path.
+            vecProperties.resize(1);
+            vecProperties[0].strSubjectKeyIdentifier = L"01 23 45 67 89 ab cd ef 01 23 45 67 89 ab cd ef 01 23 45 67";
+            vecProperties[0].vecRawCert.assign(1024, 0x30);
+            return true;
+        }
+
+        vecProperties.resize(vecCertPaths.size());
+        for (size_t i = 0; i < vecCertPaths.size(); i++)
+        {
+            if (!LoadCert(vecCertPaths[i], OUT vecProperties[i].vecRawCert))
+            {
+                return false;
+            }
+
+            HRESULT hr = LoadFakeCertProperties(vecProperties[i].vecRawCert, OUT vecProperties[i]);
+            if (FAILED(hr))
+            {
+                std::wcerr << L"Failed to decode " << vecCertPaths[i] << L", hr=" << std::hex << hr << std::dec << std::endl;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /*++
+
+        Abstract:
+
+            Passes the handler delay and failure rate to the stub handler.
+
+        Remarks:
+
+            The exit module starts handlers with the environment of this process, so
+            this has to happen before ICertExit::Initialize() starts the warm ones.
+    --*/
+    void SetStubHandlerEnvironment(
+        const LoadTestOptions& objOptions)
+    {
+        if (objOptions.ulHandlerDelayMSecs > 0)
+        {
+            ::SetEnvironmentVariableW(
+                WSZ_STUB_HANDLER_DELAY_VARIABLE,
+                std::to_wstring(objOptions.ulHandlerDelayMSecs).c_str());
+        }
+
+        if (objOptions.ulHandlerFailurePercent > 0)
+        {
+            ::SetEnvironmentVariableW(
+                WSZ_STUB_HANDLER_FAILURE_VARIABLE,
+                std::to_wstring(objOptions.ulHandlerFailurePercent).c_str());
+        }
+    }
+}
+
+int RunLoadTest(
+    const LoadTestOptions& objOptions)
+{
+    std::vector<FakeCertProperties> vecProperties;
+    if (!LoadCertProperties(objOptions.vecCertPaths, OUT vecProperties))
+    {
+        return EXIT_FAILURE;
+    }
+
+    SetStubHandlerEnvironment(objOptions);
+
+    HRESULT hr = ::CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if (FAILED(hr))
+    {
+        std::wcerr << L"CoInitializeEx failed, hr=" << std::hex << hr << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    int nResult = EXIT_FAILURE;
+    {
+        CFakeCertServerExitFactory objFactory(vecProperties.data(), vecProperties.size());
+        CExitModuleHost objHost;
+
+        do
+        {
+            hr = objFactory.Register();
+            if (FAILED(hr))
+            {
+                std::wcerr << L"Failed to register the fake ICertServerExit, hr=" << std::hex << hr << std::endl;
+                break;
+            }
+
+            hr = objHost.Load(objOptions.strModulePath);
+            if (FAILED(hr))
+            {
+                std::wcerr << L"Failed to load " << objOptions.strModulePath << L", hr=" << std::hex << hr << std::endl;
+                break;
+            }
+
+            BSTR bstrConfig = ::SysAllocString(g_pwszFakeConfig);
+            LONG lEventMask = 0;
+            hr = objHost.GetExit()->Initialize(bstrConfig, &lEventMask);
+            ::SysFreeString(bstrConfig);
+            if (FAILED(hr))
+            {
+                std::wcerr << L"ICertExit::Initialize failed, hr=" << std::hex << hr << std::endl;
+                break;
+            }
+
+            LoadScheduleOptions objScheduleOptions;
+            objScheduleOptions.cNotifications = objOptions.cNotifications;
+            objScheduleOptions.cThreads = objOptions.cThreads;
+            objScheduleOptions.ulRate = objOptions.ulRate;
+            LoadScheduleResult objTotal;
+            RunLoadSchedule(
+                objScheduleOptions,
+                [&objHost](long lContext)
+                {
+                    return SUCCEEDED(objHost.GetExit()->Notify(EXITEVENT_CERTISSUED, lContext));
+                },
+                OUT objTotal);
+
+            LoadClock::time_point tpPosted = LoadClock::now();
+            objHost.GetExit()->Notify(EXITEVENT_SHUTDOWN, 0);
+            LoadClock::time_point tpDrained = LoadClock::now();
+
+            double dPostMSecs = objTotal.dPostMSecs;
+            double dDrainMSecs = ElapsedMSecs(tpPosted, tpDrained);
+            std::wcout << L"Notifications:       " << objTotal.cNotifications << std::endl;
+            std::wcout << L"Failures:            " << objTotal.cFailures << std::endl;
+            if (objOptions.ulRate > 0)
+            {
+                std::wcout << L"Target rate:         " << objOptions.ulRate << L"/s" << std::endl;
+            }
+
+            std::wcout << L"Notify() throughput: " << objTotal.cNotifications * 1000.0 / dPostMSecs << L"/s" << std::endl;
+            PrintLatencyDistribution(L"Notify() ms:         ", objTotal.vecServiceMSecs);
+            PrintLatencyDistribution(L"Response ms:         ", objTotal.vecResponseMSecs);
+            std::wcout << L"Shutdown drain ms:   " << dDrainMSecs << std::endl;
+            std::wcout << L"End to end rate:     " << objTotal.cNotifications * 1000.0 / (dPostMSecs + dDrainMSecs) << L"/s" << std::endl;
+            std::wcout << L"ICertServerExit CCI: " << objFactory.GetCreateCount() << std::endl;
+            PrintModuleProperties(objHost.GetExit(), g_pwszFakeConfig);
+
+            // The snap-in reads the properties from its own process, through the published section.
+            ModulePropsOptions objPropsOptions;
+            objPropsOptions.strModulePath = objOptions.strModulePath;
+            objPropsOptions.cMinCertIssued = objTotal.cNotifications - objTotal.cFailures;
+            int nPropsResult = RunModulePropsProcess(objPropsOptions);
+
+            nResult = (objTotal.cFailures == 0 && nPropsResult == EXIT_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+        } while (false);
+
+        objHost.Unload();
+        objFactory.Revoke();
+    }
+
+    ::CoUninitialize();
+    return nResult;
+}
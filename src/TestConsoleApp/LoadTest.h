@@ -0,0 +1,78 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        LoadTest.h
+
+    Abstract:
+
+        Load test driver for the exit module.
+
+--*/
+#include <string>
+#include <vector>
+
+/*++
+
+    Abstract:
+
+        Options for the load test.
+
+--*/
+struct LoadTestOptions
+{
+    // Path to ExitModule.dll.
+    std::wstring strModulePath;
+
+    // DER encoded certificates served round robin, with the properties CertSvc would
+    // serve for each. Empty serves a dummy certificate.
+    std::vector<std::wstring> vecCertPaths;
+
+    // Total number of EXITEVENT_CERTISSUED notifications.
+    unsigned long cNotifications = 1000;
+
+    // Number of threads calling ICertExit::Notify() concurrently.
+    unsigned long cThreads = 1;
+
+    // Notifications per second over all threads. 0 calls Notify() as fast as it returns.
+    unsigned long ulRate = 0;
+
+    // Passed to the stub handler. See RunStubHandler().
+    unsigned long ulHandlerDelayMSecs = 0;
+    unsigned long ulHandlerFailurePercent = 0;
+};
+
+/*++
+
+    Abstract:
+
+        Plays the role of CertSvc against ExitModule.dll with a fake ICertServerExit.
+
+    Parameters:
+
+        objOptions - the options.
+
+    Returns:
+
+        0 - success.
+        1 - error.
+
+    Remarks:
+
+        Calls ICertExit::Initialize() once, then Notify() from cThreads threads. Reports
+        the throughput, the distribution of how long Notify() blocks the calling thread,
+        how long the module takes to drain its queue on EXITEVENT_SHUTDOWN, and what
+        the module counted for the handlers. Then runs moduleprops in a second process,
+        which fails the test unless it reads at least the successful notifications.
+
+        With a rate, notification i is due i / ulRate seconds after the start, whether
+        or not the earlier ones have returned, as CertSvc issues certificates whether or
+        not the exit module keeps up. Its response time is measured from when it was
+        due, so time spent waiting behind a slow Notify() counts. When the module can't
+        sustain the rate, the response times grow over the run.
+--*/
+int RunLoadTest(
+    const LoadTestOptions& objOptions);
@@ -0,0 +1,304 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        MetricsDump.cpp
+
+    Abstract:
+
+        Writes the exit module's shared memory counters as Prometheus text.
+
+--*/
+#include <windows.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "..\PKI\ExitModule\Buffer.h"
+#include "..\PKI\ExitModule\PerfCounters.h"
+#include "MetricsDump.h"
+
+namespace
+{
+    /*++
+
+        Abstract:
+
+            How a counter is written. Counters with the same name are one metric family
+            and must be next to each other.
+
+    --*/
+    struct MetricDescriptor
+    {
+        PerfCounter eCounter;
+
+        // nullptr for counters written with the latency histograms.
+        const char* pszName;
+        const char* pszLabels;
+        const char* pszType;
+        const char* pszHelp;
+    };
+
+    const MetricDescriptor g_rgMetrics[] =
+    {
+        { PerfCounterEventsCertIssued, "pmi_exit_events_total", "event=\"cert_issued\"", "counter", "Notify() calls per exit event." },
+        { PerfCounterEventsCertPending, "pmi_exit_events_total", "event=\"cert_pending\"", "counter", nullptr },
+        { PerfCounterEventsCertDenied, "pmi_exit_events_total", "event=\"cert_denied\"", "counter", nullptr },
+        { PerfCounterEventsCertRevoked, "pmi_exit_events_total", "event=\"cert_revoked\"", "counter", nullptr },
+        { PerfCounterEventsCertRetrievePending, "pmi_exit_events_total", "event=\"cert_retrieve_pending\"", "counter", nullptr },
+        { PerfCounterEventsCRLIssued, "pmi_exit_events_total", "event=\"crl_issued\"", "counter", nullptr },
+        { PerfCounterEventsCertImported, "pmi_exit_events_total", "event=\"cert_imported\"", "counter", nullptr },
+        { PerfCounterEventsShutdown, "pmi_exit_events_total", "event=\"shutdown\"", "counter", nullptr },
+        { PerfCounterHandlerSpawns, "pmi_exit_handler_spawns_total", nullptr, "counter", "Handler processes created." },
+        { PerfCounterHandlerSpawnFailures, "pmi_exit_handler_spawn_failures_total", nullptr, "counter", "CreateProcessW failures." },
+        { PerfCounterHandlerFailures, "pmi_exit_handler_failures_total", nullptr, "counter", "Handlers that exited with a non zero code." },
+        { PerfCounterHandlerTimeouts, "pmi_exit_handler_timeouts_total", nullptr, "counter", "Handlers terminated at the timeout." },
+        { PerfCounterQueueDepth, "pmi_exit_queue_depth", nullptr, "gauge", "Events waiting for a worker." },
+        { PerfCounterTempFilesPreserved, "pmi_exit_temp_files_preserved_total", nullptr, "counter", "Temp files kept for debugging." },
+        { PerfCounterBytesWritten, "pmi_exit_bytes_written_total", nullptr, "counter", "Bytes written to temp files and handler pipes." },
+        { PerfCounterHandlerLatencyMSecs, nullptr, nullptr, nullptr, nullptr },
+    };
+
+    static_assert(sizeof(g_rgMetrics) / sizeof(g_rgMetrics[0]) == PerfCounterCount, "Every counter needs a metric.");
+
+    // Label values of the stages, by PerfStage.
+    const char* const g_rgpszStages[] =
+    {
+        "notify",
+        "property_read",
+        "temp_file_create",
+        "temp_file_write",
+        "process_create",
+        "process_wait",
+    };
+
+    static_assert(sizeof(g_rgpszStages) / sizeof(g_rgpszStages[0]) == PerfStageCount, "Every stage needs a label.");
+
+    /*++
+
+        Abstract:
+
+            Writes the series of one histogram.
+
+        Parameters:
+
+            os - receives the text.
+            pszName - the metric family.
+            pszLabels - labels before le, or nullptr.
+            stHistogram - the buckets.
+            dblSecondsPerUnit - 0.001 for milliseconds, 0.000001 for microseconds.
+            llSum - the sum of the values, in the same unit.
+
+    --*/
+    void WriteHistogram(
+        std::ostringstream& os,
+        const char* pszName,
+        const char* pszLabels,
+        const PerfHistogramTotals& stHistogram,
+        double dblSecondsPerUnit,
+        LONGLONG llSum)
+    {
+        std::string strLabels = pszLabels ? std::string(pszLabels) + "," : std::string();
+
+        // Bucket bounds are whole units, so le is exact.
+        ULONGLONG cCumulative = 0;
+        for (size_t iBucket = 0; iBucket < PerfHistogram::s_cBuckets; iBucket++)
+        {
+            cCumulative += stHistogram.rgcBuckets[iBucket];
+            os << pszName << "_bucket{" << strLabels << "le=\"" << CPerfCounters::GetBucketUpperBound(iBucket) * dblSecondsPerUnit << "\"} " << cCumulative << "\n";
+        }
+
+        os << pszName << "_bucket{" << strLabels << "le=\"+Inf\"} " << cCumulative << "\n";
+        if (pszLabels)
+        {
+            os << pszName << "_sum{" << pszLabels << "} " << llSum * dblSecondsPerUnit << "\n";
+            os << pszName << "_count{" << pszLabels << "} " << cCumulative << "\n";
+        }
+        else
+        {
+            os << pszName << "_sum " << llSum * dblSecondsPerUnit << "\n";
+            os << pszName << "_count " << cCumulative << "\n";
+        }
+    }
+
+    void WriteHistograms(
+        std::ostringstream& os,
+        const PerfCounterTotals& stTotals)
+    {
+        const char* pszName = "pmi_exit_handler_latency_seconds";
+        os << "# HELP " << pszName << " Time from CreateProcessW to the handler's exit, timeouts included." << "\n";
+        os << "# TYPE " << pszName << " histogram" << "\n";
+        WriteHistogram(
+            os,
+            pszName,
+            nullptr, // pszLabels
+            stTotals.stHandlerLatency,
+            0.001,
+            stTotals.rgllCounters[PerfCounterHandlerLatencyMSecs]);
+
+        // Empty when the module was built with PMI_STAGE_TIMERS=0.
+        pszName = "pmi_exit_stage_latency_seconds";
+        os << "# HELP " << pszName << " Time spent in each stage of Notify() and the handlers." << "\n";
+        os << "# TYPE " << pszName << " histogram" << "\n";
+        for (size_t iStage = 0; iStage < PerfStageCount; iStage++)
+        {
+            std::string strLabels = std::string("stage=\"") + g_rgpszStages[iStage] + "\"";
+            WriteHistogram(
+                os,
+                pszName,
+                strLabels.c_str(),
+                stTotals.rgStageLatency[iStage],
+                0.000001,
+                stTotals.rgllStageUSecs[iStage]);
+        }
+    }
+
+    void WriteMetrics(
+        std::ostringstream& os,
+        const PerfCounterSectionHeader& stHeader,
+        const PerfCounterTotals& stTotals)
+    {
+        os << "# HELP pmi_exit_up Whether the counter section could be read." << "\n";
+        os << "# TYPE pmi_exit_up gauge" << "\n";
+        os << "pmi_exit_up 1" << "\n";
+        os << "# HELP pmi_exit_module_info The certsrv.exe process that published the counters." << "\n";
+        os << "# TYPE pmi_exit_module_info gauge" << "\n";
+        os << "pmi_exit_module_info{pid=\"" << stHeader.dwProcessID << "\"} 1" << "\n";
+
+        const char* pszFamily = nullptr;
+        for (const MetricDescriptor& stMetric : g_rgMetrics)
+        {
+            if (!stMetric.pszName)
+            {
+                continue;
+            }
+
+            if (!pszFamily || strcmp(pszFamily, stMetric.pszName) != 0)
+            {
+                pszFamily = stMetric.pszName;
+                os << "# HELP " << stMetric.pszName << " " << stMetric.pszHelp << "\n";
+                os << "# TYPE " << stMetric.pszName << " " << stMetric.pszType << "\n";
+            }
+
+            os << stMetric.pszName;
+            if (stMetric.pszLabels)
+            {
+                os << "{" << stMetric.pszLabels << "}";
+            }
+
+            os << " " << stTotals.rgllCounters[stMetric.eCounter] << "\n";
+        }
+
+        WriteHistograms(os, stTotals);
+    }
+
+    /*++
+
+        Abstract:
+
+            Maps the section and writes its metrics.
+
+        Returns:
+
+            S_OK - the metrics were written.
+            other - the section could not be read. Nothing was written.
+    --*/
+    HRESULT ReadMetrics(
+        std::ostringstream& os)
+    {
+        HRESULT hr = S_OK;
+        HANDLE hSection = ::OpenFileMappingW(
+            FILE_MAP_READ,
+            FALSE, // bInheritHandle
+            CPerfCounters::s_pwszSectionName);
+        if (!hSection)
+        {
+            return HRESULT_FROM_WIN32(::GetLastError());
+        }
+
+        const BYTE* pbView = static_cast<const BYTE*>(::MapViewOfFile(
+            hSection,
+            FILE_MAP_READ,
+            0, // dwFileOffsetHigh
+            0, // dwFileOffsetLow
+            0)); // dwNumberOfBytesToMap
+        if (!pbView)
+        {
+            hr = HRESULT_FROM_WIN32(::GetLastError());
+            ::CloseHandle(hSection);
+            return hr;
+        }
+
+        MEMORY_BASIC_INFORMATION stInfo;
+        ZeroMemory(&stInfo, sizeof(stInfo));
+        ::VirtualQuery(pbView, &stInfo, sizeof(stInfo));
+
+        const PerfCounterSectionHeader* pHeader = nullptr;
+        PerfCounterTotals stTotals;
+        hr = CPerfCounters::ReadSection(pbView, stInfo.RegionSize, OUT pHeader, OUT stTotals);
+        if (SUCCEEDED(hr))
+        {
+            WriteMetrics(os, *pHeader, stTotals);
+        }
+
+        ::UnmapViewOfFile(pbView);
+        ::CloseHandle(hSection);
+        return hr;
+    }
+
+    bool WriteFileReplace(
+        const std::wstring& strPath,
+        const std::string& strText)
+    {
+        std::wstring strTempPath = strPath + L".tmp";
+        {
+            std::ofstream file(strTempPath, std::ios::binary | std::ios::trunc);
+            file << strText;
+            if (!file)
+            {
+                std::wcerr << L"Failed to write " << strTempPath << std::endl;
+                return false;
+            }
+        }
+
+        if (!::MoveFileExW(strTempPath.c_str(), strPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+        {
+            std::wcerr << L"Failed to replace " << strPath << L", error=" << ::GetLastError() << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+}
+
+int RunMetricsDump(
+    const MetricsDumpOptions& objOptions)
+{
+    for (;;)
+    {
+        std::ostringstream os;
+        HRESULT hr = ReadMetrics(os);
+        if (FAILED(hr))
+        {
+            std::wcerr << L"Failed to read " << CPerfCounters::s_pwszSectionName << L", hr=" << std::hex << hr << std::dec << std::endl;
+            os.str("");
+            os << "# HELP pmi_exit_up Whether the counter section could be read." << "\n";
+            os << "# TYPE pmi_exit_up gauge" << "\n";
+            os << "pmi_exit_up 0" << "\n";
+        }
+
+        if (!WriteFileReplace(objOptions.strOutputPath, os.str()))
+        {
+            return EXIT_FAILURE;
+        }
+
+        if (objOptions.dwIntervalSecs == 0)
+        {
+            return SUCCEEDED(hr) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        ::Sleep(objOptions.dwIntervalSecs * 1000);
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        MetricsDump.h
+
+    Abstract:
+
+        Writes the exit module's shared memory counters as Prometheus text.
+
+--*/
+#include <string>
+
+/*++
+
+    Abstract:
+
+        Options for the metrics dump.
+
+--*/
+struct MetricsDumpOptions
+{
+    // File the metrics are written to, replaced on every dump.
+    std::wstring strOutputPath;
+
+    // Seconds between dumps. 0 dumps once.
+    unsigned long dwIntervalSecs = 0;
+};
+
+/*++
+
+    Abstract:
+
+        Reads the counter section that CPMICertExit publishes and writes it to a file in the
+        Prometheus text format.
+
+    Parameters:
+
+        objOptions - the options.
+
+    Returns:
+
+        0 - success.
+        1 - error.
+
+    Remarks:
+
+        The file is written next to the output path and moved over it, so a collector like
+        the node_exporter textfile collector never reads half a file. When the section does
+        not exist, for example because CertSvc is stopped, the file only has pmi_exit_up 0.
+        Reading needs Administrators or Performance Monitor Users.
+--*/
+int RunMetricsDump(
+    const MetricsDumpOptions& objOptions);
@@ -0,0 +1,352 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        MicroBench.cpp
+
+    Abstract:
+
+        Microbenchmarks of the exit module's per event code, with JSON results.
+
+--*/
+#include <windows.h>
+#include <atlbase.h>
+#include <strsafe.h>
+#include <fstream>
+#include <iostream>
+#include "..\PKI\ExitModule\Buffer.h"
+#include "..\PKI\ExitModule\CommandLineTemplate.h"
+#include "..\PKI\ExitModule\ConfigSource.h"
+#include "..\PKI\ExitModule\EventArg.h"
+#include "..\PKI\ExitModule\EventProcessorConfig.h"
+#include "BenchHarness.h"
+#include "MicroBench.h"
+
+namespace
+{
+    LPCWSTR g_pwszBenchExePath = L"C:\\Windows\\System32\\WindowsPowerShell\\v1.0\\powershell.exe";
+
+    // A typical PowerShell handler. The script path has a space, so it gets quoted.
+    WCHAR g_wszBenchArguments[] =
+        L"-NoProfile\0"
+        L"-NonInteractive\0"
+        L"-File\0"
+        L"C:\\Program Files\\Contoso\\On Cert Issued.ps1\0"
+        L"-requester\0"
+        L"{requester}\0";
+
+    // What CEventProcessorConfig appends for certissued with CertDeliveryTempFile.
+    LPCWSTR g_rgpwszCertIssuedArgs[] =
+    {
+        L"certissued",
+        L"-subjectkeyidentifier",
+        L"{ski}",
+        L"-serialnumber",
+        L"{serial}",
+        L"-rawcertpath",
+        L"{rawcertpath}",
+    };
+
+    LPCWSTR g_pwszBenchSubjectKeyIdentifier = L"01 23 45 67 89 ab cd ef 01 23 45 67 89 ab cd ef 01 23 45 67";
+    LPCWSTR g_pwszBenchSerialNumber = L"1a00000002f6b5a1f1d2a3b4c5000000000002";
+    LPCWSTR g_pwszBenchRawCertPath = L"C:\\Windows\\Temp\\PMI1234.tmp";
+
+    // Spaces, a quote and a backslash, so the value needs every kind of quoting.
+    LPCWSTR g_pwszBenchRequester = L"CONTOSO\\Dana O'Brien \"ops\"";
+
+    // Keeps the compiler from dropping an allocation that is freed right away.
+    BYTE* volatile g_pbSink = nullptr;
+
+    /*++
+
+        Abstract:
+
+            Config values served from memory, as if they were in the registry.
+
+    --*/
+    class CMemoryConfigSource : public CConfigSource
+    {
+    public:
+        explicit CMemoryConfigSource(
+            bool fEscapeForPS)
+            : m_fEscapeForPS(fEscapeForPS)
+        {
+        }
+
+        virtual HRESULT Open()
+        {
+            return S_OK;
+        }
+
+        virtual void Close()
+        {
+        }
+
+        virtual HRESULT QueryString(
+            LPCWSTR pwszName,
+            OUT CHeapWString& strValue)
+        {
+            if (wcscmp(pwszName, L"ExePath") != 0)
+            {
+                return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+            }
+
+            return strValue.CopyFrom(g_pwszBenchExePath);
+        }
+
+        virtual HRESULT QueryDWORD(
+            LPCWSTR pwszName,
+            OUT DWORD& dwValue)
+        {
+            if (wcscmp(pwszName, L"EscapeForPS") != 0)
+            {
+                return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+            }
+
+            dwValue = m_fEscapeForPS ? 1 : 0;
+            return S_OK;
+        }
+
+        virtual HRESULT QueryMultiString(
+            LPCWSTR pwszName,
+            OUT CHeapBuffer<WCHAR>& bufValue)
+        {
+            if (wcscmp(pwszName, L"Arguments") != 0)
+            {
+                return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+            }
+
+            size_t cch = sizeof(g_wszBenchArguments) / sizeof(g_wszBenchArguments[0]);
+            if (!bufValue.Alloc(cch))
+            {
+                return E_OUTOFMEMORY;
+            }
+
+            ::CopyMemory(bufValue.Get(), g_wszBenchArguments, sizeof(g_wszBenchArguments));
+            return S_OK;
+        }
+
+        virtual HRESULT ArmChangeNotification(
+            OUT HANDLE& hChange)
+        {
+            hChange = NULL;
+            return E_NOTIMPL;
+        }
+
+    private:
+        bool m_fEscapeForPS;
+    };
+
+    /*++
+
+        Abstract:
+
+            Compiles the certissued template the way CEventProcessorConfig::Load() does.
+
+    --*/
+    HRESULT CompileTemplate(
+        bool fEscapeForPS,
+        OUT CHeapBuffer<LPCWSTR>& bufArgs,
+        OUT CCommandLineTemplate& objTemplate)
+    {
+        size_t cArgs = 0;
+        for (LPCWSTR pwsz = g_wszBenchArguments; *pwsz; pwsz += wcslen(pwsz) + 1)
+        {
+            cArgs++;
+        }
+
+        if (!bufArgs.Alloc(cArgs))
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        size_t iArg = 0;
+        for (LPCWSTR pwsz = g_wszBenchArguments; *pwsz; pwsz += wcslen(pwsz) + 1)
+        {
+            bufArgs.Get()[iArg++] = pwsz;
+        }
+
+        CRefBuffer<LPCWSTR> bufOperationArgs(
+            g_rgpwszCertIssuedArgs,
+            sizeof(g_rgpwszCertIssuedArgs) / sizeof(g_rgpwszCertIssuedArgs[0]));
+        return objTemplate.Compile(
+            g_pwszBenchExePath,
+            bufArgs,
+            bufOperationArgs,
+            fEscapeForPS);
+    }
+
+    bool FormatCommandLine(
+        const CCommandLineTemplate& objTemplate,
+        const CommandLineValues& stValues)
+    {
+        // CProcess keeps the command line in a member, so each handler allocates one.
+        CHeapBuffer<WCHAR> bufCmdLine;
+        return SUCCEEDED(objTemplate.Format(stValues, OUT bufCmdLine));
+    }
+
+    bool FormatWithEventArgs(
+        unsigned long long /* i */)
+    {
+        HRESULT hrError = HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+        CStringEventArg argExePath(g_pwszBenchExePath);
+        CStringEventArg argSerialNumber(g_pwszBenchSerialNumber);
+        CNumericEventArg<HRESULT> argError(hrError);
+        CErrorMessageEventArg argErrorMessage(hrError);
+        CEventArg* rgArgs[] =
+        {
+            &argExePath,
+            &argSerialNumber,
+            &argError,
+            &argErrorMessage,
+        };
+
+        // What CEventSource::ReportEvent() does with the array before it reports.
+        CHeapBuffer<LPCWSTR> bufStrings;
+        if (!bufStrings.Alloc(sizeof(rgArgs) / sizeof(rgArgs[0])))
+        {
+            return false;
+        }
+
+        for (size_t iArg = 0; iArg < bufStrings.GetLength(); iArg++)
+        {
+            if (FAILED(rgArgs[iArg]->Format(OUT bufStrings.Get()[iArg])))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool FormatWithFormatter(
+        unsigned long long /* i */)
+    {
+        HRESULT hrError = HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+        CEventArgFormatter<4> objArgs;
+        return SUCCEEDED(objArgs.Format(
+            g_pwszBenchExePath,
+            g_pwszBenchSerialNumber,
+            hrError,
+            ErrorMessageText(hrError)));
+    }
+
+    bool WriteResults(
+        const MicroBenchOptions& objOptions,
+        const CBenchSuite& objSuite)
+    {
+#ifdef _WIN64
+        const char* pszPlatform = "windows-x64";
+#else
+        const char* pszPlatform = "windows-x86";
+#endif
+        if (objOptions.strOutputPath.empty())
+        {
+            objSuite.WriteJson(std::cout, pszPlatform);
+            return true;
+        }
+
+        std::ofstream file(objOptions.strOutputPath, std::ios::binary | std::ios::trunc);
+        objSuite.WriteJson(file, pszPlatform);
+        if (!file)
+        {
+            std::wcerr << L"Failed to write " << objOptions.strOutputPath << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+}
+
+int RunMicroBench(
+    const MicroBenchOptions& objOptions)
+{
+    CBenchSuite objSuite(objOptions.cIterations, objOptions.strFilter);
+
+    CHeapBuffer<LPCWSTR> bufArgs;
+    CCommandLineTemplate objTemplate;
+    CHeapBuffer<LPCWSTR> bufPSArgs;
+    CCommandLineTemplate objPSTemplate;
+    HRESULT hr = CompileTemplate(false, OUT bufArgs, OUT objTemplate);
+    if (SUCCEEDED(hr))
+    {
+        hr = CompileTemplate(true, OUT bufPSArgs, OUT objPSTemplate);
+    }
+
+    if (FAILED(hr))
+    {
+        std::wcerr << L"Failed to compile the command line template, hr=" << std::hex << hr << std::dec << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    CommandLineValues stValues;
+    stValues.rgpwsz[PlaceholderSubjectKeyIdentifier] = g_pwszBenchSubjectKeyIdentifier;
+    stValues.rgpwsz[PlaceholderSerialNumber] = g_pwszBenchSerialNumber;
+    stValues.rgpwsz[PlaceholderRawCertPath] = g_pwszBenchRawCertPath;
+    stValues.rgpwsz[PlaceholderRequester] = g_pwszBenchRequester;
+
+    // The handler command line CProcess::Create() starts, once per event.
+    objSuite.Run("CCommandLineTemplate::Format", [&](unsigned long long)
+    {
+        return FormatCommandLine(objTemplate, stValues);
+    });
+    objSuite.Run("CCommandLineTemplate::Format/EscapeForPS", [&](unsigned long long)
+    {
+        return FormatCommandLine(objPSTemplate, stValues);
+    });
+
+    objSuite.Run("CHeapBuffer::Alloc/64", [](unsigned long long)
+    {
+        CHeapBuffer<BYTE> buf;
+        if (!buf.Alloc(64))
+        {
+            return false;
+        }
+
+        g_pbSink = buf.Get();
+        return true;
+    });
+    objSuite.Run("CHeapBuffer::Alloc/4096", [](unsigned long long)
+    {
+        CHeapBuffer<BYTE> buf;
+        if (!buf.Alloc(4096))
+        {
+            return false;
+        }
+
+        g_pbSink = buf.Get();
+        return true;
+    });
+    objSuite.Run("CHeapWString::CopyFrom", [](unsigned long long)
+    {
+        CHeapWString str;
+        return SUCCEEDED(str.CopyFrom(g_pwszBenchRawCertPath));
+    });
+
+    // Parsing Arguments and compiling every template, as on a config change.
+    objSuite.Run("CEventProcessorConfig::Load", [](unsigned long long)
+    {
+        CMemoryConfigSource objSource(false);
+        CEventProcessorConfig objConfig;
+        return SUCCEEDED(objConfig.Load(objSource));
+    });
+    objSuite.Run("CEventProcessorConfig::Load/EscapeForPS", [](unsigned long long)
+    {
+        CMemoryConfigSource objSource(true);
+        CEventProcessorConfig objConfig;
+        return SUCCEEDED(objConfig.Load(objSource));
+    });
+
+    // MSG_PROCESS_START_FAILED, both ways CEventSource can format it.
+    objSuite.Run("CEventArg::Format/ProcessStartFailed", FormatWithEventArgs);
+    objSuite.Run("CEventArgFormatter::Format/ProcessStartFailed", FormatWithFormatter);
+
+    if (!WriteResults(objOptions, objSuite))
+    {
+        return EXIT_FAILURE;
+    }
+
+    return objSuite.Succeeded() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
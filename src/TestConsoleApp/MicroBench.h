@@ -0,0 +1,59 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        MicroBench.h
+
+    Abstract:
+
+        Microbenchmarks of the exit module's per event code, with JSON results.
+
+--*/
+#include <string>
+
+/*++
+
+    Abstract:
+
+        Options for the microbenchmarks.
+
+--*/
+struct MicroBenchOptions
+{
+    // File the JSON is written to. Empty writes it to stdout.
+    std::wstring strOutputPath;
+
+    // Only benchmarks whose name contains this run. Empty runs all of them.
+    std::string strFilter;
+
+    // Operations in each sample.
+    unsigned long cIterations = 100000;
+};
+
+/*++
+
+    Abstract:
+
+        Times the code CertSvc's thread and the handler threads run for every event, and
+        writes ns/op and allocations/op for each benchmark as JSON.
+
+    Parameters:
+
+        objOptions - the options.
+
+    Returns:
+
+        0 - success.
+        1 - error, or an operation failed.
+
+    Remarks:
+
+        Covers filling in the handler command line, with and without EscapeForPS, CHeapBuffer
+        and CHeapWString allocation, loading the config from an in memory source, and
+        formatting event arguments. See CBenchSuite for how they are measured.
+--*/
+int RunMicroBench(
+    const MicroBenchOptions& objOptions);
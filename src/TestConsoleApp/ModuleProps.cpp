@@ -0,0 +1,229 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        ModuleProps.cpp
+
+    Abstract:
+
+        Reads the exit module's counters through ICertManageModule, the way the snap-in does.
+
+--*/
+#include <windows.h>
+#include <certmod.h>
+#include <iostream>
+#include <vector>
+#include "ExitModuleHost.h"
+#include "ModuleProps.h"
+
+namespace
+{
+    LPCWSTR g_pwszConfig = L"ModuleProps\\FakeCA";
+
+    // Counters and percentiles read from the other process. EventsCertIssued is checked.
+    LPCWSTR g_pwszCertIssuedProperty = L"EventsCertIssued";
+    LPCWSTR g_rgpwszProperties[] =
+    {
+        L"EventsCertIssued",
+        L"HandlerSpawns",
+        L"NotifyLatencyP50USecs",
+        L"NotifyLatencyP99USecs",
+    };
+
+    /*++
+
+        Abstract:
+
+            Reads one property as a number.
+
+        Returns:
+
+            S_OK - success.
+            S_FALSE - the module has no property by that name.
+            other - error code, such as HRESULT_FROM_WIN32(ERROR_NOT_READY) when no
+                process has published the counters.
+    --*/
+    HRESULT ReadProperty(
+        ICertManageModule* pManageModule,
+        LPCWSTR pwszName,
+        OUT double& dValue)
+    {
+        HRESULT hr = S_OK;
+        BSTR bstrConfig = ::SysAllocString(g_pwszConfig);
+        BSTR bstrName = ::SysAllocString(pwszName);
+        VARIANT varValue;
+        ::VariantInit(&varValue);
+        dValue = 0;
+
+        do
+        {
+            if (!bstrConfig || !bstrName)
+            {
+                hr = E_OUTOFMEMORY;
+                break;
+            }
+
+            hr = pManageModule->GetProperty(bstrConfig, nullptr, bstrName, 0, &varValue);
+            if (hr != S_OK)
+            {
+                break;
+            }
+
+            hr = ::VariantChangeType(&varValue, &varValue, 0, VT_R8);
+            if (FAILED(hr))
+            {
+                break;
+            }
+
+            dValue = varValue.dblVal;
+        } while (false);
+
+        ::VariantClear(&varValue);
+        ::SysFreeString(bstrName);
+        ::SysFreeString(bstrConfig);
+        return hr;
+    }
+}
+
+int RunModuleProps(
+    const ModulePropsOptions& objOptions)
+{
+    HRESULT hr = ::CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if (FAILED(hr))
+    {
+        std::wcerr << L"CoInitializeEx failed, hr=" << std::hex << hr << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    int nResult = EXIT_FAILURE;
+    {
+        CExitModuleHost objHost;
+        ICertExit2* pExit2 = nullptr;
+        ICertManageModule* pManageModule = nullptr;
+
+        do
+        {
+            hr = objHost.Load(objOptions.strModulePath);
+            if (FAILED(hr))
+            {
+                std::wcerr << L"Failed to load " << objOptions.strModulePath << L", hr=" << std::hex << hr << std::endl;
+                break;
+            }
+
+            hr = objHost.GetExit()->QueryInterface(IID_ICertExit2, reinterpret_cast<void**>(&pExit2));
+            if (SUCCEEDED(hr))
+            {
+                hr = pExit2->GetManageModule(&pManageModule);
+            }
+
+            if (FAILED(hr))
+            {
+                std::wcerr << L"ICertExit2::GetManageModule failed, hr=" << std::hex << hr << std::endl;
+                break;
+            }
+
+            nResult = EXIT_SUCCESS;
+            for (LPCWSTR pwszName : g_rgpwszProperties)
+            {
+                double dValue = 0;
+                hr = ReadProperty(pManageModule, pwszName, OUT dValue);
+                if (hr != S_OK)
+                {
+                    std::wcerr << L"Reading " << pwszName << L" failed, hr=" << std::hex << hr << std::dec << std::endl;
+                    if (hr == HRESULT_FROM_WIN32(ERROR_NOT_READY))
+                    {
+                        std::wcerr << L"No process has published the counters. The CA process needs to run as an administrator." << std::endl;
+                    }
+
+                    nResult = EXIT_FAILURE;
+                    break;
+                }
+
+                std::wcout << L"Other process " << pwszName << L": " << dValue << std::endl;
+                if (_wcsicmp(pwszName, g_pwszCertIssuedProperty) == 0 && dValue < objOptions.cMinCertIssued)
+                {
+                    std::wcerr << pwszName << L" is below " << objOptions.cMinCertIssued << std::endl;
+                    nResult = EXIT_FAILURE;
+                }
+            }
+        } while (false);
+
+        if (pManageModule)
+        {
+            pManageModule->Release();
+        }
+
+        if (pExit2)
+        {
+            pExit2->Release();
+        }
+
+        objHost.Unload();
+    }
+
+    ::CoUninitialize();
+    return nResult;
+}
+
+int RunModulePropsProcess(
+    const ModulePropsOptions& objOptions)
+{
+    std::vector<WCHAR> vecExePath(MAX_PATH);
+    for (;;)
+    {
+        DWORD cch = ::GetModuleFileNameW(NULL, vecExePath.data(), (DWORD)vecExePath.size());
+        if (cch == 0)
+        {
+            std::wcerr << L"GetModuleFileNameW failed, error=" << ::GetLastError() << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        if (cch < vecExePath.size())
+        {
+            break;
+        }
+
+        vecExePath.resize(vecExePath.size() * 2);
+    }
+
+    std::wstring strCommandLine = L"\"";
+    strCommandLine += vecExePath.data();
+    strCommandLine += L"\" moduleprops \"";
+    strCommandLine += objOptions.strModulePath;
+    strCommandLine += L"\" -mincertissued ";
+    strCommandLine += std::to_wstring(objOptions.cMinCertIssued);
+
+    // CreateProcessW may write to the command line.
+    std::vector<WCHAR> vecCommandLine(strCommandLine.begin(), strCommandLine.end());
+    vecCommandLine.push_back(L'\0');
+
+    STARTUPINFOW stStartupInfo;
+    ZeroMemory(&stStartupInfo, sizeof(stStartupInfo));
+    stStartupInfo.cb = sizeof(stStartupInfo);
+    PROCESS_INFORMATION stProcessInfo;
+    ZeroMemory(&stProcessInfo, sizeof(stProcessInfo));
+    if (!::CreateProcessW(
+        vecExePath.data(),
+        vecCommandLine.data(),
+        nullptr, // lpProcessAttributes
+        nullptr, // lpThreadAttributes
+        FALSE, // bInheritHandles
+        0, // dwCreationFlags
+        nullptr, // lpEnvironment
+        nullptr, // lpCurrentDirectory
+        &stStartupInfo,
+        &stProcessInfo))
+    {
+        std::wcerr << L"CreateProcessW failed, error=" << ::GetLastError() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    DWORD dwExitCode = EXIT_FAILURE;
+    ::WaitForSingleObject(stProcessInfo.hProcess, INFINITE);
+    ::GetExitCodeProcess(stProcessInfo.hProcess, &dwExitCode);
+    ::CloseHandle(stProcessInfo.hThread);
+    ::CloseHandle(stProcessInfo.hProcess);
+    return (dwExitCode == EXIT_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,79 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        ModuleProps.h
+
+    Abstract:
+
+        Reads the exit module's counters through ICertManageModule, the way the snap-in does.
+
+--*/
+#include <string>
+
+/*++
+
+    Abstract:
+
+        Options for reading the module properties.
+
+--*/
+struct ModulePropsOptions
+{
+    // Path to ExitModule.dll.
+    std::wstring strModulePath;
+
+    // Fails unless EventsCertIssued is at least this.
+    unsigned long cMinCertIssued = 0;
+};
+
+/*++
+
+    Abstract:
+
+        Loads ExitModule.dll without initializing it and prints the counters its
+        ICertManageModule returns.
+
+    Parameters:
+
+        objOptions - the options.
+
+    Returns:
+
+        0 - success.
+        1 - a property failed to read, or EventsCertIssued is below cMinCertIssued.
+
+    Remarks:
+
+        Like the snap-in, this process never calls ICertExit::Initialize(), so it has no
+        counters of its own. The values come from the section the CA process published.
+        Reading needs Administrators or Performance Monitor Users.
+--*/
+int RunModuleProps(
+    const ModulePropsOptions& objOptions);
+
+/*++
+
+    Abstract:
+
+        Runs moduleprops in a new TestConsoleApp.exe process and waits for it.
+
+    Parameters:
+
+        objOptions - the options passed to the new process.
+
+    Returns:
+
+        0 - the new process succeeded.
+        1 - it failed or could not be started.
+
+    Remarks:
+
+        loadtest uses this to check that another process reads what its Notify() calls
+        counted. The new process shares this console.
+--*/
+int RunModulePropsProcess(
+    const ModulePropsOptions& objOptions);
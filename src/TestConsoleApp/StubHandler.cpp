@@ -0,0 +1,190 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        StubHandler.cpp
+
+    Abstract:
+
+        Stub event processor for exercising the exit module's handler modes.
+
+--*/
+#include <windows.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "../PKI/ExitModule/HandlerProtocol.h"
+#include "StubHandler.h"
+
+namespace
+{
+    DWORD g_dwDelayMSecs = 0;
+    DWORD g_dwFailurePercent = 0;
+    std::minstd_rand g_objRandom;
+
+    DWORD GetEnvironmentDWORD(
+        LPCWSTR pwszName)
+    {
+        WCHAR wszValue[16];
+        DWORD cch = ::GetEnvironmentVariableW(pwszName, wszValue, sizeof(wszValue) / sizeof(wszValue[0]));
+        if (cch == 0 || cch >= sizeof(wszValue) / sizeof(wszValue[0]))
+        {
+            return 0;
+        }
+
+        return wcstoul(wszValue, nullptr, 10);
+    }
+
+    /*++
+
+        Abstract:
+
+            Does the work of one event. Returns the status to report for it.
+
+    --*/
+    LONG ProcessEvent()
+    {
+        if (g_dwDelayMSecs > 0)
+        {
+            ::Sleep(g_dwDelayMSecs);
+        }
+
+        if (g_dwFailurePercent > 0 && g_objRandom() % 100 < g_dwFailurePercent)
+        {
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    bool ReadAll(
+        HANDLE hFile,
+        void* pvData,
+        DWORD cbData)
+    {
+        BYTE* pbData = static_cast<BYTE*>(pvData);
+        while (cbData > 0)
+        {
+            DWORD cbRead = 0;
+            if (!::ReadFile(hFile, pbData, cbData, &cbRead, nullptr) || cbRead == 0)
+            {
+                return false;
+            }
+
+            pbData += cbRead;
+            cbData -= cbRead;
+        }
+
+        return true;
+    }
+
+    bool WriteAll(
+        HANDLE hFile,
+        const void* pvData,
+        DWORD cbData)
+    {
+        const BYTE* pbData = static_cast<const BYTE*>(pvData);
+        while (cbData > 0)
+        {
+            DWORD cbWritten = 0;
+            if (!::WriteFile(hFile, pbData, cbData, &cbWritten, nullptr))
+            {
+                return false;
+            }
+
+            pbData += cbWritten;
+            cbData -= cbWritten;
+        }
+
+        return true;
+    }
+
+    int RunEventStream(
+        bool fOneEvent)
+    {
+        HANDLE hInput = ::GetStdHandle(STD_INPUT_HANDLE);
+        HANDLE hOutput = ::GetStdHandle(STD_OUTPUT_HANDLE);
+        std::vector<BYTE> vecPayload;
+
+        for (;;)
+        {
+            HandlerFrameHeader stHeader;
+            if (!ReadAll(hInput, &stHeader, sizeof(stHeader)))
+            {
+                // The exit module closed the pipe.
+                return EXIT_SUCCESS;
+            }
+
+            if (stHeader.dwMagic != HANDLER_FRAME_MAGIC)
+            {
+                return EXIT_FAILURE;
+            }
+
+            vecPayload.resize(stHeader.cbPayload);
+            if (stHeader.cbPayload > 0 && !ReadAll(hInput, vecPayload.data(), stHeader.cbPayload))
+            {
+                return EXIT_FAILURE;
+            }
+
+            HandlerAckFrame stAck;
+            stAck.stHeader.dwMagic = HANDLER_FRAME_MAGIC;
+            stAck.stHeader.wVersion = HANDLER_PROTOCOL_VERSION;
+            stAck.stHeader.wType = HANDLER_FRAME_ACK;
+            stAck.stHeader.dwSequence = stHeader.dwSequence;
+            stAck.stHeader.cbPayload = sizeof(stAck.lStatus);
+            stAck.lStatus = (stHeader.wType == HANDLER_FRAME_CERTISSUED) ? ProcessEvent() : 0;
+            if (!WriteAll(hOutput, &stAck, sizeof(stAck)))
+            {
+                return EXIT_FAILURE;
+            }
+
+            if (fOneEvent && stHeader.wType == HANDLER_FRAME_CERTISSUED)
+            {
+                return EXIT_SUCCESS;
+            }
+        }
+    }
+
+    void DrainInput()
+    {
+        HANDLE hInput = ::GetStdHandle(STD_INPUT_HANDLE);
+        BYTE rgbData[4096];
+        DWORD cbRead = 0;
+        while (::ReadFile(hInput, rgbData, sizeof(rgbData), &cbRead, nullptr) && cbRead > 0)
+        {
+        }
+    }
+}
+
+int RunStubHandler(
+    int argc,
+    const wchar_t* argv[])
+{
+    g_dwDelayMSecs = GetEnvironmentDWORD(WSZ_STUB_HANDLER_DELAY_VARIABLE);
+    g_dwFailurePercent = GetEnvironmentDWORD(WSZ_STUB_HANDLER_FAILURE_VARIABLE);
+    g_objRandom.seed(::GetCurrentProcessId() ^ ::GetTickCount());
+
+    if (argc > 0 && std::wstring(argv[0]) == WSZ_HANDLER_OPERATION_EVENTSTREAM)
+    {
+        return RunEventStream(false); // fOneEvent
+    }
+
+    if (argc > 0 && std::wstring(argv[0]) == WSZ_HANDLER_OPERATION_STANDBY)
+    {
+        return RunEventStream(true); // fOneEvent
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::wstring(argv[i]) == L"-rawcertstdin")
+        {
+            // Read the cert so the exit module's write completes.
+            DrainInput();
+            break;
+        }
+    }
+
+    return ProcessEvent();
+}
@@ -0,0 +1,53 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        StubHandler.h
+
+    Abstract:
+
+        Stub event processor for exercising the exit module's handler modes.
+
+--*/
+
+// Milliseconds the stub handler takes for each event.
+#define WSZ_STUB_HANDLER_DELAY_VARIABLE L"PMIEXITMODULE_STUB_DELAY_MSECS"
+
+// Percent of events, 0 to 100, the stub handler fails.
+#define WSZ_STUB_HANDLER_FAILURE_VARIABLE L"PMIEXITMODULE_STUB_FAILURE_PERCENT"
+
+/*++
+
+    Abstract:
+
+        Runs as the registered handler process.
+
+    Parameters:
+
+        argc - count of arguments following the stubhandler command.
+        argv - arguments following the stubhandler command. The first is the operation.
+
+    Returns:
+
+        0 - success.
+        1 - error.
+
+    Remarks:
+
+        For the eventstream operation, reads request frames from stdin and acks each
+        one with status 0 until stdin is closed. For the standby operation, acks the
+        first certissued frame and exits. Every other operation, such as certissued
+        from process-per-event mode, succeeds immediately after reading stdin if
+        -rawcertstdin was passed.
+
+        The handler inherits the environment of the exit module's process. If
+        WSZ_STUB_HANDLER_DELAY_VARIABLE is set, each event takes that long. If
+        WSZ_STUB_HANDLER_FAILURE_VARIABLE is set, that share of events, picked at
+        random, is acked with status 1 or exits with 1.
+--*/
+int RunStubHandler(
+    int argc,
+    const wchar_t* argv[]);
@@ -0,0 +1,118 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        StubLoadTest.cpp
+
+    Abstract:
+
+        Runs the load schedule against a stub sink, without the exit module.
+
+    Remarks:
+
+        ExitModule.dll is a Windows COM server and only loads on Windows. This program
+        runs the same pacing, threads and percentiles as loadtest against a sink with a
+        set delay and failure rate, so the driver itself can be checked on Linux. It is
+        not part of TestConsoleApp.exe. Build it with:
+
+            g++ -std=c++14 -O2 -pthread LoadSchedule.cpp StubLoadTest.cpp -o stubloadtest
+--*/
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "LoadSchedule.h"
+
+namespace
+{
+    void PrintUsage()
+    {
+        std::cerr << "stubloadtest [-count N] [-threads N] [-rate N] [-delay N] [-failures N]" << std::endl;
+    }
+
+    void PrintDistribution(
+        const char* pszName,
+        std::vector<double>& vecMSecs)
+    {
+        LatencyDistribution stDistribution = ComputeLatencyDistribution(vecMSecs);
+        if (stDistribution.cSamples == 0)
+        {
+            return;
+        }
+
+        std::cout << pszName
+            << "avg " << stDistribution.dAvg
+            << " p50 " << stDistribution.dP50
+            << " p90 " << stDistribution.dP90
+            << " p99 " << stDistribution.dP99
+            << " p99.9 " << stDistribution.dP999
+            << " max " << stDistribution.dMax << std::endl;
+    }
+}
+
+int main(
+    int argc,
+    char* argv[])
+{
+    LoadScheduleOptions objOptions;
+    unsigned long ulDelayMSecs = 0;
+    unsigned long ulFailurePercent = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            PrintUsage();
+            return EXIT_FAILURE;
+        }
+
+        unsigned long ulValue = std::strtoul(argv[i + 1], nullptr, 10);
+        if (std::strcmp(argv[i], "-count") == 0)
+        {
+            objOptions.cNotifications = ulValue;
+        }
+        else if (std::strcmp(argv[i], "-threads") == 0 && ulValue > 0)
+        {
+            objOptions.cThreads = ulValue;
+        }
+        else if (std::strcmp(argv[i], "-rate") == 0)
+        {
+            objOptions.ulRate = ulValue;
+        }
+        else if (std::strcmp(argv[i], "-delay") == 0)
+        {
+            ulDelayMSecs = ulValue;
+        }
+        else if (std::strcmp(argv[i], "-failures") == 0 && ulValue <= 100)
+        {
+            ulFailurePercent = ulValue;
+        }
+        else
+        {
+            PrintUsage();
+            return EXIT_FAILURE;
+        }
+
+        i++;
+    }
+
+    LoadScheduleResult objResult;
+    RunLoadSchedule(objOptions, CreateStubLoadSink(ulDelayMSecs, ulFailurePercent), objResult);
+
+    std::cout << "Notifications:       " << objResult.cNotifications << std::endl;
+    std::cout << "Failures:            " << objResult.cFailures << std::endl;
+    if (objOptions.ulRate > 0)
+    {
+        std::cout << "Target rate:         " << objOptions.ulRate << "/s" << std::endl;
+    }
+
+    if (objResult.dPostMSecs > 0)
+    {
+        std::cout << "Throughput:          " << objResult.cNotifications * 1000.0 / objResult.dPostMSecs << "/s" << std::endl;
+    }
+
+    PrintDistribution("Sink ms:             ", objResult.vecServiceMSecs);
+    PrintDistribution("Response ms:         ", objResult.vecResponseMSecs);
+    return EXIT_SUCCESS;
+}
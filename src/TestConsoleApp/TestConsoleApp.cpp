@@ -1,21 +1,473 @@
-// TestConsoleApp.cpp : This file contains the 'main' function. Program execution begins and ends there.
-//
+/*++
 
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        TestConsoleApp.cpp
+
+    Abstract:
+
+        Main entry point for the exit module test tools.
+
+--*/
+#include <windows.h>
 #include <iostream>
+#include <string>
+#include "DerBench.h"
+#include "EventArgBench.h"
+#include "EventLogBench.h"
+#include "LoadTest.h"
+#include "MetricsDump.h"
+#include "MicroBench.h"
+#include "ModuleProps.h"
+#include "StubHandler.h"
+#include "TraceReplay.h"
 
-int main(int argc, const char* argv[])
+namespace
 {
-    std::cout << "Hello World!\n";
-    return 0;
+    void PrintUsage()
+    {
+        std::wcerr << L"Usage:" << std::endl;
+        std::wcerr << L"TestConsoleApp.exe loadtest <path to ExitModule.dll> [-count N] [-threads N] [-rate N] [-cert <path>]... [-handlerdelay N] [-handlerfailures N]" << std::endl;
+        std::wcerr << L"    Calls ICertExit::Notify() with a fake ICertServerExit at a rate and reports throughput and latency percentiles." << std::endl;
+        std::wcerr << L"TestConsoleApp.exe derbench <path to DER cert> [-count N]" << std::endl;
+        std::wcerr << L"    Times parsing the handler's cert fields from DER against fetching them from a fake ICertServerExit." << std::endl;
+        std::wcerr << L"TestConsoleApp.exe eventargbench [-count N]" << std::endl;
+        std::wcerr << L"    Times formatting event arguments with CEventArg objects against CEventArgFormatter." << std::endl;
+        std::wcerr << L"TestConsoleApp.exe eventlogbench <output file> [-count N] [-threads N] [-capacity N]" << std::endl;
+        std::wcerr << L"    Times reporting events through the file sink on the calling threads against posting them to the background writer." << std::endl;
+        std::wcerr << L"TestConsoleApp.exe metricsdump <output file> [-interval N]" << std::endl;
+        std::wcerr << L"    Writes the exit module's shared memory counters to a file as Prometheus text, once or every N seconds." << std::endl;
+        std::wcerr << L"TestConsoleApp.exe moduleprops <path to ExitModule.dll> [-mincertissued N]" << std::endl;
+        std::wcerr << L"    Reads the counters of the CA process through ICertManageModule, as the snap-in does. Fails below N issued." << std::endl;
+        std::wcerr << L"TestConsoleApp.exe microbench [-count N] [-filter <text>] [-out <path>]" << std::endl;
+        std::wcerr << L"    Times the exit module's per event code and writes ns/op and allocations/op as JSON." << std::endl;
+        std::wcerr << L"TestConsoleApp.exe tracereplay <path to ExitModule.dll> <trace file> [-speed N|max]" << std::endl;
+        std::wcerr << L"    Replays an event trace captured with TracePath through ICertExit::Notify(), at N times the recorded speed." << std::endl;
+        std::wcerr << L"TestConsoleApp.exe stubhandler <operation> [args]" << std::endl;
+        std::wcerr << L"    Register as ExePath with Arguments=stubhandler to act as an event processor. Succeeds unless loadtest asks it to fail." << std::endl;
+    }
+
+    bool TryParseLoadTest(
+        int argc,
+        const wchar_t* argv[],
+        OUT LoadTestOptions& objOptions)
+    {
+        if (argc < 3)
+        {
+            return false;
+        }
+
+        objOptions.strModulePath = argv[2];
+        for (int i = 3; i < argc; i++)
+        {
+            std::wstring strOption = argv[i];
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+
+            const wchar_t* pwszValue = argv[++i];
+            if (strOption == L"-count")
+            {
+                objOptions.cNotifications = wcstoul(pwszValue, nullptr, 10);
+            }
+            else if (strOption == L"-threads")
+            {
+                objOptions.cThreads = wcstoul(pwszValue, nullptr, 10);
+            }
+            else if (strOption == L"-rate")
+            {
+                objOptions.ulRate = wcstoul(pwszValue, nullptr, 10);
+            }
+            else if (strOption == L"-cert")
+            {
+                objOptions.vecCertPaths.push_back(pwszValue);
+            }
+            else if (strOption == L"-handlerdelay")
+            {
+                objOptions.ulHandlerDelayMSecs = wcstoul(pwszValue, nullptr, 10);
+            }
+            else if (strOption == L"-handlerfailures")
+            {
+                objOptions.ulHandlerFailurePercent = wcstoul(pwszValue, nullptr, 10);
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return objOptions.cThreads > 0 && objOptions.ulHandlerFailurePercent <= 100;
+    }
+
+    bool TryParseDerBench(
+        int argc,
+        const wchar_t* argv[],
+        OUT DerBenchOptions& objOptions)
+    {
+        if (argc < 3)
+        {
+            return false;
+        }
+
+        objOptions.strCertPath = argv[2];
+        for (int i = 3; i < argc; i++)
+        {
+            std::wstring strOption = argv[i];
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+
+            const wchar_t* pwszValue = argv[++i];
+            if (strOption == L"-count")
+            {
+                objOptions.cIterations = wcstoul(pwszValue, nullptr, 10);
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool TryParseEventArgBench(
+        int argc,
+        const wchar_t* argv[],
+        OUT EventArgBenchOptions& objOptions)
+    {
+        for (int i = 2; i < argc; i++)
+        {
+            std::wstring strOption = argv[i];
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+
+            const wchar_t* pwszValue = argv[++i];
+            if (strOption == L"-count")
+            {
+                objOptions.cIterations = wcstoul(pwszValue, nullptr, 10);
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool TryParseEventLogBench(
+        int argc,
+        const wchar_t* argv[],
+        OUT EventLogBenchOptions& objOptions)
+    {
+        if (argc < 3)
+        {
+            return false;
+        }
+
+        objOptions.strOutputPath = argv[2];
+        for (int i = 3; i < argc; i++)
+        {
+            std::wstring strOption = argv[i];
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+
+            const wchar_t* pwszValue = argv[++i];
+            if (strOption == L"-count")
+            {
+                objOptions.cEvents = wcstoul(pwszValue, nullptr, 10);
+            }
+            else if (strOption == L"-threads")
+            {
+                objOptions.cThreads = wcstoul(pwszValue, nullptr, 10);
+            }
+            else if (strOption == L"-capacity")
+            {
+                objOptions.cCapacity = wcstoul(pwszValue, nullptr, 10);
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return objOptions.cThreads > 0 && objOptions.cCapacity > 0;
+    }
+
+    bool TryParseMetricsDump(
+        int argc,
+        const wchar_t* argv[],
+        OUT MetricsDumpOptions& objOptions)
+    {
+        if (argc < 3)
+        {
+            return false;
+        }
+
+        objOptions.strOutputPath = argv[2];
+        for (int i = 3; i < argc; i++)
+        {
+            std::wstring strOption = argv[i];
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+
+            const wchar_t* pwszValue = argv[++i];
+            if (strOption == L"-interval")
+            {
+                objOptions.dwIntervalSecs = wcstoul(pwszValue, nullptr, 10);
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool TryParseModuleProps(
+        int argc,
+        const wchar_t* argv[],
+        OUT ModulePropsOptions& objOptions)
+    {
+        if (argc < 3)
+        {
+            return false;
+        }
+
+        objOptions.strModulePath = argv[2];
+        for (int i = 3; i < argc; i++)
+        {
+            std::wstring strOption = argv[i];
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+
+            const wchar_t* pwszValue = argv[++i];
+            if (strOption == L"-mincertissued")
+            {
+                objOptions.cMinCertIssued = wcstoul(pwszValue, nullptr, 10);
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool TryParseMicroBench(
+        int argc,
+        const wchar_t* argv[],
+        OUT MicroBenchOptions& objOptions)
+    {
+        for (int i = 2; i < argc; i++)
+        {
+            std::wstring strOption = argv[i];
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+
+            const wchar_t* pwszValue = argv[++i];
+            if (strOption == L"-count")
+            {
+                objOptions.cIterations = wcstoul(pwszValue, nullptr, 10);
+            }
+            else if (strOption == L"-filter")
+            {
+                // Benchmark names are ASCII.
+                for (const wchar_t* pwch = pwszValue; *pwch; pwch++)
+                {
+                    objOptions.strFilter += (char)*pwch;
+                }
+            }
+            else if (strOption == L"-out")
+            {
+                objOptions.strOutputPath = pwszValue;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return objOptions.cIterations > 0;
+    }
+
+    bool TryParseTraceReplay(
+        int argc,
+        const wchar_t* argv[],
+        OUT TraceReplayOptions& objOptions)
+    {
+        if (argc < 4)
+        {
+            return false;
+        }
+
+        objOptions.strModulePath = argv[2];
+        objOptions.strTracePath = argv[3];
+        for (int i = 4; i < argc; i++)
+        {
+            std::wstring strOption = argv[i];
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+
+            const wchar_t* pwszValue = argv[++i];
+            if (strOption == L"-speed")
+            {
+                objOptions.dSpeed = (std::wstring(pwszValue) == L"max") ? 0.0 : wcstod(pwszValue, nullptr);
+                if (objOptions.dSpeed <= 0.0 && std::wstring(pwszValue) != L"max")
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
 }
 
-// Run program: Ctrl + F5 or Debug > Start Without Debugging menu
-// Debug program: F5 or Debug > Start Debugging menu
+/*++
+
+    Abstract:
+
+        Main entry point.
+
+    Arguments:
+
+        argc - count of program arguments.
+        argv - array of program arguments.
+
+    Returns:
 
-// Tips for Getting Started: 
-//   1. Use the Solution Explorer window to add/manage files
-//   2. Use the Team Explorer window to connect to source control
-//   3. Use the Output window to see build output and other messages
-//   4. Use the Error List window to view errors
-//   5. Go to Project > Add New Item to create new code files, or Project > Add Existing Item to add existing code files to the project
-//   6. In the future, to open this project again, go to File > Open > Project and select the .sln file
+        0 - success.
+        1 - error.
+
+--*/
+int __cdecl wmain(
+    int argc,
+    const wchar_t* argv[])
+{
+    if (argc < 2)
+    {
+        PrintUsage();
+        return EXIT_FAILURE;
+    }
+
+    std::wstring strCommand = argv[1];
+    if (strCommand == L"loadtest")
+    {
+        LoadTestOptions objOptions;
+        if (!TryParseLoadTest(argc, argv, OUT objOptions))
+        {
+            PrintUsage();
+            return EXIT_FAILURE;
+        }
+
+        return RunLoadTest(objOptions);
+    }
+    else if (strCommand == L"derbench")
+    {
+        DerBenchOptions objOptions;
+        if (!TryParseDerBench(argc, argv, OUT objOptions))
+        {
+            PrintUsage();
+            return EXIT_FAILURE;
+        }
+
+        return RunDerBench(objOptions);
+    }
+    else if (strCommand == L"eventargbench")
+    {
+        EventArgBenchOptions objOptions;
+        if (!TryParseEventArgBench(argc, argv, OUT objOptions))
+        {
+            PrintUsage();
+            return EXIT_FAILURE;
+        }
+
+        return RunEventArgBench(objOptions);
+    }
+    else if (strCommand == L"eventlogbench")
+    {
+        EventLogBenchOptions objOptions;
+        if (!TryParseEventLogBench(argc, argv, OUT objOptions))
+        {
+            PrintUsage();
+            return EXIT_FAILURE;
+        }
+
+        return RunEventLogBench(objOptions);
+    }
+    else if (strCommand == L"metricsdump")
+    {
+        MetricsDumpOptions objOptions;
+        if (!TryParseMetricsDump(argc, argv, OUT objOptions))
+        {
+            PrintUsage();
+            return EXIT_FAILURE;
+        }
+
+        return RunMetricsDump(objOptions);
+    }
+    else if (strCommand == L"moduleprops")
+    {
+        ModulePropsOptions objOptions;
+        if (!TryParseModuleProps(argc, argv, OUT objOptions))
+        {
+            PrintUsage();
+            return EXIT_FAILURE;
+        }
+
+        return RunModuleProps(objOptions);
+    }
+    else if (strCommand == L"microbench")
+    {
+        MicroBenchOptions objOptions;
+        if (!TryParseMicroBench(argc, argv, OUT objOptions))
+        {
+            PrintUsage();
+            return EXIT_FAILURE;
+        }
+
+        return RunMicroBench(objOptions);
+    }
+    else if (strCommand == L"tracereplay")
+    {
+        TraceReplayOptions objOptions;
+        if (!TryParseTraceReplay(argc, argv, OUT objOptions))
+        {
+            PrintUsage();
+            return EXIT_FAILURE;
+        }
+
+        return RunTraceReplay(objOptions);
+    }
+    else if (strCommand == L"stubhandler")
+    {
+        return RunStubHandler(argc - 2, argv + 2);
+    }
+
+    PrintUsage();
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,206 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        TraceReader.cpp
+
+    Abstract:
+
+        CTraceReader class impl.
+
+--*/
+#include "TraceReader.h"
+
+CTraceReader::CTraceReader()
+    : m_hFile(INVALID_HANDLE_VALUE),
+    m_hMapping(NULL),
+    m_cbFile(0),
+    m_dwGranularity(0),
+    m_pbView(nullptr),
+    m_ullViewOffset(0),
+    m_cbView(0),
+    m_ullNext(0)
+{
+    ZeroMemory(&m_stHeader, sizeof(m_stHeader));
+}
+
+CTraceReader::~CTraceReader()
+{
+    Close();
+}
+
+HRESULT CTraceReader::Open(
+    const std::wstring& strPath)
+{
+    Close();
+
+    SYSTEM_INFO stSystemInfo;
+    ::GetSystemInfo(&stSystemInfo);
+    m_dwGranularity = stSystemInfo.dwAllocationGranularity;
+
+    // The exit module may still be writing it.
+    m_hFile = ::CreateFileW(
+        strPath.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr, // lpSecurityAttributes
+        OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN,
+        NULL); // hTemplateFile
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(::GetLastError());
+    }
+
+    LARGE_INTEGER liSize;
+    if (!::GetFileSizeEx(m_hFile, &liSize))
+    {
+        return HRESULT_FROM_WIN32(::GetLastError());
+    }
+
+    m_cbFile = (ULONGLONG)liSize.QuadPart;
+    if (m_cbFile < sizeof(EventTraceFileHeader))
+    {
+        return HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+    }
+
+    m_hMapping = ::CreateFileMappingW(
+        m_hFile,
+        nullptr, // lpFileMappingAttributes
+        PAGE_READONLY,
+        liSize.HighPart,
+        liSize.LowPart,
+        nullptr); // lpName
+    if (!m_hMapping)
+    {
+        return HRESULT_FROM_WIN32(::GetLastError());
+    }
+
+    const BYTE* pbHeader = Map(0, sizeof(m_stHeader));
+    if (!pbHeader)
+    {
+        return HRESULT_FROM_WIN32(::GetLastError());
+    }
+
+    CopyMemory(&m_stHeader, pbHeader, sizeof(m_stHeader));
+    if (m_stHeader.dwMagic != EVENT_TRACE_FILE_MAGIC ||
+        m_stHeader.wVersion != EVENT_TRACE_VERSION ||
+        m_stHeader.cbHeader < sizeof(m_stHeader) ||
+        m_stHeader.cbHeader > m_cbFile)
+    {
+        return HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+    }
+
+    m_ullNext = m_stHeader.cbHeader;
+    return S_OK;
+}
+
+bool CTraceReader::Next(
+    OUT TraceRecord& stRecord)
+{
+    if (!m_hMapping || m_cbFile - m_ullNext < sizeof(EventTraceRecordHeader))
+    {
+        return false;
+    }
+
+    const EventTraceRecordHeader* pHeader = reinterpret_cast<const EventTraceRecordHeader*>(
+        Map(m_ullNext, sizeof(EventTraceRecordHeader)));
+    if (!pHeader || pHeader->dwMagic != EVENT_TRACE_RECORD_MAGIC)
+    {
+        return false;
+    }
+
+    ULONGLONG cbExpected =
+        sizeof(EventTraceRecordHeader) +
+        ((ULONGLONG)pHeader->cchSubjectKeyIdentifier + pHeader->cchSerialNumber + pHeader->cchRequesterName) * sizeof(WCHAR) +
+        pHeader->cbRawCert;
+    if (pHeader->cbRecord != cbExpected || m_cbFile - m_ullNext < cbExpected)
+    {
+        return false;
+    }
+
+    // Remaps if the record runs past the end of the view.
+    const BYTE* pbRecord = Map(m_ullNext, pHeader->cbRecord);
+    if (!pbRecord)
+    {
+        return false;
+    }
+
+    stRecord.pHeader = reinterpret_cast<const EventTraceRecordHeader*>(pbRecord);
+    stRecord.pwchSubjectKeyIdentifier = reinterpret_cast<LPCWSTR>(stRecord.pHeader + 1);
+    stRecord.pwchSerialNumber = stRecord.pwchSubjectKeyIdentifier + stRecord.pHeader->cchSubjectKeyIdentifier;
+    stRecord.pwchRequesterName = stRecord.pwchSerialNumber + stRecord.pHeader->cchSerialNumber;
+    stRecord.pbRawCert = reinterpret_cast<const BYTE*>(stRecord.pwchRequesterName + stRecord.pHeader->cchRequesterName);
+
+    ULONGLONG cbAligned = (cbExpected + EVENT_TRACE_RECORD_ALIGNMENT - 1) & ~(ULONGLONG)(EVENT_TRACE_RECORD_ALIGNMENT - 1);
+    m_ullNext += min(cbAligned, m_cbFile - m_ullNext);
+    return true;
+}
+
+const BYTE* CTraceReader::Map(
+    ULONGLONG ullOffset,
+    size_t cb)
+{
+    if (m_pbView && ullOffset >= m_ullViewOffset && ullOffset + cb <= m_ullViewOffset + m_cbView)
+    {
+        return m_pbView + (ullOffset - m_ullViewOffset);
+    }
+
+    if (m_pbView)
+    {
+        ::UnmapViewOfFile(m_pbView);
+        m_pbView = nullptr;
+    }
+
+    // Views start on the allocation granularity. Most records fit in the default window.
+    ULONGLONG ullViewOffset = ullOffset - (ullOffset % m_dwGranularity);
+    ULONGLONG cbView = max((ULONGLONG)s_cbView, ullOffset + cb - ullViewOffset);
+    cbView = min(cbView, m_cbFile - ullViewOffset);
+    if (cbView > (SIZE_T)-1)
+    {
+        ::SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return nullptr;
+    }
+
+    m_pbView = static_cast<const BYTE*>(::MapViewOfFile(
+        m_hMapping,
+        FILE_MAP_READ,
+        (DWORD)(ullViewOffset >> 32),
+        (DWORD)ullViewOffset,
+        (SIZE_T)cbView));
+    if (!m_pbView)
+    {
+        return nullptr;
+    }
+
+    m_ullViewOffset = ullViewOffset;
+    m_cbView = (size_t)cbView;
+    return m_pbView + (ullOffset - m_ullViewOffset);
+}
+
+void CTraceReader::Close()
+{
+    if (m_pbView)
+    {
+        ::UnmapViewOfFile(m_pbView);
+        m_pbView = nullptr;
+    }
+
+    if (m_hMapping)
+    {
+        ::CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+    }
+
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        ::CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+
+    m_cbFile = 0;
+    m_cbView = 0;
+    m_ullNext = 0;
+}
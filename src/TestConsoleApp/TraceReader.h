@@ -0,0 +1,128 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        TraceReader.h
+
+    Abstract:
+
+        CTraceReader class declaration.
+
+--*/
+#include <windows.h>
+#include <string>
+#include "..\PKI\ExitModule\TraceFormat.h"
+
+/*++
+
+    Abstract:
+
+        One record of a trace. The pointers are into the mapped file.
+
+--*/
+struct TraceRecord
+{
+    const EventTraceRecordHeader* pHeader;
+    LPCWSTR pwchSubjectKeyIdentifier;
+    LPCWSTR pwchSerialNumber;
+    LPCWSTR pwchRequesterName;
+    const BYTE* pbRawCert;
+};
+
+/*++
+
+    Abstract:
+
+        Reads the records of an event trace written by the exit module, in order.
+
+    Remarks:
+
+        Maps a window of s_cbView bytes of the file at a time, and moves it as the records
+        are read, so a trace of any size takes the same memory. Only what was in the file
+        when it was opened is read.
+--*/
+class CTraceReader
+{
+public:
+    static const size_t s_cbView = 64 * 1024 * 1024;
+
+    CTraceReader();
+    ~CTraceReader();
+
+    /*++
+
+        Abstract:
+
+            Opens a trace and checks its header.
+
+        Returns:
+
+            S_OK - success.
+            HRESULT_FROM_WIN32(ERROR_BAD_FORMAT) - not a trace, or a version this can't read.
+            other - error opening or mapping the file.
+    --*/
+    HRESULT Open(
+        const std::wstring& strPath);
+
+    inline const EventTraceFileHeader& GetHeader() const
+    {
+        return m_stHeader;
+    }
+
+    /*++
+
+        Abstract:
+
+            Reads the next record.
+
+        Parameters:
+
+            stRecord - receives the record. It is valid until the next call.
+
+        Returns:
+
+            true - success.
+            false - the end of the trace, or a record that was not completely written.
+    --*/
+    bool Next(
+        OUT TraceRecord& stRecord);
+
+    /*++
+
+        Abstract:
+
+            Gets the file offset of the next record. At the end, the size of the valid part of the trace.
+
+    --*/
+    inline ULONGLONG GetPosition() const
+    {
+        return m_ullNext;
+    }
+
+    inline ULONGLONG GetFileSize() const
+    {
+        return m_cbFile;
+    }
+
+private:
+    HANDLE m_hFile;
+    HANDLE m_hMapping;
+    ULONGLONG m_cbFile;
+    DWORD m_dwGranularity;
+    const BYTE* m_pbView;
+    ULONGLONG m_ullViewOffset;
+    size_t m_cbView;
+    ULONGLONG m_ullNext;
+    EventTraceFileHeader m_stHeader;
+
+    const BYTE* Map(
+        ULONGLONG ullOffset,
+        size_t cb);
+    void Close();
+
+    CTraceReader(const CTraceReader&) = delete;
+    CTraceReader& operator=(const CTraceReader&) = delete;
+};
@@ -0,0 +1,189 @@
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        TraceReplay.cpp
+
+    Abstract:
+
+        Replays an event trace captured by the exit module.
+
+--*/
+#include <windows.h>
+#include <certsrv.h>
+#include <iostream>
+#include <vector>
+#include "FakeCertServerExit.h"
+#include "ExitModuleHost.h"
+#include "LoadDriver.h"
+#include "TraceReader.h"
+#include "TraceReplay.h"
+
+namespace
+{
+    LPCWSTR g_pwszFakeConfig = L"TraceReplay\\FakeCA";
+
+    /*++
+
+        Abstract:
+
+            Points the fake ICertServerExit at the recorded properties of an issued cert.
+
+    --*/
+    void LoadRecordedProperties(
+        const TraceRecord& stRecord,
+        OUT FakeCertProperties& objProperties)
+    {
+        const EventTraceRecordHeader& stHeader = *stRecord.pHeader;
+        objProperties.strSubjectKeyIdentifier.assign(stRecord.pwchSubjectKeyIdentifier, stHeader.cchSubjectKeyIdentifier);
+        objProperties.strSerialNumber.assign(stRecord.pwchSerialNumber, stHeader.cchSerialNumber);
+        objProperties.strRequesterName.assign(stRecord.pwchRequesterName, stHeader.cchRequesterName);
+        objProperties.vecRawCert.assign(stRecord.pbRawCert, stRecord.pbRawCert + stHeader.cbRawCert);
+    }
+}
+
+int RunTraceReplay(
+    const TraceReplayOptions& objOptions)
+{
+    CTraceReader objReader;
+    HRESULT hr = objReader.Open(objOptions.strTracePath);
+    if (FAILED(hr))
+    {
+        std::wcerr << L"Failed to open the trace " << objOptions.strTracePath << L", hr=" << std::hex << hr << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    hr = ::CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if (FAILED(hr))
+    {
+        std::wcerr << L"CoInitializeEx failed, hr=" << std::hex << hr << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    int nResult = EXIT_FAILURE;
+    {
+        // Notify() copies the properties before it returns, so one set is refilled for each event.
+        FakeCertProperties objProperties;
+        CFakeCertServerExitFactory objFactory(objProperties);
+        CExitModuleHost objHost;
+
+        do
+        {
+            hr = objFactory.Register();
+            if (FAILED(hr))
+            {
+                std::wcerr << L"Failed to register the fake ICertServerExit, hr=" << std::hex << hr << std::endl;
+                break;
+            }
+
+            hr = objHost.Load(objOptions.strModulePath);
+            if (FAILED(hr))
+            {
+                std::wcerr << L"Failed to load " << objOptions.strModulePath << L", hr=" << std::hex << hr << std::endl;
+                break;
+            }
+
+            BSTR bstrConfig = ::SysAllocString(g_pwszFakeConfig);
+            LONG lEventMask = 0;
+            hr = objHost.GetExit()->Initialize(bstrConfig, &lEventMask);
+            ::SysFreeString(bstrConfig);
+            if (FAILED(hr))
+            {
+                std::wcerr << L"ICertExit::Initialize failed, hr=" << std::hex << hr << std::endl;
+                break;
+            }
+
+            CPacer objPacer;
+            unsigned long cEvents = 0;
+            unsigned long cCertsIssued = 0;
+            unsigned long cFailures = 0;
+            ULONGLONG ullFirstUSecs = 0;
+            ULONGLONG ullLastUSecs = 0;
+            std::vector<double> vecServiceMSecs;
+            std::vector<double> vecResponseMSecs;
+
+            LoadClock::time_point tpStart = LoadClock::now();
+
+            TraceRecord stRecord;
+            while (objReader.Next(OUT stRecord))
+            {
+                const EventTraceRecordHeader& stHeader = *stRecord.pHeader;
+                if (stHeader.lExitEvent == EXITEVENT_SHUTDOWN)
+                {
+                    break;
+                }
+
+                if (cEvents == 0)
+                {
+                    ullFirstUSecs = stHeader.ullUSecs;
+                }
+
+                ullLastUSecs = stHeader.ullUSecs;
+
+                LoadClock::time_point tpDue = tpStart;
+                if (objOptions.dSpeed > 0)
+                {
+                    double dUSecs = (double)(stHeader.ullUSecs - ullFirstUSecs) / objOptions.dSpeed;
+                    tpDue += std::chrono::duration_cast<LoadClock::duration>(std::chrono::duration<double, std::micro>(dUSecs));
+                    objPacer.WaitUntil(tpDue);
+                }
+
+                if (stHeader.lExitEvent == EXITEVENT_CERTISSUED)
+                {
+                    LoadRecordedProperties(stRecord, OUT objProperties);
+                    cCertsIssued++;
+                }
+
+                LoadClock::time_point tpBefore = LoadClock::now();
+                HRESULT hrNotify = objHost.GetExit()->Notify(stHeader.lExitEvent, stHeader.lContext);
+                LoadClock::time_point tpAfter = LoadClock::now();
+
+                cEvents++;
+                vecServiceMSecs.push_back(ElapsedMSecs(tpBefore, tpAfter));
+                if (objOptions.dSpeed > 0)
+                {
+                    vecResponseMSecs.push_back(ElapsedMSecs(tpDue, tpAfter));
+                }
+
+                if (FAILED(hrNotify))
+                {
+                    cFailures++;
+                }
+            }
+
+            LoadClock::time_point tpPosted = LoadClock::now();
+            objHost.GetExit()->Notify(EXITEVENT_SHUTDOWN, 0);
+            LoadClock::time_point tpDrained = LoadClock::now();
+
+            double dTraceMSecs = (double)(ullLastUSecs - ullFirstUSecs) / 1000.0;
+            double dReplayMSecs = ElapsedMSecs(tpStart, tpPosted);
+            double dDrainMSecs = ElapsedMSecs(tpPosted, tpDrained);
+            std::wcout << L"Events:              " << cEvents << std::endl;
+            std::wcout << L"Certs issued:        " << cCertsIssued << std::endl;
+            std::wcout << L"Failures:            " << cFailures << std::endl;
+            std::wcout << L"Trace bytes read:    " << objReader.GetPosition() << L" of " << objReader.GetFileSize() << std::endl;
+            std::wcout << L"Trace ms:            " << dTraceMSecs << std::endl;
+            std::wcout << L"Replay ms:           " << dReplayMSecs << std::endl;
+            if (dReplayMSecs > 0)
+            {
+                std::wcout << L"Replay speed:        " << dTraceMSecs / dReplayMSecs << L"x" << std::endl;
+                std::wcout << L"Notify() throughput: " << cEvents * 1000.0 / dReplayMSecs << L"/s" << std::endl;
+            }
+
+            PrintLatencyDistribution(L"Notify() ms:         ", vecServiceMSecs);
+            PrintLatencyDistribution(L"Response ms:         ", vecResponseMSecs);
+            std::wcout << L"Shutdown drain ms:   " << dDrainMSecs << std::endl;
+            PrintModuleProperties(objHost.GetExit(), g_pwszFakeConfig);
+
+            nResult = (cFailures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+        } while (false);
+
+        objHost.Unload();
+        objFactory.Revoke();
+    }
+
+    ::CoUninitialize();
+    return nResult;
+}
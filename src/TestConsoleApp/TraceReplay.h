@@ -0,0 +1,59 @@
+#pragma once
+/*++
+
+    Copyright (C) Microsoft Corp. All rights reserved.
+
+    File:
+
+        TraceReplay.h
+
+    Abstract:
+
+        Replays an event trace captured by the exit module.
+
+--*/
+#include <string>
+
+/*++
+
+    Abstract:
+
+        Options for the trace replay.
+
+--*/
+struct TraceReplayOptions
+{
+    // Path to ExitModule.dll.
+    std::wstring strModulePath;
+
+    // Path to a PMITrace.*.dat file from the TracePath directory.
+    std::wstring strTracePath;
+
+    // Multiple of the recorded speed. 0 calls Notify() as fast as it returns.
+    double dSpeed = 1.0;
+};
+
+/*++
+
+    Abstract:
+
+        Feeds the events of a trace to ExitModule.dll through ICertExit::Notify(), with a
+        fake ICertServerExit that serves the recorded properties.
+
+    Parameters:
+
+        objOptions - the options.
+
+    Returns:
+
+        0 - success.
+        1 - error.
+
+    Remarks:
+
+        Events are replayed in order on one thread, each one due at its recorded time
+        divided by dSpeed. A recorded EXITEVENT_SHUTDOWN ends the replay. Reports the same
+        latencies as the load test, and how far the replay fell behind the trace.
+--*/
+int RunTraceReplay(
+    const TraceReplayOptions& objOptions);